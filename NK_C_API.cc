@@ -1,10 +1,320 @@
+#include <algorithm>
 #include <cstring>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <unistd.h>
+#include <sys/eventfd.h>
 #include "NK_C_API.h"
 #include "include/LibraryException.h"
+#include "include/hotplug.h"
+#include "include/long_operation.h"
+#include "include/proxy_server.h"
+#include "include/remote_device.h"
 
 using namespace nitrokey;
 
-static uint8_t NK_last_command_status = 0;
+/*
+ *	Per-thread status of the last command, see NK_get_last_command_status.
+ *	Handles keep their own as well.
+ */
+static thread_local uint8_t NK_last_command_status = 0;
+
+void clear_string(std::string &s){
+    std::fill(s.begin(), s.end(), ' ');
+}
+
+/*
+ *	Completion queue of asynchronous operations. Readable state of the
+ *	eventfd follows the emptiness of the queue; both change under the mutex.
+ */
+struct NK_completion_queue {
+    struct Completion {
+        uint64_t user_data;
+        int operation;
+        uint8_t status;
+        uint32_t code;
+        string text;
+    };
+
+    NK_completion_queue() : fd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) {}
+    ~NK_completion_queue() {
+        for (auto &c : completions) clear_string(c.text);
+        if (fd >= 0) close(fd);
+    }
+
+    void push(Completion &&completion) {
+        std::lock_guard<std::mutex> lock(mutex);
+        completions.push_back(std::move(completion));
+        const uint64_t one = 1;
+        if (write(fd, &one, sizeof one) != sizeof one) {}  // counter can't overflow here
+    }
+
+    bool pop(Completion &completion) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (completions.empty()) return false;
+        completion = std::move(completions.front());
+        completions.pop_front();
+        if (completions.empty()) {
+            uint64_t count;
+            if (read(fd, &count, sizeof count) != sizeof count) {}  // reset to not readable
+        }
+        return true;
+    }
+
+    const int fd;
+    std::mutex mutex;
+    std::deque<Completion> completions;
+};
+
+/*
+ *	Handle owned by the caller. Submitted operations keep the queue itself
+ *	alive, so the handle can be destroyed with operations in flight.
+ */
+struct NK_queue {
+    shared_ptr<NK_completion_queue> queue;
+};
+
+/*
+ *	Copy of a secret argument in a buffer of its own, wiped in place. A
+ *	move wipes the source, so the secret is never left behind in freed
+ *	or reused memory the way a std::string copy or its SSO buffer can be.
+ */
+struct SecretArgument {
+    static const size_t SIZE = 128;  // terminating NUL included
+
+    SecretArgument() { data[0] = 0; }
+    SecretArgument(SecretArgument &&other) {
+        memcpy(data, other.data, SIZE);
+        other.wipe();
+    }
+    SecretArgument(const SecretArgument &) = delete;
+    SecretArgument &operator=(const SecretArgument &) = delete;
+    ~SecretArgument() { wipe(); }
+
+    // false if s does not fit, nothing is copied then; NULL is empty
+    bool assign(const char *s) {
+        const size_t length = s == nullptr ? 0 : strnlen(s, SIZE);
+        if (length == SIZE) return false;
+        memcpy(data, s == nullptr ? "" : s, length);
+        data[length] = 0;
+        return true;
+    }
+
+    const char *c_str() const { return data; }
+
+    void wipe() { misc::secure_zero(data, SIZE); }
+
+    char data[SIZE];
+};
+
+/*
+ *	Submitted operation with copies of all its arguments. Secrets are
+ *	kept in SecretArgument buffers.
+ */
+struct NK_operation {
+    int type;
+    uint64_t user_data;
+    shared_ptr<NK_completion_queue> queue;
+
+    uint8_t slot_number;
+    uint64_t challenge;
+    uint64_t last_totp_time;
+    uint8_t last_interval;
+    uint8_t hotp_counter;
+    uint16_t time_window;
+    bool use_8_digits;
+    bool use_enter;
+    bool use_tokenID;
+    string slot_name;
+    SecretArgument secret;
+    string token_ID;
+    SecretArgument temporary_password;
+    SecretArgument pin;
+    uint32_t poll_interval_ms;
+
+    NK_operation(int type, uint64_t user_data, shared_ptr<NK_completion_queue> queue)
+            : type(type), user_data(user_data), queue(queue), slot_number(0), challenge(0), last_totp_time(0),
+              last_interval(0), hotp_counter(0), time_window(0), use_8_digits(false), use_enter(false),
+              use_tokenID(false), poll_interval_ms(0) {}
+    NK_operation(NK_operation &&) = default;
+};
+
+/*
+ *	Each handle owns its manager and device. Calls on a single handle are
+ *	serialized, calls on different handles run in parallel.
+ *	Asynchronous operations are run in order by a worker thread of the
+ *	handle, started on the first submission. Long operations of the
+ *	Storage are followed from the Poller::blocking() thread once begun by
+ *	the worker.
+ */
+struct NK_device {
+    NK_device(shared_ptr<NitrokeyManager> manager) : manager(manager), last_command_status(0), stopping(false) {}
+    ~NK_device() {
+        stop_worker();
+        cancel_long_operation();
+    }
+
+    void submit(NK_operation &&operation);
+    // runs the operations submitted so far first
+    void stop_worker();
+    void cancel_long_operation();
+
+    shared_ptr<NitrokeyManager> manager;
+    std::mutex mutex;
+    uint8_t last_command_status;
+    // serves the device to other hosts, see NK_device_start_proxy
+    std::unique_ptr<ProxyServer> proxy;
+
+private:
+    void run_worker();
+    void execute(NK_operation &operation);
+    void start_long_operation(NK_operation &operation);
+
+    std::thread worker;
+    std::mutex submission_mutex;
+    std::condition_variable submission_cv;
+    std::deque<NK_operation> submissions;
+    bool stopping;
+
+    std::mutex long_operation_mutex;
+    shared_ptr<LongOperation> long_operation;
+};
+
+/*
+ *	Handle behind the functions without a device argument
+ */
+static NK_device *default_device(){
+    static NK_device device(NitrokeyManager::instance());
+    return &device;
+}
+
+void NK_device::submit(NK_operation &&operation) {
+    std::lock_guard<std::mutex> lock(submission_mutex);
+    submissions.push_back(std::move(operation));
+    if (!worker.joinable()) {
+        worker = std::thread(&NK_device::run_worker, this);
+    }
+    submission_cv.notify_one();
+}
+
+void NK_device::stop_worker() {
+    {
+        std::lock_guard<std::mutex> lock(submission_mutex);
+        if (!worker.joinable()) return;
+        stopping = true;
+    }
+    submission_cv.notify_one();
+    worker.join();
+    stopping = false;
+}
+
+void NK_device::run_worker() {
+    for (;;) {
+        std::unique_lock<std::mutex> lock(submission_mutex);
+        submission_cv.wait(lock, [this] { return stopping || !submissions.empty(); });
+        if (submissions.empty()) return;  // stopping
+        NK_operation operation = std::move(submissions.front());
+        submissions.pop_front();
+        lock.unlock();
+
+        execute(operation);
+    }
+}
+
+void NK_device::cancel_long_operation() {
+    shared_ptr<LongOperation> operation;
+    {
+        std::lock_guard<std::mutex> lock(long_operation_mutex);
+        operation = std::move(long_operation);
+    }
+    if (operation != nullptr) operation->cancel();
+}
+
+void NK_device::start_long_operation(NK_operation &op) {
+    LongOperation::Begin begin = [&op](NitrokeyManager &m) {
+        switch (op.type) {
+            case NK_OP_FILL_SD_CARD:
+                return m.fill_SD_card_with_random_data(op.pin.c_str());
+            case NK_OP_CREATE_NEW_KEYS:
+                return m.create_new_keys(op.pin.c_str());
+            case NK_OP_UNLOCK_ENCRYPTED_VOLUME:
+                return m.unlock_encrypted_volume(op.pin.c_str());
+            default:
+                return m.export_firmware(op.pin.c_str());
+        }
+    };
+    auto queue = op.queue;
+    const uint64_t user_data = op.user_data;
+    const int type = op.type;
+    auto callback = [queue, user_data, type](const LongOperation::Progress &progress) {
+        const bool running = progress.state == LongOperation::State::RUNNING;
+        queue->push({user_data, running ? NK_OP_PROGRESS : type, progress.status,
+                     (uint32_t) std::max(progress.percent, 0), string()});
+    };
+    const auto interval = op.poll_interval_ms == 0 ? LongOperation::DEFAULT_POLL_INTERVAL
+                                                   : std::chrono::milliseconds(op.poll_interval_ms);
+    auto operation = LongOperation::start(manager, begin, callback, interval, &mutex);
+    if (operation->is_finished()) return;
+    std::lock_guard<std::mutex> lock(long_operation_mutex);
+    long_operation = std::move(operation);
+}
+
+void NK_device::execute(NK_operation &op) {
+    if (op.type >= NK_OP_FILL_SD_CARD) {
+        // completed by the LongOperation
+        start_long_operation(op);
+        return;
+    }
+    NK_completion_queue::Completion completion = {op.user_data, op.type, 0, 0, string()};
+    const char *text = nullptr;
+    // the NK_device_ functions set the status of this (worker) thread
+    try {
+        switch (op.type) {
+            case NK_OP_GET_HOTP_CODE:
+                completion.code = NK_device_get_hotp_code_PIN(this, op.slot_number, op.temporary_password.c_str());
+                break;
+            case NK_OP_GET_TOTP_CODE:
+                completion.code = NK_device_get_totp_code_PIN(this, op.slot_number, op.challenge, op.last_totp_time,
+                                                              op.last_interval, op.temporary_password.c_str());
+                break;
+            case NK_OP_GET_HOTP_SLOT_NAME:
+                text = NK_device_get_hotp_slot_name(this, op.slot_number);
+                break;
+            case NK_OP_GET_TOTP_SLOT_NAME:
+                text = NK_device_get_totp_slot_name(this, op.slot_number);
+                break;
+            case NK_OP_WRITE_HOTP_SLOT:
+                NK_device_write_hotp_slot(this, op.slot_number, op.slot_name.c_str(), op.secret.c_str(),
+                                          op.hotp_counter, op.use_8_digits, op.use_enter, op.use_tokenID,
+                                          op.token_ID.c_str(), op.temporary_password.c_str());
+                break;
+            case NK_OP_WRITE_TOTP_SLOT:
+                NK_device_write_totp_slot(this, op.slot_number, op.slot_name.c_str(), op.secret.c_str(),
+                                          op.time_window, op.use_8_digits, op.use_enter, op.use_tokenID,
+                                          op.token_ID.c_str(), op.temporary_password.c_str());
+                break;
+        }
+        completion.status = NK_get_last_command_status();
+    }
+    catch (std::runtime_error &e){
+        // no caller to pass the exception to
+        cerr << e.what() << endl;
+        completion.status = NK_OP_STATUS_DEVICE_ERROR;
+    }
+    if (text != nullptr) {
+        completion.text = text;
+        // a static empty string is returned on failure, a copy otherwise
+        if (completion.status == 0) free((void *) text);
+    }
+    op.queue->push(std::move(completion));
+}
+
+static void set_status(NK_device *device, uint8_t status){
+    device->last_command_status = status;
+    NK_last_command_status = status;
+}
 
 template <typename T>
 T* duplicate_vector_and_clear(std::vector<T> &v){
@@ -15,64 +325,121 @@ T* duplicate_vector_and_clear(std::vector<T> &v){
 }
 
 template <typename T>
-uint8_t * get_with_array_result(T func){
-    NK_last_command_status = 0;
+uint8_t * get_with_array_result(NK_device *device, T func){
+    std::lock_guard<std::mutex> lock(device->mutex);
+    set_status(device, 0);
     try {
         return func();
     }
     catch (CommandFailedException & commandFailedException){
-        NK_last_command_status = commandFailedException.last_command_status;
+        set_status(device, commandFailedException.last_command_status);
     }
     catch (LibraryException & libraryException){
-        NK_last_command_status = libraryException.exception_id();
+        set_status(device, libraryException.exception_id());
     }
     return nullptr;
 }
 
 template <typename T>
-const char* get_with_string_result(T func){
-    NK_last_command_status = 0;
+const char* get_with_string_result(NK_device *device, T func){
+    std::lock_guard<std::mutex> lock(device->mutex);
+    set_status(device, 0);
     try {
         return func();
     }
     catch (CommandFailedException & commandFailedException){
-        NK_last_command_status = commandFailedException.last_command_status;
+        set_status(device, commandFailedException.last_command_status);
     }
     catch (LibraryException & libraryException){
-        NK_last_command_status = libraryException.exception_id();
+        set_status(device, libraryException.exception_id());
     }
     return "";
 }
 
 template <typename T>
-auto get_with_result(T func){
-    NK_last_command_status = 0;
+auto get_with_result(NK_device *device, T func){
+    std::lock_guard<std::mutex> lock(device->mutex);
+    set_status(device, 0);
     try {
         return func();
     }
     catch (CommandFailedException & commandFailedException){
-        NK_last_command_status = commandFailedException.last_command_status;
+        set_status(device, commandFailedException.last_command_status);
     }
     catch (LibraryException & libraryException){
-        NK_last_command_status = libraryException.exception_id();
+        set_status(device, libraryException.exception_id());
     }
     return static_cast<decltype(func())>(0);
 }
 
 template <typename T>
-uint8_t get_without_result(T func){
-    NK_last_command_status = 0;
+uint8_t get_without_result(NK_device *device, T func){
+    std::lock_guard<std::mutex> lock(device->mutex);
+    set_status(device, 0);
     try {
         func();
         return 0;
     }
     catch (CommandFailedException & commandFailedException){
-        NK_last_command_status = commandFailedException.last_command_status;
+        set_status(device, commandFailedException.last_command_status);
+    }
+    catch (LibraryException & libraryException){
+        set_status(device, libraryException.exception_id());
+    }
+    return device->last_command_status;
+}
+
+/*
+ *	For the try_* calls of NitrokeyManager, returning a TransactionStatus:
+ *	commands refused by the device set the status with no exception thrown
+ *	on the way.
+ */
+template <typename T>
+uint8_t get_with_status(NK_device *device, T func){
+    std::lock_guard<std::mutex> lock(device->mutex);
+    set_status(device, 0);
+    try {
+        set_status(device, func().to_command_status());
+    }
+    catch (CommandFailedException & commandFailedException){
+        set_status(device, commandFailedException.last_command_status);
     }
     catch (LibraryException & libraryException){
-        NK_last_command_status = libraryException.exception_id();
+        set_status(device, libraryException.exception_id());
+    }
+    return device->last_command_status;
+}
+
+/*
+ *	Results into caller buffers: on failure the whole buffer is zeroed, so
+ *	it never holds a partial or stale result.
+ */
+template <typename T>
+int get_into_buffer(NK_device *device, void *buffer, size_t buffer_size, T func){
+    const int result = get_without_result(device, func);
+    if (result != 0 && buffer != nullptr) misc::secure_zero(buffer, buffer_size);
+    return result;
+}
+
+template <typename T>
+int get_status_into_buffer(NK_device *device, void *buffer, size_t buffer_size, T func){
+    const int result = get_with_status(device, func);
+    if (result != 0 && buffer != nullptr) misc::secure_zero(buffer, buffer_size);
+    return result;
+}
+
+struct NK_device * NK_device_open_object(std::shared_ptr<nitrokey::device::Device> device_object) {
+    auto device = new NK_device(NitrokeyManager::create());
+    auto m = device->manager;
+    try {
+        NK_last_command_status = 0;
+        if (m->connect_device(device_object)) return device;
     }
-    return NK_last_command_status;
+    catch (std::runtime_error &e){
+        cerr << e.what() << endl;
+    }
+    delete device;
+    return nullptr;
 }
 
 extern "C"
@@ -83,14 +450,87 @@ extern uint8_t NK_get_last_command_status(){
     return _copy;
 }
 
+extern uint8_t NK_device_get_last_command_status(struct NK_device *device){
+    std::lock_guard<std::mutex> lock(device->mutex);
+    auto _copy = device->last_command_status;
+    device->last_command_status = 0;
+    return _copy;
+}
+
+extern void NK_device_set_timeout(struct NK_device *device, uint32_t timeout_ms){
+    // not serialized with the operations, so that it can be called while one runs
+    device->manager->set_timeout(std::chrono::milliseconds(timeout_ms));
+}
+
+extern void NK_device_cancel(struct NK_device *device){
+    device->manager->cancel();
+}
+
+extern void NK_device_set_keep_alive(struct NK_device *device, uint32_t idle_threshold_ms){
+    std::lock_guard<std::mutex> lock(device->mutex);
+    device->manager->set_keep_alive(std::chrono::milliseconds(idle_threshold_ms));
+}
+
+extern void NK_device_get_keep_alive_stats(struct NK_device *device, uint64_t *sent, uint64_t *failed,
+                                           uint64_t *saved_us){
+    std::lock_guard<std::mutex> lock(device->mutex);
+    const auto stats = device->manager->get_keep_alive_stats();
+    if (sent != nullptr) *sent = stats.sent;
+    if (failed != nullptr) *failed = stats.failed;
+    if (saved_us != nullptr) *saved_us = (uint64_t) stats.saved.count();
+}
+
+extern void NK_set_keep_alive(uint32_t idle_threshold_ms){
+    NK_device_set_keep_alive(default_device(), idle_threshold_ms);
+}
+
+extern void NK_get_keep_alive_stats(uint64_t *sent, uint64_t *failed, uint64_t *saved_us){
+    NK_device_get_keep_alive_stats(default_device(), sent, failed, saved_us);
+}
+
+extern void NK_device_set_lease_timeout(struct NK_device *device, uint32_t timeout_ms){
+    // not serialized with the operations, as NK_device_set_timeout
+    device->manager->set_device_lease_timeout(std::chrono::milliseconds(timeout_ms));
+}
+
+extern void NK_device_get_lease_stats(struct NK_device *device, uint64_t *acquired, uint64_t *contended,
+                                      uint64_t *timeouts, uint64_t *total_wait_us, uint64_t *max_wait_us){
+    std::lock_guard<std::mutex> lock(device->mutex);
+    const auto stats = device->manager->get_device_lease_stats();
+    if (acquired != nullptr) *acquired = stats.acquired;
+    if (contended != nullptr) *contended = stats.contended;
+    if (timeouts != nullptr) *timeouts = stats.timeouts;
+    if (total_wait_us != nullptr) *total_wait_us = (uint64_t) stats.total_wait.count();
+    if (max_wait_us != nullptr) *max_wait_us = (uint64_t) stats.max_wait.count();
+}
+
+extern void NK_set_lease_timeout(uint32_t timeout_ms){
+    NK_device_set_lease_timeout(default_device(), timeout_ms);
+}
+
+extern void NK_get_lease_stats(uint64_t *acquired, uint64_t *contended, uint64_t *timeouts,
+                               uint64_t *total_wait_us, uint64_t *max_wait_us){
+    NK_device_get_lease_stats(default_device(), acquired, contended, timeouts, total_wait_us, max_wait_us);
+}
+
+extern void NK_set_timeout(uint32_t timeout_ms){
+    NK_device_set_timeout(default_device(), timeout_ms);
+}
+
+extern void NK_cancel(){
+    NK_device_cancel(default_device());
+}
+
 extern int NK_login(const char *device_model) {
-    auto m = NitrokeyManager::instance();
+    auto device = default_device();
+    auto m = device->manager;
+    std::lock_guard<std::mutex> lock(device->mutex);
     try {
-        NK_last_command_status = 0;
+        set_status(device, 0);
         return m->connect(device_model);
     }
     catch (CommandFailedException & commandFailedException){
-        NK_last_command_status = commandFailedException.last_command_status;
+        set_status(device, commandFailedException.last_command_status);
         return commandFailedException.last_command_status;
     }
     catch (std::runtime_error &e){
@@ -100,74 +540,172 @@ extern int NK_login(const char *device_model) {
     return 0;
 }
 
+extern int NK_login_auto() {
+    auto device = default_device();
+    auto m = device->manager;
+    return get_with_result(device, [&](){
+        return (uint8_t) m->connect();
+    });
+}
+
 extern int NK_logout() {
-    auto m = NitrokeyManager::instance();
-    return get_without_result( [&](){
+    return NK_device_close(default_device());
+}
+
+extern const char * NK_list_devices(const char *device_model) {
+    try {
+        string paths;
+        for (auto &path : NitrokeyManager::list_devices(device_model)){
+            paths += path;
+            paths += '\n';
+        }
+        return strdup(paths.c_str());
+    }
+    catch (std::runtime_error &e){
+        cerr << e.what() << endl;
+        return strdup("");
+    }
+}
+
+extern struct NK_device * NK_device_open(const char *device_model) {
+    return NK_device_open_path(device_model, nullptr);
+}
+
+extern struct NK_device * NK_device_open_path(const char *device_model, const char *path) {
+    auto device = new NK_device(NitrokeyManager::create());
+    auto m = device->manager;
+    try {
+        NK_last_command_status = 0;
+        bool connected = path == nullptr ? m->connect(device_model) : m->connect(device_model, path);
+        if (connected) return device;
+    }
+    catch (CommandFailedException & commandFailedException){
+        NK_last_command_status = commandFailedException.last_command_status;
+    }
+    catch (std::runtime_error &e){
+        cerr << e.what() << endl;
+    }
+    delete device;
+    return nullptr;
+}
+
+extern struct NK_device * NK_device_open_remote(const char *host, uint16_t port) {
+    auto connection = RemoteConnection::connect(host, port);
+    if (connection == nullptr) return nullptr;
+    return NK_device_open_object(make_shared<RemoteDevice>(connection));
+}
+
+extern int NK_device_start_proxy(struct NK_device *device, const char *address, uint16_t port) {
+    if (device->proxy == nullptr) device->proxy.reset(new ProxyServer(device->manager, &device->mutex));
+    return device->proxy->start(address, port) ? device->proxy->get_port() : -1;
+}
+
+extern void NK_device_stop_proxy(struct NK_device *device) {
+    if (device->proxy != nullptr) device->proxy->stop();
+}
+
+extern int NK_device_close(struct NK_device *device) {
+    if (device == nullptr) return 0;
+    NK_device_stop_proxy(device);
+    device->stop_worker();
+    device->cancel_long_operation();
+    auto m = device->manager;
+    auto result = get_without_result(device, [&](){
         m->disconnect();
     });
+    if (device != default_device()) delete device;
+    return result;
 }
 
-extern int NK_first_authenticate(const char* admin_password, const char* admin_temporary_password){
-    auto m = NitrokeyManager::instance();
-    return get_without_result( [&](){
+extern int NK_device_first_authenticate(struct NK_device *device, const char* admin_password,
+                                        const char* admin_temporary_password){
+    auto m = device->manager;
+    return get_without_result(device, [&](){
         return m->first_authenticate(admin_password, admin_temporary_password);
     });
 }
 
+extern int NK_first_authenticate(const char* admin_password, const char* admin_temporary_password){
+    return NK_device_first_authenticate(default_device(), admin_password, admin_temporary_password);
+}
 
-extern int NK_user_authenticate(const char* user_password, const char* user_temporary_password){
-    auto m = NitrokeyManager::instance();
-    return get_without_result( [&](){
+extern int NK_device_user_authenticate(struct NK_device *device, const char* user_password,
+                                       const char* user_temporary_password){
+    auto m = device->manager;
+    return get_without_result(device, [&](){
         m->user_authenticate(user_password, user_temporary_password);
     });
 }
 
-extern int NK_factory_reset(const char* admin_password){
-    auto m = NitrokeyManager::instance();
-    return get_without_result( [&](){
+extern int NK_user_authenticate(const char* user_password, const char* user_temporary_password){
+    return NK_device_user_authenticate(default_device(), user_password, user_temporary_password);
+}
+
+extern int NK_device_factory_reset(struct NK_device *device, const char* admin_password){
+    auto m = device->manager;
+    return get_without_result(device, [&](){
         m->factory_reset(admin_password);
     });
 }
-extern int NK_build_aes_key(const char* admin_password){
-    auto m = NitrokeyManager::instance();
-    return get_without_result( [&](){
+
+extern int NK_factory_reset(const char* admin_password){
+    return NK_device_factory_reset(default_device(), admin_password);
+}
+
+extern int NK_device_build_aes_key(struct NK_device *device, const char* admin_password){
+    auto m = device->manager;
+    return get_without_result(device, [&](){
         m->build_aes_key(admin_password);
     });
 }
 
-extern int NK_unlock_user_password(const char *admin_password, const char *new_user_password) {
-    auto m = NitrokeyManager::instance();
-    return get_without_result( [&](){
+extern int NK_build_aes_key(const char* admin_password){
+    return NK_device_build_aes_key(default_device(), admin_password);
+}
+
+extern int NK_device_unlock_user_password(struct NK_device *device, const char *admin_password,
+                                          const char *new_user_password) {
+    auto m = device->manager;
+    return get_without_result(device, [&](){
         m->unlock_user_password(admin_password, new_user_password);
     });
 }
 
-extern int NK_write_config(uint8_t numlock, uint8_t capslock, uint8_t scrolllock, bool enable_user_password,
-                           bool delete_user_password,
-                           const char *admin_temporary_password) {
-    auto m = NitrokeyManager::instance();
-    return get_without_result( [&](){
+extern int NK_unlock_user_password(const char *admin_password, const char *new_user_password) {
+    return NK_device_unlock_user_password(default_device(), admin_password, new_user_password);
+}
+
+extern int NK_device_write_config(struct NK_device *device, uint8_t numlock, uint8_t capslock, uint8_t scrolllock,
+                                  bool enable_user_password, bool delete_user_password,
+                                  const char *admin_temporary_password) {
+    auto m = device->manager;
+    return get_without_result(device, [&](){
         return m->write_config(numlock, capslock, scrolllock, enable_user_password, delete_user_password, admin_temporary_password);
     });
 }
 
+extern int NK_write_config(uint8_t numlock, uint8_t capslock, uint8_t scrolllock, bool enable_user_password,
+                           bool delete_user_password,
+                           const char *admin_temporary_password) {
+    return NK_device_write_config(default_device(), numlock, capslock, scrolllock, enable_user_password,
+                                  delete_user_password, admin_temporary_password);
+}
 
-extern uint8_t* NK_read_config(){
-    auto m = NitrokeyManager::instance();
-    return get_with_array_result( [&](){
+extern uint8_t* NK_device_read_config(struct NK_device *device){
+    auto m = device->manager;
+    return get_with_array_result(device, [&](){
         auto v = m->read_config();
         return duplicate_vector_and_clear(v);
     });
 }
 
-
-void clear_string(std::string &s){
-    std::fill(s.begin(), s.end(), ' ');
+extern uint8_t* NK_read_config(){
+    return NK_device_read_config(default_device());
 }
 
-extern const char * NK_status() {
-    auto m = NitrokeyManager::instance();
-    return get_with_string_result([&](){
+extern const char * NK_device_status(struct NK_device *device) {
+    auto m = device->manager;
+    return get_with_string_result(device, [&](){
         string && s = m->get_status();
         char * rs = strdup(s.c_str());
         clear_string(s);
@@ -175,9 +713,13 @@ extern const char * NK_status() {
     });
 }
 
-extern const char * NK_device_serial_number(){
-    auto m = NitrokeyManager::instance();
-    return get_with_string_result([&](){
+extern const char * NK_status() {
+    return NK_device_status(default_device());
+}
+
+extern const char * NK_device_get_serial_number(struct NK_device *device){
+    auto m = device->manager;
+    return get_with_string_result(device, [&](){
         string && s = m->get_serial_number();
         char * rs = strdup(s.c_str());
         clear_string(s);
@@ -185,15 +727,26 @@ extern const char * NK_device_serial_number(){
     });
 }
 
+extern const char * NK_device_serial_number(){
+    return NK_device_get_serial_number(default_device());
+}
+
 extern uint32_t NK_get_hotp_code(uint8_t slot_number) {
     return NK_get_hotp_code_PIN(slot_number, "");
 }
 
-extern uint32_t NK_get_hotp_code_PIN(uint8_t slot_number, const char* user_temporary_password){
-    auto m = NitrokeyManager::instance();
-    return get_with_result([&](){
-        return m->get_HOTP_code(slot_number, user_temporary_password);
+extern uint32_t NK_device_get_hotp_code_PIN(struct NK_device *device, uint8_t slot_number,
+                                            const char* user_temporary_password){
+    auto m = device->manager;
+    uint32_t code = 0;
+    get_with_status(device, [&](){
+        return m->try_get_HOTP_code(slot_number, user_temporary_password, code);
     });
+    return code;
+}
+
+extern uint32_t NK_get_hotp_code_PIN(uint8_t slot_number, const char* user_temporary_password){
+    return NK_device_get_hotp_code_PIN(default_device(), slot_number, user_temporary_password);
 }
 
 extern uint32_t NK_get_totp_code(uint8_t slot_number, uint64_t challenge, uint64_t last_totp_time,
@@ -201,34 +754,69 @@ extern uint32_t NK_get_totp_code(uint8_t slot_number, uint64_t challenge, uint64
     return NK_get_totp_code_PIN(slot_number, challenge, last_totp_time, last_interval, "");
 }
 
+extern uint32_t NK_device_get_totp_code_PIN(struct NK_device *device, uint8_t slot_number, uint64_t challenge,
+                                            uint64_t last_totp_time, uint8_t last_interval,
+                                            const char* user_temporary_password){
+    auto m = device->manager;
+    uint32_t code = 0;
+    get_with_status(device, [&](){
+        return m->try_get_TOTP_code(slot_number, challenge, last_totp_time, last_interval, user_temporary_password,
+                                    code);
+    });
+    return code;
+}
+
 extern uint32_t NK_get_totp_code_PIN(uint8_t slot_number, uint64_t challenge, uint64_t last_totp_time,
                                  uint8_t last_interval, const char* user_temporary_password){
-    auto m = NitrokeyManager::instance();
-    return get_with_result([&](){
-        return m->get_TOTP_code(slot_number, challenge, last_totp_time, last_interval, user_temporary_password);
+    return NK_device_get_totp_code_PIN(default_device(), slot_number, challenge, last_totp_time, last_interval,
+                                       user_temporary_password);
+}
+
+extern int NK_device_erase_hotp_slot(struct NK_device *device, uint8_t slot_number, const char *temporary_password) {
+    auto m = device->manager;
+    return get_without_result(device, [&]{
+        m->erase_hotp_slot(slot_number, temporary_password);
     });
 }
 
 extern int NK_erase_hotp_slot(uint8_t slot_number, const char *temporary_password) {
-    auto m = NitrokeyManager::instance();
-    return get_without_result([&]{
-        m->erase_hotp_slot(slot_number, temporary_password);
+    return NK_device_erase_hotp_slot(default_device(), slot_number, temporary_password);
+}
+
+extern int NK_device_erase_totp_slot(struct NK_device *device, uint8_t slot_number, const char *temporary_password) {
+    auto m = device->manager;
+    return get_without_result(device, [&]{
+        m->erase_totp_slot(slot_number, temporary_password);
     });
 }
 
 extern int NK_erase_totp_slot(uint8_t slot_number, const char *temporary_password) {
-    auto m = NitrokeyManager::instance();
-    return get_without_result([&]{
-        m->erase_totp_slot(slot_number, temporary_password);
+    return NK_device_erase_totp_slot(default_device(), slot_number, temporary_password);
+}
+
+extern int NK_device_write_hotp_slot(struct NK_device *device, uint8_t slot_number, const char *slot_name,
+                                     const char *secret, uint8_t hotp_counter, bool use_8_digits, bool use_enter,
+                                     bool use_tokenID, const char *token_ID, const char *temporary_password) {
+    auto m = device->manager;
+    return get_without_result(device, [&]{
+        m->write_HOTP_slot(slot_number, slot_name, secret, hotp_counter, use_8_digits, use_enter, use_tokenID, token_ID,
+                           temporary_password);
     });
 }
 
 extern int NK_write_hotp_slot(uint8_t slot_number, const char *slot_name, const char *secret, uint8_t hotp_counter,
                               bool use_8_digits, bool use_enter, bool use_tokenID, const char *token_ID,
                               const char *temporary_password) {
-    auto m = NitrokeyManager::instance();
-    return get_without_result([&]{
-        m->write_HOTP_slot(slot_number, slot_name, secret, hotp_counter, use_8_digits, use_enter, use_tokenID, token_ID,
+    return NK_device_write_hotp_slot(default_device(), slot_number, slot_name, secret, hotp_counter, use_8_digits,
+                                     use_enter, use_tokenID, token_ID, temporary_password);
+}
+
+extern int NK_device_write_totp_slot(struct NK_device *device, uint8_t slot_number, const char *slot_name,
+                                     const char *secret, uint16_t time_window, bool use_8_digits, bool use_enter,
+                                     bool use_tokenID, const char *token_ID, const char *temporary_password) {
+    auto m = device->manager;
+    return get_without_result(device, [&]{
+        m->write_TOTP_slot(slot_number, slot_name, secret, time_window, use_8_digits, use_enter, use_tokenID, token_ID,
                            temporary_password);
     });
 }
@@ -236,144 +824,570 @@ extern int NK_write_hotp_slot(uint8_t slot_number, const char *slot_name, const
 extern int NK_write_totp_slot(uint8_t slot_number, const char *slot_name, const char *secret, uint16_t time_window,
                               bool use_8_digits, bool use_enter, bool use_tokenID, const char *token_ID,
                               const char *temporary_password) {
-    auto m = NitrokeyManager::instance();
-    return get_without_result([&]{
-        m->write_TOTP_slot(slot_number, slot_name, secret, time_window, use_8_digits, use_enter, use_tokenID, token_ID,
-                           temporary_password);
-    });
+    return NK_device_write_totp_slot(default_device(), slot_number, slot_name, secret, time_window, use_8_digits,
+                                     use_enter, use_tokenID, token_ID, temporary_password);
 }
 
-extern const char* NK_get_totp_slot_name(uint8_t slot_number){
-    auto m = NitrokeyManager::instance();
-    return get_with_string_result([&]() {
+extern const char* NK_device_get_totp_slot_name(struct NK_device *device, uint8_t slot_number){
+    auto m = device->manager;
+    return get_with_string_result(device, [&]() {
         const auto slot_name = m->get_totp_slot_name(slot_number);
         return slot_name;
     });
 }
-extern const char* NK_get_hotp_slot_name(uint8_t slot_number){
-    auto m = NitrokeyManager::instance();
-    return get_with_string_result([&]() {
+
+extern const char* NK_get_totp_slot_name(uint8_t slot_number){
+    return NK_device_get_totp_slot_name(default_device(), slot_number);
+}
+
+extern const char* NK_device_get_hotp_slot_name(struct NK_device *device, uint8_t slot_number){
+    auto m = device->manager;
+    return get_with_string_result(device, [&]() {
         const auto slot_name = m->get_hotp_slot_name(slot_number);
         return slot_name;
     });
 }
 
+extern const char* NK_get_hotp_slot_name(uint8_t slot_number){
+    return NK_device_get_hotp_slot_name(default_device(), slot_number);
+}
+
 extern void NK_set_debug(bool state){
     auto m = NitrokeyManager::instance();
     m->set_debug(state);
 }
 
-extern int NK_totp_set_time(uint64_t time){
-    auto m = NitrokeyManager::instance();
-    return get_without_result([&](){
+extern void NK_set_async_logging(bool state){
+    nitrokey::log::Log::instance().set_async(state);
+}
+
+extern int NK_device_totp_set_time(struct NK_device *device, uint64_t time){
+    auto m = device->manager;
+    return get_without_result(device, [&](){
         m->set_time(time);
     });
 }
 
-extern int NK_totp_get_time(){
-    auto m = NitrokeyManager::instance();
-    return get_without_result([&](){
+extern int NK_totp_set_time(uint64_t time){
+    return NK_device_totp_set_time(default_device(), time);
+}
+
+extern int NK_device_totp_get_time(struct NK_device *device){
+    auto m = device->manager;
+    return get_without_result(device, [&](){
         m->get_time(); // FIXME check how that should work
     });
 }
 
-extern int NK_change_admin_PIN(char *current_PIN, char *new_PIN){
-    auto m = NitrokeyManager::instance();
-    return get_without_result([&](){
+extern int NK_totp_get_time(){
+    return NK_device_totp_get_time(default_device());
+}
+
+extern int NK_device_change_admin_PIN(struct NK_device *device, char *current_PIN, char *new_PIN){
+    auto m = device->manager;
+    return get_without_result(device, [&](){
         m->change_admin_PIN(current_PIN, new_PIN);
     });
 }
 
-extern int NK_change_user_PIN(char *current_PIN, char *new_PIN){
-    auto m = NitrokeyManager::instance();
-    return get_without_result([&](){
+extern int NK_change_admin_PIN(char *current_PIN, char *new_PIN){
+    return NK_device_change_admin_PIN(default_device(), current_PIN, new_PIN);
+}
+
+extern int NK_device_change_user_PIN(struct NK_device *device, char *current_PIN, char *new_PIN){
+    auto m = device->manager;
+    return get_without_result(device, [&](){
         m->change_user_PIN(current_PIN, new_PIN);
     });
 }
 
-extern int NK_enable_password_safe(const char *user_pin){
-    auto m = NitrokeyManager::instance();
-    return get_without_result([&](){
+extern int NK_change_user_PIN(char *current_PIN, char *new_PIN){
+    return NK_device_change_user_PIN(default_device(), current_PIN, new_PIN);
+}
+
+extern int NK_device_enable_password_safe(struct NK_device *device, const char *user_pin){
+    auto m = device->manager;
+    return get_without_result(device, [&](){
         m->enable_password_safe(user_pin);
     });
 }
-extern uint8_t * NK_get_password_safe_slot_status(){
-    auto m = NitrokeyManager::instance();
-    return get_with_array_result( [&](){
+
+extern int NK_enable_password_safe(const char *user_pin){
+    return NK_device_enable_password_safe(default_device(), user_pin);
+}
+
+extern uint8_t * NK_device_get_password_safe_slot_status(struct NK_device *device){
+    auto m = device->manager;
+    return get_with_array_result(device, [&](){
         auto slot_status = m->get_password_safe_slot_status();
         return duplicate_vector_and_clear(slot_status);
     });
 
 }
 
-extern uint8_t NK_get_user_retry_count(){
-    auto m = NitrokeyManager::instance();
-    return get_with_result([&](){
+extern uint8_t * NK_get_password_safe_slot_status(){
+    return NK_device_get_password_safe_slot_status(default_device());
+}
+
+extern uint8_t NK_device_get_user_retry_count(struct NK_device *device){
+    auto m = device->manager;
+    return get_with_result(device, [&](){
         return m->get_user_retry_count();
     });
 }
 
-extern uint8_t NK_get_admin_retry_count(){
-    auto m = NitrokeyManager::instance();
-    return get_with_result([&](){
+extern uint8_t NK_get_user_retry_count(){
+    return NK_device_get_user_retry_count(default_device());
+}
+
+extern uint8_t NK_device_get_admin_retry_count(struct NK_device *device){
+    auto m = device->manager;
+    return get_with_result(device, [&](){
         return m->get_admin_retry_count();
     });
 }
 
-extern int NK_lock_device(){
-    auto m = NitrokeyManager::instance();
-    return get_without_result([&](){
+extern uint8_t NK_get_admin_retry_count(){
+    return NK_device_get_admin_retry_count(default_device());
+}
+
+extern int NK_device_lock_device(struct NK_device *device){
+    auto m = device->manager;
+    return get_without_result(device, [&](){
         m->lock_device();
     });
 }
 
-extern const char *NK_get_password_safe_slot_name(uint8_t slot_number) {
-    auto m = NitrokeyManager::instance();
-    return get_with_string_result([&](){
+extern int NK_lock_device(){
+    return NK_device_lock_device(default_device());
+}
+
+extern const char *NK_device_get_password_safe_slot_name(struct NK_device *device, uint8_t slot_number) {
+    auto m = device->manager;
+    return get_with_string_result(device, [&](){
         return m->get_password_safe_slot_name(slot_number);
     });
 }
 
-extern const char *NK_get_password_safe_slot_login(uint8_t slot_number) {
-    auto m = NitrokeyManager::instance();
-    return get_with_string_result([&](){
+extern const char *NK_get_password_safe_slot_name(uint8_t slot_number) {
+    return NK_device_get_password_safe_slot_name(default_device(), slot_number);
+}
+
+extern const char *NK_device_get_password_safe_slot_login(struct NK_device *device, uint8_t slot_number) {
+    auto m = device->manager;
+    return get_with_string_result(device, [&](){
         return m->get_password_safe_slot_login(slot_number);
     });
 }
-extern const char *NK_get_password_safe_slot_password(uint8_t slot_number) {
-    auto m = NitrokeyManager::instance();
-    return get_with_string_result([&](){
+
+extern const char *NK_get_password_safe_slot_login(uint8_t slot_number) {
+    return NK_device_get_password_safe_slot_login(default_device(), slot_number);
+}
+
+extern const char *NK_device_get_password_safe_slot_password(struct NK_device *device, uint8_t slot_number) {
+    auto m = device->manager;
+    return get_with_string_result(device, [&](){
         return m->get_password_safe_slot_password(slot_number);
     });
 }
+
+extern const char *NK_get_password_safe_slot_password(uint8_t slot_number) {
+    return NK_device_get_password_safe_slot_password(default_device(), slot_number);
+}
+
+extern int NK_device_write_password_safe_slot(struct NK_device *device, uint8_t slot_number, const char *slot_name,
+                                              const char *slot_login, const char *slot_password) {
+    auto m = device->manager;
+    return get_without_result(device, [&](){
+        m->write_password_safe_slot(slot_number, slot_name, slot_login, slot_password);
+    });
+}
+
 extern int NK_write_password_safe_slot(uint8_t slot_number, const char *slot_name, const char *slot_login,
                                        const char *slot_password) {
-    auto m = NitrokeyManager::instance();
-    return get_without_result([&](){
-        m->write_password_safe_slot(slot_number, slot_name, slot_login, slot_password);
+    return NK_device_write_password_safe_slot(default_device(), slot_number, slot_name, slot_login, slot_password);
+}
+
+extern int NK_device_erase_password_safe_slot(struct NK_device *device, uint8_t slot_number) {
+    auto m = device->manager;
+    return get_without_result(device, [&](){
+        m->erase_password_safe_slot(slot_number);
     });
 }
 
 extern int NK_erase_password_safe_slot(uint8_t slot_number) {
-    auto m = NitrokeyManager::instance();
-    return get_without_result([&](){
-        m->erase_password_safe_slot(slot_number);
+    return NK_device_erase_password_safe_slot(default_device(), slot_number);
+}
+
+extern int NK_device_is_AES_supported(struct NK_device *device, const char *user_password) {
+    auto m = device->manager;
+    return get_with_result(device, [&](){
+       return (uint8_t) m->is_AES_supported(user_password);
     });
 }
 
 extern int NK_is_AES_supported(const char *user_password) {
-    auto m = NitrokeyManager::instance();
-    return get_with_result([&](){
-       return (uint8_t) m->is_AES_supported(user_password);
+    return NK_device_is_AES_supported(default_device(), user_password);
+}
+
+extern const char * NK_device_get_flight_recorder_dump(struct NK_device *device){
+    std::lock_guard<std::mutex> lock(device->mutex);
+    return strdup(device->manager->get_flight_recorder_dump().c_str());
+}
+
+extern const char * NK_get_flight_recorder_dump(){
+    return NK_device_get_flight_recorder_dump(default_device());
+}
+
+extern void NK_set_tracing(bool state){
+    trace::Tracer::set_enabled(state);
+}
+
+extern const char * NK_get_trace_json(){
+    return strdup(trace::Tracer::instance().dump_chrome_json().c_str());
+}
+
+extern void NK_clear_trace(){
+    trace::Tracer::instance().clear();
+}
+
+extern struct NK_queue * NK_queue_create(){
+    auto queue = new NK_queue{make_shared<NK_completion_queue>()};
+    if (queue->queue->fd < 0) {
+        delete queue;
+        return nullptr;
+    }
+    return queue;
+}
+
+extern void NK_queue_destroy(struct NK_queue *queue){
+    delete queue;
+}
+
+extern int NK_queue_fd(struct NK_queue *queue){
+    return queue->queue->fd;
+}
+
+extern int NK_queue_reap(struct NK_queue *queue, uint64_t *user_data, int *operation, uint8_t *status,
+                         uint32_t *code, char *text, size_t text_size){
+    NK_completion_queue::Completion completion;
+    if (!queue->queue->pop(completion)) return 0;
+    if (user_data != nullptr) *user_data = completion.user_data;
+    if (operation != nullptr) *operation = completion.operation;
+    if (status != nullptr) *status = completion.status;
+    if (code != nullptr) *code = completion.code;
+    if (text != nullptr && text_size > 0) {
+        const size_t length = std::min(completion.text.size(), text_size - 1);
+        memcpy(text, completion.text.data(), length);
+        text[length] = 0;
+    }
+    clear_string(completion.text);
+    return 1;
+}
+
+static int submit(NK_device *device, NK_operation &&operation){
+    if (operation.queue == nullptr) return -1;
+    if (device == nullptr) device = default_device();
+    device->submit(std::move(operation));
+    return 0;
+}
+
+static string copy_string(const char *s){
+    return s == nullptr ? string() : string(s);
+}
+
+extern int NK_submit_get_hotp_code(struct NK_device *device, struct NK_queue *queue, uint64_t user_data,
+                                   uint8_t slot_number, const char *user_temporary_password){
+    if (queue == nullptr) return -1;
+    NK_operation op(NK_OP_GET_HOTP_CODE, user_data, queue->queue);
+    op.slot_number = slot_number;
+    if (!op.temporary_password.assign(user_temporary_password)) return -1;
+    return submit(device, std::move(op));
+}
+
+extern int NK_submit_get_totp_code(struct NK_device *device, struct NK_queue *queue, uint64_t user_data,
+                                   uint8_t slot_number, uint64_t challenge, uint64_t last_totp_time,
+                                   uint8_t last_interval, const char *user_temporary_password){
+    if (queue == nullptr) return -1;
+    NK_operation op(NK_OP_GET_TOTP_CODE, user_data, queue->queue);
+    op.slot_number = slot_number;
+    op.challenge = challenge;
+    op.last_totp_time = last_totp_time;
+    op.last_interval = last_interval;
+    if (!op.temporary_password.assign(user_temporary_password)) return -1;
+    return submit(device, std::move(op));
+}
+
+extern int NK_submit_get_hotp_slot_name(struct NK_device *device, struct NK_queue *queue, uint64_t user_data,
+                                        uint8_t slot_number){
+    if (queue == nullptr) return -1;
+    NK_operation op(NK_OP_GET_HOTP_SLOT_NAME, user_data, queue->queue);
+    op.slot_number = slot_number;
+    return submit(device, std::move(op));
+}
+
+extern int NK_submit_get_totp_slot_name(struct NK_device *device, struct NK_queue *queue, uint64_t user_data,
+                                        uint8_t slot_number){
+    if (queue == nullptr) return -1;
+    NK_operation op(NK_OP_GET_TOTP_SLOT_NAME, user_data, queue->queue);
+    op.slot_number = slot_number;
+    return submit(device, std::move(op));
+}
+
+extern int NK_submit_write_hotp_slot(struct NK_device *device, struct NK_queue *queue, uint64_t user_data,
+                                     uint8_t slot_number, const char *slot_name, const char *secret,
+                                     uint8_t hotp_counter, bool use_8_digits, bool use_enter, bool use_tokenID,
+                                     const char *token_ID, const char *temporary_password){
+    if (queue == nullptr) return -1;
+    NK_operation op(NK_OP_WRITE_HOTP_SLOT, user_data, queue->queue);
+    op.slot_number = slot_number;
+    op.slot_name = copy_string(slot_name);
+    if (!op.secret.assign(secret)) return -1;
+    op.hotp_counter = hotp_counter;
+    op.use_8_digits = use_8_digits;
+    op.use_enter = use_enter;
+    op.use_tokenID = use_tokenID;
+    op.token_ID = copy_string(token_ID);
+    if (!op.temporary_password.assign(temporary_password)) return -1;
+    return submit(device, std::move(op));
+}
+
+extern int NK_submit_write_totp_slot(struct NK_device *device, struct NK_queue *queue, uint64_t user_data,
+                                     uint8_t slot_number, const char *slot_name, const char *secret,
+                                     uint16_t time_window, bool use_8_digits, bool use_enter, bool use_tokenID,
+                                     const char *token_ID, const char *temporary_password){
+    if (queue == nullptr) return -1;
+    NK_operation op(NK_OP_WRITE_TOTP_SLOT, user_data, queue->queue);
+    op.slot_number = slot_number;
+    op.slot_name = copy_string(slot_name);
+    if (!op.secret.assign(secret)) return -1;
+    op.time_window = time_window;
+    op.use_8_digits = use_8_digits;
+    op.use_enter = use_enter;
+    op.use_tokenID = use_tokenID;
+    op.token_ID = copy_string(token_ID);
+    if (!op.temporary_password.assign(temporary_password)) return -1;
+    return submit(device, std::move(op));
+}
+
+static int submit_long_operation(NK_device *device, NK_queue *queue, int type, uint64_t user_data,
+                                 const char *pin, uint32_t poll_interval_ms){
+    if (queue == nullptr) return -1;
+    NK_operation op(type, user_data, queue->queue);
+    if (!op.pin.assign(pin)) return -1;
+    op.poll_interval_ms = poll_interval_ms;
+    return submit(device, std::move(op));
+}
+
+extern int NK_submit_fill_SD_card_with_random_data(struct NK_device *device, struct NK_queue *queue, uint64_t user_data,
+                                                   const char *admin_pin, uint32_t poll_interval_ms){
+    return submit_long_operation(device, queue, NK_OP_FILL_SD_CARD, user_data, admin_pin, poll_interval_ms);
+}
+
+extern int NK_submit_create_new_keys(struct NK_device *device, struct NK_queue *queue, uint64_t user_data,
+                                     const char *admin_pin, uint32_t poll_interval_ms){
+    return submit_long_operation(device, queue, NK_OP_CREATE_NEW_KEYS, user_data, admin_pin, poll_interval_ms);
+}
+
+extern int NK_submit_unlock_encrypted_volume(struct NK_device *device, struct NK_queue *queue, uint64_t user_data,
+                                             const char *user_pin, uint32_t poll_interval_ms){
+    return submit_long_operation(device, queue, NK_OP_UNLOCK_ENCRYPTED_VOLUME, user_data, user_pin,
+                                 poll_interval_ms);
+}
+
+extern int NK_submit_export_firmware(struct NK_device *device, struct NK_queue *queue, uint64_t user_data,
+                                     const char *admin_pin, uint32_t poll_interval_ms){
+    return submit_long_operation(device, queue, NK_OP_EXPORT_FIRMWARE, user_data, admin_pin, poll_interval_ms);
+}
+
+extern void NK_device_cancel_long_operation(struct NK_device *device){
+    device->cancel_long_operation();
+}
+
+extern void NK_cancel_long_operation(){
+    NK_device_cancel_long_operation(default_device());
+}
+
+extern int NK_device_get_progress_bar_value(struct NK_device *device){
+    auto m = device->manager;
+    int progress = -1;
+    get_without_result(device, [&](){
+        progress = m->get_progress_bar_value();
     });
+    return progress;
 }
 
-extern int NK_login_auto() {
-    auto m = NitrokeyManager::instance();
-    return get_with_result([&](){
-        return (uint8_t) m->connect();
+extern int NK_get_progress_bar_value(){
+    return NK_device_get_progress_bar_value(default_device());
+}
+
+extern int NK_device_get_storage_status(struct NK_device *device, struct NK_storage_status *out){
+    auto m = device->manager;
+    return get_without_result(device, [&](){
+        const auto status = m->get_storage_status();
+        if (out == nullptr) return;
+        out->unencrypted_volume_read_only = status.unencrypted_volume.read_only;
+        out->unencrypted_volume_active = status.unencrypted_volume.active;
+        out->encrypted_volume_read_only = status.encrypted_volume.read_only;
+        out->encrypted_volume_active = status.encrypted_volume.active;
+        out->hidden_volume_read_only = status.hidden_volume.read_only;
+        out->hidden_volume_active = status.hidden_volume.active;
+        out->firmware_version_major = status.firmware_version_major;
+        out->firmware_version_minor = status.firmware_version_minor;
+        out->firmware_locked = status.firmware_locked;
+        out->serial_number_sd_card = status.sd_card_id;
+        out->serial_number_smart_card = status.smart_card_id;
+        out->user_retry_count = status.user_retry_count;
+        out->admin_retry_count = status.admin_retry_count;
+        out->new_sd_card_found = status.new_sd_card_found;
+        out->filled_with_random = status.sd_card_filled_with_random_data;
+        out->new_smart_card_found = status.new_smart_card_found;
+        out->stick_initialized = status.keys_initialized;
+    });
+}
+
+extern int NK_get_storage_status(struct NK_storage_status *out){
+    return NK_device_get_storage_status(default_device(), out);
+}
+
+extern void NK_device_set_storage_status_ttl(struct NK_device *device, uint32_t ttl_ms){
+    std::lock_guard<std::mutex> lock(device->mutex);
+    device->manager->set_storage_status_ttl(std::chrono::milliseconds(ttl_ms));
+}
+
+extern void NK_set_storage_status_ttl(uint32_t ttl_ms){
+    NK_device_set_storage_status_ttl(default_device(), ttl_ms);
+}
+
+extern int NK_device_status_buf(struct NK_device *device, char *buffer, size_t buffer_size) {
+    auto m = device->manager;
+    return get_into_buffer(device, buffer, buffer_size, [&](){
+        m->get_status(buffer, buffer_size);
+    });
+}
+
+extern int NK_status_buf(char *buffer, size_t buffer_size) {
+    return NK_device_status_buf(default_device(), buffer, buffer_size);
+}
+
+extern int NK_device_get_serial_number_buf(struct NK_device *device, char *buffer, size_t buffer_size) {
+    auto m = device->manager;
+    return get_into_buffer(device, buffer, buffer_size, [&](){
+        m->get_serial_number(buffer, buffer_size);
+    });
+}
+
+extern int NK_device_serial_number_buf(char *buffer, size_t buffer_size) {
+    return NK_device_get_serial_number_buf(default_device(), buffer, buffer_size);
+}
+
+extern int NK_device_get_totp_slot_name_buf(struct NK_device *device, uint8_t slot_number, char *buffer,
+                                            size_t buffer_size) {
+    auto m = device->manager;
+    return get_status_into_buffer(device, buffer, buffer_size, [&](){
+        return m->try_get_totp_slot_name(slot_number, buffer, buffer_size);
+    });
+}
+
+extern int NK_get_totp_slot_name_buf(uint8_t slot_number, char *buffer, size_t buffer_size) {
+    return NK_device_get_totp_slot_name_buf(default_device(), slot_number, buffer, buffer_size);
+}
+
+extern int NK_device_get_hotp_slot_name_buf(struct NK_device *device, uint8_t slot_number, char *buffer,
+                                            size_t buffer_size) {
+    auto m = device->manager;
+    return get_status_into_buffer(device, buffer, buffer_size, [&](){
+        return m->try_get_hotp_slot_name(slot_number, buffer, buffer_size);
+    });
+}
+
+extern int NK_get_hotp_slot_name_buf(uint8_t slot_number, char *buffer, size_t buffer_size) {
+    return NK_device_get_hotp_slot_name_buf(default_device(), slot_number, buffer, buffer_size);
+}
+
+extern int NK_device_get_password_safe_slot_name_buf(struct NK_device *device, uint8_t slot_number, char *buffer,
+                                                     size_t buffer_size) {
+    auto m = device->manager;
+    return get_status_into_buffer(device, buffer, buffer_size, [&](){
+        return m->try_get_password_safe_slot_name(slot_number, buffer, buffer_size);
+    });
+}
+
+extern int NK_get_password_safe_slot_name_buf(uint8_t slot_number, char *buffer, size_t buffer_size) {
+    return NK_device_get_password_safe_slot_name_buf(default_device(), slot_number, buffer, buffer_size);
+}
+
+extern int NK_device_get_password_safe_slot_login_buf(struct NK_device *device, uint8_t slot_number, char *buffer,
+                                                      size_t buffer_size) {
+    auto m = device->manager;
+    return get_into_buffer(device, buffer, buffer_size, [&](){
+        m->get_password_safe_slot_login(slot_number, buffer, buffer_size);
+    });
+}
+
+extern int NK_get_password_safe_slot_login_buf(uint8_t slot_number, char *buffer, size_t buffer_size) {
+    return NK_device_get_password_safe_slot_login_buf(default_device(), slot_number, buffer, buffer_size);
+}
+
+extern int NK_device_get_password_safe_slot_password_buf(struct NK_device *device, uint8_t slot_number, char *buffer,
+                                                         size_t buffer_size) {
+    auto m = device->manager;
+    return get_into_buffer(device, buffer, buffer_size, [&](){
+        m->get_password_safe_slot_password(slot_number, buffer, buffer_size);
+    });
+}
+
+extern int NK_get_password_safe_slot_password_buf(uint8_t slot_number, char *buffer, size_t buffer_size) {
+    return NK_device_get_password_safe_slot_password_buf(default_device(), slot_number, buffer, buffer_size);
+}
+
+extern int NK_device_read_config_buf(struct NK_device *device, uint8_t *buffer, size_t buffer_size) {
+    auto m = device->manager;
+    return get_into_buffer(device, buffer, buffer_size, [&](){
+        m->read_config(buffer, buffer_size);
+    });
+}
+
+extern int NK_read_config_buf(uint8_t *buffer, size_t buffer_size) {
+    return NK_device_read_config_buf(default_device(), buffer, buffer_size);
+}
+
+extern int NK_device_get_password_safe_slot_status_buf(struct NK_device *device, uint8_t *buffer,
+                                                       size_t buffer_size) {
+    auto m = device->manager;
+    return get_into_buffer(device, buffer, buffer_size, [&](){
+        m->get_password_safe_slot_status(buffer, buffer_size);
+    });
+}
+
+extern int NK_get_password_safe_slot_status_buf(uint8_t *buffer, size_t buffer_size) {
+    return NK_device_get_password_safe_slot_status_buf(default_device(), buffer, buffer_size);
+}
+
+extern int NK_hotplug_start(){
+    return HotplugMonitor::instance().start() ? 0 : -1;
+}
+
+extern void NK_hotplug_stop(){
+    HotplugMonitor::instance().stop();
+}
+
+extern int NK_hotplug_register(NK_hotplug_callback callback, void *user_data){
+    return HotplugMonitor::instance().add_callback([callback, user_data](const HotplugMonitor::Event &event){
+        const char model = event.device.update_mode ? 'U' : event.device.model == DeviceModel::PRO ? 'P' : 'S';
+        callback(event.action == HotplugMonitor::Action::ARRIVAL ? NK_HOTPLUG_ARRIVAL : NK_HOTPLUG_REMOVAL,
+                 model, event.device.devpath.c_str(), user_data);
     });
 }
 
+extern void NK_hotplug_unregister(int id){
+    HotplugMonitor::instance().remove_callback(id);
 }
 
+extern int NK_hotplug_device_count(){
+    auto &monitor = HotplugMonitor::instance();
+    if (!monitor.is_running()) return -1;
+    return (int) monitor.get_devices().size();
+}
+
+}
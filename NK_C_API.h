@@ -8,6 +8,13 @@
 
 extern "C"
 {
+/**
+ * Handle of a connected device, opened with NK_device_open. Each handle owns its own connection and state, so different
+ * handles can be used from different threads at once. Calls using the same handle are serialized.
+ * Functions without a handle argument use a shared default device, connected with NK_login.
+ */
+struct NK_device;
+
 /**
  * Set debug level of messages written on stderr
  * @param state state=True - all messages, state=False - only errors level
@@ -15,7 +22,14 @@ extern "C"
 extern void NK_set_debug(bool state);
 
 /**
- * Connect to device of given model. Currently library can be connected only to one device at once.
+ * Write log messages from a background thread. Calling threads only copy the message to a lock-free buffer
+ * and never wait for stderr. When the buffer is full messages are dropped and the number of dropped ones is logged.
+ * @param state true - asynchronous logging, false - synchronous (default), flushes pending messages
+ */
+extern void NK_set_async_logging(bool state);
+
+/**
+ * Connect the default device to a device of given model. To use several devices at once see NK_device_open.
  * @param device_model char 'S': Nitrokey Storage, 'P': Nitrokey Pro
  * @return 1 if connected, 0 if wrong model or cannot connect
  */
@@ -47,7 +61,7 @@ extern const char * NK_device_serial_number();
 
 /**
  * Get last command processing status. Useful for commands which returns the results of their own and could not return
- * an error code.
+ * an error code. The status is kept per calling thread and covers calls with and without a device handle.
  * @return previous command processing error code
  */
 extern uint8_t NK_get_last_command_status();
@@ -324,7 +338,520 @@ extern int NK_erase_password_safe_slot(uint8_t slot_number);
  */
 extern int NK_is_AES_supported(const char *user_password);
 
+/**
+ * Get the last packets exchanged with the device, dissected. Secret fields are redacted.
+ * The same dump is written to the log when a command fails.
+ * @return dump string
+ */
+extern const char * NK_get_flight_recorder_dump();
+
+//devices
+
+/**
+ * List connected devices of given model.
+ * @param device_model char 'S': Nitrokey Storage, 'P': Nitrokey Pro
+ * @return HID paths of the devices, each followed by a new line, to use with NK_device_open_path
+ */
+extern const char * NK_list_devices(const char *device_model);
+
+/**
+ * Connect to the first device of given model.
+ * @param device_model char 'S': Nitrokey Storage, 'P': Nitrokey Pro
+ * @return device handle, NULL if wrong model or cannot connect
+ */
+extern struct NK_device * NK_device_open(const char *device_model);
+
+/**
+ * Connect to the device of given model with given HID path.
+ * @param device_model char 'S': Nitrokey Storage, 'P': Nitrokey Pro
+ * @param path HID path, @see NK_list_devices
+ * @return device handle, NULL if wrong model or cannot connect
+ */
+extern struct NK_device * NK_device_open_path(const char *device_model, const char *path);
+
+/**
+ * Connect to the device served by NK_device_start_proxy on another host. The handle works as one of a local device;
+ * several handles to the same server have their requests in flight at once.
+ * There is no authentication nor encryption, PINs are sent as they are: use over a trusted network or a tunnel.
+ * @param host name or address of the host
+ * @param port TCP port, 4108 by default on the server
+ * @return device handle, NULL if the server can't be reached or has no device
+ */
+extern struct NK_device * NK_device_open_remote(const char *host, uint16_t port);
+
+/**
+ * Serve the device to NK_device_open_remote of other hosts, from background threads. Calls on the handle are
+ * serialized with the served requests. Stopped by NK_device_close.
+ * @param address address to listen on, e.g. "127.0.0.1", "::"
+ * @param port TCP port, 0 - any free one
+ * @return port listened on, -1 if the socket can't be set up
+ */
+extern int NK_device_start_proxy(struct NK_device *device, const char *address, uint16_t port);
+extern void NK_device_stop_proxy(struct NK_device *device);
+
+/**
+ * Disconnect from the device and free the handle. Asynchronous operations submitted to the device are run first.
+ * @return command processing error code
+ */
+extern int NK_device_close(struct NK_device *device);
+
+/**
+ * Get and clear last command processing status of the device.
+ * @return previous command processing error code of the given device
+ */
+extern uint8_t NK_device_get_last_command_status(struct NK_device *device);
+
+/**
+ * Limit the duration of each following operation on the device. An operation which does not finish in time fails
+ * with error 204 (DeadlineExceededException), checked before each packet sent and between polls of the device.
+ * Can be called from any thread.
+ * @param timeout_ms time limit in milliseconds, 0 - no limit (default)
+ */
+extern void NK_device_set_timeout(struct NK_device *device, uint32_t timeout_ms);
+
+/**
+ * Make the operation in progress on the device fail with error 205 (OperationCancelledException), at its next
+ * packet or poll of the device. Meant to be called from another thread than the one waiting for the operation.
+ * Does nothing if no operation is in progress; operations started later are not affected.
+ */
+extern void NK_device_cancel(struct NK_device *device);
+
+/**
+ * NK_device_set_timeout and NK_device_cancel for the default device.
+ */
+extern void NK_set_timeout(uint32_t timeout_ms);
+extern void NK_cancel();
+
+/**
+ * Keep the device out of USB autosuspend: when it has been idle for the threshold, the cheapest read-only command
+ * is sent to it from a background thread. Nothing is sent while requests keep coming. Spares the first request
+ * after a pause the wake-up time of the device.
+ * @param idle_threshold_ms idle time before a keep-alive, 0 - off (default)
+ */
+extern void NK_device_set_keep_alive(struct NK_device *device, uint32_t idle_threshold_ms);
+
+/**
+ * Counters of the keep-alives of the device. Any output pointer can be NULL.
+ * @param sent [out] keep-alives sent
+ * @param failed [out] keep-alives which failed
+ * @param saved_us [out] wake-up time in microseconds taken by keep-alives and not by the requests following them
+ */
+extern void NK_device_get_keep_alive_stats(struct NK_device *device, uint64_t *sent, uint64_t *failed,
+                                           uint64_t *saved_us);
+
+/**
+ * NK_device_set_keep_alive and NK_device_get_keep_alive_stats for the default device.
+ */
+extern void NK_set_keep_alive(uint32_t idle_threshold_ms);
+extern void NK_get_keep_alive_stats(uint64_t *sent, uint64_t *failed, uint64_t *saved_us);
+
+/**
+ * Each operation on the device holds a lock shared with other processes using libnitrokey, so that they do not
+ * mix up each other's packets: they wait for the operation to end and are served in turn. An operation waiting
+ * longer than the timeout fails with error 206 (DeviceLeaseTimeoutException). Lock files are created in
+ * $LIBNITROKEY_LOCK_DIR, $XDG_RUNTIME_DIR or /tmp. Can be called from any thread.
+ * @param timeout_ms time to wait for other processes in milliseconds, 10000 by default, 0 - no lock taken
+ */
+extern void NK_device_set_lease_timeout(struct NK_device *device, uint32_t timeout_ms);
+
+/**
+ * Counters of the lock of the connected device. Any output pointer can be NULL.
+ * @param acquired [out] operations which got the lock
+ * @param contended [out] operations which had to wait for another process
+ * @param timeouts [out] operations which failed waiting
+ * @param total_wait_us [out] time waited by the contended ones in microseconds
+ * @param max_wait_us [out] longest wait in microseconds
+ */
+extern void NK_device_get_lease_stats(struct NK_device *device, uint64_t *acquired, uint64_t *contended,
+                                      uint64_t *timeouts, uint64_t *total_wait_us, uint64_t *max_wait_us);
+
+/**
+ * NK_device_set_lease_timeout and NK_device_get_lease_stats for the default device.
+ */
+extern void NK_set_lease_timeout(uint32_t timeout_ms);
+extern void NK_get_lease_stats(uint64_t *acquired, uint64_t *contended, uint64_t *timeouts,
+                               uint64_t *total_wait_us, uint64_t *max_wait_us);
+
+/*
+ * Functions below work like the ones of the same name without the NK_device_ prefix
+ * (NK_device_status is NK_status, NK_device_get_serial_number is NK_device_serial_number), on the given device.
+ */
+
+extern const char * NK_device_status(struct NK_device *device);
+extern const char * NK_device_get_serial_number(struct NK_device *device);
+extern int NK_device_lock_device(struct NK_device *device);
+extern int NK_device_user_authenticate(struct NK_device *device, const char* user_password,
+                                       const char* user_temporary_password);
+extern int NK_device_first_authenticate(struct NK_device *device, const char* admin_password,
+                                        const char* admin_temporary_password);
+extern int NK_device_factory_reset(struct NK_device *device, const char* admin_password);
+extern int NK_device_build_aes_key(struct NK_device *device, const char* admin_password);
+extern int NK_device_unlock_user_password(struct NK_device *device, const char *admin_password,
+                                          const char *new_user_password);
+extern int NK_device_write_config(struct NK_device *device, uint8_t numlock, uint8_t capslock, uint8_t scrolllock,
+                                  bool enable_user_password, bool delete_user_password,
+                                  const char *admin_temporary_password);
+extern uint8_t* NK_device_read_config(struct NK_device *device);
+extern const char * NK_device_get_totp_slot_name(struct NK_device *device, uint8_t slot_number);
+extern const char * NK_device_get_hotp_slot_name(struct NK_device *device, uint8_t slot_number);
+extern int NK_device_erase_hotp_slot(struct NK_device *device, uint8_t slot_number, const char *temporary_password);
+extern int NK_device_erase_totp_slot(struct NK_device *device, uint8_t slot_number, const char *temporary_password);
+extern int NK_device_write_hotp_slot(struct NK_device *device, uint8_t slot_number, const char *slot_name,
+                                     const char *secret, uint8_t hotp_counter, bool use_8_digits, bool use_enter,
+                                     bool use_tokenID, const char *token_ID, const char *temporary_password);
+extern int NK_device_write_totp_slot(struct NK_device *device, uint8_t slot_number, const char *slot_name,
+                                     const char *secret, uint16_t time_window, bool use_8_digits, bool use_enter,
+                                     bool use_tokenID, const char *token_ID, const char *temporary_password);
+extern uint32_t NK_device_get_hotp_code_PIN(struct NK_device *device, uint8_t slot_number,
+                                            const char* user_temporary_password);
+extern uint32_t NK_device_get_totp_code_PIN(struct NK_device *device, uint8_t slot_number, uint64_t challenge,
+                                            uint64_t last_totp_time, uint8_t last_interval,
+                                            const char* user_temporary_password);
+extern int NK_device_totp_set_time(struct NK_device *device, uint64_t time);
+extern int NK_device_totp_get_time(struct NK_device *device);
+extern int NK_device_change_admin_PIN(struct NK_device *device, char *current_PIN, char *new_PIN);
+extern int NK_device_change_user_PIN(struct NK_device *device, char *current_PIN, char *new_PIN);
+extern uint8_t NK_device_get_user_retry_count(struct NK_device *device);
+extern uint8_t NK_device_get_admin_retry_count(struct NK_device *device);
+extern int NK_device_enable_password_safe(struct NK_device *device, const char *user_pin);
+extern uint8_t * NK_device_get_password_safe_slot_status(struct NK_device *device);
+extern const char *NK_device_get_password_safe_slot_name(struct NK_device *device, uint8_t slot_number);
+extern const char *NK_device_get_password_safe_slot_login(struct NK_device *device, uint8_t slot_number);
+extern const char *NK_device_get_password_safe_slot_password(struct NK_device *device, uint8_t slot_number);
+extern int NK_device_write_password_safe_slot(struct NK_device *device, uint8_t slot_number, const char *slot_name,
+                                              const char *slot_login, const char *slot_password);
+extern int NK_device_erase_password_safe_slot(struct NK_device *device, uint8_t slot_number);
+extern int NK_device_is_AES_supported(struct NK_device *device, const char *user_password);
+extern const char * NK_device_get_flight_recorder_dump(struct NK_device *device);
+
+//results into caller buffers
+
+/*
+ * Buffer sizes enough for any result of the NK_*_buf functions below, terminating NUL included.
+ */
+#define NK_STATUS_BUFFER_SIZE 512
+#define NK_SERIAL_NUMBER_BUFFER_SIZE 16
+#define NK_SLOT_NAME_BUFFER_SIZE 16
+#define NK_PWS_SLOT_NAME_BUFFER_SIZE 12
+#define NK_PWS_SLOT_LOGIN_BUFFER_SIZE 33
+#define NK_PWS_SLOT_PASSWORD_BUFFER_SIZE 21
+#define NK_CONFIG_SIZE 5
+#define NK_PWS_SLOT_STATUS_SIZE 16
+
+/*
+ * Functions below work like the ones without the _buf suffix, but write the result to the buffer given by the caller
+ * instead of returning memory allocated by the library, which the caller would have to free. No heap allocations are
+ * made on this path, so they are meant for long running processes.
+ * Strings are NUL terminated. If the result does not fit the buffer (203, TargetBufferSmallerThanSource) or the
+ * command fails, the whole buffer is zeroed, so it never holds a partial result. Buffers holding password safe
+ * data should be zeroed by the caller after use as well.
+ * All return the command processing error code, 0 on success.
+ */
+
+extern int NK_status_buf(char *buffer, size_t buffer_size);
+extern int NK_device_serial_number_buf(char *buffer, size_t buffer_size);
+extern int NK_get_totp_slot_name_buf(uint8_t slot_number, char *buffer, size_t buffer_size);
+extern int NK_get_hotp_slot_name_buf(uint8_t slot_number, char *buffer, size_t buffer_size);
+extern int NK_get_password_safe_slot_name_buf(uint8_t slot_number, char *buffer, size_t buffer_size);
+extern int NK_get_password_safe_slot_login_buf(uint8_t slot_number, char *buffer, size_t buffer_size);
+extern int NK_get_password_safe_slot_password_buf(uint8_t slot_number, char *buffer, size_t buffer_size);
+extern int NK_read_config_buf(uint8_t *buffer, size_t buffer_size);
+extern int NK_get_password_safe_slot_status_buf(uint8_t *buffer, size_t buffer_size);
+
+extern int NK_device_status_buf(struct NK_device *device, char *buffer, size_t buffer_size);
+extern int NK_device_get_serial_number_buf(struct NK_device *device, char *buffer, size_t buffer_size);
+extern int NK_device_get_totp_slot_name_buf(struct NK_device *device, uint8_t slot_number, char *buffer,
+                                            size_t buffer_size);
+extern int NK_device_get_hotp_slot_name_buf(struct NK_device *device, uint8_t slot_number, char *buffer,
+                                            size_t buffer_size);
+extern int NK_device_get_password_safe_slot_name_buf(struct NK_device *device, uint8_t slot_number, char *buffer,
+                                                     size_t buffer_size);
+extern int NK_device_get_password_safe_slot_login_buf(struct NK_device *device, uint8_t slot_number, char *buffer,
+                                                      size_t buffer_size);
+extern int NK_device_get_password_safe_slot_password_buf(struct NK_device *device, uint8_t slot_number, char *buffer,
+                                                         size_t buffer_size);
+extern int NK_device_read_config_buf(struct NK_device *device, uint8_t *buffer, size_t buffer_size);
+extern int NK_device_get_password_safe_slot_status_buf(struct NK_device *device, uint8_t *buffer, size_t buffer_size);
+
+//asynchronous operations
+
+/**
+ * Completion queue of asynchronous operations, see NK_queue_create.
+ */
+struct NK_queue;
+
+/**
+ * Operation kinds, as reported by NK_queue_reap. NK_OP_PROGRESS is the progress of a long operation of the Storage,
+ * reported with the user_data of its submission; the operations after it are the long operations, completed once the
+ * device is done.
+ */
+enum NK_operation_type {
+    NK_OP_GET_HOTP_CODE = 1,
+    NK_OP_GET_TOTP_CODE = 2,
+    NK_OP_GET_HOTP_SLOT_NAME = 3,
+    NK_OP_GET_TOTP_SLOT_NAME = 4,
+    NK_OP_WRITE_HOTP_SLOT = 5,
+    NK_OP_WRITE_TOTP_SLOT = 6,
+    NK_OP_PROGRESS = 7,
+    NK_OP_FILL_SD_CARD = 8,
+    NK_OP_CREATE_NEW_KEYS = 9,
+    NK_OP_UNLOCK_ENCRYPTED_VOLUME = 10,
+    NK_OP_EXPORT_FIRMWARE = 11
+};
+
+/**
+ * Completion status of an operation which failed on communication with the device (not a command error).
+ */
+#define NK_OP_STATUS_DEVICE_ERROR 255
+
+/**
+ * Create a completion queue. Results of operations submitted with NK_submit_* functions are put there.
+ * Operations on each device are run in order by a worker thread of the device, the submitting thread never waits.
+ * @return queue handle, NULL if the queue event descriptor cannot be created
+ */
+extern struct NK_queue * NK_queue_create();
+
+/**
+ * Destroy the queue. Operations still in flight complete into nowhere.
+ */
+extern void NK_queue_destroy(struct NK_queue *queue);
+
+/**
+ * Get the event descriptor (eventfd) of the queue, to be watched for reading with poll/epoll or an event loop
+ * (libuv, asyncio). It is readable while there are completions to reap. Do not read or close it.
+ * @return file descriptor
+ */
+extern int NK_queue_fd(struct NK_queue *queue);
+
+/**
+ * Take one completion from the queue. Does not block. Any output pointer can be NULL.
+ * @param user_data [out] value given on submission
+ * @param operation [out] NK_operation_type of the operation
+ * @param status [out] command processing error code as returned by the blocking function, NK_OP_STATUS_DEVICE_ERROR
+ * @param code [out] OTP code for NK_OP_GET_*_CODE, progress in percent for NK_OP_PROGRESS and long operations
+ * @param text [out] slot name for NK_OP_GET_*_SLOT_NAME, always NUL terminated
+ * @param text_size size of text buffer
+ * @return 1 if a completion was taken, 0 if the queue is empty
+ */
+extern int NK_queue_reap(struct NK_queue *queue, uint64_t *user_data, int *operation, uint8_t *status,
+                         uint32_t *code, char *text, size_t text_size);
+
+/**
+ * Submit getting a HOTP code. Arguments are as of NK_get_hotp_code_PIN. All strings are copied.
+ * @param device device handle, NULL for the default device
+ * @param queue queue to put the completion to
+ * @param user_data any value, returned with the completion
+ * @return 0 if submitted, -1 if queue is NULL or a password, PIN or secret is longer than 127 characters
+ */
+extern int NK_submit_get_hotp_code(struct NK_device *device, struct NK_queue *queue, uint64_t user_data,
+                                   uint8_t slot_number, const char *user_temporary_password);
+
+/**
+ * Submit getting a TOTP code. Arguments are as of NK_get_totp_code_PIN, the rest as of NK_submit_get_hotp_code.
+ */
+extern int NK_submit_get_totp_code(struct NK_device *device, struct NK_queue *queue, uint64_t user_data,
+                                   uint8_t slot_number, uint64_t challenge, uint64_t last_totp_time,
+                                   uint8_t last_interval, const char *user_temporary_password);
+
+/**
+ * Submit reading a HOTP slot name. @see NK_get_hotp_slot_name, NK_submit_get_hotp_code
+ */
+extern int NK_submit_get_hotp_slot_name(struct NK_device *device, struct NK_queue *queue, uint64_t user_data,
+                                        uint8_t slot_number);
+
+/**
+ * Submit reading a TOTP slot name. @see NK_get_totp_slot_name, NK_submit_get_hotp_code
+ */
+extern int NK_submit_get_totp_slot_name(struct NK_device *device, struct NK_queue *queue, uint64_t user_data,
+                                        uint8_t slot_number);
+
+/**
+ * Submit writing a HOTP slot. @see NK_write_hotp_slot, NK_submit_get_hotp_code
+ */
+extern int NK_submit_write_hotp_slot(struct NK_device *device, struct NK_queue *queue, uint64_t user_data,
+                                     uint8_t slot_number, const char *slot_name, const char *secret,
+                                     uint8_t hotp_counter, bool use_8_digits, bool use_enter, bool use_tokenID,
+                                     const char *token_ID, const char *temporary_password);
+
+/**
+ * Submit writing a TOTP slot. @see NK_write_totp_slot, NK_submit_get_hotp_code
+ */
+extern int NK_submit_write_totp_slot(struct NK_device *device, struct NK_queue *queue, uint64_t user_data,
+                                     uint8_t slot_number, const char *slot_name, const char *secret,
+                                     uint16_t time_window, bool use_8_digits, bool use_enter, bool use_tokenID,
+                                     const char *token_ID, const char *temporary_password);
+
+/**
+ * Submit filling the SD card of the Storage with random data, which takes the device up to an hour. Once the device
+ * has begun, its progress is polled every poll_interval_ms from a background thread and each change is put to the
+ * queue as NK_OP_PROGRESS. The operation completes as NK_OP_FILL_SD_CARD when the device is done, with status 0 or
+ * the error code; 205 if NK_device_cancel_long_operation was called. Meanwhile other calls on the device fail with
+ * error 207 (LongOperationInProgressException). Rest of the arguments as of NK_submit_get_hotp_code.
+ * @param admin_pin admin PIN
+ * @param poll_interval_ms interval of progress polls, 0 - 500 ms
+ */
+extern int NK_submit_fill_SD_card_with_random_data(struct NK_device *device, struct NK_queue *queue, uint64_t user_data,
+                                                   const char *admin_pin, uint32_t poll_interval_ms);
+
+/**
+ * Submit generating new keys of the Storage, completed as NK_OP_CREATE_NEW_KEYS.
+ * @see NK_submit_fill_SD_card_with_random_data
+ */
+extern int NK_submit_create_new_keys(struct NK_device *device, struct NK_queue *queue, uint64_t user_data,
+                                     const char *admin_pin, uint32_t poll_interval_ms);
+
+/**
+ * Submit unlocking the encrypted volume of the Storage, completed as NK_OP_UNLOCK_ENCRYPTED_VOLUME.
+ * @see NK_submit_fill_SD_card_with_random_data
+ */
+extern int NK_submit_unlock_encrypted_volume(struct NK_device *device, struct NK_queue *queue, uint64_t user_data,
+                                             const char *user_pin, uint32_t poll_interval_ms);
+
+/**
+ * Submit exporting the firmware of the Storage to its unencrypted volume, completed as NK_OP_EXPORT_FIRMWARE.
+ * @see NK_submit_fill_SD_card_with_random_data
+ */
+extern int NK_submit_export_firmware(struct NK_device *device, struct NK_queue *queue, uint64_t user_data,
+                                     const char *admin_pin, uint32_t poll_interval_ms);
+
+/**
+ * Stop following the long operation submitted on the device, it completes with status 205. The device can't abort
+ * it and stays busy until it is done. No progress is put to the queue once this returns.
+ */
+extern void NK_device_cancel_long_operation(struct NK_device *device);
+
+/**
+ * Progress of the long operation the Storage works on.
+ * @return percent, -1 if none is in progress or on error (see NK_get_last_command_status)
+ */
+extern int NK_device_get_progress_bar_value(struct NK_device *device);
+
+/**
+ * NK_device_cancel_long_operation and NK_device_get_progress_bar_value for the default device.
+ */
+extern void NK_cancel_long_operation();
+extern int NK_get_progress_bar_value();
+
+//storage status
+
+/**
+ * Status of the Nitrokey Storage, as filled by NK_get_storage_status.
+ */
+struct NK_storage_status {
+    bool unencrypted_volume_read_only;
+    bool unencrypted_volume_active;
+    bool encrypted_volume_read_only;
+    bool encrypted_volume_active;
+    bool hidden_volume_read_only;
+    bool hidden_volume_active;
+    uint8_t firmware_version_major;
+    uint8_t firmware_version_minor;
+    bool firmware_locked;
+    uint32_t serial_number_sd_card;
+    uint32_t serial_number_smart_card;
+    uint8_t user_retry_count;
+    uint8_t admin_retry_count;
+    bool new_sd_card_found;
+    bool filled_with_random;
+    bool new_smart_card_found;
+    bool stick_initialized;
+};
+
+/**
+ * Get the status of the Storage. The status is kept as a snapshot of the device and returned without querying the
+ * device while it is younger than the TTL, see NK_device_set_storage_status_ttl.
+ * @param out [out] status, written on success only
+ * @return command processing error code
+ */
+extern int NK_device_get_storage_status(struct NK_device *device, struct NK_storage_status *out);
+
+/**
+ * Set how long the status of NK_device_get_storage_status is reused, 1000 ms by default. Calls of the library which
+ * change the status (authentication, PIN changes, locking, long operations) drop it before.
+ * @param ttl_ms time to live of the snapshot in milliseconds, 0 - query the device each time
+ */
+extern void NK_device_set_storage_status_ttl(struct NK_device *device, uint32_t ttl_ms);
+
+/**
+ * NK_device_get_storage_status and NK_device_set_storage_status_ttl for the default device.
+ */
+extern int NK_get_storage_status(struct NK_storage_status *out);
+extern void NK_set_storage_status_ttl(uint32_t ttl_ms);
+
+//tracing
+
+/**
+ * Enable or disable recording of transaction and command spans into the in-memory trace buffer.
+ * When disabled, tracing costs a single branch per span.
+ * @param state true - record spans, false - stop recording
+ */
+extern void NK_set_tracing(bool state);
+
+/**
+ * Get recorded spans in Chrome trace event format (open with chrome://tracing or ui.perfetto.dev).
+ * The buffer holds the last 4096 spans.
+ * @return JSON string
+ */
+extern const char * NK_get_trace_json();
+
+/**
+ * Drop all recorded spans.
+ */
+extern void NK_clear_trace();
+
+//hotplug
+
+/**
+ * Hotplug events, as passed to NK_hotplug_callback.
+ */
+enum NK_hotplug_event {
+    NK_HOTPLUG_ARRIVAL = 1,
+    NK_HOTPLUG_REMOVAL = 2
+};
+
+/**
+ * Called on the hotplug monitor thread, should return quickly and must not call NK_hotplug_* functions.
+ * @param event NK_hotplug_event
+ * @param device_model 'P' Nitrokey Pro, 'S' Nitrokey Storage, 'U' Nitrokey Storage in firmware update mode
+ * @param devpath sysfs path of the USB device, valid during the call only
+ * @param user_data value given on registration
+ */
+typedef void (*NK_hotplug_callback)(int event, char device_model, const char *devpath, void *user_data);
+
+/**
+ * Start monitoring Nitrokey arrivals and removals through udev netlink events (Linux). While running,
+ * NK_login_auto opens devices only if the set of connected Nitrokeys changed since its last successful call,
+ * and does nothing when none is connected.
+ * @return 0 if started or already running, -1 if the netlink socket cannot be opened
+ */
+extern int NK_hotplug_start();
+
+/**
+ * Stop monitoring. Registered callbacks are kept.
+ */
+extern void NK_hotplug_stop();
+
+/**
+ * Register a callback for arrivals and removals.
+ * @return id for NK_hotplug_unregister
+ */
+extern int NK_hotplug_register(NK_hotplug_callback callback, void *user_data);
+
+extern void NK_hotplug_unregister(int id);
+
+/**
+ * @return number of connected Nitrokeys as seen by the monitor, -1 if not running
+ */
+extern int NK_hotplug_device_count();
+
 }
 
+/**
+ * C++ only: handle of the given device object, e.g. a nitrokey::device::DeviceEmulator, to use the C API without
+ * a HID device. Close with NK_device_close.
+ * @return device handle, NULL if cannot connect
+ */
+struct NK_device * NK_device_open_object(std::shared_ptr<nitrokey::device::Device> device);
+
 
 #endif //LIBNITROKEY_NK_C_API_H
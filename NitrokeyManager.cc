@@ -2,21 +2,14 @@
 #include <iostream>
 #include "include/NitrokeyManager.h"
 #include "include/LibraryException.h"
+#include "include/hotplug.h"
+#include "include/probes.h"
 #include <algorithm>
 
 namespace nitrokey{
 
-    template <typename T>
-    void strcpyT(T& dest, const char* src){
-        if (src == nullptr)
-//            throw EmptySourceStringException(slot_number);
-            return;
-        const size_t s_dest = sizeof dest;
-        if (strlen(src) > s_dest){
-            throw TooLongStringException(strlen(src), s_dest, src);
-        }
-        strncpy((char*) &dest, src, s_dest);
-    }
+    using misc::strcpyT;
+    using misc::vector_copy;
 
     template <typename T>
     typename T::CommandPayload get_payload(){
@@ -27,57 +20,236 @@ namespace nitrokey{
     }
 
 
-    // package type to auth, auth type [Authorize,UserAuthorize]
-    template <typename S, typename A, typename T>
+    // package type to auth, auth type [Authorize,UserAuthorize] follows from command_metadata
+    template <typename S, typename T>
     void authorize_packet(T &package, const char *admin_temporary_password, shared_ptr<Device> device){
+        typedef typename AuthorizingCommand<S>::type A;
         auto auth = get_payload<A>();
         strcpyT(auth.temporary_password, admin_temporary_password);
         auth.crc_to_authorize = S::CommandTransaction::getCRC(package);
-        A::CommandTransaction::run(*device, auth);
+        NK_PROBE1(authorize__start, (int)S::CommandTransaction::command_id);
+        try {
+            A::CommandTransaction::run(*device, auth);
+        } catch (...) {
+            NK_PROBE2(authorize__done, (int)S::CommandTransaction::command_id, -1);
+            throw;
+        }
+        NK_PROBE2(authorize__done, (int)S::CommandTransaction::command_id, 0);
+    }
+
+    template <typename S, typename T>
+    TransactionStatus try_authorize_packet(T &package, const char *temporary_password, shared_ptr<Device> device){
+        typedef typename AuthorizingCommand<S>::type A;
+        auto auth = get_payload<A>();
+        strcpyT(auth.temporary_password, temporary_password);
+        auth.crc_to_authorize = S::CommandTransaction::getCRC(package);
+        typename A::CommandTransaction::ResponsePayload response{};
+        NK_PROBE1(authorize__start, (int)S::CommandTransaction::command_id);
+        const auto status = A::CommandTransaction::try_run(*device, auth, response);
+        NK_PROBE2(authorize__done, (int)S::CommandTransaction::command_id, (int)status.outcome);
+        return status;
+    }
+
+    /*
+     * Password fields of the Storage begin with the kind of the password.
+     */
+    template <typename T>
+    void set_storage_password(T &field, PasswordKind kind, const char *password){
+        const size_t length = password == nullptr ? 0 : strlen(password);
+        if (length + 1 > sizeof field){
+            throw TooLongStringException(length, sizeof field - 1, password);
+        }
+        field[0] = (uint8_t) kind;
+        memcpy(field + 1, password, length);
+    }
+
+    /*
+     * Sends the command of a long operation: true if the Storage works on it in the background.
+     */
+    template <typename S>
+    bool start_long_operation(Device &device, typename S::CommandPayload &payload){
+        typename S::CommandTransaction::ResponsePayload response{};
+        const auto status = S::CommandTransaction::try_run(device, payload, response);
+        misc::secure_zero(&payload, sizeof payload);
+        if (status.outcome == TransactionStatus::Outcome::LONG_OPERATION_IN_PROGRESS) return true;
+        status.raise();
+        return false;
+    }
+
+    /*
+     * Device string fields are NUL terminated only when shorter than the field.
+     */
+    template <typename T>
+    void copy_field_to_buffer(const T &field, char *buffer, size_t buffer_size){
+        const size_t length = strnlen((const char *) field, sizeof field);
+        if (buffer == nullptr || length + 1 > buffer_size){
+            throw TargetBufferSmallerThanSource(length + 1, buffer_size);
+        }
+        memcpy(buffer, field, length);
+        buffer[length] = 0;
+    }
+
+    template <typename T>
+    void copy_array_to_buffer(const T &array, uint8_t *buffer, size_t buffer_size){
+        if (buffer == nullptr || sizeof array > buffer_size){
+            throw TargetBufferSmallerThanSource(sizeof array, buffer_size);
+        }
+        memcpy(buffer, array, sizeof array);
+    }
+
+    NitrokeyManager::Operation::Operation(NitrokeyManager &manager, const char *name)
+            : span("NitrokeyManager", name), manager(manager), device(manager.device), applied(false),
+              cancelled(false) {
+        if (manager.operation_depth++ > 0 || device == nullptr) return;
+        // no keep-alive between the transactions of the operation
+        device->begin_exchange();
+        {
+            // cancel() reaches this operation only, it can't be left over for the next one
+            std::lock_guard<std::mutex> lock(manager.cancel_mutex);
+            manager.cancel_target = &cancelled;
+        }
+        auto limits = OperationLimits{manager.deadline, &cancelled};
+        const auto timeout = std::chrono::milliseconds(manager.timeout_ms.load());
+        if (timeout.count() > 0)
+            limits.deadline = std::min(limits.deadline, device->get_clock().now() + timeout);
+        device->set_operation_limits(limits);
+        applied = true;
+        device->begin_operation();
+        const auto lease_timeout = std::chrono::milliseconds(manager.lease_timeout_ms.load());
+        if (lease_timeout.count() == 0) return;
+        try {
+            device->get_lease().acquire(device->get_lease_key(), device->get_clock(), lease_timeout,
+                                        limits.deadline, limits.cancelled);
+        } catch (...) {
+            // the destructor is not called
+            end();
+            throw;
+        }
+    }
+
+    NitrokeyManager::Operation::~Operation() {
+        end();
     }
 
-    shared_ptr <NitrokeyManager> NitrokeyManager::_instance = nullptr;
+    void NitrokeyManager::Operation::end() {
+        manager.operation_depth--;
+        if (!applied) return;
+        device->end_operation();
+        device->get_lease().release();
+        device->set_operation_limits(OperationLimits::none());
+        device->end_exchange();
+        std::lock_guard<std::mutex> lock(manager.cancel_mutex);
+        manager.cancel_target = nullptr;
+    }
 
-    NitrokeyManager::NitrokeyManager() {
-        set_debug(true);
+    NitrokeyManager::NitrokeyManager() : hotplug_generation(UINT64_MAX), keep_alive_threshold(0),
+                                         keep_alive_stats{0, 0, std::chrono::microseconds(0)}, operation_depth(0),
+                                         cancel_target(nullptr), timeout_ms(0), deadline(Clock::time_point::max()),
+                                         lease_timeout_ms(DEFAULT_LEASE_TIMEOUT.count()),
+                                         storage_status_ttl(DEFAULT_STORAGE_STATUS_TTL) {
     }
     NitrokeyManager::~NitrokeyManager() {
+        if (keep_alive != nullptr) keep_alive->stop();
     }
 
     bool NitrokeyManager::connect() {
+        return connect_any({ make_shared<Stick10>(), make_shared<Stick20>() });
+    }
+
+    bool NitrokeyManager::connect_any(vector< shared_ptr<Device> > candidates) {
+        Operation operation(*this, __func__);
+        // with hotplug monitoring devices are opened only when the set of them changed
+        auto &hotplug = HotplugMonitor::instance();
+        const bool monitored = hotplug.is_running();
+        const auto generation = hotplug.get_generation();
+        // a device found must still be open, it may have been closed behind the manager's back
+        if (monitored && generation == hotplug_generation && (device == nullptr || device->is_connected())) {
+            NK_PROBE1(cache__hit, (int)probes::ProbeCache::HOTPLUG_CONNECT);
+            return device != nullptr;
+        }
+        if (monitored) NK_PROBE1(cache__miss, (int)probes::ProbeCache::HOTPLUG_CONNECT);
+
         device = nullptr;
-        vector< shared_ptr<Device> > devices = { make_shared<Stick10>(), make_shared<Stick20>() };
-        for( auto & d : devices ){
+        if (monitored && !hotplug.has_connectable_device()) {
+            hotplug_generation = generation;
+            restart_keep_alive(false);
+            return false;
+        }
+        for( auto & d : candidates ){
             if (d->connect()){
                 device = std::shared_ptr<Device>(d);
             }
         }
+        // failures are retried on the next call
+        hotplug_generation = monitored && device != nullptr ? generation : UINT64_MAX;
+        restart_keep_alive(device != nullptr);
         return device != nullptr;
     }
 
 
-    bool NitrokeyManager::connect(const char *device_model) {
+    shared_ptr<Device> NitrokeyManager::make_device(const char *device_model) {
         switch (device_model[0]){
             case 'P':
-                device = make_shared<Stick10>();
-                break;
+                return make_shared<Stick10>();
             case 'S':
-                device = make_shared<Stick20>();
-                break;
+                return make_shared<Stick20>();
             default:
                 throw std::runtime_error("Unknown model");
         }
-        return device->connect();
+    }
+
+    bool NitrokeyManager::connect(const char *device_model) {
+        Operation operation(*this, __func__);
+        hotplug_generation = UINT64_MAX;
+        device = make_device(device_model);
+        const bool connected = device->connect();
+        restart_keep_alive(connected);
+        return connected;
+    }
+
+    bool NitrokeyManager::connect(const char *device_model, const char *path) {
+        Operation operation(*this, __func__);
+        hotplug_generation = UINT64_MAX;
+        device = make_device(device_model);
+        device->set_path(path);
+        const bool connected = device->connect();
+        restart_keep_alive(connected);
+        return connected;
+    }
+
+    bool NitrokeyManager::connect_device(shared_ptr<Device> device) {
+        Operation operation(*this, __func__);
+        hotplug_generation = UINT64_MAX;
+        this->device = device;
+        const bool connected = device->connect();
+        restart_keep_alive(connected);
+        return connected;
+    }
+
+    vector<string> NitrokeyManager::list_devices(const char *device_model) {
+        return make_device(device_model)->enumerate();
     }
 
     shared_ptr<NitrokeyManager> NitrokeyManager::instance() {
-        if (_instance == nullptr){
-            _instance = shared_ptr<NitrokeyManager>(new NitrokeyManager());
-        }
+        // initialization of function statics is thread safe
+        static shared_ptr<NitrokeyManager> _instance = [] {
+            auto manager = create();
+            manager->set_debug(true);
+            return manager;
+        }();
         return _instance;
     }
 
+    shared_ptr<NitrokeyManager> NitrokeyManager::create() {
+        return shared_ptr<NitrokeyManager>(new NitrokeyManager());
+    }
+
     bool NitrokeyManager::disconnect() {
+        Operation operation(*this, __func__);
+        hotplug_generation = UINT64_MAX;
+        if (device == nullptr) return false;
+        if (keep_alive != nullptr) keep_alive->stop();
+        drop_storage_status();
         return device->disconnect();
     }
 
@@ -90,22 +262,41 @@ namespace nitrokey{
     }
 
     string NitrokeyManager::get_serial_number() {
+        Operation operation(*this, __func__);
         auto response = GetStatus::CommandTransaction::run(*device);
         return response.data().get_card_serial_hex();
     }
 
     string NitrokeyManager::get_status() {
+        Operation operation(*this, __func__);
         auto response = GetStatus::CommandTransaction::run(*device);
         return response.data().dissect();
     }
 
+    void NitrokeyManager::get_serial_number(char *buffer, size_t buffer_size) {
+        Operation operation(*this, __func__);
+        auto response = GetStatus::CommandTransaction::run(*device);
+        char text[64];
+        DissectWriter out(text, sizeof text);
+        out.hexdump(response.data().card_serial, sizeof response.data().card_serial, false);
+        copy_field_to_buffer(text, buffer, buffer_size);
+    }
+
+    void NitrokeyManager::get_status(char *buffer, size_t buffer_size) {
+        Operation operation(*this, __func__);
+        auto response = GetStatus::CommandTransaction::run(*device);
+        char text[DISSECT_BUFFER_SIZE];
+        DissectWriter out(text, sizeof text);
+        response.data().dissect(out);
+        copy_field_to_buffer(text, buffer, buffer_size);
+    }
+
     uint32_t NitrokeyManager::get_HOTP_code(uint8_t slot_number, const char *user_temporary_password) {
-        if (!is_valid_hotp_slot_number(slot_number)) throw InvalidSlotException(slot_number);
-        auto gh = get_payload<GetHOTP>();
-        gh.slot_number = get_internal_slot_number_for_hotp(slot_number);
+        Operation operation(*this, __func__);
+        auto gh = make_HOTP_code_payload(slot_number);
 
         if(user_temporary_password != nullptr && strlen(user_temporary_password)!=0){ //FIXME use string instead of strlen
-            authorize_packet<GetHOTP, UserAuthorize>(gh, user_temporary_password, device);
+            authorize_packet<GetHOTP>(gh, user_temporary_password, device);
         }
 
         auto resp = GetHOTP::CommandTransaction::run(*device, gh);
@@ -113,6 +304,29 @@ namespace nitrokey{
     }
 
 
+    TransactionStatus NitrokeyManager::try_get_HOTP_code(uint8_t slot_number, const char *user_temporary_password,
+                                                         uint32_t &code) {
+        Operation operation(*this, __func__);
+        auto gh = make_HOTP_code_payload(slot_number);
+
+        if(user_temporary_password != nullptr && strlen(user_temporary_password)!=0){
+            const auto status = try_authorize_packet<GetHOTP>(gh, user_temporary_password, device);
+            if (!status) return status;
+        }
+
+        GetHOTP::ResponsePayload response{};
+        const auto status = GetHOTP::CommandTransaction::try_run(*device, gh, response);
+        if (status) code = response.code;
+        return status;
+    }
+
+    GetHOTP::CommandPayload NitrokeyManager::make_HOTP_code_payload(uint8_t slot_number) const {
+        if (!is_valid_hotp_slot_number(slot_number)) throw InvalidSlotException(slot_number);
+        auto gh = get_payload<GetHOTP>();
+        gh.slot_number = get_internal_slot_number_for_hotp(slot_number);
+        return gh;
+    }
+
     bool NitrokeyManager::is_valid_hotp_slot_number(uint8_t slot_number) const { return slot_number < 3; }
     bool NitrokeyManager::is_valid_totp_slot_number(uint8_t slot_number) const { return slot_number < 0x10-1; } //15
     uint8_t NitrokeyManager::get_internal_slot_number_for_totp(uint8_t slot_number) const { return (uint8_t) (0x20 + slot_number); }
@@ -121,56 +335,100 @@ namespace nitrokey{
     uint32_t NitrokeyManager::get_TOTP_code(uint8_t slot_number, uint64_t challenge, uint64_t last_totp_time,
                                             uint8_t last_interval,
                                             const char *user_temporary_password) {
-        if(!is_valid_totp_slot_number(slot_number)) throw InvalidSlotException(slot_number);
-        slot_number = get_internal_slot_number_for_totp(slot_number);
-        auto gt = get_payload<GetTOTP>();
-        gt.slot_number = slot_number;
-        gt.challenge = challenge;
-        gt.last_interval = last_interval;
-        gt.last_totp_time = last_totp_time;
+        Operation operation(*this, __func__);
+        auto gt = make_TOTP_code_payload(slot_number, challenge, last_totp_time, last_interval);
 
         if(user_temporary_password != nullptr && strlen(user_temporary_password)!=0){ //FIXME use string instead of strlen
-            authorize_packet<GetTOTP, UserAuthorize>(gt, user_temporary_password, device);
+            authorize_packet<GetTOTP>(gt, user_temporary_password, device);
         }
         auto resp = GetTOTP::CommandTransaction::run(*device, gt);
         return resp.data().code;
     }
 
+    TransactionStatus NitrokeyManager::try_get_TOTP_code(uint8_t slot_number, uint64_t challenge,
+                                                         uint64_t last_totp_time, uint8_t last_interval,
+                                                         const char *user_temporary_password, uint32_t &code) {
+        Operation operation(*this, __func__);
+        auto gt = make_TOTP_code_payload(slot_number, challenge, last_totp_time, last_interval);
+
+        if(user_temporary_password != nullptr && strlen(user_temporary_password)!=0){
+            const auto status = try_authorize_packet<GetTOTP>(gt, user_temporary_password, device);
+            if (!status) return status;
+        }
+
+        GetTOTP::ResponsePayload response{};
+        const auto status = GetTOTP::CommandTransaction::try_run(*device, gt, response);
+        if (status) code = response.code;
+        return status;
+    }
+
+    GetTOTP::CommandPayload NitrokeyManager::make_TOTP_code_payload(uint8_t slot_number, uint64_t challenge,
+                                                                    uint64_t last_totp_time,
+                                                                    uint8_t last_interval) const {
+        if(!is_valid_totp_slot_number(slot_number)) throw InvalidSlotException(slot_number);
+        auto gt = get_payload<GetTOTP>();
+        gt.slot_number = get_internal_slot_number_for_totp(slot_number);
+        gt.challenge = challenge;
+        gt.last_interval = last_interval;
+        gt.last_totp_time = last_totp_time;
+        return gt;
+    }
+
     bool NitrokeyManager::erase_slot(uint8_t slot_number, const char *temporary_password) {
         auto p = get_payload<EraseSlot>();
         p.slot_number = slot_number;
 
-        authorize_packet<EraseSlot, Authorize>(p, temporary_password, device);
+        authorize_packet<EraseSlot>(p, temporary_password, device);
 
         auto resp = EraseSlot::CommandTransaction::run(*device,p);
         return true;
     }
 
     bool NitrokeyManager::erase_hotp_slot(uint8_t slot_number, const char *temporary_password) {
+        Operation operation(*this, __func__);
         if (!is_valid_hotp_slot_number(slot_number)) throw InvalidSlotException(slot_number);
         slot_number = get_internal_slot_number_for_hotp(slot_number);
         return erase_slot(slot_number, temporary_password);
     }
 
     bool NitrokeyManager::erase_totp_slot(uint8_t slot_number, const char *temporary_password) {
+        Operation operation(*this, __func__);
         if (!is_valid_totp_slot_number(slot_number)) throw InvalidSlotException(slot_number);
         slot_number = get_internal_slot_number_for_totp(slot_number);
         return erase_slot(slot_number, temporary_password);
     }
 
-    template <typename T, typename U>
-    void vector_copy(T& dest, std::vector<U> &vec){
-        const size_t d_size = sizeof(dest);
-        if(d_size < vec.size()){
-            throw TargetBufferSmallerThanSource(vec.size(), d_size);
-        }
-        std::fill(dest, dest+d_size, 0);
-        std::copy(vec.begin(), vec.end(), dest);
+    bool NitrokeyManager::write_HOTP_slot(uint8_t slot_number, const char *slot_name, const char *secret, uint8_t hotp_counter,
+                                              bool use_8_digits, bool use_enter, bool use_tokenID, const char *token_ID,
+                                              const char *temporary_password) {
+        Operation operation(*this, __func__);
+        auto payload = make_HOTP_slot_payload(slot_number, slot_name, secret, hotp_counter, use_8_digits, use_enter,
+                                              use_tokenID, token_ID);
+
+        authorize_packet<WriteToHOTPSlot>(payload, temporary_password, device);
+
+        auto resp = WriteToHOTPSlot::CommandTransaction::run(*device, payload);
+        return true;
     }
 
-    bool NitrokeyManager::write_HOTP_slot(uint8_t slot_number, const char *slot_name, const char *secret, uint8_t hotp_counter,
+    bool NitrokeyManager::write_TOTP_slot(uint8_t slot_number, const char *slot_name, const char *secret, uint16_t time_window,
                                               bool use_8_digits, bool use_enter, bool use_tokenID, const char *token_ID,
                                               const char *temporary_password) {
+        Operation operation(*this, __func__);
+        auto payload = make_TOTP_slot_payload(slot_number, slot_name, secret, time_window, use_8_digits, use_enter,
+                                              use_tokenID, token_ID);
+
+        authorize_packet<WriteToTOTPSlot>(payload, temporary_password, device);
+
+        auto resp = WriteToTOTPSlot::CommandTransaction::run(*device, payload);
+        return true;
+    }
+
+    WriteToHOTPSlot::CommandPayload NitrokeyManager::make_HOTP_slot_payload(uint8_t slot_number, const char *slot_name,
+                                                                            const char *secret, uint8_t hotp_counter,
+                                                                            bool use_8_digits, bool use_enter,
+                                                                            bool use_tokenID,
+                                                                            const char *token_ID) const {
         if (!is_valid_hotp_slot_number(slot_number)) throw InvalidSlotException(slot_number);
 
         slot_number = get_internal_slot_number_for_hotp(slot_number);
@@ -184,16 +442,14 @@ namespace nitrokey{
         payload.use_8_digits = use_8_digits;
         payload.use_enter = use_enter;
         payload.use_tokenID = use_tokenID;
-
-        authorize_packet<WriteToHOTPSlot, Authorize>(payload, temporary_password, device);
-
-        auto resp = WriteToHOTPSlot::CommandTransaction::run(*device, payload);
-        return true;
+        return payload;
     }
 
-    bool NitrokeyManager::write_TOTP_slot(uint8_t slot_number, const char *slot_name, const char *secret, uint16_t time_window,
-                                              bool use_8_digits, bool use_enter, bool use_tokenID, const char *token_ID,
-                                              const char *temporary_password) {
+    WriteToTOTPSlot::CommandPayload NitrokeyManager::make_TOTP_slot_payload(uint8_t slot_number, const char *slot_name,
+                                                                            const char *secret, uint16_t time_window,
+                                                                            bool use_8_digits, bool use_enter,
+                                                                            bool use_tokenID,
+                                                                            const char *token_ID) const {
         auto payload = get_payload<WriteToTOTPSlot>();
         if (!is_valid_totp_slot_number(slot_number)) throw InvalidSlotException(slot_number);
 
@@ -207,19 +463,17 @@ namespace nitrokey{
         payload.use_8_digits = use_8_digits;
         payload.use_enter = use_enter;
         payload.use_tokenID = use_tokenID;
-
-        authorize_packet<WriteToTOTPSlot, Authorize>(payload, temporary_password, device);
-
-        auto resp = WriteToTOTPSlot::CommandTransaction::run(*device, payload);
-        return true;
+        return payload;
     }
 
     const char * NitrokeyManager::get_totp_slot_name(uint8_t slot_number) {
+        Operation operation(*this, __func__);
         if (!is_valid_totp_slot_number(slot_number)) throw InvalidSlotException(slot_number);
         slot_number = get_internal_slot_number_for_totp(slot_number);
         return get_slot_name(slot_number);
     }
     const char * NitrokeyManager::get_hotp_slot_name(uint8_t slot_number) {
+        Operation operation(*this, __func__);
         if (!is_valid_hotp_slot_number(slot_number)) throw InvalidSlotException(slot_number);
         slot_number = get_internal_slot_number_for_hotp(slot_number);
         return get_slot_name(slot_number);
@@ -232,15 +486,58 @@ namespace nitrokey{
         return strdup((const char *) resp.data().slot_name);
     }
 
+    void NitrokeyManager::get_totp_slot_name(uint8_t slot_number, char *buffer, size_t buffer_size) {
+        Operation operation(*this, __func__);
+        if (!is_valid_totp_slot_number(slot_number)) throw InvalidSlotException(slot_number);
+        get_slot_name(get_internal_slot_number_for_totp(slot_number), buffer, buffer_size);
+    }
+
+    void NitrokeyManager::get_hotp_slot_name(uint8_t slot_number, char *buffer, size_t buffer_size) {
+        Operation operation(*this, __func__);
+        if (!is_valid_hotp_slot_number(slot_number)) throw InvalidSlotException(slot_number);
+        get_slot_name(get_internal_slot_number_for_hotp(slot_number), buffer, buffer_size);
+    }
+
+    void NitrokeyManager::get_slot_name(uint8_t slot_number, char *buffer, size_t buffer_size) {
+        auto payload = get_payload<GetSlotName>();
+        payload.slot_number = slot_number;
+        auto resp = GetSlotName::CommandTransaction::run(*device, payload);
+        copy_field_to_buffer(resp.data().slot_name, buffer, buffer_size);
+    }
+
+    TransactionStatus NitrokeyManager::try_get_totp_slot_name(uint8_t slot_number, char *buffer, size_t buffer_size) {
+        Operation operation(*this, __func__);
+        if (!is_valid_totp_slot_number(slot_number)) throw InvalidSlotException(slot_number);
+        return try_get_slot_name(get_internal_slot_number_for_totp(slot_number), buffer, buffer_size);
+    }
+
+    TransactionStatus NitrokeyManager::try_get_hotp_slot_name(uint8_t slot_number, char *buffer, size_t buffer_size) {
+        Operation operation(*this, __func__);
+        if (!is_valid_hotp_slot_number(slot_number)) throw InvalidSlotException(slot_number);
+        return try_get_slot_name(get_internal_slot_number_for_hotp(slot_number), buffer, buffer_size);
+    }
+
+    TransactionStatus NitrokeyManager::try_get_slot_name(uint8_t slot_number, char *buffer, size_t buffer_size) {
+        auto payload = get_payload<GetSlotName>();
+        payload.slot_number = slot_number;
+        GetSlotName::ResponsePayload response{};
+        const auto status = GetSlotName::CommandTransaction::try_run(*device, payload, response);
+        if (status) copy_field_to_buffer(response.slot_name, buffer, buffer_size);
+        return status;
+    }
+
     bool NitrokeyManager::first_authenticate(const char *pin, const char *temporary_password) {
+        Operation operation(*this, __func__);
         auto authreq = get_payload<FirstAuthenticate>();
         strcpyT(authreq.card_password, pin);
         strcpyT(authreq.temporary_password, temporary_password);
+        drop_storage_status();
         FirstAuthenticate::CommandTransaction::run(*device, authreq);
         return true;
     }
 
     bool NitrokeyManager::set_time(uint64_t time) {
+        Operation operation(*this, __func__);
         auto p = get_payload<SetTime>();
         p.reset = 1;
         p.time = time;
@@ -249,6 +546,7 @@ namespace nitrokey{
     }
 
     bool NitrokeyManager::get_time() {
+        Operation operation(*this, __func__);
         auto p = get_payload<SetTime>();
         p.reset = 0;
         SetTime::CommandTransaction::run(*device, p);
@@ -256,43 +554,45 @@ namespace nitrokey{
     }
 
     void NitrokeyManager::change_user_PIN(char *current_PIN, char *new_PIN) {
+        Operation operation(*this, __func__);
         change_PIN_general<ChangeUserPin, PasswordKind::User>(current_PIN, new_PIN);
     }
 
     void NitrokeyManager::change_admin_PIN(char *current_PIN, char *new_PIN) {
+        Operation operation(*this, __func__);
         change_PIN_general<ChangeAdminPin, PasswordKind::Admin>(current_PIN, new_PIN);
     }
 
     template <typename ProCommand, PasswordKind StoKind>
     void NitrokeyManager::change_PIN_general(char *current_PIN, char *new_PIN) {
-        switch (device->get_device_model()){
-            case DeviceModel::PRO:
-            {
-                auto p = get_payload<ProCommand>();
-                strcpyT(p.old_pin, current_PIN);
-                strcpyT(p.new_pin, new_PIN);
-                ProCommand::CommandTransaction::run(*device, p);
-            }
-                break;
-            //in Storage change admin/user pin is divided to two commands with 20 chars field len
-            case DeviceModel::STORAGE:
-            {
-                auto p = get_payload<ChangeAdminUserPin20Current>();
-                strcpyT(p.old_pin, current_PIN);
-                p.set_kind(StoKind);
-                ChangeAdminUserPin20Current::CommandTransaction::run(*device, p);
-
-                auto p2 = get_payload<ChangeAdminUserPin20New>();
-                strcpyT(p2.new_pin, new_PIN);
-                p2.set_kind(StoKind);
-                ChangeAdminUserPin20New::CommandTransaction::run(*device, p2);
-            }
-                break;
+        drop_storage_status();
+        constexpr auto pro_command = ProCommand::CommandTransaction::metadata;
+        const auto model = device->get_device_model() == DeviceModel::PRO ? PRO_ONLY : STORAGE_ONLY;
+        if (pro_command.supports(model)) {
+            auto p = get_payload<ProCommand>();
+            strcpyT(p.old_pin, current_PIN);
+            strcpyT(p.new_pin, new_PIN);
+            ProCommand::CommandTransaction::run(*device, p);
+            return;
         }
+        //in Storage change admin/user pin is divided to two commands with 20 chars field len
+        static_assert(ChangeAdminUserPin20Current::CommandTransaction::metadata.supports(STORAGE_ONLY) &&
+                      ChangeAdminUserPin20New::CommandTransaction::metadata.supports(STORAGE_ONLY),
+                      "Storage PIN change commands");
+        auto p = get_payload<ChangeAdminUserPin20Current>();
+        strcpyT(p.old_pin, current_PIN);
+        p.set_kind(StoKind);
+        ChangeAdminUserPin20Current::CommandTransaction::run(*device, p);
 
+        auto p2 = get_payload<ChangeAdminUserPin20New>();
+        strcpyT(p2.new_pin, new_PIN);
+        p2.set_kind(StoKind);
+        ChangeAdminUserPin20New::CommandTransaction::run(*device, p2);
     }
 
     void NitrokeyManager::enable_password_safe(const char *user_pin) {
+        Operation operation(*this, __func__);
+        drop_storage_status();
         //The following command will cancel enabling PWS if it is not supported
         auto a = get_payload<IsAESSupported>();
         strcpyT(a.user_password, user_pin);
@@ -304,6 +604,7 @@ namespace nitrokey{
     }
 
     vector <uint8_t> NitrokeyManager::get_password_safe_slot_status() {
+        Operation operation(*this, __func__);
         auto responsePayload = GetPasswordSafeSlotStatus::CommandTransaction::run(*device);
         vector<uint8_t> v = vector<uint8_t>(responsePayload.data().password_safe_status,
                                             responsePayload.data().password_safe_status
@@ -311,20 +612,31 @@ namespace nitrokey{
         return v;
     }
 
+    void NitrokeyManager::get_password_safe_slot_status(uint8_t *buffer, size_t buffer_size) {
+        Operation operation(*this, __func__);
+        auto response = GetPasswordSafeSlotStatus::CommandTransaction::run(*device);
+        copy_array_to_buffer(response.data().password_safe_status, buffer, buffer_size);
+    }
+
     uint8_t NitrokeyManager::get_user_retry_count() {
+        Operation operation(*this, __func__);
         auto response = GetUserPasswordRetryCount::CommandTransaction::run(*device);
         return response.data().password_retry_count;
     }
     uint8_t NitrokeyManager::get_admin_retry_count() {
+        Operation operation(*this, __func__);
         auto response = GetPasswordRetryCount::CommandTransaction::run(*device);
         return response.data().password_retry_count;
     }
 
     void NitrokeyManager::lock_device() {
+        Operation operation(*this, __func__);
+        drop_storage_status();
         LockDevice::CommandTransaction::run(*device);
     }
 
     const char *NitrokeyManager::get_password_safe_slot_name(uint8_t slot_number) {
+        Operation operation(*this, __func__);
         if (!is_valid_password_safe_slot_number(slot_number)) throw InvalidSlotException(slot_number);
         auto p = get_payload<GetPasswordSafeSlotName>();
         p.slot_number = slot_number;
@@ -335,6 +647,7 @@ namespace nitrokey{
     bool NitrokeyManager::is_valid_password_safe_slot_number(uint8_t slot_number) const { return slot_number < 16; }
 
     const char *NitrokeyManager::get_password_safe_slot_login(uint8_t slot_number) {
+        Operation operation(*this, __func__);
         if (!is_valid_password_safe_slot_number(slot_number)) throw InvalidSlotException(slot_number);
         auto p = get_payload<GetPasswordSafeSlotLogin>();
         p.slot_number = slot_number;
@@ -343,6 +656,7 @@ namespace nitrokey{
     }
 
     const char *NitrokeyManager::get_password_safe_slot_password(uint8_t slot_number) {
+        Operation operation(*this, __func__);
         if (!is_valid_password_safe_slot_number(slot_number)) throw InvalidSlotException(slot_number);
         auto p = get_payload<GetPasswordSafeSlotPassword>();
         p.slot_number = slot_number;
@@ -350,8 +664,48 @@ namespace nitrokey{
         return strdup((const char *) response.data().slot_password);
     }
 
+    void NitrokeyManager::get_password_safe_slot_name(uint8_t slot_number, char *buffer, size_t buffer_size) {
+        Operation operation(*this, __func__);
+        if (!is_valid_password_safe_slot_number(slot_number)) throw InvalidSlotException(slot_number);
+        auto p = get_payload<GetPasswordSafeSlotName>();
+        p.slot_number = slot_number;
+        auto response = GetPasswordSafeSlotName::CommandTransaction::run(*device, p);
+        copy_field_to_buffer(response.data().slot_name, buffer, buffer_size);
+    }
+
+    TransactionStatus NitrokeyManager::try_get_password_safe_slot_name(uint8_t slot_number, char *buffer,
+                                                                       size_t buffer_size) {
+        Operation operation(*this, __func__);
+        if (!is_valid_password_safe_slot_number(slot_number)) throw InvalidSlotException(slot_number);
+        auto p = get_payload<GetPasswordSafeSlotName>();
+        p.slot_number = slot_number;
+        GetPasswordSafeSlotName::ResponsePayload response{};
+        const auto status = GetPasswordSafeSlotName::CommandTransaction::try_run(*device, p, response);
+        if (status) copy_field_to_buffer(response.slot_name, buffer, buffer_size);
+        return status;
+    }
+
+    void NitrokeyManager::get_password_safe_slot_login(uint8_t slot_number, char *buffer, size_t buffer_size) {
+        Operation operation(*this, __func__);
+        if (!is_valid_password_safe_slot_number(slot_number)) throw InvalidSlotException(slot_number);
+        auto p = get_payload<GetPasswordSafeSlotLogin>();
+        p.slot_number = slot_number;
+        auto response = GetPasswordSafeSlotLogin::CommandTransaction::run(*device, p);
+        copy_field_to_buffer(response.data().slot_login, buffer, buffer_size);
+    }
+
+    void NitrokeyManager::get_password_safe_slot_password(uint8_t slot_number, char *buffer, size_t buffer_size) {
+        Operation operation(*this, __func__);
+        if (!is_valid_password_safe_slot_number(slot_number)) throw InvalidSlotException(slot_number);
+        auto p = get_payload<GetPasswordSafeSlotPassword>();
+        p.slot_number = slot_number;
+        auto response = GetPasswordSafeSlotPassword::CommandTransaction::run(*device, p);
+        copy_field_to_buffer(response.data().slot_password, buffer, buffer_size);
+    }
+
     void NitrokeyManager::write_password_safe_slot(uint8_t slot_number, const char *slot_name, const char *slot_login,
                                                        const char *slot_password) {
+        Operation operation(*this, __func__);
         if (!is_valid_password_safe_slot_number(slot_number)) throw InvalidSlotException(slot_number);
         auto p = get_payload<SetPasswordSafeSlotData>();
         p.slot_number = slot_number;
@@ -366,6 +720,7 @@ namespace nitrokey{
     }
 
     void NitrokeyManager::erase_password_safe_slot(uint8_t slot_number) {
+        Operation operation(*this, __func__);
         if (!is_valid_password_safe_slot_number(slot_number)) throw InvalidSlotException(slot_number);
         auto p = get_payload<ErasePasswordSafeSlot>();
         p.slot_number = slot_number;
@@ -373,34 +728,109 @@ namespace nitrokey{
     }
 
     void NitrokeyManager::user_authenticate(const char *user_password, const char *temporary_password) {
+        Operation operation(*this, __func__);
         auto p = get_payload<UserAuthenticate>();
         strcpyT(p.card_password, user_password);
         strcpyT(p.temporary_password, temporary_password);
+        drop_storage_status();
         UserAuthenticate::CommandTransaction::run(*device, p);
     }
 
     void NitrokeyManager::build_aes_key(const char *admin_password) {
+        Operation operation(*this, __func__);
         auto p = get_payload<BuildAESKey>();
         strcpyT(p.admin_password, admin_password);
+        drop_storage_status();
         BuildAESKey::CommandTransaction::run(*device, p);
     }
 
+    bool NitrokeyManager::fill_SD_card_with_random_data(const char *admin_pin) {
+        Operation operation(*this, __func__);
+        auto p = get_payload<FillSDCardWithRandomChars>();
+        set_storage_password(p.password, PasswordKind::Admin, admin_pin);
+        drop_storage_status();
+        return start_long_operation<FillSDCardWithRandomChars>(*device, p);
+    }
+
+    bool NitrokeyManager::create_new_keys(const char *admin_pin) {
+        Operation operation(*this, __func__);
+        auto p = get_payload<CreateNewKeys>();
+        set_storage_password(p.password, PasswordKind::Admin, admin_pin);
+        drop_storage_status();
+        return start_long_operation<CreateNewKeys>(*device, p);
+    }
+
+    bool NitrokeyManager::unlock_encrypted_volume(const char *user_pin) {
+        Operation operation(*this, __func__);
+        auto p = get_payload<EnableEncryptedPartition>();
+        set_storage_password(p.password, PasswordKind::User, user_pin);
+        drop_storage_status();
+        return start_long_operation<EnableEncryptedPartition>(*device, p);
+    }
+
+    bool NitrokeyManager::export_firmware(const char *admin_pin) {
+        Operation operation(*this, __func__);
+        auto p = get_payload<ExportFirmware>();
+        set_storage_password(p.password, PasswordKind::Admin, admin_pin);
+        drop_storage_status();
+        return start_long_operation<ExportFirmware>(*device, p);
+    }
+
+    int NitrokeyManager::get_progress_bar_value() {
+        Operation operation(*this, __func__);
+        GetDeviceStatus::ResponsePayload response{};
+        const auto status = GetDeviceStatus::CommandTransaction::try_run(*device, EmptyPayload(), response);
+        if (status.outcome == TransactionStatus::Outcome::LONG_OPERATION_IN_PROGRESS) return status.progress;
+        status.raise();
+        return -1;
+    }
+
+    StorageStatus NitrokeyManager::get_storage_status() {
+        Operation operation(*this, __func__);
+        if (storage_status_device.lock() == device &&
+            device->get_clock().now() - storage_status_time < storage_status_ttl) {
+            NK_PROBE1(cache__hit, (int)probes::ProbeCache::STORAGE_STATUS);
+            return storage_status;
+        }
+        NK_PROBE1(cache__miss, (int)probes::ProbeCache::STORAGE_STATUS);
+        auto response = GetDeviceStatus::CommandTransaction::run(*device);
+        storage_status = StorageStatus::decode(response.data());
+        storage_status_device = device;
+        storage_status_time = device->get_clock().now();
+        return storage_status;
+    }
+
+    constexpr std::chrono::milliseconds NitrokeyManager::DEFAULT_STORAGE_STATUS_TTL;
+
+    void NitrokeyManager::set_storage_status_ttl(std::chrono::milliseconds ttl) {
+        storage_status_ttl = ttl;
+    }
+
+    void NitrokeyManager::drop_storage_status() {
+        storage_status_device.reset();
+    }
+
     void NitrokeyManager::factory_reset(const char *admin_password) {
+        Operation operation(*this, __func__);
         auto p = get_payload<FactoryReset>();
         strcpyT(p.admin_password, admin_password);
+        drop_storage_status();
         FactoryReset::CommandTransaction::run(*device, p);
     }
 
     void NitrokeyManager::unlock_user_password(const char *admin_password, const char *new_user_password) {
+        Operation operation(*this, __func__);
         auto p = get_payload<UnlockUserPassword>();
         strcpyT(p.admin_password, admin_password);
         strcpyT(p.user_new_password, new_user_password);
+        drop_storage_status();
         UnlockUserPassword::CommandTransaction::run(*device, p);
     }
 
 
     void NitrokeyManager::write_config(uint8_t numlock, uint8_t capslock, uint8_t scrolllock, bool enable_user_password,
                                        bool delete_user_password, const char *admin_temporary_password) {
+        Operation operation(*this, __func__);
         auto p = get_payload<WriteGeneralConfig>();
         p.numlock = (uint8_t) numlock;
         p.capslock = (uint8_t) capslock;
@@ -408,23 +838,142 @@ namespace nitrokey{
         p.enable_user_password = (uint8_t) enable_user_password;
         p.delete_user_password = (uint8_t) delete_user_password;
 
-        authorize_packet<WriteGeneralConfig, Authorize>(p, admin_temporary_password, device);
+        authorize_packet<WriteGeneralConfig>(p, admin_temporary_password, device);
 
         WriteGeneralConfig::CommandTransaction::run(*device, p);
     }
 
     vector<uint8_t> NitrokeyManager::read_config() {
+        Operation operation(*this, __func__);
         auto responsePayload = GetStatus::CommandTransaction::run(*device);
         vector<uint8_t> v = vector<uint8_t>(responsePayload.data().general_config,
                                             responsePayload.data().general_config+sizeof(responsePayload.data().general_config));
         return v;
     }
 
+    void NitrokeyManager::read_config(uint8_t *buffer, size_t buffer_size) {
+        Operation operation(*this, __func__);
+        auto responsePayload = GetStatus::CommandTransaction::run(*device);
+        copy_array_to_buffer(responsePayload.data().general_config, buffer, buffer_size);
+    }
+
     bool NitrokeyManager::is_AES_supported(const char *user_password) {
+        Operation operation(*this, __func__);
         auto a = get_payload<IsAESSupported>();
         strcpyT(a.user_password, user_password);
+        drop_storage_status();
         IsAESSupported::CommandTransaction::run(*device, a);
         return true;
     }
 
+    void NitrokeyManager::set_timeout(std::chrono::milliseconds timeout) {
+        timeout_ms = timeout.count();
+    }
+
+    void NitrokeyManager::set_deadline(Clock::time_point deadline) {
+        this->deadline = deadline;
+    }
+
+    void NitrokeyManager::cancel() {
+        std::lock_guard<std::mutex> lock(cancel_mutex);
+        if (cancel_target != nullptr) *cancel_target = true;
+    }
+
+    void NitrokeyManager::set_keep_alive(std::chrono::milliseconds idle_threshold) {
+        keep_alive_threshold = idle_threshold;
+        restart_keep_alive(device != nullptr);
+    }
+
+    void NitrokeyManager::restart_keep_alive(bool connected) {
+        if (keep_alive != nullptr) {
+            keep_alive->stop();
+            auto stats = keep_alive->get_stats();
+            keep_alive_stats.sent += stats.sent;
+            keep_alive_stats.failed += stats.failed;
+            keep_alive_stats.saved += stats.saved;
+            keep_alive = nullptr;
+        }
+        if (keep_alive_threshold.count() == 0 || !connected) return;
+        keep_alive = KeepAlive::create(device, keep_alive_threshold);
+        keep_alive->start();
+    }
+
+    KeepAlive::Stats NitrokeyManager::get_keep_alive_stats() {
+        auto stats = keep_alive_stats;
+        if (keep_alive != nullptr) {
+            auto current = keep_alive->get_stats();
+            stats.sent += current.sent;
+            stats.failed += current.failed;
+            stats.saved += current.saved;
+        }
+        return stats;
+    }
+
+    bool NitrokeyManager::is_connected() const {
+        return device != nullptr;
+    }
+
+    DeviceModel NitrokeyManager::get_connected_device_model() const {
+        if (device == nullptr) throw std::runtime_error("No device connected");
+        return device->get_device_model();
+    }
+
+    /*
+     * Generic Transaction::run(): send, then poll with the retry policy of the command until the device answers it.
+     * When the policy runs out the last response is given, the caller tells it is not an answer by its CRC.
+     */
+    void NitrokeyManager::forward_packet(const uint8_t *packet, uint8_t *response) {
+        Operation operation(*this, __func__);
+        if (device == nullptr) throw std::runtime_error("No device connected");
+        // the command is not known here
+        drop_storage_status();
+
+        struct Exchange {
+            Device &device;
+            explicit Exchange(Device &device) : device(device) { device.begin_exchange(); }
+            ~Exchange() { device.end_exchange(); }
+        } exchange(*device);
+        const auto raise = [&](TransactionStatus::Outcome outcome, int device_result) {
+            TransactionStatus{outcome, packet[1], 0, device_result, 0}.raise();
+        };
+
+        // offsets as in HIDReport
+        const auto id = static_cast<CommandID>(packet[1]);
+        uint32_t crc;
+        memcpy(&crc, packet + HID_REPORT_SIZE - 4, sizeof crc);
+        const auto metadata = command_metadata(id);
+
+        ReceiveState receive;
+        receive.reset();
+        raise(operation_limits_outcome(*device), 0);
+        int status = device->send(packet);
+        device->get_flight_recorder().record(FlightRecorder::Direction::OUTGOING, packet, status,
+                                             metadata.carries_secrets);
+        NK_PROBE2(device__send, (int)id, status);
+        if (status <= 0) raise(TransactionStatus::Outcome::SEND_FAILED, status);
+
+        // a busy Storage is reported by the transaction of the client
+        receive.start(*device, id, metadata.latency);
+        receive.run(*device, id, metadata.carries_secrets, crc, response);
+        raise(receive.interrupted, 0);
+        if (receive.status != HID_REPORT_SIZE) raise(TransactionStatus::Outcome::RECEIVE_FAILED, receive.status);
+    }
+
+    constexpr std::chrono::milliseconds NitrokeyManager::DEFAULT_LEASE_TIMEOUT;
+
+    void NitrokeyManager::set_device_lease_timeout(std::chrono::milliseconds timeout) {
+        lease_timeout_ms = timeout.count();
+    }
+
+    DeviceLease::Stats NitrokeyManager::get_device_lease_stats() {
+        if (device == nullptr) return DeviceLease::Stats{0, 0, 0, std::chrono::microseconds(0),
+                                                         std::chrono::microseconds(0)};
+        return device->get_lease().get_stats();
+    }
+
+    string NitrokeyManager::get_flight_recorder_dump() {
+        if (device == nullptr) return "";
+        return device->get_flight_recorder().dump();
+    }
+
 }
@@ -0,0 +1,119 @@
+/*
+ *	Cost of expected failures: probes OTP and password safe slots of an
+ *	emulated device, most of them not programmed, through the throwing
+ *	calls (the failure caught as CommandFailedException) and through the
+ *	try_* calls returning a TransactionStatus. Device waits use a
+ *	VirtualClock, so the time is the one spent in the library.
+ *	Logging is off; with the default level the throwing calls also dump
+ *	the flight recorder on each failure.
+ *
+ *	Usage: bench_errors [probes per case]
+ */
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include "NitrokeyManager.h"
+#include "device_emulator.h"
+
+using namespace nitrokey;
+using namespace nitrokey::device;
+using namespace std::chrono;
+
+typedef std::function<bool(NitrokeyManager &, uint8_t)> Probe;
+
+static void run_case(const char *operation, const char *path, uint8_t slots,
+                     size_t probes, Probe probe) {
+  auto clock = std::make_shared<VirtualClock>();
+  auto emulator = std::make_shared<DeviceEmulator>();
+  emulator->set_clock(clock);
+  auto manager = NitrokeyManager::create();
+  manager->connect_device(emulator);
+
+  // one slot of each kind programmed, the rest fail
+  manager->first_authenticate("12345678", "123123123");
+  manager->write_HOTP_slot(0, "bench", "00112233", 0, false, false, false, "",
+                           "123123123");
+  manager->write_TOTP_slot(0, "bench", "00112233", 30, false, false, false,
+                           "", "123123123");
+  manager->enable_password_safe("123456");
+  manager->write_password_safe_slot(0, "bench", "login", "password");
+
+  size_t failures = 0;
+  const auto begin = steady_clock::now();
+  for (size_t i = 0; i < probes; i++)
+    if (!probe(*manager, (uint8_t)(i % slots))) failures++;
+  const auto cpu = steady_clock::now() - begin;
+
+  const double cpu_ns = duration<double, std::nano>(cpu).count();
+  printf("%-16s %-10s %8zu %8zu %12.0f %12.0f\n", operation, path, probes,
+         failures, cpu_ns / probes, probes / (cpu_ns / 1e9));
+}
+
+int main(int argc, char *argv[]) {
+  const size_t probes = argc > 1 ? strtoul(argv[1], nullptr, 10) : 100000;
+  Log::instance().set_handler(nullptr);
+
+  char name[32];
+  uint32_t code;
+  printf("%-16s %-10s %8s %8s %12s %12s\n", "operation", "path", "probes",
+         "failed", "ns/probe", "probes/s");
+
+  run_case("hotp slot name", "throwing", 3, probes,
+           [&](NitrokeyManager &m, uint8_t slot) {
+             try {
+               m.get_hotp_slot_name(slot, name, sizeof name);
+               return true;
+             } catch (CommandFailedException &) {
+               return false;
+             }
+           });
+  run_case("hotp slot name", "status", 3, probes,
+           [&](NitrokeyManager &m, uint8_t slot) {
+             return (bool)m.try_get_hotp_slot_name(slot, name, sizeof name);
+           });
+
+  run_case("totp slot name", "throwing", 15, probes,
+           [&](NitrokeyManager &m, uint8_t slot) {
+             try {
+               m.get_totp_slot_name(slot, name, sizeof name);
+               return true;
+             } catch (CommandFailedException &) {
+               return false;
+             }
+           });
+  run_case("totp slot name", "status", 15, probes,
+           [&](NitrokeyManager &m, uint8_t slot) {
+             return (bool)m.try_get_totp_slot_name(slot, name, sizeof name);
+           });
+
+  run_case("hotp code", "throwing", 3, probes,
+           [&](NitrokeyManager &m, uint8_t slot) {
+             try {
+               code = m.get_HOTP_code(slot, "");
+               return true;
+             } catch (CommandFailedException &) {
+               return false;
+             }
+           });
+  run_case("hotp code", "status", 3, probes,
+           [&](NitrokeyManager &m, uint8_t slot) {
+             return (bool)m.try_get_HOTP_code(slot, "", code);
+           });
+
+  run_case("pws slot name", "throwing", 16, probes,
+           [&](NitrokeyManager &m, uint8_t slot) {
+             try {
+               m.get_password_safe_slot_name(slot, name, sizeof name);
+               return true;
+             } catch (CommandFailedException &) {
+               return false;
+             }
+           });
+  run_case("pws slot name", "status", 16, probes,
+           [&](NitrokeyManager &m, uint8_t slot) {
+             return (bool)m.try_get_password_safe_slot_name(slot, name,
+                                                            sizeof name);
+           });
+  return 0;
+}
@@ -0,0 +1,172 @@
+/*
+ *	Cost of the recovery paths of transactions: runs Transaction::run and
+ *	NitrokeyManager calls against DeviceEmulator through
+ *	FaultInjectingDevice, for each fault profile. Device waits use a
+ *	VirtualClock, so "latency" is what the calls would take with a real
+ *	device's delays, while "cpu" is the real time spent in the library.
+ *
+ *	Calls giving a result other than the one set up are counted as wrong,
+ *	and make the program exit with 1.
+ *
+ *	Usage: bench_faults [calls per profile]
+ */
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <stdexcept>
+#include "NitrokeyManager.h"
+#include "device_emulator.h"
+#include "fault_injecting_device.h"
+
+using namespace nitrokey;
+using namespace nitrokey::device;
+using namespace std::chrono;
+
+typedef FaultInjectingDevice::Fault Fault;
+typedef FaultInjectingDevice::Profile Profile;
+
+struct FaultProfile {
+  const char *name;
+  std::function<void(FaultInjectingDevice &)> apply;
+};
+
+/*
+ *	Emulator with the waits of Stick10.
+ */
+class Stick10Emulator : public DeviceEmulator {
+ public:
+  Stick10Emulator() {
+    m_send_receive_delay = 100ms;
+    set_processing_time(50ms);
+  }
+};
+
+struct NamedPolicy {
+  const char *name;
+  RetryPolicy policy;
+};
+
+/*
+ *	A call of the benchmark, false if its result is not the one set up:
+ *	a fault let through as a response. Exceptions are counted as failures.
+ */
+typedef std::function<bool(NitrokeyManager &, Device &)> Call;
+
+static const char *PWS_LOGIN = "login of the full field length..";
+
+static bool wrong_results = false;
+
+static void run_profile(const char *operation, const NamedPolicy &policy,
+                        const FaultProfile &profile, size_t calls, Call call) {
+  auto clock = std::make_shared<VirtualClock>();
+  auto emulator = std::make_shared<Stick10Emulator>();
+  emulator->set_clock(clock);
+  emulator->set_retry_policy(policy.policy);
+  auto device = std::make_shared<FaultInjectingDevice>(emulator, 42);
+  device->set_clock(clock);
+  auto manager = NitrokeyManager::create();
+  manager->connect_device(device);
+
+  // OTP slot for code reads, written before the faults are on
+  manager->first_authenticate("12345678", "123123123");
+  manager->write_HOTP_slot(1, "bench", "00112233", 0, false, false, false, "",
+                           "123123123");
+  manager->enable_password_safe("123456");
+  manager->write_password_safe_slot(0, "bench", PWS_LOGIN, "password");
+  profile.apply(*device);
+
+  size_t failures = 0;
+  size_t wrong = 0;
+  const auto virtual_begin = clock->elapsed();
+  const auto begin = steady_clock::now();
+  for (size_t i = 0; i < calls; i++) {
+    try {
+      if (!call(*manager, *device)) wrong++;
+    } catch (std::exception &) {
+      failures++;
+    }
+  }
+  const auto cpu = steady_clock::now() - begin;
+  const auto latency = clock->elapsed() - virtual_begin;
+
+  size_t injected = 0;
+  for (size_t i = 0; i < FaultInjectingDevice::FAULT_COUNT; i++)
+    injected += device->get_injected_count((Fault)i);
+
+  const double latency_ms = duration<double, std::milli>(latency).count();
+  const double cpu_us = duration<double, std::micro>(cpu).count();
+  printf("%-12s %-14s %-18s %8zu %8zu %8zu %8zu %12.1f %12.1f %10.2f\n",
+         operation, policy.name, profile.name, calls, failures, wrong, injected,
+         latency_ms / calls, cpu_us / calls, calls / (latency_ms / 1000));
+  if (wrong > 0) wrong_results = true;
+}
+
+int main(int argc, char *argv[]) {
+  const size_t calls = argc > 1 ? strtoul(argv[1], nullptr, 10) : 1000;
+  // failures are counted, not reported
+  Log::instance().set_handler(nullptr);
+
+  const FaultProfile profiles[] = {
+      {"none", [](FaultInjectingDevice &) {}},
+      {"busy 10%",
+       [](FaultInjectingDevice &d) { d.set_fault(Fault::BUSY, {0.1, 0, 1}); }},
+      {"busy burst 5 /20",
+       [](FaultInjectingDevice &d) { d.set_fault(Fault::BUSY, {0, 20, 5}); }},
+      {"stale crc 10%",
+       [](FaultInjectingDevice &d) {
+         d.set_fault(Fault::STALE_CRC, {0.1, 0, 1});
+       }},
+      {"recv failure 10%",
+       [](FaultInjectingDevice &d) {
+         d.set_fault(Fault::RECV_FAILURE, {0.1, 0, 1});
+       }},
+      {"short read 1%",
+       [](FaultInjectingDevice &d) {
+         d.set_fault(Fault::SHORT_READ, {0.01, 0, 1});
+       }},
+      {"mixed",
+       [](FaultInjectingDevice &d) {
+         d.set_fault(Fault::BUSY, {0.05, 0, 2});
+         d.set_fault(Fault::STALE_CRC, {0.02, 0, 1});
+         d.set_fault(Fault::RECV_FAILURE, {0.02, 0, 1});
+       }},
+  };
+
+  const NamedPolicy policies[] = {
+      {"fixed 100ms", RetryPolicy::fixed(100, 100ms)},
+      {"Stick10", Stick10().get_retry_policy()},
+  };
+
+  printf("%-12s %-14s %-18s %8s %8s %8s %8s %12s %12s %10s\n", "operation",
+         "retry policy", "faults", "calls", "failed", "wrong", "injected", "latency ms",
+         "cpu us", "calls/s");
+  for (const auto &profile : profiles) {
+    for (const auto &policy : policies) {
+      run_profile("transaction", policy, profile, calls,
+                  [](NitrokeyManager &, Device &d) {
+                    auto response = proto::stick10::GetStatus::CommandTransaction::run(d);
+                    return response.data().get_card_serial_hex() == "00 00 4e 4b \n";
+                  });
+      // the emulator's code is the slot counter, counting every code read
+      int64_t last_code = -1;
+      run_profile("get_HOTP", policy, profile, calls,
+                  [&last_code](NitrokeyManager &m, Device &) {
+                    const int64_t code = m.get_HOTP_code(1, "");
+                    const bool counted = code > last_code;
+                    last_code = code;
+                    return counted;
+                  });
+      // the login fills the payload, a short read cuts it
+      run_profile("get_PWS", policy, profile, calls,
+                  [](NitrokeyManager &m, Device &) {
+                    char login[64];
+                    m.get_password_safe_slot_login(0, login, sizeof login);
+                    return strcmp(login, PWS_LOGIN) == 0;
+                  });
+    }
+  }
+  // results let through corrupted fail the run
+  return wrong_results ? 1 : 0;
+}
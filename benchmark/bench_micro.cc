@@ -0,0 +1,273 @@
+/*
+ *	Microbenchmarks of the CPU hot paths of the library: CRC, hex
+ *	conversions, packet building and checking, authorization of a packet,
+ *	dissection and ClearingProxy. Each case is timed until it ran for the
+ *	given time, five times; the median is reported as ns/op, with the heap
+ *	allocations per op (operator new, any thread) and the throughput.
+ *	Device exchanges use the emulator in virtual time, so no waits are
+ *	counted.
+ *
+ *	Results can be written as tab separated values and compared with the
+ *	ones of another commit:
+ *
+ *	  bench_micro --out before.tsv
+ *	  ... (rebuild)
+ *	  bench_micro --compare before.tsv
+ *
+ *	Usage: bench_micro [--time ms] [--filter text] [--out file]
+ *	                   [--compare file]
+ */
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <new>
+#include <string>
+#include <utility>
+#include <vector>
+#include "NitrokeyManager.h"
+#include "device_emulator.h"
+#include "dissect.h"
+#include "misc.h"
+
+using namespace nitrokey;
+using namespace nitrokey::device;
+using namespace nitrokey::proto;
+using namespace std::chrono;
+
+static std::atomic<size_t> allocations(0);
+
+void *operator new(size_t size) {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  void *p = malloc(size ? size : 1);
+  if (p == nullptr) throw std::bad_alloc();
+  return p;
+}
+
+void operator delete(void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+
+// keeps the compiler from dropping the computation of a result
+template <typename T>
+static void keep(const T &value) {
+  asm volatile("" : : "r"(&value) : "memory");
+}
+
+struct Result {
+  std::string name;
+  double ns_per_op;
+  double allocations_per_op;
+  double ops_per_s;
+  double bytes_per_s;  // 0 - not a byte throughput
+};
+
+static milliseconds target_time(200);
+static const char *filter = nullptr;
+static std::vector<Result> results;
+
+template <typename F>
+static double time_ops(F &op, size_t iterations, size_t &allocated) {
+  const size_t allocations_before = allocations.load();
+  const auto begin = steady_clock::now();
+  for (size_t i = 0; i < iterations; i++) op();
+  const auto elapsed = steady_clock::now() - begin;
+  allocated = allocations.load() - allocations_before;
+  return duration<double, std::nano>(elapsed).count();
+}
+
+/*
+ *	Runs op for about target_time, five times; bytes is the data
+ *	processed by one op.
+ */
+template <typename F>
+static void run_case(const char *name, size_t bytes, F op) {
+  if (filter != nullptr && strstr(name, filter) == nullptr) return;
+
+  // iterations for a tenth of the time, found by doubling
+  size_t iterations = 1, allocated;
+  const double calibration_ns = duration<double, std::nano>(target_time).count() / 10;
+  for (;;) {
+    const double ns = time_ops(op, iterations, allocated);
+    if (ns >= calibration_ns || iterations >= ((size_t)1 << 40)) break;
+    iterations *= 2;
+  }
+  iterations *= 10;
+
+  std::vector<double> ns_per_op;
+  size_t total_allocated = 0;
+  for (int run = 0; run < 5; run++) {
+    ns_per_op.push_back(time_ops(op, iterations, allocated) / iterations);
+    total_allocated += allocated;
+  }
+  std::sort(ns_per_op.begin(), ns_per_op.end());
+  const double median = ns_per_op[ns_per_op.size() / 2];
+
+  Result result{name, median, (double)total_allocated / (iterations * 5),
+                1e9 / median, bytes > 0 ? bytes * 1e9 / median : 0};
+  printf("%-44s %12.1f %10.2f %14.0f", name, result.ns_per_op,
+         result.allocations_per_op, result.ops_per_s);
+  if (bytes > 0) printf(" %10.1f", result.bytes_per_s / 1e6);
+  printf("\n");
+  results.push_back(result);
+}
+
+static bool write_results(const char *path) {
+  FILE *f = fopen(path, "w");
+  if (f == nullptr) return false;
+  fprintf(f, "name\tns_per_op\tallocations_per_op\tops_per_s\tbytes_per_s\n");
+  for (const auto &r : results)
+    fprintf(f, "%s\t%.3f\t%.3f\t%.1f\t%.1f\n", r.name.c_str(), r.ns_per_op,
+            r.allocations_per_op, r.ops_per_s, r.bytes_per_s);
+  return fclose(f) == 0;
+}
+
+static bool compare_results(const char *path) {
+  FILE *f = fopen(path, "r");
+  if (f == nullptr) return false;
+  std::map<std::string, std::pair<double, double>> baseline;  // ns, allocs
+  char line[512];
+  bool header = true;
+  while (fgets(line, sizeof line, f) != nullptr) {
+    if (header) {
+      header = false;
+      continue;
+    }
+    char *tab = strchr(line, '\t');
+    if (tab == nullptr) continue;
+    *tab = 0;
+    double ns, allocs;
+    if (sscanf(tab + 1, "%lf\t%lf", &ns, &allocs) == 2)
+      baseline[line] = std::make_pair(ns, allocs);
+  }
+  fclose(f);
+
+  printf("\n%-44s %12s %12s %8s %10s\n", "compared with", "ns/op before",
+         "ns/op now", "change", "allocs");
+  for (const auto &r : results) {
+    auto b = baseline.find(r.name);
+    if (b == baseline.end()) {
+      printf("%-44s %12s %12.1f %8s\n", r.name.c_str(), "-", r.ns_per_op, "new");
+      continue;
+    }
+    printf("%-44s %12.1f %12.1f %+7.1f%% %+10.2f\n", r.name.c_str(),
+           b->second.first, r.ns_per_op,
+           (r.ns_per_op / b->second.first - 1) * 100,
+           r.allocations_per_op - b->second.second);
+  }
+  return true;
+}
+
+/*
+ *	Manager of an emulated device in virtual time, with the admin
+ *	temporary password set for authorized commands.
+ */
+static shared_ptr<NitrokeyManager> make_emulated_manager() {
+  auto emulator = std::make_shared<DeviceEmulator>();
+  emulator->set_clock(std::make_shared<VirtualClock>());
+  auto manager = NitrokeyManager::create();
+  manager->connect_device(emulator);
+  manager->first_authenticate("12345678", "123123123");
+  return manager;
+}
+
+int main(int argc, char *argv[]) {
+  const char *out_path = nullptr;
+  const char *compare_path = nullptr;
+  for (int i = 1; i + 1 < argc; i += 2) {
+    if (strcmp(argv[i], "--time") == 0)
+      target_time = milliseconds(strtoul(argv[i + 1], nullptr, 10));
+    else if (strcmp(argv[i], "--filter") == 0)
+      filter = argv[i + 1];
+    else if (strcmp(argv[i], "--out") == 0)
+      out_path = argv[i + 1];
+    else if (strcmp(argv[i], "--compare") == 0)
+      compare_path = argv[i + 1];
+  }
+  Log::instance().set_handler(nullptr);
+  Log::instance().set_loglevel(Loglevel::ERROR);
+
+  printf("%-44s %12s %10s %14s %10s\n", "case", "ns/op", "allocs/op",
+         "ops/s", "MB/s");
+
+  uint8_t packet[HID_REPORT_SIZE];
+  for (size_t i = 0; i < sizeof packet; i++) packet[i] = (uint8_t)(i * 37);
+
+  run_case("misc::stm_crc32 (packet, 60 B)", HID_REPORT_SIZE - 5, [&] {
+    keep(misc::stm_crc32(packet + 1, HID_REPORT_SIZE - 5));
+  });
+
+  const char *secret = "3132333435363738393031323334353637383930";
+  run_case("misc::hex_string_to_byte (20 B secret)", strlen(secret), [&] {
+    auto bytes = misc::hex_string_to_byte(secret);
+    keep(bytes);
+  });
+
+  run_case("misc::hexdump (packet)", sizeof packet, [&] {
+    auto dump = misc::hexdump((const char *)packet, sizeof packet);
+    keep(dump);
+  });
+
+  typedef stick10::GetHOTP::CommandTransaction HOTPTransaction;
+  HOTPTransaction::CommandPayload hotp_payload;
+  memset(&hotp_payload, 0, sizeof hotp_payload);
+  hotp_payload.slot_number = 0x10;
+  run_case("HIDReport initialize + CRC", HID_REPORT_SIZE, [&] {
+    HOTPTransaction::OutgoingPacket outp;
+    outp.initialize();
+    outp.payload = hotp_payload;
+    outp.update_CRC();
+    keep(outp);
+  });
+
+  HOTPTransaction::ResponsePacket response;
+  memcpy(&response, packet, sizeof response);
+  response.update_CRC();
+  run_case("DeviceResponse CRC check", HID_REPORT_SIZE,
+           [&] { keep(response.isCRCcorrect()); });
+
+  run_case("ClearingProxy construction", HID_REPORT_SIZE, [&] {
+    HOTPTransaction::ResponsePacket copy = response;
+    ClearingProxy<HOTPTransaction::ResponsePacket, HOTPTransaction::ResponsePayload> proxy(
+        copy);
+    keep(proxy.data());
+  });
+
+  typedef stick10::ReadSlot::CommandTransaction SlotTransaction;
+  SlotTransaction::ResponsePacket slot;
+  memset(&slot, 0, sizeof slot);
+  memcpy(slot.payload.slot_name, "benchmark", 9);
+  slot.update_CRC();
+  char dissection[DISSECT_BUFFER_SIZE];
+  run_case("dissect ReadSlot response (buffer)", 0, [&] {
+    keep(ResponseDissector<CommandID::READ_SLOT, SlotTransaction::ResponsePacket>::
+             dissect(slot, dissection, sizeof dissection));
+  });
+  run_case("dissect ReadSlot response (string)", 0, [&] {
+    auto text =
+        ResponseDissector<CommandID::READ_SLOT, SlotTransaction::ResponsePacket>::
+            dissect(slot);
+    keep(text);
+  });
+
+  // authorize_packet is internal; the authorized call adds one exchange
+  // with the emulator to the plain one
+  auto manager = make_emulated_manager();
+  run_case("read_config (emulated exchange)", 0,
+           [&] { keep(manager->read_config()); });
+  run_case("write_config (authorize_packet + exchange)", 0, [&] {
+    manager->write_config(0xFF, 0xFF, 0xFF, false, false, "123123123");
+  });
+
+  if (out_path != nullptr && !write_results(out_path)) {
+    fprintf(stderr, "Cannot write %s\n", out_path);
+    return 1;
+  }
+  if (compare_path != nullptr && !compare_results(compare_path)) {
+    fprintf(stderr, "Cannot read %s\n", compare_path);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,88 @@
+/*
+ *	Response polling strategies against an emulated device answering after
+ *	a given time, as the quick commands (GET_STATUS, READ_SLOT_NAME,
+ *	GET_CODE) do. Each HID transfer takes 1 ms, as a full speed USB control
+ *	transfer does. Time is virtual, so the results do not depend on the
+ *	machine; "latency" is from the call to its result, "polls" counts the
+ *	feature report reads per call, the cost of polling for the device and
+ *	the host CPU.
+ *
+ *	Usage: bench_polling [calls per case]
+ */
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include "NitrokeyManager.h"
+#include "device_emulator.h"
+
+using namespace nitrokey;
+using namespace nitrokey::device;
+using namespace std::chrono;
+
+static const auto TRANSFER_TIME = 1ms;
+
+class UsbDeviceEmulator : public DeviceEmulator {
+ public:
+  UsbDeviceEmulator(std::shared_ptr<VirtualClock> clock) : m_polls(0) {
+    set_clock(clock);
+    m_send_receive_delay = 100ms;
+    m_virtual_clock = clock;
+  }
+
+  virtual int send(const void *packet) {
+    m_virtual_clock->advance(TRANSFER_TIME);
+    return DeviceEmulator::send(packet);
+  }
+
+  virtual int recv(void *packet) {
+    m_virtual_clock->advance(TRANSFER_TIME);
+    m_polls++;
+    return DeviceEmulator::recv(packet);
+  }
+
+  size_t get_polls() const { return m_polls; }
+
+ private:
+  std::shared_ptr<VirtualClock> m_virtual_clock;
+  size_t m_polls;
+};
+
+struct Strategy {
+  const char *name;
+  RetryPolicy policy;
+};
+
+int main(int argc, char *argv[]) {
+  const size_t calls = argc > 1 ? strtoul(argv[1], nullptr, 10) : 1000;
+  Log::instance().set_handler(nullptr);
+
+  const auto stick10 = Stick10().get_retry_policy();
+  const Strategy strategies[] = {
+      {"fixed 100ms", RetryPolicy::fixed(100, 100ms)},
+      {"backoff", stick10},
+      {"spin 20ms/500us", stick10.spinning(20ms, 500us)},
+      {"spin 20ms/100us", stick10.spinning(20ms, 100us)},
+  };
+  const milliseconds response_times[] = {1ms, 3ms, 10ms, 30ms, 100ms};
+
+  printf("%-18s %10s %12s %10s\n", "strategy", "response", "latency ms",
+         "polls");
+  for (const auto &strategy : strategies) {
+    for (const auto response_time : response_times) {
+      auto clock = std::make_shared<VirtualClock>();
+      auto device = std::make_shared<UsbDeviceEmulator>(clock);
+      device->set_processing_time(response_time);
+      device->set_retry_policy(strategy.policy);
+      auto manager = NitrokeyManager::create();
+      manager->connect_device(device);
+
+      for (size_t i = 0; i < calls; i++) manager->get_serial_number();
+
+      printf("%-18s %8lldms %12.2f %10.1f\n", strategy.name,
+             (long long)response_time.count(),
+             duration<double, std::milli>(clock->elapsed()).count() / calls,
+             (double)device->get_polls() / calls);
+    }
+  }
+  return 0;
+}
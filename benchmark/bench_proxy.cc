@@ -0,0 +1,84 @@
+/*
+ *	Throughput of a device used through ProxyServer and RemoteDevice over
+ *	loopback, against using it locally. The emulated device answers after
+ *	the given processing time, in real time. With several clients sharing
+ *	the connection, requests wait at the server while the device works,
+ *	so the round trip is hidden behind it.
+ *
+ *	Usage: bench_proxy [calls per client]
+ */
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+#include "NitrokeyManager.h"
+#include "device_emulator.h"
+#include "proxy_server.h"
+#include "remote_device.h"
+
+using namespace nitrokey;
+using namespace nitrokey::device;
+using namespace std::chrono;
+
+class TimedDeviceEmulator : public DeviceEmulator {
+ public:
+  TimedDeviceEmulator(milliseconds processing_time) {
+    m_send_receive_delay = 0ms;
+    m_retry_policy = RetryPolicy::fixed(1000000, 0ms).spinning(10s, 50us);
+    set_processing_time(processing_time);
+  }
+};
+
+static void report(const char *mode, milliseconds processing_time,
+                   size_t clients, size_t calls, steady_clock::duration time) {
+  const double seconds = duration<double>(time).count();
+  printf("%-8s %12lld %8zu %12.1f %12.1f\n", mode,
+         (long long)processing_time.count(), clients,
+         clients * calls / seconds,
+         duration<double, std::micro>(time).count() / calls);
+}
+
+int main(int argc, char *argv[]) {
+  const size_t calls = argc > 1 ? strtoul(argv[1], nullptr, 10) : 1000;
+  Log::instance().set_handler(nullptr);
+
+  const milliseconds processing_times[] = {0ms, 1ms, 5ms};
+  const size_t client_counts[] = {1, 2, 4, 8};
+
+  printf("%-8s %12s %8s %12s %12s\n", "mode", "device ms", "clients",
+         "calls/s", "latency us");
+  for (const auto processing_time : processing_times) {
+    auto local = NitrokeyManager::create();
+    local->connect_device(std::make_shared<TimedDeviceEmulator>(processing_time));
+
+    auto begin = steady_clock::now();
+    for (size_t i = 0; i < calls; i++) local->get_serial_number();
+    report("local", processing_time, 1, calls, steady_clock::now() - begin);
+
+    ProxyServer server(local);
+    if (!server.start("127.0.0.1", 0)) return 1;
+    auto connection = RemoteConnection::connect("127.0.0.1", server.get_port());
+    if (connection == nullptr) return 1;
+
+    for (const size_t clients : client_counts) {
+      std::vector<std::shared_ptr<NitrokeyManager>> remotes;
+      for (size_t c = 0; c < clients; c++) {
+        remotes.push_back(NitrokeyManager::create());
+        remotes.back()->connect_device(std::make_shared<RemoteDevice>(connection));
+      }
+      std::vector<std::thread> threads;
+      begin = steady_clock::now();
+      for (auto &remote : remotes) {
+        threads.emplace_back([&remote, calls] {
+          for (size_t i = 0; i < calls; i++) remote->get_serial_number();
+        });
+      }
+      for (auto &thread : threads) thread.join();
+      report("remote", processing_time, clients, calls,
+             steady_clock::now() - begin);
+    }
+  }
+  return 0;
+}
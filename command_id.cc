@@ -1,5 +1,6 @@
 #include <assert.h>
 #include "command_id.h"
+#include "command_metadata.h"
 
 namespace nitrokey {
 namespace proto {
@@ -142,5 +143,9 @@ const char *commandid_to_string(CommandID id) {
   }
   return "UNKNOWN";
 }
+
+bool command_carries_secrets(CommandID id) {
+  return command_metadata(id).carries_secrets;
+}
 }
 }
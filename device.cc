@@ -1,11 +1,13 @@
 #include <chrono>
 #include <thread>
 #include <cstddef>
+#include <mutex>
 #include <stdexcept>
 #include <hidapi/hidapi.h>
 #include "include/misc.h"
 #include "include/device.h"
 #include "include/log.h"
+#include "include/trace.h"
 
 using namespace nitrokey::device;
 using namespace nitrokey::log;
@@ -13,27 +15,65 @@ using namespace nitrokey::log;
 Device::Device()
     : m_vid(0),
       m_pid(0),
-      m_retry_count(40),
-      m_retry_timeout(100),
+      m_retry_policy(RetryPolicy::fixed(40, std::chrono::milliseconds(100))),
+      m_clock(std::make_shared<SystemClock>()),
+      m_operation_limits(OperationLimits::none()),
+      m_exchanges(0),
+      m_exchange_count(0),
       mp_devhandle(NULL),
       last_command_status(0){}
 
+/*
+ *	HIDAPI initializes itself on the first open, which is not thread
+ *	safe, hence done once here for all devices.
+ */
+static void init_hidapi() {
+  static std::once_flag initialized;
+  std::call_once(initialized, [] { hid_init(); });
+}
+
 bool Device::disconnect() {
   Log::instance()(__PRETTY_FUNCTION__, Loglevel::DEBUG_L2);
 
-  hid_exit();
+  // hid_exit() would close the devices of all other Device objects too
+  if (mp_devhandle != NULL) hid_close(mp_devhandle);
   mp_devhandle = NULL;
+  m_opened_path.clear();
   return true;
 }
 bool Device::connect() {
   Log::instance()(__PRETTY_FUNCTION__, Loglevel::DEBUG_L2);
 
-  // hid_init();
-  mp_devhandle = hid_open(m_vid, m_pid, NULL);
-  // hid_init();
+  // the first device of the model is opened by its path, as hid_open()
+  // does, so that it is known for the lease
+  std::string path = m_path;
+  if (path.empty()) path = first_path(m_vid, m_pid);
+  if (path.empty()) return false;
+  mp_devhandle = hid_open_path(path.c_str());
+  if (mp_devhandle != NULL) m_opened_path = path;
   return mp_devhandle != NULL;
 }
 
+static std::vector<std::string> enumerate_paths(uint16_t vid, uint16_t pid) {
+  init_hidapi();
+  std::vector<std::string> paths;
+  struct hid_device_info *devices = hid_enumerate(vid, pid);
+  for (auto d = devices; d != NULL; d = d->next)
+    if (d->path != NULL) paths.push_back(d->path);
+  hid_free_enumeration(devices);
+  return paths;
+}
+
+std::string Device::first_path(uint16_t vid, uint16_t pid) {
+  if (vid == 0) return std::string();
+  const auto paths = enumerate_paths(vid, pid);
+  return paths.empty() ? std::string() : paths.front();
+}
+
+std::vector<std::string> Device::enumerate() {
+  return enumerate_paths(m_vid, m_pid);
+}
+
 int Device::send(const void *packet) {
   Log::instance()(__PRETTY_FUNCTION__, Loglevel::DEBUG_L2);
 
@@ -45,40 +85,82 @@ int Device::send(const void *packet) {
 }
 
 int Device::recv(void *packet) {
-  int status;
-  int retry_count = 0;
-
   Log::instance()(__PRETTY_FUNCTION__, Loglevel::DEBUG_L2);
 
   if (mp_devhandle == NULL)
     throw std::runtime_error("Attempted HID receive on an invalid descriptor.");
 
-  // FIXME extract error handling and repeating to parent function in
-  // device_proto:192
-  for (;;) {
-    status = (hid_get_feature_report(mp_devhandle, (unsigned char *)(packet),
-                                     HID_REPORT_SIZE));
+  int status = (hid_get_feature_report(mp_devhandle, (unsigned char *)(packet),
+                                       HID_REPORT_SIZE));
 
-    // FIXME handle getting libhid error message somewhere else
+  // FIXME handle getting libhid error message somewhere else
+  if (status <= 0 && Log::instance().is_enabled(Loglevel::DEBUG_L2)) {
     auto pwherr = hid_error(mp_devhandle);
     std::wstring wherr = (pwherr != NULL) ? pwherr : L"No error message";
     std::string herr(wherr.begin(), wherr.end());
     Log::instance()(std::string("libhid error message: ") + herr,
                     Loglevel::DEBUG_L2);
+  }
+  return status;
+}
 
-    if (status > 0) break;  // success
-    if (retry_count++ >= m_retry_count) {
-      Log::instance()(
-          "Maximum retry count reached" + std::to_string(retry_count),
-          Loglevel::WARNING);
-      break;
-    }
-    Log::instance()("Retrying... " + std::to_string(retry_count),
-                    Loglevel::DEBUG);
-    std::this_thread::sleep_for(m_retry_timeout);
+std::string Device::get_lease_key() const {
+  if (!m_opened_path.empty()) return m_opened_path;
+  if (!m_path.empty()) return m_path;
+  return first_path(m_vid, m_pid);
+}
+
+void Device::begin_exchange() {
+  std::unique_lock<std::mutex> lock(m_activity_mutex);
+  // the keep-alive itself goes on
+  const auto self = std::this_thread::get_id();
+  m_keep_alive_ended.wait(lock, [&] {
+    return m_keep_alive_thread == std::thread::id() ||
+           m_keep_alive_thread == self;
+  });
+  m_exchanges++;
+}
+
+void Device::end_exchange() {
+  const auto now = m_clock->now();
+  std::lock_guard<std::mutex> lock(m_activity_mutex);
+  m_exchanges--;
+  m_last_activity = now;
+  if (m_keep_alive_thread != std::this_thread::get_id()) m_exchange_count++;
+}
+
+bool Device::begin_keep_alive(Clock::time_point::duration idle_threshold,
+                              Clock::time_point &last_activity) {
+  const auto now = m_clock->now();
+  std::lock_guard<std::mutex> lock(m_activity_mutex);
+  last_activity = m_exchanges > 0 ? now : m_last_activity;
+  if (m_exchanges > 0 || now - m_last_activity < idle_threshold) return false;
+  m_keep_alive_thread = std::this_thread::get_id();
+  return true;
+}
+
+void Device::end_keep_alive() {
+  {
+    std::lock_guard<std::mutex> lock(m_activity_mutex);
+    m_keep_alive_thread = std::thread::id();
   }
+  m_keep_alive_ended.notify_all();
+}
 
-  return status;
+uint64_t Device::get_exchange_count() {
+  std::lock_guard<std::mutex> lock(m_activity_mutex);
+  return m_exchange_count;
+}
+
+void Device::set_retry_policy(proto::CommandID command,
+                              const RetryPolicy &policy) {
+  for (auto &p : m_command_retry_policies) {
+    if (p.first == command) {
+      p.second = policy;
+      return;
+    }
+  }
+  m_command_retry_policies.emplace_back(command, policy);
 }
 
 Stick10::Stick10() {
@@ -86,13 +168,15 @@ Stick10::Stick10() {
   m_pid = 0x4108;
   m_model = DeviceModel::PRO;
     m_send_receive_delay = 100ms;
-  m_retry_count = 100;
+  // 10 s in total, as 100 polls 100 ms apart did
+  m_retry_policy = RetryPolicy::exponential(20ms, 200ms, 10s);
+  set_retry_policy(proto::Latency::QUICK, m_retry_policy.spinning(20ms, 500us));
 }
 
 Stick20::Stick20() {
   m_vid = 0x20a0;
   m_pid = 0x4109;
-  m_retry_timeout = std::chrono::milliseconds(500);
+  m_retry_policy = RetryPolicy::exponential(100ms, 1000ms, 20s);
   m_model = DeviceModel::STORAGE;
     m_send_receive_delay = 1000ms;
 }
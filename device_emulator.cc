@@ -0,0 +1,429 @@
+#include <cstring>
+#include <stdexcept>
+#include "include/device_emulator.h"
+#include "include/misc.h"
+#include "include/log.h"
+#include "include/stick10_commands.h"
+
+using namespace nitrokey::device;
+using namespace nitrokey::log;
+using namespace nitrokey::proto;
+using namespace nitrokey::proto::stick10;
+
+// FIXME use values from firmware, see also command_status_names in dissect.cc
+enum : uint8_t {
+  CMD_STATUS_OK = 0,
+  CMD_STATUS_WRONG_CRC = 1,
+  CMD_STATUS_WRONG_SLOT = 2,
+  CMD_STATUS_SLOT_NOT_PROGRAMMED = 3,
+  CMD_STATUS_WRONG_PASSWORD = 4,
+  CMD_STATUS_NOT_AUTHORIZED = 5,
+  CMD_STATUS_UNKNOWN_COMMAND = 9,
+};
+
+// offsets in the outgoing and incoming reports, see HIDReport and
+// DeviceResponse
+static const size_t request_payload_begin = 2;
+static const size_t response_payload_begin = 8;
+static const size_t crc_begin = HID_REPORT_SIZE - 4;
+
+static const uint8_t initial_retry_count = 3;
+
+template <typename T>
+static typename T::CommandPayload request_of(const uint8_t *payload) {
+  typename T::CommandPayload p;
+  memcpy(&p, payload, sizeof p);
+  return p;
+}
+
+template <typename T>
+static typename T::ResponsePayload empty_response() {
+  typename T::ResponsePayload p;
+  memset(&p, 0, sizeof p);
+  return p;
+}
+
+template <typename P>
+static void put_response(uint8_t *payload, const P &p) {
+  memcpy(payload, &p, sizeof p);
+}
+
+template <size_t N>
+static void copy_pin(uint8_t (&dest)[N], const uint8_t *src, size_t size) {
+  memset(dest, 0, N);
+  memcpy(dest, src, size < N ? size : N);
+}
+
+DeviceEmulator::DeviceEmulator() : m_connected(false), m_has_response(false) {
+  m_vid = 0;
+  m_pid = 0;
+  m_model = DeviceModel::PRO;
+  m_send_receive_delay = std::chrono::milliseconds(0);
+  m_retry_policy = RetryPolicy::fixed(40, std::chrono::milliseconds(0));
+  memset(m_response, 0, sizeof m_response);
+  m_command_count = 0;
+  m_processing_time = std::chrono::milliseconds(0);
+  factory_reset();
+}
+
+void DeviceEmulator::factory_reset() {
+  copy_pin(m_user_pin, (const uint8_t *)"123456", 6);
+  copy_pin(m_admin_pin, (const uint8_t *)"12345678", 8);
+  m_user_retry_count = initial_retry_count;
+  m_admin_retry_count = initial_retry_count;
+  memset(m_user_temporary_password, 0, sizeof m_user_temporary_password);
+  memset(m_admin_temporary_password, 0, sizeof m_admin_temporary_password);
+  m_authorized_crc = 0;
+  m_user_authorized_crc = 0;
+  // OTP on double press disabled, no PIN protection of OTP
+  memset(m_general_config, 0xFF, 3);
+  m_general_config[3] = m_general_config[4] = 0;
+  m_time = 0;
+  memset(m_hotp_slots, 0, sizeof m_hotp_slots);
+  memset(m_totp_slots, 0, sizeof m_totp_slots);
+  m_password_safe_enabled = false;
+  memset(m_password_safe_slots, 0, sizeof m_password_safe_slots);
+}
+
+bool DeviceEmulator::connect() {
+  Log::instance()(__PRETTY_FUNCTION__, Loglevel::DEBUG_L2);
+  m_connected = true;
+  return true;
+}
+
+bool DeviceEmulator::disconnect() {
+  Log::instance()(__PRETTY_FUNCTION__, Loglevel::DEBUG_L2);
+  m_connected = false;
+  return true;
+}
+
+int DeviceEmulator::send(const void *packet) {
+  Log::instance()(__PRETTY_FUNCTION__, Loglevel::DEBUG_L2);
+
+  if (!m_connected)
+    throw std::runtime_error("Attempted HID send on an invalid descriptor.");
+
+  const uint8_t *request = (const uint8_t *)packet;
+  uint32_t crc;
+  memcpy(&crc, request + crc_begin, sizeof crc);
+  m_command_count++;
+
+  memset(m_response, 0, sizeof m_response);
+  m_response[2] = request[1];
+  memcpy(m_response + 3, &crc, sizeof crc);
+  if (crc != misc::stm_crc32(request + 1, HID_REPORT_SIZE - 5))
+    m_response[7] = CMD_STATUS_WRONG_CRC;
+  else
+    m_response[7] = execute(request[1], crc, request + request_payload_begin,
+                            m_response + response_payload_begin);
+  const uint32_t response_crc =
+      misc::stm_crc32(m_response + 1, HID_REPORT_SIZE - 5);
+  memcpy(m_response + crc_begin, &response_crc, sizeof response_crc);
+  m_has_response = true;
+  m_ready_at = m_clock->now() + m_processing_time;
+  return HID_REPORT_SIZE;
+}
+
+int DeviceEmulator::recv(void *packet) {
+  Log::instance()(__PRETTY_FUNCTION__, Loglevel::DEBUG_L2);
+
+  if (!m_connected)
+    throw std::runtime_error("Attempted HID receive on an invalid descriptor.");
+  if (!m_has_response) return 0;
+
+  // as the device, answers with the last response until the next command
+  memcpy(packet, m_response, HID_REPORT_SIZE);
+  if (m_clock->now() < m_ready_at) {
+    uint8_t *busy = (uint8_t *)packet;
+    busy[1] = 1;  // device_status
+    const uint32_t crc = misc::stm_crc32(busy + 1, HID_REPORT_SIZE - 5);
+    memcpy(busy + crc_begin, &crc, sizeof crc);
+  }
+  return HID_REPORT_SIZE;
+}
+
+DeviceEmulator::OTPSlot *DeviceEmulator::find_otp_slot(uint8_t slot_number) {
+  if (slot_number >= 0x10 && slot_number < 0x10 + 3)
+    return &m_hotp_slots[slot_number - 0x10];
+  if (slot_number >= 0x20 && slot_number < 0x20 + 15)
+    return &m_totp_slots[slot_number - 0x20];
+  return nullptr;
+}
+
+bool DeviceEmulator::check_pin(const uint8_t *pin, size_t size,
+                               const uint8_t *expected, uint8_t &retry_count) {
+  if (retry_count == 0) return false;
+  uint8_t given[PIN_SIZE];
+  copy_pin(given, pin, size);
+  const bool correct = memcmp(given, expected, PIN_SIZE) == 0;
+  misc::secure_zero(given, sizeof given);
+  if (!correct) {
+    retry_count--;
+    return false;
+  }
+  retry_count = initial_retry_count;
+  return true;
+}
+
+/*
+ *	An authorization is good for the single packet it was given for.
+ */
+bool DeviceEmulator::take_authorization(uint32_t &authorized_crc,
+                                        uint32_t crc) {
+  const bool authorized = authorized_crc != 0 && authorized_crc == crc;
+  authorized_crc = 0;
+  return authorized;
+}
+
+uint8_t DeviceEmulator::execute(uint8_t command_id, uint32_t crc,
+                                const uint8_t *request, uint8_t *response) {
+  switch ((CommandID)command_id) {
+    case CommandID::GET_STATUS: {
+      auto r = empty_response<GetStatus>();
+      r.firmware_version = 8;
+      const uint8_t serial[4] = {0x00, 0x00, 0x4e, 0x4b};
+      memcpy(r.card_serial, serial, sizeof serial);
+      memcpy(r.general_config, m_general_config, sizeof m_general_config);
+      put_response(response, r);
+      return CMD_STATUS_OK;
+    }
+    case CommandID::WRITE_TO_SLOT: {
+      if (!take_authorization(m_authorized_crc, crc))
+        return CMD_STATUS_NOT_AUTHORIZED;
+      // the HOTP and TOTP layouts differ only in the last field
+      auto p = request_of<WriteToHOTPSlot>(request);
+      OTPSlot *slot = find_otp_slot(p.slot_number);
+      if (slot == nullptr) return CMD_STATUS_WRONG_SLOT;
+      slot->programmed = true;
+      memcpy(slot->name, p.slot_name, sizeof slot->name);
+      slot->config = p._slot_config;
+      memcpy(slot->token_id, p.slot_token_id, sizeof slot->token_id);
+      slot->counter = p.slot_number < 0x20 ? p.slot_counter : 0;
+      misc::secure_zero(&p, sizeof p);
+      return CMD_STATUS_OK;
+    }
+    case CommandID::READ_SLOT_NAME: {
+      auto p = request_of<GetSlotName>(request);
+      const OTPSlot *slot = find_otp_slot(p.slot_number);
+      if (slot == nullptr) return CMD_STATUS_WRONG_SLOT;
+      if (!slot->programmed) return CMD_STATUS_SLOT_NOT_PROGRAMMED;
+      auto r = empty_response<GetSlotName>();
+      memcpy(r.slot_name, slot->name, sizeof r.slot_name);
+      put_response(response, r);
+      return CMD_STATUS_OK;
+    }
+    case CommandID::READ_SLOT: {
+      auto p = request_of<ReadSlot>(request);
+      const OTPSlot *slot = find_otp_slot(p.slot_number);
+      if (slot == nullptr) return CMD_STATUS_WRONG_SLOT;
+      if (!slot->programmed) return CMD_STATUS_SLOT_NOT_PROGRAMMED;
+      auto r = empty_response<ReadSlot>();
+      memcpy(r.slot_name, slot->name, sizeof r.slot_name);
+      r.config = slot->config;
+      memcpy(r.token_id, slot->token_id, sizeof r.token_id);
+      r.counter = slot->counter;
+      put_response(response, r);
+      return CMD_STATUS_OK;
+    }
+    case CommandID::GET_CODE: {
+      auto p = request_of<GetTOTP>(request);
+      OTPSlot *slot = find_otp_slot(p.slot_number);
+      if (slot == nullptr) return CMD_STATUS_WRONG_SLOT;
+      if (!slot->programmed) return CMD_STATUS_SLOT_NOT_PROGRAMMED;
+      if (m_general_config[3] &&
+          !take_authorization(m_user_authorized_crc, crc))
+        return CMD_STATUS_NOT_AUTHORIZED;
+      auto r = empty_response<GetTOTP>();
+      if (p.slot_number < 0x20)
+        r.code = (uint32_t)(slot->counter++);
+      else
+        r.code = (uint32_t)(p.challenge % 1000000);
+      r._slot_config = slot->config;
+      put_response(response, r);
+      return CMD_STATUS_OK;
+    }
+    case CommandID::WRITE_CONFIG: {
+      if (!take_authorization(m_authorized_crc, crc))
+        return CMD_STATUS_NOT_AUTHORIZED;
+      auto p = request_of<WriteGeneralConfig>(request);
+      memcpy(m_general_config, p.config, sizeof m_general_config);
+      return CMD_STATUS_OK;
+    }
+    case CommandID::ERASE_SLOT: {
+      if (!take_authorization(m_authorized_crc, crc))
+        return CMD_STATUS_NOT_AUTHORIZED;
+      auto p = request_of<EraseSlot>(request);
+      OTPSlot *slot = find_otp_slot(p.slot_number);
+      if (slot == nullptr) return CMD_STATUS_WRONG_SLOT;
+      memset(slot, 0, sizeof *slot);
+      return CMD_STATUS_OK;
+    }
+    case CommandID::FIRST_AUTHENTICATE: {
+      auto p = request_of<FirstAuthenticate>(request);
+      const bool correct = check_pin(p.card_password, sizeof p.card_password,
+                                     m_admin_pin, m_admin_retry_count);
+      if (correct)
+        copy_pin(m_admin_temporary_password, p.temporary_password,
+                 sizeof p.temporary_password);
+      misc::secure_zero(&p, sizeof p);
+      return correct ? CMD_STATUS_OK : CMD_STATUS_WRONG_PASSWORD;
+    }
+    case CommandID::USER_AUTHENTICATE: {
+      auto p = request_of<UserAuthenticate>(request);
+      const bool correct = check_pin(p.card_password, sizeof p.card_password,
+                                     m_user_pin, m_user_retry_count);
+      if (correct)
+        copy_pin(m_user_temporary_password, p.temporary_password,
+                 sizeof p.temporary_password);
+      misc::secure_zero(&p, sizeof p);
+      return correct ? CMD_STATUS_OK : CMD_STATUS_WRONG_PASSWORD;
+    }
+    case CommandID::AUTHORIZE:
+    case CommandID::USER_AUTHORIZE: {
+      const bool user = (CommandID)command_id == CommandID::USER_AUTHORIZE;
+      auto p = request_of<Authorize>(request);
+      const uint8_t *expected =
+          user ? m_user_temporary_password : m_admin_temporary_password;
+      uint8_t given[PIN_SIZE];
+      copy_pin(given, p.temporary_password, sizeof p.temporary_password);
+      const bool correct =
+          expected[0] != 0 && memcmp(given, expected, PIN_SIZE) == 0;
+      misc::secure_zero(given, sizeof given);
+      misc::secure_zero(&p.temporary_password, sizeof p.temporary_password);
+      if (!correct) return CMD_STATUS_NOT_AUTHORIZED;
+      (user ? m_user_authorized_crc : m_authorized_crc) = p.crc_to_authorize;
+      return CMD_STATUS_OK;
+    }
+    case CommandID::GET_PASSWORD_RETRY_COUNT:
+    case CommandID::GET_USER_PASSWORD_RETRY_COUNT: {
+      auto r = empty_response<GetPasswordRetryCount>();
+      r.password_retry_count =
+          (CommandID)command_id == CommandID::GET_PASSWORD_RETRY_COUNT
+              ? m_admin_retry_count
+              : m_user_retry_count;
+      put_response(response, r);
+      return CMD_STATUS_OK;
+    }
+    case CommandID::SET_TIME: {
+      auto p = request_of<SetTime>(request);
+      if (p.reset == 1) m_time = p.time;
+      return CMD_STATUS_OK;
+    }
+    case CommandID::UNLOCK_USER_PASSWORD: {
+      auto p = request_of<UnlockUserPassword>(request);
+      const bool correct =
+          check_pin(p.admin_password, sizeof p.admin_password, m_admin_pin,
+                    m_admin_retry_count);
+      if (correct) {
+        copy_pin(m_user_pin, p.user_new_password, sizeof p.user_new_password);
+        m_user_retry_count = initial_retry_count;
+      }
+      misc::secure_zero(&p, sizeof p);
+      return correct ? CMD_STATUS_OK : CMD_STATUS_WRONG_PASSWORD;
+    }
+    case CommandID::LOCK_DEVICE:
+      m_password_safe_enabled = false;
+      return CMD_STATUS_OK;
+    case CommandID::FACTORY_RESET: {
+      auto p = request_of<FactoryReset>(request);
+      const bool correct =
+          check_pin(p.admin_password, sizeof p.admin_password, m_admin_pin,
+                    m_admin_retry_count);
+      misc::secure_zero(&p, sizeof p);
+      if (!correct) return CMD_STATUS_WRONG_PASSWORD;
+      factory_reset();
+      return CMD_STATUS_OK;
+    }
+    case CommandID::CHANGE_USER_PIN:
+    case CommandID::CHANGE_ADMIN_PIN: {
+      const bool user = (CommandID)command_id == CommandID::CHANGE_USER_PIN;
+      auto p = request_of<ChangeUserPin>(request);
+      uint8_t *pin = user ? m_user_pin : m_admin_pin;
+      const bool correct =
+          check_pin(p.old_pin, sizeof p.old_pin, pin,
+                    user ? m_user_retry_count : m_admin_retry_count);
+      if (correct) {
+        memset(pin, 0, PIN_SIZE);
+        memcpy(pin, p.new_pin, sizeof p.new_pin);
+      }
+      misc::secure_zero(&p, sizeof p);
+      return correct ? CMD_STATUS_OK : CMD_STATUS_WRONG_PASSWORD;
+    }
+    case CommandID::PW_SAFE_ENABLE: {
+      auto p = request_of<EnablePasswordSafe>(request);
+      const bool correct = check_pin(p.user_password, sizeof p.user_password,
+                                     m_user_pin, m_user_retry_count);
+      misc::secure_zero(&p, sizeof p);
+      if (!correct) return CMD_STATUS_WRONG_PASSWORD;
+      m_password_safe_enabled = true;
+      return CMD_STATUS_OK;
+    }
+    case CommandID::DETECT_SC_AES:
+      return CMD_STATUS_OK;
+    case CommandID::NEW_AES_KEY: {
+      auto p = request_of<BuildAESKey>(request);
+      const bool correct =
+          check_pin(p.admin_password, sizeof p.admin_password, m_admin_pin,
+                    m_admin_retry_count);
+      misc::secure_zero(&p, sizeof p);
+      if (!correct) return CMD_STATUS_WRONG_PASSWORD;
+      m_password_safe_enabled = false;
+      memset(m_password_safe_slots, 0, sizeof m_password_safe_slots);
+      return CMD_STATUS_OK;
+    }
+    case CommandID::GET_PW_SAFE_SLOT_STATUS: {
+      if (!m_password_safe_enabled) return CMD_STATUS_NOT_AUTHORIZED;
+      auto r = empty_response<GetPasswordSafeSlotStatus>();
+      for (size_t i = 0; i < PWS_SLOT_COUNT; i++)
+        r.password_safe_status[i] = m_password_safe_slots[i].programmed;
+      put_response(response, r);
+      return CMD_STATUS_OK;
+    }
+    case CommandID::GET_PW_SAFE_SLOT_NAME:
+    case CommandID::GET_PW_SAFE_SLOT_PASSWORD:
+    case CommandID::GET_PW_SAFE_SLOT_LOGINNAME: {
+      if (!m_password_safe_enabled) return CMD_STATUS_NOT_AUTHORIZED;
+      auto p = request_of<GetPasswordSafeSlotName>(request);
+      if (p.slot_number >= PWS_SLOT_COUNT) return CMD_STATUS_WRONG_SLOT;
+      const PasswordSafeSlot &slot = m_password_safe_slots[p.slot_number];
+      if (!slot.programmed) return CMD_STATUS_SLOT_NOT_PROGRAMMED;
+      if ((CommandID)command_id == CommandID::GET_PW_SAFE_SLOT_NAME)
+        memcpy(response, slot.name, sizeof slot.name);
+      else if ((CommandID)command_id == CommandID::GET_PW_SAFE_SLOT_PASSWORD)
+        memcpy(response, slot.password, sizeof slot.password);
+      else
+        memcpy(response, slot.login, sizeof slot.login);
+      return CMD_STATUS_OK;
+    }
+    case CommandID::SET_PW_SAFE_SLOT_DATA_1: {
+      if (!m_password_safe_enabled) return CMD_STATUS_NOT_AUTHORIZED;
+      auto p = request_of<SetPasswordSafeSlotData>(request);
+      if (p.slot_number >= PWS_SLOT_COUNT) return CMD_STATUS_WRONG_SLOT;
+      PasswordSafeSlot &slot = m_password_safe_slots[p.slot_number];
+      slot.programmed = true;
+      memcpy(slot.name, p.slot_name, sizeof slot.name);
+      memcpy(slot.password, p.slot_password, sizeof slot.password);
+      misc::secure_zero(&p, sizeof p);
+      return CMD_STATUS_OK;
+    }
+    case CommandID::SET_PW_SAFE_SLOT_DATA_2: {
+      if (!m_password_safe_enabled) return CMD_STATUS_NOT_AUTHORIZED;
+      auto p = request_of<SetPasswordSafeSlotData2>(request);
+      if (p.slot_number >= PWS_SLOT_COUNT) return CMD_STATUS_WRONG_SLOT;
+      memcpy(m_password_safe_slots[p.slot_number].login, p.slot_login_name,
+             sizeof p.slot_login_name);
+      misc::secure_zero(&p, sizeof p);
+      return CMD_STATUS_OK;
+    }
+    case CommandID::PW_SAFE_ERASE_SLOT: {
+      if (!m_password_safe_enabled) return CMD_STATUS_NOT_AUTHORIZED;
+      auto p = request_of<ErasePasswordSafeSlot>(request);
+      if (p.slot_number >= PWS_SLOT_COUNT) return CMD_STATUS_WRONG_SLOT;
+      misc::secure_zero(&m_password_safe_slots[p.slot_number],
+                        sizeof m_password_safe_slots[p.slot_number]);
+      return CMD_STATUS_OK;
+    }
+    default:
+      return CMD_STATUS_UNKNOWN_COMMAND;
+  }
+}
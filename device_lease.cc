@@ -0,0 +1,147 @@
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <unistd.h>
+#include "include/device_lease.h"
+#include "include/LibraryException.h"
+#include "include/log.h"
+
+using namespace nitrokey::device;
+using namespace nitrokey::log;
+
+constexpr std::chrono::milliseconds DeviceLease::MAX_POLL_INTERVAL;
+
+DeviceLease::DeviceLease()
+    : m_lock_fd(-1),
+      m_queue_fd(-1),
+      m_held(false),
+      m_stats{0, 0, 0, std::chrono::microseconds(0),
+              std::chrono::microseconds(0)} {}
+
+DeviceLease::~DeviceLease() {
+  release();
+  close();
+}
+
+std::string DeviceLease::lock_path(const std::string &key) {
+  const char *dir = getenv("LIBNITROKEY_LOCK_DIR");
+  if (dir == nullptr || *dir == 0) dir = getenv("XDG_RUNTIME_DIR");
+  if (dir == nullptr || *dir == 0) dir = "/tmp";
+
+  // HID paths have slashes and colons
+  std::string name = key;
+  for (auto &c : name)
+    if (!isalnum((unsigned char)c) && c != '.' && c != '-') c = '_';
+  return std::string(dir) + "/libnitrokey-" + name + ".lock";
+}
+
+static int open_lock_file(const std::string &path) {
+  return ::open(path.c_str(), O_RDWR | O_CREAT | O_NOFOLLOW | O_CLOEXEC, 0600);
+}
+
+bool DeviceLease::open(const std::string &key) {
+  if (key.empty()) return false;
+  if (key == m_key) return m_lock_fd >= 0;
+
+  close();
+  m_key = key;
+  const auto path = lock_path(key);
+  m_lock_fd = open_lock_file(path);
+  if (m_lock_fd >= 0)
+    m_queue_fd = open_lock_file(path.substr(0, path.size() - 5) + ".queue");
+  if (m_lock_fd < 0 || m_queue_fd < 0) {
+    Log::instance()(std::string("Device lease not used, can't open ") + path +
+                        ": " + strerror(errno),
+                    Loglevel::WARNING);
+    close();
+    m_key = key;  // not tried again
+    return false;
+  }
+  return true;
+}
+
+void DeviceLease::close() {
+  if (m_lock_fd >= 0) ::close(m_lock_fd);
+  if (m_queue_fd >= 0) ::close(m_queue_fd);
+  m_lock_fd = m_queue_fd = -1;
+  m_key.clear();
+}
+
+static bool try_lock(int fd) {
+  while (flock(fd, LOCK_EX | LOCK_NB) != 0) {
+    if (errno != EINTR) return false;
+  }
+  return true;
+}
+
+void DeviceLease::acquire(const std::string &key, Clock &clock,
+                          std::chrono::milliseconds timeout,
+                          Clock::time_point deadline,
+                          const std::atomic<bool> *cancelled) {
+  if (m_held || !open(key)) return;
+
+  const auto begin = clock.now();
+  const auto give_up = std::min(deadline, begin + timeout);
+  auto interval = std::chrono::microseconds(1000);
+  bool contended = false;
+
+  auto record = [&](bool acquired) {
+    const auto wait = ceil_microseconds(clock.now() - begin);
+    std::lock_guard<std::mutex> lock(m_stats_mutex);
+    if (acquired) m_stats.acquired++;
+    else m_stats.timeouts++;
+    if (!contended) return;
+    m_stats.contended++;
+    m_stats.total_wait += wait;
+    m_stats.max_wait = std::max(m_stats.max_wait, wait);
+  };
+
+  // the turnstile first, then the lease
+  for (int fd : {m_queue_fd, m_lock_fd}) {
+    while (!try_lock(fd)) {
+      contended = true;
+      const auto now = clock.now();
+      const bool is_cancelled = cancelled != nullptr && cancelled->load();
+      if (is_cancelled || now >= give_up) {
+        if (fd == m_lock_fd) flock(m_queue_fd, LOCK_UN);
+        record(false);
+        Log::instance()("Device lease for " + m_key + " not acquired",
+                        Loglevel::DEBUG);
+        if (is_cancelled) throw OperationCancelledException();
+        if (now >= deadline) throw DeadlineExceededException();
+        throw DeviceLeaseTimeoutException();
+      }
+      clock.sleep_for(std::min(interval, ceil_microseconds(give_up - now)));
+      interval = std::min(2 * interval,
+                          std::chrono::microseconds(MAX_POLL_INTERVAL));
+    }
+  }
+  flock(m_queue_fd, LOCK_UN);
+  m_held = true;
+  record(true);
+}
+
+bool DeviceLease::try_acquire(const std::string &key) {
+  if (m_held) return false;
+  if (!open(key)) return true;
+  if (!try_lock(m_queue_fd)) return false;
+  const bool acquired = try_lock(m_lock_fd);
+  flock(m_queue_fd, LOCK_UN);
+  m_held = acquired;
+  return acquired;
+}
+
+void DeviceLease::release() {
+  if (!m_held) return;
+  flock(m_lock_fd, LOCK_UN);
+  m_held = false;
+}
+
+DeviceLease::Stats DeviceLease::get_stats() {
+  std::lock_guard<std::mutex> lock(m_stats_mutex);
+  return m_stats;
+}
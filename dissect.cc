@@ -0,0 +1,204 @@
+#include <algorithm>
+#include <cstring>
+#include "dissect.h"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace nitrokey {
+namespace proto {
+
+// FIXME use values from firmware (possibly generate separate
+// header automatically)
+static const char *const device_status_names[] = {
+    "STATUS_READY", "STATUS_BUSY", "STATUS_ERROR", "STATUS_RECEIVED_REPORT",
+};
+
+static const char *const command_status_names[] = {
+    "CMD_STATUS_OK",
+    "CMD_STATUS_WRONG_CRC",
+    "CMD_STATUS_WRONG_SLOT",
+    "CMD_STATUS_SLOT_NOT_PROGRAMMED",
+    "CMD_STATUS_WRONG_PASSWORD",
+    "CMD_STATUS_NOT_AUTHORIZED",
+    "CMD_STATUS_TIMESTAMP_WARNING",
+    "CMD_STATUS_NO_NAME_ERROR",
+    "CMD_STATUS_NOT_SUPPORTED",
+    "CMD_STATUS_UNKNOWN_COMMAND",
+    "CMD_STATUS_AES_DEC_FAILED",
+};
+
+const char *device_status_to_string(uint8_t status) {
+  if (status >= sizeof device_status_names / sizeof device_status_names[0])
+    return "UNKNOWN";
+  return device_status_names[status];
+}
+
+const char *command_status_to_string(uint8_t status) {
+  if (status >= sizeof command_status_names / sizeof command_status_names[0])
+    return "UNKNOWN";
+  return command_status_names[status];
+}
+
+/*
+ *	Two hex digits for every byte value, built at compile time.
+ */
+struct HexPairs {
+  char pairs[256][2];
+
+  constexpr HexPairs() : pairs() {
+    const char digits[] = "0123456789abcdef";
+    for (int i = 0; i < 256; i++) {
+      pairs[i][0] = digits[i >> 4];
+      pairs[i][1] = digits[i & 0xF];
+    }
+  }
+};
+
+static constexpr HexPairs hex_pairs;
+
+#ifdef __SSE2__
+/*
+ *	16 bytes into 32 hex digits at once.
+ */
+static inline void hex16(const uint8_t *in, char *out) {
+  const __m128i bytes = _mm_loadu_si128((const __m128i *)in);
+  const __m128i low_nibble = _mm_set1_epi8(0x0F);
+  const __m128i nine = _mm_set1_epi8(9);
+  const __m128i zero = _mm_set1_epi8('0');
+  const __m128i letter_offset = _mm_set1_epi8('a' - '0' - 10);
+
+  __m128i hi = _mm_and_si128(_mm_srli_epi16(bytes, 4), low_nibble);
+  __m128i lo = _mm_and_si128(bytes, low_nibble);
+  hi = _mm_add_epi8(_mm_add_epi8(hi, zero),
+                    _mm_and_si128(_mm_cmpgt_epi8(hi, nine), letter_offset));
+  lo = _mm_add_epi8(_mm_add_epi8(lo, zero),
+                    _mm_and_si128(_mm_cmpgt_epi8(lo, nine), letter_offset));
+
+  _mm_storeu_si128((__m128i *)out, _mm_unpacklo_epi8(hi, lo));
+  _mm_storeu_si128((__m128i *)(out + 16), _mm_unpackhi_epi8(hi, lo));
+}
+#endif
+
+DissectWriter::DissectWriter(char *buf, size_t size)
+    : m_buf(buf),
+      m_capacity(size > 0 ? size - 1 : 0),
+      m_length(0),
+      m_truncated(false) {
+  if (size > 0) m_buf[0] = 0;
+}
+
+DissectWriter &DissectWriter::text_truncated(const char *s, size_t length) {
+  // as the inline path: the bytes given, not stopping at a NUL
+  const size_t left = m_capacity - m_length;
+  const size_t n = std::min(length, left);
+  memcpy(m_buf + m_length, s, n);
+  m_length += n;
+  if (m_capacity > 0) m_buf[m_length] = 0;
+  if (length > left) m_truncated = true;
+  return *this;
+}
+
+DissectWriter &DissectWriter::dec(uint64_t value) {
+  char digits[20];
+  size_t n = 0;
+  do {
+    digits[sizeof digits - ++n] = (char)('0' + value % 10);
+    value /= 10;
+  } while (value != 0);
+  return text(digits + sizeof digits - n, n);
+}
+
+DissectWriter &DissectWriter::dec_signed(int64_t value) {
+  if (value >= 0) return dec((uint64_t)value);
+  character('-');
+  return dec(0 - (uint64_t)value);
+}
+
+DissectWriter &DissectWriter::hex(uint64_t value) {
+  char digits[16];
+  size_t n = 0;
+  do {
+    digits[sizeof digits - ++n] = "0123456789abcdef"[value & 0xF];
+    value >>= 4;
+  } while (value != 0);
+  return text(digits + sizeof digits - n, n);
+}
+
+DissectWriter &DissectWriter::hex32(uint32_t value) {
+  char digits[8];
+  for (int i = 0; i < 4; i++)
+    memcpy(digits + 2 * i, hex_pairs.pairs[(value >> (24 - 8 * i)) & 0xFF],
+           2);
+  return text(digits, sizeof digits);
+}
+
+DissectWriter &DissectWriter::binary8(uint8_t value) {
+  char digits[8];
+  for (int i = 0; i < 8; i++) digits[i] = (value & (0x80 >> i)) ? '1' : '0';
+  return text(digits, sizeof digits);
+}
+
+DissectWriter &DissectWriter::hex_compact(const void *data, size_t size) {
+  const uint8_t *p = (const uint8_t *)data;
+  char chunk[32];
+  size_t i = 0;
+#ifdef __SSE2__
+  for (; i + 16 <= size; i += 16) {
+    hex16(p + i, chunk);
+    text(chunk, 32);
+  }
+#endif
+  for (; i < size; i++) text(hex_pairs.pairs[p[i]], 2);
+  return *this;
+}
+
+DissectWriter &DissectWriter::hexdump(const void *data, size_t size,
+                                      bool print_header) {
+  const uint8_t *p = (const uint8_t *)data;
+  // "0000\t" + 16 * "xx " + "\n"
+  char line[5 + 16 * 3 + 1];
+  char digits[32];
+
+  for (size_t offset = 0; offset < size; offset += 16) {
+    size_t n = 0;
+    if (print_header) {
+      memcpy(line, hex_pairs.pairs[(offset >> 8) & 0xFF], 2);
+      memcpy(line + 2, hex_pairs.pairs[offset & 0xFF], 2);
+      line[4] = '\t';
+      n = 5;
+    }
+    const size_t count = size - offset < 16 ? size - offset : 16;
+#ifdef __SSE2__
+    if (count == 16) {
+      hex16(p + offset, digits);
+    } else
+#endif
+    {
+      for (size_t i = 0; i < count; i++)
+        memcpy(digits + 2 * i, hex_pairs.pairs[p[offset + i]], 2);
+    }
+    for (size_t i = 0; i < count; i++) {
+      line[n] = digits[2 * i];
+      line[n + 1] = digits[2 * i + 1];
+      line[n + 2] = ' ';
+      n += 3;
+    }
+    line[n++] = '\n';
+    text(line, n);
+  }
+  return *this;
+}
+
+DissectWriter &DissectWriter::c_string(const uint8_t *s, size_t max_length) {
+  const void *end = memchr(s, 0, max_length);
+  return text((const char *)s,
+              end ? (const uint8_t *)end - s : max_length);
+}
+
+size_t payload_used_size(const uint8_t *data, size_t size) {
+  while (size > 0 && data[size - 1] == 0) size--;
+  return size;
+}
+}
+}
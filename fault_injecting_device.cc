@@ -0,0 +1,113 @@
+#include <algorithm>
+#include <cstring>
+#include "include/fault_injecting_device.h"
+#include "include/misc.h"
+
+using namespace nitrokey::device;
+
+// offsets in the reports, see HIDReport and DeviceResponse
+static const size_t device_status_begin = 1;
+static const size_t last_command_crc_begin = 3;
+static const size_t crc_begin = HID_REPORT_SIZE - 4;
+
+static const uint8_t device_status_busy = 1;
+
+FaultInjectingDevice::FaultInjectingDevice(std::shared_ptr<Device> device,
+                                           uint32_t seed)
+    : m_device(device),
+      m_random(seed),
+      m_recv_count(0),
+      m_previous_crc(0),
+      m_last_crc(0) {
+  m_model = device->get_device_model();
+  m_retry_policy = device->get_retry_policy();
+  m_send_receive_delay = device->get_send_receive_delay();
+  clear_faults();
+}
+
+void FaultInjectingDevice::set_fault(Fault fault, Profile profile) {
+  FaultState &state = m_faults[(size_t)fault];
+  state.enabled = true;
+  state.profile = profile;
+  state.remaining = 0;
+}
+
+void FaultInjectingDevice::clear_faults() {
+  for (auto &state : m_faults) {
+    state.enabled = false;
+    state.profile = Profile{0, 0, 0};
+    state.remaining = 0;
+    state.injected = 0;
+  }
+}
+
+bool FaultInjectingDevice::connect() { return m_device->connect(); }
+
+bool FaultInjectingDevice::disconnect() { return m_device->disconnect(); }
+
+int FaultInjectingDevice::send(const void *packet) {
+  m_previous_crc = m_last_crc;
+  memcpy(&m_last_crc, (const uint8_t *)packet + crc_begin, sizeof m_last_crc);
+  return m_device->send(packet);
+}
+
+bool FaultInjectingDevice::should_inject(FaultState &state) {
+  if (!state.enabled) return false;
+  if (state.remaining > 0) {
+    state.remaining--;
+    return true;
+  }
+  bool start;
+  if (state.profile.period > 0) {
+    start = m_recv_count % state.profile.period == 0;
+  } else {
+    std::uniform_real_distribution<double> chance(0, 1);
+    start = chance(m_random) < state.profile.rate;
+  }
+  if (!start) return false;
+  state.remaining = state.profile.burst > 0 ? state.profile.burst - 1 : 0;
+  return true;
+}
+
+int FaultInjectingDevice::recv(void *packet) {
+  m_recv_count++;
+  bool inject[FAULT_COUNT];
+  for (size_t i = 0; i < FAULT_COUNT; i++)
+    inject[i] = should_inject(m_faults[i]);
+
+  if (inject[(size_t)Fault::RECV_FAILURE]) {
+    m_faults[(size_t)Fault::RECV_FAILURE].injected++;
+    return -1;
+  }
+
+  int status = m_device->recv(packet);
+  if (status <= 0) return status;
+
+  uint8_t *report = (uint8_t *)packet;
+  bool modified = false;
+  if (inject[(size_t)Fault::BUSY]) {
+    m_faults[(size_t)Fault::BUSY].injected++;
+    report[device_status_begin] = device_status_busy;
+    modified = true;
+  }
+  if (inject[(size_t)Fault::STALE_CRC]) {
+    m_faults[(size_t)Fault::STALE_CRC].injected++;
+    // repeated commands have the same CRC
+    const uint32_t stale =
+        m_previous_crc != m_last_crc ? m_previous_crc : ~m_last_crc;
+    memcpy(report + last_command_crc_begin, &stale, sizeof stale);
+    modified = true;
+  }
+  if (modified) {
+    // the device would send a well formed report
+    const uint32_t crc = misc::stm_crc32(report + 1, HID_REPORT_SIZE - 5);
+    memcpy(report + crc_begin, &crc, sizeof crc);
+  }
+  if (inject[(size_t)Fault::SHORT_READ]) {
+    m_faults[(size_t)Fault::SHORT_READ].injected++;
+    const int length = HID_REPORT_SIZE / 2;
+    memset(report + length, 0, HID_REPORT_SIZE - length);
+    status = std::min(status, length);
+  }
+  return status;
+}
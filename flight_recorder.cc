@@ -0,0 +1,100 @@
+#include <cstring>
+#include "include/device.h"
+#include "include/device_proto.h"
+#include "include/dissect.h"
+
+namespace nitrokey {
+namespace device {
+
+using namespace nitrokey::proto;
+
+const size_t FlightRecorder::CAPACITY;
+
+// offsets in the outgoing and incoming reports, see HIDReport and
+// DeviceResponse
+static const size_t outgoing_payload_begin = 2;
+static const size_t incoming_payload_begin = 8;
+static const size_t incoming_last_command_crc = 3;
+
+void FlightRecorder::record(Direction direction, const void *packet,
+                            int status, bool redact) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  Record &r = m_records[m_next];
+  r.time = std::chrono::steady_clock::now();
+  r.direction = direction;
+  r.redacted = redact;
+  r.status = status;
+  memcpy(r.packet, packet, HID_REPORT_SIZE);
+  if (redact) {
+    const size_t begin = direction == Direction::OUTGOING
+                             ? outgoing_payload_begin
+                             : incoming_payload_begin;
+    // the CRCs are computed over the payload, so they would allow to
+    // find a short secret offline
+    memset(r.packet + begin, 0, HID_REPORT_SIZE - begin);
+    if (direction == Direction::INCOMING)
+      memset(r.packet + incoming_last_command_crc, 0, sizeof(uint32_t));
+  }
+  m_next = (m_next + 1) % CAPACITY;
+  if (m_count < CAPACITY) m_count++;
+}
+
+/*
+ *	Payload type is not known for recorded packets, hence only
+ *	the raw dump of it is available.
+ */
+struct RecordedPayload {
+  uint8_t _data[1];
+
+  void dissect(DissectWriter &out) const { out.text("See raw packet.\n"); }
+} __packed;
+
+std::string FlightRecorder::dump() const {
+  // command id given here is not used by the dissectors
+  typedef HIDReport<CommandID::GET_STATUS, RecordedPayload> OutgoingPacket;
+  typedef DeviceResponse<CommandID::GET_STATUS, RecordedPayload> ResponsePacket;
+  static_assert(sizeof(OutgoingPacket) == HID_REPORT_SIZE,
+                "OutgoingPacket type is not the right size");
+  static_assert(sizeof(ResponsePacket) == HID_REPORT_SIZE,
+                "ResponsePacket type is not the right size");
+
+  // dissected from a copy, not to hold the recording threads meanwhile
+  Record records[CAPACITY];
+  size_t count;
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    count = m_count;
+    for (size_t i = 0; i < count; i++) records[i] = at(i);
+  }
+  if (count == 0) return std::string("Flight recorder is empty.\n");
+
+  std::string out;
+  char buf[DISSECT_BUFFER_SIZE];
+  const auto begin = records[0].time;
+  for (size_t i = 0; i < count; i++) {
+    const Record &r = records[i];
+    const auto offset =
+        std::chrono::duration_cast<std::chrono::microseconds>(r.time - begin);
+    DissectWriter writer(buf, sizeof buf);
+    writer.character('#').dec(i).text(" +").dec(offset.count()).text("us ");
+    writer.text(r.direction == Direction::OUTGOING ? "OUTGOING" : "INCOMING")
+        .text(" status: ")
+        .dec_signed(r.status)
+        .text(r.redacted ? " (payload redacted)\n" : "\n");
+
+    if (r.direction == Direction::OUTGOING) {
+      OutgoingPacket p;
+      memcpy(&p, r.packet, sizeof p);
+      QueryDissector<CommandID::GET_STATUS, OutgoingPacket>::dissect(p, writer);
+    } else {
+      ResponsePacket p;
+      memcpy(&p, r.packet, sizeof p);
+      ResponseDissector<CommandID::GET_STATUS, ResponsePacket>::dissect(p,
+                                                                        writer);
+    }
+    out.append(writer.c_str(), writer.size());
+  }
+  return out;
+}
+}
+}
@@ -0,0 +1,334 @@
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <fstream>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <linux/netlink.h>
+#include "include/hotplug.h"
+#include "include/device_proto.h"
+#include "include/log.h"
+
+using namespace nitrokey::device;
+using namespace nitrokey::log;
+
+static const uint16_t nitrokey_vid = 0x20a0;
+static const uint16_t pro_pid = 0x4108;
+static const uint16_t storage_pid = 0x4109;
+
+// netlink multicast group of the events udev sends after processing them
+static const uint32_t udev_monitor_group = 2;
+
+/*
+ *	Header of messages sent by udev (libudev monitor), followed by the
+ *	properties as in kernel messages.
+ */
+struct UdevMonitorHeader {
+  char prefix[8];  // "libudev"
+  uint32_t magic;  // network byte order
+  uint32_t header_size;
+  uint32_t properties_off;
+  uint32_t properties_len;
+};
+static const uint32_t udev_monitor_magic = 0xfeedcafe;
+
+HotplugMonitor &HotplugMonitor::instance() {
+  static HotplugMonitor monitor;
+  return monitor;
+}
+
+HotplugMonitor::HotplugMonitor()
+    : m_next_callback_id(1),
+      m_generation(0),
+      m_running(false),
+      m_socket(-1),
+      m_stop_fd(-1) {}
+
+HotplugMonitor::~HotplugMonitor() { stop(); }
+
+bool HotplugMonitor::is_nitrokey(uint16_t vid, uint16_t pid) {
+  return (vid == nitrokey_vid && (pid == pro_pid || pid == storage_pid)) ||
+         (vid == STICK20_UPDATE_MODE_VID && pid == STICK20_UPDATE_MODE_PID);
+}
+
+static void fill_model(HotplugMonitor::UsbDevice &device) {
+  device.update_mode = device.vid == STICK20_UPDATE_MODE_VID;
+  device.model = device.pid == pro_pid ? DeviceModel::PRO : DeviceModel::STORAGE;
+}
+
+/*
+ *	"20a0/4108/101" - vendor, product, release, hex without leading zeros
+ */
+static bool parse_product(const char *value, uint16_t &vid, uint16_t &pid) {
+  char *end;
+  const unsigned long v = strtoul(value, &end, 16);
+  if (*end != '/') return false;
+  const unsigned long p = strtoul(end + 1, &end, 16);
+  if (*end != '/' || v > 0xffff || p > 0xffff) return false;
+  vid = (uint16_t)v;
+  pid = (uint16_t)p;
+  return true;
+}
+
+bool HotplugMonitor::parse_uevent(const char *message, size_t size,
+                                  Event &event) {
+  const char *properties = message;
+  size_t length = size;
+  if (size >= sizeof(UdevMonitorHeader) && memcmp(message, "libudev", 8) == 0) {
+    UdevMonitorHeader header;
+    memcpy(&header, message, sizeof header);
+    if (ntohl(header.magic) != udev_monitor_magic) return false;
+    if (header.properties_off > size ||
+        header.properties_len > size - header.properties_off)
+      return false;
+    properties = message + header.properties_off;
+    length = header.properties_len;
+  }
+  // a kernel message starts with "action@devpath", skipped as not KEY=VALUE
+
+  const char *action = nullptr, *subsystem = nullptr, *devtype = nullptr,
+             *product = nullptr, *devpath = nullptr;
+  for (size_t i = 0; i < length;) {
+    const char *entry = properties + i;
+    const size_t entry_length = strnlen(entry, length - i);
+    if (i + entry_length == length) break;  // not NUL terminated
+    const char *separator = (const char *)memchr(entry, '=', entry_length);
+    if (separator != nullptr) {
+      const size_t key_length = separator - entry;
+      const char *value = separator + 1;
+      if (key_length == 6 && memcmp(entry, "ACTION", 6) == 0)
+        action = value;
+      else if (key_length == 9 && memcmp(entry, "SUBSYSTEM", 9) == 0)
+        subsystem = value;
+      else if (key_length == 7 && memcmp(entry, "DEVTYPE", 7) == 0)
+        devtype = value;
+      else if (key_length == 7 && memcmp(entry, "PRODUCT", 7) == 0)
+        product = value;
+      else if (key_length == 7 && memcmp(entry, "DEVPATH", 7) == 0)
+        devpath = value;
+    }
+    i += entry_length + 1;
+  }
+
+  // interfaces of the device come with the same PRODUCT, only the device counts
+  if (action == nullptr || subsystem == nullptr || devtype == nullptr ||
+      product == nullptr || devpath == nullptr)
+    return false;
+  if (strcmp(subsystem, "usb") != 0 || strcmp(devtype, "usb_device") != 0)
+    return false;
+  if (strcmp(action, "add") == 0)
+    event.action = Action::ARRIVAL;
+  else if (strcmp(action, "remove") == 0)
+    event.action = Action::REMOVAL;
+  else
+    return false;
+  if (!parse_product(product, event.device.vid, event.device.pid)) return false;
+  if (!is_nitrokey(event.device.vid, event.device.pid)) return false;
+  event.device.devpath = devpath;
+  fill_model(event.device);
+  return true;
+}
+
+void HotplugMonitor::process_uevent(const char *message, size_t size) {
+  Event event;
+  if (parse_uevent(message, size, event)) update(event, true);
+}
+
+void HotplugMonitor::update(const Event &event, bool notify) {
+  std::vector<std::pair<int, Callback>> callbacks;
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto found = std::find_if(m_devices.begin(), m_devices.end(),
+                              [&](const UsbDevice &d) {
+                                return d.devpath == event.device.devpath;
+                              });
+    if (event.action == Action::ARRIVAL) {
+      if (found != m_devices.end()) return;
+      m_devices.push_back(event.device);
+    } else {
+      if (found == m_devices.end()) return;
+      m_devices.erase(found);
+    }
+    m_generation++;
+    if (notify) callbacks = m_callbacks;
+  }
+
+  if (Log::instance().is_enabled(Loglevel::DEBUG))
+    Log::instance()(std::string("Hotplug: ") +
+                        (event.action == Action::ARRIVAL ? "arrival " : "removal ") +
+                        event.device.devpath,
+                    Loglevel::DEBUG);
+  for (auto &callback : callbacks) callback.second(event);
+}
+
+static bool read_hex_attribute(const std::string &path, uint16_t &value) {
+  std::ifstream file(path);
+  unsigned int v;
+  if (!(file >> std::hex >> v) || v > 0xffff) return false;
+  value = (uint16_t)v;
+  return true;
+}
+
+void HotplugMonitor::scan_sysfs(bool notify) {
+  const std::string root = "/sys/bus/usb/devices/";
+  std::vector<UsbDevice> present;
+  DIR *dir = opendir(root.c_str());
+  if (dir == nullptr) return;
+  while (struct dirent *entry = readdir(dir)) {
+    if (entry->d_name[0] == '.') continue;
+    const std::string path = root + entry->d_name;
+    UsbDevice device;
+    if (!read_hex_attribute(path + "/idVendor", device.vid) ||
+        !read_hex_attribute(path + "/idProduct", device.pid) ||
+        !is_nitrokey(device.vid, device.pid))
+      continue;
+    char real[PATH_MAX];
+    if (realpath(path.c_str(), real) == nullptr) continue;
+    if (strncmp(real, "/sys/", 5) != 0) continue;
+    device.devpath = real + 4;
+    fill_model(device);
+    present.push_back(device);
+  }
+  closedir(dir);
+
+  for (const auto &device : get_devices()) {
+    if (std::none_of(present.begin(), present.end(), [&](const UsbDevice &d) {
+          return d.devpath == device.devpath;
+        }))
+      update(Event{Action::REMOVAL, device}, notify);
+  }
+  for (const auto &device : present) update(Event{Action::ARRIVAL, device}, notify);
+}
+
+bool HotplugMonitor::start() {
+  std::lock_guard<std::mutex> lock(m_start_mutex);
+  if (m_running) return true;
+
+  m_socket = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK,
+                    NETLINK_KOBJECT_UEVENT);
+  if (m_socket < 0) {
+    Log::instance()(std::string("Hotplug: cannot open netlink socket: ") +
+                        strerror(errno),
+                    Loglevel::ERROR);
+    return false;
+  }
+  struct sockaddr_nl address;
+  memset(&address, 0, sizeof address);
+  address.nl_family = AF_NETLINK;
+  address.nl_groups = udev_monitor_group;
+  const int on = 1;
+  m_stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (bind(m_socket, (struct sockaddr *)&address, sizeof address) < 0 ||
+      setsockopt(m_socket, SOL_SOCKET, SO_PASSCRED, &on, sizeof on) < 0 ||
+      m_stop_fd < 0) {
+    Log::instance()(std::string("Hotplug: cannot listen to uevents: ") +
+                        strerror(errno),
+                    Loglevel::ERROR);
+    close(m_socket);
+    if (m_stop_fd >= 0) close(m_stop_fd);
+    m_socket = m_stop_fd = -1;
+    return false;
+  }
+
+  // events from now on are queued on the socket, none is missed
+  scan_sysfs(false);
+  m_running = true;
+  m_thread = std::thread(&HotplugMonitor::run, this);
+  return true;
+}
+
+void HotplugMonitor::stop() {
+  std::lock_guard<std::mutex> start_lock(m_start_mutex);
+  if (!m_running) return;
+  const uint64_t one = 1;
+  if (write(m_stop_fd, &one, sizeof one) < 0) {
+    // the counter can't overflow with a single write
+  }
+  m_thread.join();
+  close(m_socket);
+  close(m_stop_fd);
+  m_socket = m_stop_fd = -1;
+  m_running = false;
+
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_devices.clear();
+  m_generation++;
+}
+
+int HotplugMonitor::add_callback(Callback callback) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  const int id = m_next_callback_id++;
+  m_callbacks.emplace_back(id, std::move(callback));
+  return id;
+}
+
+void HotplugMonitor::remove_callback(int id) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_callbacks.erase(std::remove_if(m_callbacks.begin(), m_callbacks.end(),
+                                   [id](const std::pair<int, Callback> &c) {
+                                     return c.first == id;
+                                   }),
+                    m_callbacks.end());
+}
+
+std::vector<HotplugMonitor::UsbDevice> HotplugMonitor::get_devices() {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return m_devices;
+}
+
+bool HotplugMonitor::has_connectable_device() {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return std::any_of(m_devices.begin(), m_devices.end(),
+                     [](const UsbDevice &d) { return !d.update_mode; });
+}
+
+void HotplugMonitor::run() {
+  char message[8192];
+  char control[CMSG_SPACE(sizeof(struct ucred))];
+  struct pollfd fds[2] = {{m_socket, POLLIN, 0}, {m_stop_fd, POLLIN, 0}};
+
+  while (true) {
+    if (poll(fds, 2, -1) < 0) {
+      if (errno == EINTR) continue;
+      Log::instance()(std::string("Hotplug: poll failed: ") + strerror(errno),
+                      Loglevel::ERROR);
+      return;
+    }
+    if (fds[1].revents != 0) return;
+
+    struct sockaddr_nl sender;
+    struct iovec iov = {message, sizeof message};
+    struct msghdr header;
+    memset(&header, 0, sizeof header);
+    header.msg_name = &sender;
+    header.msg_namelen = sizeof sender;
+    header.msg_iov = &iov;
+    header.msg_iovlen = 1;
+    header.msg_control = control;
+    header.msg_controllen = sizeof control;
+    const ssize_t size = recvmsg(m_socket, &header, 0);
+    if (size < 0 && errno == ENOBUFS) {
+      // events were lost, the devices are read again
+      Log::instance()("Hotplug: uevents lost", Loglevel::WARNING);
+      scan_sysfs(true);
+      continue;
+    }
+    if (size <= 0) continue;
+
+    // only root (udev) is trusted to describe devices
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&header);
+    if (cmsg == nullptr || cmsg->cmsg_type != SCM_CREDENTIALS) continue;
+    struct ucred credentials;
+    memcpy(&credentials, CMSG_DATA(cmsg), sizeof credentials);
+    if (credentials.uid != 0 || sender.nl_groups != udev_monitor_group)
+      continue;
+
+    process_uevent(message, (size_t)size);
+  }
+}
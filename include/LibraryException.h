@@ -12,6 +12,58 @@ public:
 
 
 
+class LongOperationInProgressException : public LibraryException {
+public:
+    uint8_t progress_bar_value;
+
+    LongOperationInProgressException(uint8_t progress_bar_value) : progress_bar_value(progress_bar_value) {}
+
+    virtual uint8_t exception_id() override {
+        return 207;
+    }
+
+    virtual const char *what() const throw() override {
+        return "Device is busy with a long operation";
+    }
+
+};
+
+class DeviceLeaseTimeoutException : public LibraryException {
+public:
+    virtual uint8_t exception_id() override {
+        return 206;
+    }
+
+    virtual const char *what() const throw() override {
+        return "Device in use by another process";
+    }
+
+};
+
+class OperationCancelledException : public LibraryException {
+public:
+    virtual uint8_t exception_id() override {
+        return 205;
+    }
+
+    virtual const char *what() const throw() override {
+        return "Operation cancelled";
+    }
+
+};
+
+class DeadlineExceededException : public LibraryException {
+public:
+    virtual uint8_t exception_id() override {
+        return 204;
+    }
+
+    virtual const char *what() const throw() override {
+        return "Operation deadline exceeded";
+    }
+
+};
+
 class TargetBufferSmallerThanSource: public LibraryException {
 public:
     virtual uint8_t exception_id() override {
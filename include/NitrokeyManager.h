@@ -2,10 +2,15 @@
 #define LIBNITROKEY_NITROKEYMANAGER_H
 
 #include "device.h"
+#include "keep_alive.h"
 #include "log.h"
 #include "device_proto.h"
 #include "stick10_commands.h"
 #include "stick20_commands.h"
+#include "storage_status.h"
+#include "trace.h"
+#include <atomic>
+#include <mutex>
 #include <vector>
 #include <memory>
 
@@ -17,10 +22,28 @@ namespace nitrokey {
     using namespace nitrokey::proto;
     using namespace nitrokey::log;
 
+    class AwaitableNitrokeyManager;
+    class ProxyServer;
+
     class NitrokeyManager {
     public:
+        /**
+         * Shared manager used by the single device C API.
+         */
         static shared_ptr <NitrokeyManager> instance();
 
+        /**
+         * New manager, independent of instance() and of other managers. Managers
+         * are not thread safe themselves, but different ones can be used from
+         * different threads at once.
+         */
+        static shared_ptr <NitrokeyManager> create();
+
+        /**
+         * HID paths of connected devices of given model, for connect(device_model, path).
+         */
+        static vector <string> list_devices(const char *device_model);
+
         bool first_authenticate(const char *pin, const char *temporary_password);
         bool write_HOTP_slot(uint8_t slot_number, const char *slot_name, const char *secret, uint8_t hotp_counter,
                                      bool use_8_digits, bool use_enter, bool use_tokenID, const char *token_ID,
@@ -36,7 +59,16 @@ namespace nitrokey {
         bool erase_totp_slot(uint8_t slot_number, const char *temporary_password);
         bool erase_hotp_slot(uint8_t slot_number, const char *temporary_password);
         bool connect(const char *device_model);
+        bool connect(const char *device_model, const char *path);
         bool connect();
+        /**
+         * As connect(), trying the given devices instead of one of each model, the last one connecting wins.
+         */
+        bool connect_any(vector< shared_ptr<Device> > candidates);
+        /**
+         * Use given device object, e.g. a DeviceEmulator, instead of a HID device.
+         */
+        bool connect_device(shared_ptr<Device> device);
         bool disconnect();
         void set_debug(bool state);
         string get_status();
@@ -82,13 +114,165 @@ namespace nitrokey {
 
         bool is_AES_supported(const char *user_password);
 
+        /**
+         * Long operations of the Storage. Each returns true once the device has begun it and works on in the
+         * background, false if it was done at once. Meanwhile the device answers every command with
+         * LongOperationInProgressException, get_progress_bar_value gives how far it got; see LongOperation to
+         * follow one without blocking a thread.
+         */
+        bool fill_SD_card_with_random_data(const char *admin_pin);
+        bool create_new_keys(const char *admin_pin);
+        bool unlock_encrypted_volume(const char *user_pin);
+        bool export_firmware(const char *admin_pin);
+
+        /**
+         * Progress of the long operation of the Storage in percent, -1 if none is in progress.
+         */
+        int get_progress_bar_value();
+
+        /**
+         * Status of the Storage. It is kept as a snapshot of the connected device for the TTL, on the clock of the
+         * device, and returned meanwhile without querying the device - a query of the Storage takes over a second.
+         * Calls of this manager changing the status (authentication, PIN changes, locking, long operations) drop
+         * the snapshot, changes made otherwise are seen once it expires. 0 - the device is queried each time.
+         */
+        StorageStatus get_storage_status();
+        static constexpr std::chrono::milliseconds DEFAULT_STORAGE_STATUS_TTL = std::chrono::milliseconds(1000);
+        void set_storage_status_ttl(std::chrono::milliseconds ttl);
+
+        string get_flight_recorder_dump();
+
+        /**
+         * True if a device was connected. Its model, std::runtime_error if none.
+         */
+        bool is_connected() const;
+        DeviceModel get_connected_device_model() const;
+
+        /**
+         * Sends a raw HID report of HID_REPORT_SIZE and writes the response to it, of HID_REPORT_SIZE, polling
+         * the device as for the transactions of the command. The response is not checked, nor is the command
+         * authorized. Used by ProxyServer.
+         */
+        void forward_packet(const uint8_t *packet, uint8_t *response);
+
+        /**
+         * Limits of the following operations, checked before each packet is sent and between polls of the device.
+         * An operation taking longer than timeout (0 - no limit) or lasting past deadline
+         * (Clock::time_point::max() - none, on the clock of the device) fails with DeadlineExceededException.
+         * Both stay set for all the operations of the manager until changed; the deadline is an absolute time, so
+         * once it has passed every operation fails until it is reset. set_timeout can be called from any thread,
+         * set_deadline only from the one running the operations.
+         */
+        void set_timeout(std::chrono::milliseconds timeout);
+        void set_deadline(Clock::time_point deadline);
+
+        /**
+         * Make the operation in progress fail with OperationCancelledException. Can be called from any thread; does
+         * nothing if no operation is in progress, and nothing to operations started later.
+         */
+        void cancel();
+
+        /**
+         * Keep the connected device out of USB autosuspend with a keep-alive after idle_threshold without requests,
+         * see KeepAlive. 0 - off (default). Applies to the devices connected later too.
+         */
+        void set_keep_alive(std::chrono::milliseconds idle_threshold);
+        KeepAlive::Stats get_keep_alive_stats();
+
+        /**
+         * Each operation holds the lease of the device (see DeviceLease), so that other processes using the
+         * device wait for it to end. Waiting longer than timeout for the lease fails the operation with
+         * DeviceLeaseTimeoutException. 0 - no lease taken. Can be called from any thread.
+         * Lease stats are of the connected device.
+         */
+        static constexpr std::chrono::milliseconds DEFAULT_LEASE_TIMEOUT = std::chrono::milliseconds(10000);
+        void set_device_lease_timeout(std::chrono::milliseconds timeout);
+        DeviceLease::Stats get_device_lease_stats();
+
+        /**
+         * Variants of the functions above writing the result to a caller buffer, with no heap allocations.
+         * Strings are NUL terminated. If the result does not fit, nothing is written and
+         * TargetBufferSmallerThanSource is thrown with the size needed.
+         */
+        void get_status(char *buffer, size_t buffer_size);
+        void get_serial_number(char *buffer, size_t buffer_size);
+        void get_totp_slot_name(uint8_t slot_number, char *buffer, size_t buffer_size);
+        void get_hotp_slot_name(uint8_t slot_number, char *buffer, size_t buffer_size);
+        void get_password_safe_slot_name(uint8_t slot_number, char *buffer, size_t buffer_size);
+        void get_password_safe_slot_login(uint8_t slot_number, char *buffer, size_t buffer_size);
+        void get_password_safe_slot_password(uint8_t slot_number, char *buffer, size_t buffer_size);
+        void read_config(uint8_t *buffer, size_t buffer_size);
+        void get_password_safe_slot_status(uint8_t *buffer, size_t buffer_size);
+
+        /**
+         * Variants for loops in which the device refusing the command is expected, e.g. probing slots or polling
+         * until one is programmed: the outcome of the exchanges with the device is returned instead of thrown, and
+         * the result is written on success only. Misuse (invalid slot, small buffer) still throws, as does waiting
+         * for the device lease.
+         */
+        TransactionStatus try_get_HOTP_code(uint8_t slot_number, const char *user_temporary_password,
+                                            uint32_t &code);
+        TransactionStatus try_get_TOTP_code(uint8_t slot_number, uint64_t challenge, uint64_t last_totp_time,
+                                            uint8_t last_interval, const char *user_temporary_password,
+                                            uint32_t &code);
+        TransactionStatus try_get_totp_slot_name(uint8_t slot_number, char *buffer, size_t buffer_size);
+        TransactionStatus try_get_hotp_slot_name(uint8_t slot_number, char *buffer, size_t buffer_size);
+        TransactionStatus try_get_password_safe_slot_name(uint8_t slot_number, char *buffer, size_t buffer_size);
+
         ~NitrokeyManager();
     private:
+        friend class AwaitableNitrokeyManager;
+        friend class ProxyServer;
+
+        /*
+         * Each operation runs within one: it is traced, holds the device lease and its transactions are limited
+         * by the timeout, deadline and cancellation of the manager. Operations called by other ones run within the
+         * limits of the outer one. It may end on another thread than it began, as those of
+         * AwaitableNitrokeyManager do.
+         */
+        class Operation {
+        public:
+            Operation(NitrokeyManager &manager, const char *name);
+            ~Operation();
+            Operation(const Operation &) = delete;
+            Operation &operator=(const Operation &) = delete;
+
+        private:
+            void end();
+
+            trace::Span span;
+            NitrokeyManager &manager;
+            // kept alive, an operation may replace the device of the manager
+            shared_ptr<Device> device;
+            bool applied;
+            std::atomic<bool> cancelled;  // set by cancel() while this is the operation in progress
+        };
+
         NitrokeyManager();
 
-        static shared_ptr <NitrokeyManager> _instance;
+        static shared_ptr<Device> make_device(const char *device_model);
+
         bool connected;
         std::shared_ptr<Device> device;
+        uint64_t hotplug_generation;  // of HotplugMonitor when connect() last looked for a device
+        std::chrono::milliseconds keep_alive_threshold;
+        shared_ptr<KeepAlive> keep_alive;
+        KeepAlive::Stats keep_alive_stats;  // of the previous devices
+        void restart_keep_alive(bool connected);
+
+        int operation_depth;
+        std::mutex cancel_mutex;
+        std::atomic<bool> *cancel_target;  // of the outer operation in progress, nullptr if none
+        std::atomic<std::chrono::milliseconds::rep> timeout_ms;
+        Clock::time_point deadline;
+        std::atomic<std::chrono::milliseconds::rep> lease_timeout_ms;
+
+        // snapshot of get_storage_status, of storage_status_device
+        StorageStatus storage_status;
+        weak_ptr<Device> storage_status_device;
+        Clock::time_point storage_status_time;
+        std::chrono::milliseconds storage_status_ttl;
+        void drop_storage_status();
 
         bool is_valid_hotp_slot_number(uint8_t slot_number) const;
         bool is_valid_totp_slot_number(uint8_t slot_number) const;
@@ -97,6 +281,21 @@ namespace nitrokey {
         uint8_t get_internal_slot_number_for_totp(uint8_t slot_number) const;
         bool erase_slot(uint8_t slot_number, const char *temporary_password);
         const char * get_slot_name(uint8_t slot_number);
+        void get_slot_name(uint8_t slot_number, char *buffer, size_t buffer_size);
+        TransactionStatus try_get_slot_name(uint8_t slot_number, char *buffer, size_t buffer_size);
+
+        // payloads shared by the blocking and the awaitable operations
+        GetHOTP::CommandPayload make_HOTP_code_payload(uint8_t slot_number) const;
+        GetTOTP::CommandPayload make_TOTP_code_payload(uint8_t slot_number, uint64_t challenge,
+                                                       uint64_t last_totp_time, uint8_t last_interval) const;
+        WriteToHOTPSlot::CommandPayload make_HOTP_slot_payload(uint8_t slot_number, const char *slot_name,
+                                                               const char *secret, uint8_t hotp_counter,
+                                                               bool use_8_digits, bool use_enter, bool use_tokenID,
+                                                               const char *token_ID) const;
+        WriteToTOTPSlot::CommandPayload make_TOTP_slot_payload(uint8_t slot_number, const char *slot_name,
+                                                               const char *secret, uint16_t time_window,
+                                                               bool use_8_digits, bool use_enter, bool use_tokenID,
+                                                               const char *token_ID) const;
 
         template <typename ProCommand, PasswordKind StoKind>
         void change_PIN_general(char *current_PIN, char *new_PIN);
@@ -0,0 +1,380 @@
+#ifndef LIBNITROKEY_NITROKEYMANAGERAWAITABLE_H
+#define LIBNITROKEY_NITROKEYMANAGERAWAITABLE_H
+
+/*
+ * C++20 coroutine versions of NitrokeyManager operations. Header only, so the library itself stays C++14;
+ * the header is empty when compiled without coroutine support (see NITROKEY_COROUTINES).
+ */
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+#define NITROKEY_COROUTINES 1
+
+#include <condition_variable>
+#include <coroutine>
+#include <exception>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include "NitrokeyManager.h"
+#include "poller.h"
+
+namespace nitrokey {
+    namespace coro {
+
+        template <typename T>
+        class Task;
+
+        namespace detail {
+            struct PromiseBase {
+                std::coroutine_handle<> continuation;
+                std::exception_ptr error;
+
+                // lazy, runs when awaited
+                std::suspend_always initial_suspend() noexcept { return {}; }
+
+                struct FinalAwaiter {
+                    bool await_ready() noexcept { return false; }
+
+                    template <typename Promise>
+                    std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept {
+                        auto continuation = handle.promise().continuation;
+                        return continuation ? continuation : std::noop_coroutine();
+                    }
+
+                    void await_resume() noexcept {}
+                };
+
+                FinalAwaiter final_suspend() noexcept { return {}; }
+
+                void unhandled_exception() { error = std::current_exception(); }
+            };
+
+            template <typename T>
+            struct Promise : PromiseBase {
+                std::optional<T> value;
+
+                Task<T> get_return_object();
+                void return_value(T v) { value = std::move(v); }
+
+                T result() {
+                    if (error) std::rethrow_exception(error);
+                    return std::move(*value);
+                }
+            };
+
+            template <>
+            struct Promise<void> : PromiseBase {
+                Task<void> get_return_object();
+                void return_void() {}
+
+                void result() {
+                    if (error) std::rethrow_exception(error);
+                }
+            };
+
+            /*
+             * Coroutine which starts at once and frees itself when done.
+             */
+            struct Detached {
+                struct promise_type {
+                    Detached get_return_object() noexcept { return {}; }
+                    std::suspend_never initial_suspend() noexcept { return {}; }
+                    std::suspend_never final_suspend() noexcept { return {}; }
+                    void return_void() noexcept {}
+                    void unhandled_exception() noexcept { std::terminate(); }
+                };
+            };
+        }
+
+        /**
+         * Result of a coroutine. Lazy: the coroutine starts when the task is awaited and the awaiting one is
+         * resumed when it completes, on the thread which completed it (usually the Poller thread).
+         */
+        template <typename T = void>
+        class Task {
+        public:
+            typedef detail::Promise<T> promise_type;
+
+            explicit Task(std::coroutine_handle<promise_type> handle) : handle(handle) {}
+            Task(Task &&other) noexcept : handle(std::exchange(other.handle, {})) {}
+            Task(const Task &) = delete;
+            ~Task() {
+                if (handle) handle.destroy();
+            }
+
+            bool await_ready() const noexcept { return false; }
+
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<> continuation) noexcept {
+                handle.promise().continuation = continuation;
+                return handle;
+            }
+
+            T await_resume() { return handle.promise().result(); }
+
+        private:
+            std::coroutine_handle<promise_type> handle;
+        };
+
+        template <typename T>
+        Task<T> detail::Promise<T>::get_return_object() {
+            return Task<T>(std::coroutine_handle<Promise<T>>::from_promise(*this));
+        }
+
+        inline Task<void> detail::Promise<void>::get_return_object() {
+            return Task<void>(std::coroutine_handle<Promise<void>>::from_promise(*this));
+        }
+
+        namespace detail {
+            template <typename T>
+            struct SyncWaitState {
+                struct Nothing {};
+                std::optional<std::conditional_t<std::is_void<T>::value, Nothing, T>> result;
+                std::exception_ptr error;
+                std::mutex mutex;
+                std::condition_variable cv;
+                bool done = false;
+            };
+
+            template <typename T>
+            Detached sync_wait_for(Task<T> &task, SyncWaitState<T> &state) {
+                try {
+                    if constexpr (std::is_void<T>::value) {
+                        co_await task;
+                        state.result.emplace();
+                    } else {
+                        state.result.emplace(co_await task);
+                    }
+                }
+                catch (...) {
+                    state.error = std::current_exception();
+                }
+                std::lock_guard<std::mutex> lock(state.mutex);
+                state.done = true;
+                state.cv.notify_one();
+            }
+        }
+
+        /**
+         * Run the task and block until it completes. For callers outside of coroutines.
+         */
+        template <typename T>
+        T sync_wait(Task<T> task) {
+            detail::SyncWaitState<T> state;
+            detail::sync_wait_for(task, state);
+
+            std::unique_lock<std::mutex> lock(state.mutex);
+            state.cv.wait(lock, [&] { return state.done; });
+            if (state.error) std::rethrow_exception(state.error);
+            if constexpr (!std::is_void<T>::value) return std::move(*state.result);
+        }
+
+        /**
+         * Transaction of Command which suspends the awaiting coroutine instead of sleeping. The packet is sent from
+         * the awaiting thread, receive polls are run by Poller with the device's delays between them.
+         * Awaiting gives what Command::CommandTransaction::run would return.
+         */
+        template <typename Command>
+        class TransactionAwaiter {
+            typedef typename Command::CommandTransaction Transaction;
+
+        public:
+            TransactionAwaiter(device::Device &device, const typename Transaction::CommandPayload &payload)
+                    : device(device), payload(payload) {}
+            ~TransactionAwaiter() { misc::secure_zero(&payload, sizeof payload); }
+
+            bool await_ready() const noexcept { return false; }
+
+            bool await_suspend(std::coroutine_handle<> awaiting) {
+                handle = awaiting;
+                try {
+                    Transaction::send(device, payload, exchange);
+                }
+                catch (...) {
+                    error = std::current_exception();
+                    return false;
+                }
+                // the coroutine may be resumed (and this destroyed) before schedule_after returns
+                device::Poller::instance().schedule_after(exchange.wait, [this] { poll(); },
+                                                          Transaction::priority);
+                return true;
+            }
+
+            auto await_resume() {
+                if (error) std::rethrow_exception(error);
+                return Transaction::finish(device, exchange);
+            }
+
+        private:
+            void poll() {
+                bool done;
+                try {
+                    done = Transaction::try_receive(device, exchange);
+                }
+                catch (...) {
+                    error = std::current_exception();
+                    done = true;
+                }
+                if (!done) {
+                    device::Poller::instance().schedule_after(exchange.wait, [this] { poll(); },
+                                                              Transaction::priority);
+                    return;
+                }
+                handle.resume();
+            }
+
+            device::Device &device;
+            typename Transaction::CommandPayload payload;
+            typename Transaction::Exchange exchange;
+            std::coroutine_handle<> handle;
+            std::exception_ptr error;
+        };
+
+        template <typename Command>
+        TransactionAwaiter<Command> transaction(device::Device &device,
+                                                const typename Command::CommandTransaction::CommandPayload &payload) {
+            return {device, payload};
+        }
+
+        template <typename Command>
+        TransactionAwaiter<Command> transaction(device::Device &device) {
+            typename Command::CommandTransaction::CommandPayload empty_payload;
+            return {device, empty_payload};
+        }
+    }
+
+    /**
+     * Coroutine versions of the main NitrokeyManager operations. They suspend while the device works and are
+     * resumed from the Poller thread, so the calling thread never sleeps and a single thread can drive many devices.
+     * Tasks are lazy: string arguments are read when the task is awaited and have to stay valid until it completes.
+     * As with the blocking functions, a manager runs one operation at a time, and errors are thrown the same way.
+     * Each task is one NitrokeyManager operation, from its start to its end: it holds the device lease (so an
+     * authorization and the command it authorizes are not split) and is limited by the timeout, deadline and
+     * cancellation of the manager. Waiting for the lease held by another process blocks the awaiting thread.
+     */
+    class AwaitableNitrokeyManager {
+    public:
+        explicit AwaitableNitrokeyManager(shared_ptr<NitrokeyManager> manager) : manager(std::move(manager)) {}
+
+        shared_ptr<NitrokeyManager> get_manager() const { return manager; }
+
+        coro::Task<bool> first_authenticate(const char *pin, const char *temporary_password) {
+            NitrokeyManager::Operation operation(*manager, __func__);
+            auto authreq = misc::get_payload<FirstAuthenticate>();
+            misc::strcpyT(authreq.card_password, pin);
+            misc::strcpyT(authreq.temporary_password, temporary_password);
+            co_await coro::transaction<FirstAuthenticate>(device(), authreq);
+            misc::secure_zero(&authreq, sizeof authreq);
+            co_return true;
+        }
+
+        coro::Task<void> user_authenticate(const char *user_password, const char *temporary_password) {
+            NitrokeyManager::Operation operation(*manager, __func__);
+            auto p = misc::get_payload<UserAuthenticate>();
+            misc::strcpyT(p.card_password, user_password);
+            misc::strcpyT(p.temporary_password, temporary_password);
+            co_await coro::transaction<UserAuthenticate>(device(), p);
+            misc::secure_zero(&p, sizeof p);
+        }
+
+        coro::Task<uint32_t> get_HOTP_code(uint8_t slot_number, const char *user_temporary_password) {
+            NitrokeyManager::Operation operation(*manager, __func__);
+            auto gh = manager->make_HOTP_code_payload(slot_number);
+            if (user_temporary_password != nullptr && strlen(user_temporary_password) != 0) {
+                co_await authorize<GetHOTP>(gh, user_temporary_password);
+            }
+            auto resp = co_await coro::transaction<GetHOTP>(device(), gh);
+            co_return resp.data().code;
+        }
+
+        coro::Task<uint32_t> get_TOTP_code(uint8_t slot_number, uint64_t challenge, uint64_t last_totp_time,
+                                           uint8_t last_interval, const char *user_temporary_password) {
+            NitrokeyManager::Operation operation(*manager, __func__);
+            auto gt = manager->make_TOTP_code_payload(slot_number, challenge, last_totp_time, last_interval);
+            if (user_temporary_password != nullptr && strlen(user_temporary_password) != 0) {
+                co_await authorize<GetTOTP>(gt, user_temporary_password);
+            }
+            auto resp = co_await coro::transaction<GetTOTP>(device(), gt);
+            co_return resp.data().code;
+        }
+
+        coro::Task<std::string> get_hotp_slot_name(uint8_t slot_number) {
+            NitrokeyManager::Operation operation(*manager, __func__);
+            if (!manager->is_valid_hotp_slot_number(slot_number)) throw InvalidSlotException(slot_number);
+            co_return co_await get_slot_name(manager->get_internal_slot_number_for_hotp(slot_number));
+        }
+
+        coro::Task<std::string> get_totp_slot_name(uint8_t slot_number) {
+            NitrokeyManager::Operation operation(*manager, __func__);
+            if (!manager->is_valid_totp_slot_number(slot_number)) throw InvalidSlotException(slot_number);
+            co_return co_await get_slot_name(manager->get_internal_slot_number_for_totp(slot_number));
+        }
+
+        coro::Task<bool> write_HOTP_slot(uint8_t slot_number, const char *slot_name, const char *secret,
+                                         uint8_t hotp_counter, bool use_8_digits, bool use_enter, bool use_tokenID,
+                                         const char *token_ID, const char *temporary_password) {
+            NitrokeyManager::Operation operation(*manager, __func__);
+            auto payload = manager->make_HOTP_slot_payload(slot_number, slot_name, secret, hotp_counter, use_8_digits,
+                                                           use_enter, use_tokenID, token_ID);
+            co_await authorize<WriteToHOTPSlot>(payload, temporary_password);
+            co_await coro::transaction<WriteToHOTPSlot>(device(), payload);
+            misc::secure_zero(&payload, sizeof payload);
+            co_return true;
+        }
+
+        coro::Task<bool> write_TOTP_slot(uint8_t slot_number, const char *slot_name, const char *secret,
+                                         uint16_t time_window, bool use_8_digits, bool use_enter, bool use_tokenID,
+                                         const char *token_ID, const char *temporary_password) {
+            NitrokeyManager::Operation operation(*manager, __func__);
+            auto payload = manager->make_TOTP_slot_payload(slot_number, slot_name, secret, time_window, use_8_digits,
+                                                           use_enter, use_tokenID, token_ID);
+            co_await authorize<WriteToTOTPSlot>(payload, temporary_password);
+            co_await coro::transaction<WriteToTOTPSlot>(device(), payload);
+            misc::secure_zero(&payload, sizeof payload);
+            co_return true;
+        }
+
+        coro::Task<std::string> get_status() {
+            NitrokeyManager::Operation operation(*manager, __func__);
+            auto response = co_await coro::transaction<GetStatus>(device());
+            co_return response.data().dissect();
+        }
+
+        coro::Task<std::string> get_serial_number() {
+            NitrokeyManager::Operation operation(*manager, __func__);
+            auto response = co_await coro::transaction<GetStatus>(device());
+            co_return response.data().get_card_serial_hex();
+        }
+
+    private:
+        device::Device &device() {
+            if (manager->device == nullptr) throw std::runtime_error("Device is not connected");
+            return *manager->device;
+        }
+
+        coro::Task<std::string> get_slot_name(uint8_t internal_slot_number) {
+            auto payload = misc::get_payload<GetSlotName>();
+            payload.slot_number = internal_slot_number;
+            auto resp = co_await coro::transaction<GetSlotName>(device(), payload);
+            const auto &name = resp.data().slot_name;
+            co_return std::string((const char *) name, strnlen((const char *) name, sizeof name));
+        }
+
+        // package type to auth, auth type [Authorize,UserAuthorize] follows from command_metadata
+        template <typename S>
+        coro::Task<void> authorize(const typename S::CommandPayload &package, const char *temporary_password) {
+            typedef typename proto::stick10::AuthorizingCommand<S>::type A;
+            auto auth = misc::get_payload<A>();
+            misc::strcpyT(auth.temporary_password, temporary_password);
+            auth.crc_to_authorize = S::CommandTransaction::getCRC(package);
+            co_await coro::transaction<A>(device(), auth);
+            misc::secure_zero(&auth, sizeof auth);
+        }
+
+        shared_ptr<NitrokeyManager> manager;
+    };
+}
+
+#endif
+
+#endif //LIBNITROKEY_NITROKEYMANAGERAWAITABLE_H
@@ -0,0 +1,79 @@
+#ifndef CLOCK_H
+#define CLOCK_H
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <thread>
+
+namespace nitrokey {
+namespace device {
+
+/*
+ *	Source of time for the waits of a device and its transactions (send
+ *	receive delay, retry timeouts). Replaceable per device with
+ *	Device::set_clock(), so timing can be tested without waiting.
+ */
+class Clock {
+ public:
+  typedef std::chrono::steady_clock::time_point time_point;
+
+  virtual ~Clock() {}
+
+  virtual time_point now() = 0;
+  virtual void sleep_for(std::chrono::microseconds duration) = 0;
+};
+
+/*
+ *	Rounded up, so that a wait of it does not end before the given time.
+ */
+inline std::chrono::microseconds ceil_microseconds(
+    Clock::time_point::duration duration) {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+      duration + std::chrono::microseconds(1) -
+      Clock::time_point::duration(1));
+}
+
+/*
+ *	Real time, std::chrono::steady_clock and std::this_thread::sleep_for.
+ */
+class SystemClock : public Clock {
+ public:
+  virtual time_point now() { return std::chrono::steady_clock::now(); }
+  virtual void sleep_for(std::chrono::microseconds duration) {
+    std::this_thread::sleep_for(duration);
+  }
+};
+
+/*
+ *	Time which only moves on sleep_for() and advance(), at once. Starts at
+ *	the steady_clock epoch. Can be shared by devices used from different
+ *	threads; a sleep of each of them moves the time of all.
+ */
+class VirtualClock : public Clock {
+ public:
+  VirtualClock() : m_elapsed(0) {}
+
+  virtual time_point now() {
+    return time_point(std::chrono::steady_clock::duration(m_elapsed.load()));
+  }
+  virtual void sleep_for(std::chrono::microseconds duration) {
+    advance(duration);
+  }
+
+  void advance(std::chrono::steady_clock::duration duration) {
+    m_elapsed += duration.count();
+  }
+
+  /*
+   *	Time slept and advanced in total.
+   */
+  std::chrono::steady_clock::duration elapsed() const {
+    return std::chrono::steady_clock::duration(m_elapsed.load());
+  }
+
+ private:
+  std::atomic<std::chrono::steady_clock::rep> m_elapsed;
+};
+}
+}
+#endif
@@ -86,6 +86,13 @@ enum class CommandID : uint8_t {
 };
 
 const char *commandid_to_string(CommandID id);
+
+/*
+ *	True for commands which payload (either direction) may hold PINs,
+ *	temporary passwords, OTP secrets or password safe data, see
+ *	command_metadata().
+ */
+bool command_carries_secrets(CommandID id);
 }
 }
 #endif
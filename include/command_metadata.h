@@ -0,0 +1,169 @@
+#ifndef COMMAND_METADATA_H
+#define COMMAND_METADATA_H
+#include <cstddef>
+#include "inttypes.h"
+#include "command_id.h"
+
+namespace nitrokey {
+namespace proto {
+
+/*
+ *	Packet which has to precede the command, carrying the CRC of its
+ *	packet and a temporary password.
+ */
+enum class Authorization : uint8_t {
+  NONE,
+  ADMIN,              // Authorize
+  USER,               // UserAuthorize
+  USER_IF_PROTECTED,  // UserAuthorize, if enabled in the general config
+};
+
+/*
+ *	Bit mask of the device models handling a command.
+ */
+enum SupportedModels : uint8_t {
+  PRO_ONLY = 1 << 0,
+  STORAGE_ONLY = 1 << 1,
+  ALL_MODELS = PRO_ONLY | STORAGE_ONLY,
+};
+
+/*
+ *	How long the device takes to answer a command. Sets the RetryPolicy
+ *	used for it (see Device::set_retry_policy) and the order of waiting
+ *	transactions (see scheduling_priority).
+ */
+enum class Latency : uint8_t {
+  QUICK,   // a few milliseconds, status and slot reads
+  NORMAL,  // up to a few hundred milliseconds, flash writes, PIN checks
+  SLOW,    // seconds, key generation, encrypted volumes
+  LONG,    // minutes, reported busy meanwhile
+};
+constexpr size_t LATENCY_COUNT = 4;
+
+struct CommandMetadata {
+  Authorization authorization;
+  uint8_t models;  // SupportedModels
+  bool idempotent;  // only reads, so sending it again is harmless
+  Latency latency;
+  bool carries_secrets;  // see command_carries_secrets
+
+  constexpr bool supports(SupportedModels model) const {
+    return (models & model) != 0;
+  }
+};
+
+/*
+ *	Facts about each command, used at compile time by Transaction and
+ *	NitrokeyManager. Unknown commands are assumed to be slow and to carry
+ *	secrets.
+ */
+constexpr CommandMetadata command_metadata(CommandID id) {
+  using A = Authorization;
+  using L = Latency;
+  switch (id) {
+    case CommandID::GET_STATUS:
+      return {A::NONE, ALL_MODELS, true, L::QUICK, false};
+    case CommandID::WRITE_TO_SLOT:
+      return {A::ADMIN, ALL_MODELS, false, L::NORMAL, true};
+    case CommandID::READ_SLOT_NAME:
+      return {A::NONE, ALL_MODELS, true, L::QUICK, false};
+    case CommandID::READ_SLOT:
+      return {A::NONE, ALL_MODELS, true, L::QUICK, false};
+    case CommandID::GET_CODE:
+      // HOTP counter moves on
+      return {A::USER_IF_PROTECTED, ALL_MODELS, false, L::QUICK, false};
+    case CommandID::WRITE_CONFIG:
+      return {A::ADMIN, ALL_MODELS, false, L::NORMAL, false};
+    case CommandID::ERASE_SLOT:
+      return {A::ADMIN, ALL_MODELS, false, L::NORMAL, false};
+    case CommandID::FIRST_AUTHENTICATE:
+    case CommandID::AUTHORIZE:
+    case CommandID::USER_AUTHENTICATE:
+    case CommandID::USER_AUTHORIZE:
+    case CommandID::UNLOCK_USER_PASSWORD:
+      return {A::NONE, ALL_MODELS, false, L::NORMAL, true};
+    case CommandID::GET_PASSWORD_RETRY_COUNT:
+    case CommandID::GET_USER_PASSWORD_RETRY_COUNT:
+      return {A::NONE, ALL_MODELS, true, L::QUICK, false};
+    case CommandID::CLEAR_WARNING:
+    case CommandID::SET_TIME:
+    case CommandID::TEST_COUNTER:
+    case CommandID::TEST_TIME:
+    case CommandID::LOCK_DEVICE:
+      return {A::NONE, ALL_MODELS, false, L::NORMAL, false};
+    case CommandID::FACTORY_RESET:
+      return {A::NONE, PRO_ONLY, false, L::SLOW, true};
+    // the Storage changes PINs with SEND_PASSWORD and SEND_NEW_PASSWORD
+    case CommandID::CHANGE_USER_PIN:
+    case CommandID::CHANGE_ADMIN_PIN:
+      return {A::NONE, PRO_ONLY, false, L::NORMAL, true};
+
+    case CommandID::ENABLE_CRYPTED_PARI:
+    case CommandID::ENABLE_HIDDEN_CRYPTED_PARI:
+    case CommandID::ENABLE_FIRMWARE_UPDATE:
+    case CommandID::EXPORT_FIRMWARE_TO_FILE:
+    case CommandID::GENERATE_NEW_KEYS:
+    case CommandID::SEND_HIDDEN_VOLUME_PASSWORD:
+      return {A::NONE, STORAGE_ONLY, false, L::SLOW, true};
+    case CommandID::DISABLE_CRYPTED_PARI:
+    case CommandID::DISABLE_HIDDEN_CRYPTED_PARI:
+    case CommandID::SEND_HIDDEN_VOLUME_SETUP:
+      return {A::NONE, STORAGE_ONLY, false, L::SLOW, false};
+    case CommandID::FILL_SD_CARD_WITH_RANDOM_CHARS:
+      return {A::NONE, STORAGE_ONLY, false, L::LONG, true};
+    case CommandID::ENABLE_READONLY_UNCRYPTED_LUN:
+    case CommandID::ENABLE_READWRITE_UNCRYPTED_LUN:
+    case CommandID::SEND_PASSWORD_MATRIX_PINDATA:
+    case CommandID::SEND_PASSWORD:      // STICK20_CMD_SEND_PASSWORD
+    case CommandID::SEND_NEW_PASSWORD:  // STICK20_CMD_SEND_NEW_PASSWORD
+    case CommandID::CLEAR_NEW_SD_CARD_FOUND:
+    case CommandID::SEND_LOCK_STICK_HARDWARE:
+    case CommandID::CHANGE_UPDATE_PIN:
+      return {A::NONE, STORAGE_ONLY, false, L::NORMAL, true};
+    case CommandID::GET_DEVICE_STATUS:
+      return {A::NONE, STORAGE_ONLY, true, L::NORMAL, false};
+    case CommandID::WRITE_STATUS_DATA:
+    case CommandID::SEND_PASSWORD_MATRIX:
+    case CommandID::SEND_PASSWORD_MATRIX_SETUP:
+    case CommandID::SEND_DEVICE_STATUS:
+    case CommandID::SEND_STARTUP:
+    case CommandID::SEND_CLEAR_STICK_KEYS_NOT_INITIATED:
+    case CommandID::PRODUCTION_TEST:
+    case CommandID::SEND_DEBUG_DATA:
+    case CommandID::SD_CARD_HIGH_WATERMARK:
+      return {A::NONE, STORAGE_ONLY, false, L::NORMAL, false};
+
+    case CommandID::GET_PW_SAFE_SLOT_STATUS:
+      return {A::NONE, ALL_MODELS, true, L::QUICK, false};
+    case CommandID::GET_PW_SAFE_SLOT_NAME:
+    case CommandID::GET_PW_SAFE_SLOT_PASSWORD:
+    case CommandID::GET_PW_SAFE_SLOT_LOGINNAME:
+      return {A::NONE, ALL_MODELS, true, L::NORMAL, true};
+    case CommandID::SET_PW_SAFE_SLOT_DATA_1:
+    case CommandID::SET_PW_SAFE_SLOT_DATA_2:
+      return {A::NONE, ALL_MODELS, false, L::NORMAL, true};
+    case CommandID::PW_SAFE_ERASE_SLOT:
+    case CommandID::PW_SAFE_SEND_DATA:
+      return {A::NONE, ALL_MODELS, false, L::NORMAL, false};
+    case CommandID::PW_SAFE_ENABLE:
+    case CommandID::DETECT_SC_AES:
+      return {A::NONE, ALL_MODELS, false, L::SLOW, true};
+    case CommandID::PW_SAFE_INIT_KEY:
+      return {A::NONE, ALL_MODELS, false, L::SLOW, false};
+    // the Storage builds keys with GENERATE_NEW_KEYS
+    case CommandID::NEW_AES_KEY:
+      return {A::NONE, PRO_ONLY, false, L::SLOW, true};
+  }
+  return {A::NONE, ALL_MODELS, false, L::SLOW, true};
+}
+
+/*
+ *	Order of transactions waiting to be polled at the same time, higher
+ *	first, so a slot read is not held up by the polls of long operations.
+ */
+constexpr int scheduling_priority(Latency latency) {
+  return (int)LATENCY_COUNT - 1 - (int)latency;
+}
+}
+}
+#endif
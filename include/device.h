@@ -1,8 +1,22 @@
 #ifndef DEVICE_H
 #define DEVICE_H
+#include <atomic>
 #include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
 #include <hidapi/hidapi.h>
 #include "inttypes.h"
+#include "clock.h"
+#include "command_id.h"
+#include "command_metadata.h"
+#include "device_lease.h"
+#include "retry_policy.h"
 
 #define HID_REPORT_SIZE 65
 
@@ -17,6 +31,80 @@ enum class DeviceModel{
     STORAGE
 };
 
+/*
+ *	Always-on record of the last raw reports exchanged with a device.
+ *	Recording copies a single report into preallocated storage, so it is
+ *	cheap enough to be left enabled. Payloads of commands carrying
+ *	secrets are zeroed before they are stored, with the CRCs derived
+ *	from them.
+ *	Dissection is done only when the record is dumped.
+ *	Devices are used from several threads (keep-alive, proxy, callers),
+ *	so the records are guarded by a mutex, held only for the copies.
+ */
+class FlightRecorder {
+ public:
+  static const size_t CAPACITY = 32;
+
+  enum class Direction : uint8_t { OUTGOING, INCOMING };
+
+  struct Record {
+    std::chrono::steady_clock::time_point time;
+    Direction direction;
+    bool redacted;
+    int status;  // send/recv result
+    uint8_t packet[HID_REPORT_SIZE];
+  };
+
+  FlightRecorder() : m_next(0), m_count(0) {}
+
+  void record(Direction direction, const void *packet, int status,
+              bool redact);
+  void clear() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_next = m_count = 0;
+  }
+  size_t size() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_count;
+  }
+
+  /*
+   *	Copy of a record, oldest first, 0 <= i < size()
+   */
+  Record get(size_t i) const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return at(i);
+  }
+
+  /*
+   *	Human readable dump of all records, through Query/ResponseDissector.
+   */
+  std::string dump() const;
+
+ private:
+  const Record &at(size_t i) const {
+    return m_records[(m_next + CAPACITY - m_count + i) % CAPACITY];
+  }
+
+  mutable std::mutex m_mutex;
+  Record m_records[CAPACITY];
+  size_t m_next;
+  size_t m_count;
+};
+
+/*
+ *	Limits of the operation in progress on a device, checked by its
+ *	transactions before sending and between polls.
+ */
+struct OperationLimits {
+  Clock::time_point deadline;  // time_point::max() - none
+  const std::atomic<bool> *cancelled;  // nullptr - can't be cancelled
+
+  static OperationLimits none() {
+    return OperationLimits{Clock::time_point::max(), nullptr};
+  }
+};
+
 class Device {
 
 public:
@@ -27,43 +115,156 @@ public:
   virtual bool connect();
   virtual bool disconnect();
 
+  /*
+   *	True after a successful connect() until disconnect().
+   */
+  virtual bool is_connected() const { return mp_devhandle != NULL; }
+
+  /*
+   *	Open the device with the given HID path on connect() instead of
+   *	the first one of the model. Needed to use several devices of the
+   *	same model at once.
+   */
+  void set_path(const std::string &path) { m_path = path; }
+
+  /*
+   *	HID paths of all connected devices of this model.
+   */
+  std::vector<std::string> enumerate();
+
+  /*
+   *	Names the device to other processes, see DeviceLease: its HID path,
+   *	whether it was set or the first device of the model was opened, so
+   *	that all ways of connecting a device take the same lease. Empty, so
+   *	no lease, for devices not on the bus.
+   */
+  virtual std::string get_lease_key() const;
+  DeviceLease &get_lease() { return m_lease; }
+
+  /*
+   *	All waits of the device and of transactions run on it go through
+   *	the clock, SystemClock by default. See VirtualClock.
+   */
+  void set_clock(std::shared_ptr<Clock> clock) { m_clock = clock; }
+  Clock &get_clock() const { return *m_clock; }
+
   /*
    *	Sends packet of HID_REPORT_SIZE.
    */
   virtual int send(const void *packet);
 
   /*
-   *	Gets packet of HID_REPORT_SIZE.
-   *	Can sleep. See below.
+   *	Gets packet of HID_REPORT_SIZE. A single read, retrying is left to
+   *	the transaction (see RetryPolicy).
    */
   virtual int recv(void *packet);
 
-  int get_retry_count() const { return m_retry_count; };
-  std::chrono::milliseconds get_retry_timeout() const { return m_retry_timeout; };
+  /*
+   *	Polling for responses of the given command, see RetryPolicy. The
+   *	policy set for the command if any, else the one set for its latency
+   *	class (see command_metadata), else the default one of the device.
+   *	Transactions pass their latency class known at compile time.
+   */
+  const RetryPolicy &get_retry_policy(proto::CommandID command) const {
+    return get_retry_policy(command, proto::command_metadata(command).latency);
+  }
+  const RetryPolicy &get_retry_policy(proto::CommandID command,
+                                      proto::Latency latency) const {
+    if (!m_command_retry_policies.empty()) {
+      for (const auto &p : m_command_retry_policies)
+        if (p.first == command) return p.second;
+    }
+    const auto &p = m_latency_retry_policies[(size_t)latency];
+    return p.first ? p.second : m_retry_policy;
+  }
+  const RetryPolicy &get_retry_policy() const { return m_retry_policy; }
+  void set_retry_policy(const RetryPolicy &policy) { m_retry_policy = policy; }
+  void set_retry_policy(proto::CommandID command, const RetryPolicy &policy);
+  void set_retry_policy(proto::Latency latency, const RetryPolicy &policy) {
+    m_latency_retry_policies[(size_t)latency] = std::make_pair(true, policy);
+  }
+
+  /*
+   *	Exchanges with the device in progress: transactions and whole
+   *	NitrokeyManager operations, which may nest. Keep-alives (see
+   *	KeepAlive) are sent only when none is in progress; an exchange
+   *	started meanwhile waits for the keep-alive to end.
+   */
+  void begin_exchange();
+  void end_exchange();
+
+  /*
+   *	Starts a keep-alive on the calling thread, if no exchange is in
+   *	progress and the last one ended at least idle_threshold ago. Else
+   *	gives the time the last exchange ended.
+   */
+  bool begin_keep_alive(Clock::time_point::duration idle_threshold,
+                        Clock::time_point &last_activity);
+  void end_keep_alive();
+
+  /*
+   *	Called by NitrokeyManager around each of its operations (the outer
+   *	ones), for devices which have to keep the exchanges of an operation
+   *	together themselves, see RemoteDevice.
+   */
+  virtual void begin_operation() {}
+  virtual void end_operation() {}
+
+  /*
+   *	Exchanges ended so far, keep-alives not counted.
+   */
+  uint64_t get_exchange_count();
+
+  /*
+   *	Set by NitrokeyManager for each of its operations.
+   */
+  const OperationLimits &get_operation_limits() const { return m_operation_limits; }
+  void set_operation_limits(const OperationLimits &limits) { m_operation_limits = limits; }
     std::chrono::milliseconds get_send_receive_delay() const {return m_send_receive_delay;}
 
     int get_last_command_status() {auto a = last_command_status; last_command_status = 0; return a;};
     void set_last_command_status(uint8_t _err) { last_command_status = _err;} ;
     bool last_command_sucessfull() const {return last_command_status == 0;};
     DeviceModel get_device_model() const {return m_model;}
+
+    FlightRecorder &get_flight_recorder() { return m_flight_recorder; }
 private:
+    // HID path of the first device of the model, empty if none
+    static std::string first_path(uint16_t vid, uint16_t pid);
+
     uint8_t last_command_status;
 
  protected:
   uint16_t m_vid;
   uint16_t m_pid;
     DeviceModel m_model;
+  std::string m_path;
 
   /*
    *	While the project uses Signal11 portable HIDAPI
    *	library, there's no way of doing it asynchronously,
    *	hence polling.
    */
-  int m_retry_count;
-  std::chrono::milliseconds m_retry_timeout;
+  RetryPolicy m_retry_policy;
+  std::vector<std::pair<proto::CommandID, RetryPolicy>> m_command_retry_policies;
+  std::pair<bool, RetryPolicy> m_latency_retry_policies[proto::LATENCY_COUNT];  // set, policy
   std::chrono::milliseconds m_send_receive_delay;
 
+  std::shared_ptr<Clock> m_clock;
+  OperationLimits m_operation_limits;
+
+  std::mutex m_activity_mutex;
+  std::condition_variable m_keep_alive_ended;
+  int m_exchanges;  // in progress
+  uint64_t m_exchange_count;
+  Clock::time_point m_last_activity;
+  std::thread::id m_keep_alive_thread;  // none if no keep-alive in progress
+  DeviceLease m_lease;
+
   hid_device *mp_devhandle;
+  std::string m_opened_path;  // of mp_devhandle
+
+  FlightRecorder m_flight_recorder;
 };
 
 class Stick10 : public Device {
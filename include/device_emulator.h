@@ -0,0 +1,95 @@
+#ifndef DEVICE_EMULATOR_H
+#define DEVICE_EMULATOR_H
+#include <cstddef>
+#include "inttypes.h"
+#include "device.h"
+
+namespace nitrokey {
+namespace device {
+
+/*
+ *	Nitrokey Pro answering the stick10 protocol from memory, with no
+ *	hardware and no HIDAPI involved. Meant for tests and benchmarks of the
+ *	layers above Device.
+ *	PINs start as the factory ones, 123456 (user) and 12345678 (admin).
+ *	OTP codes are not computed: a HOTP code is the slot counter, which is
+ *	incremented on each use, a TOTP code is the challenge modulo 10^6.
+ */
+class DeviceEmulator : public Device {
+ public:
+  static const size_t PIN_SIZE = 25;
+
+  DeviceEmulator();
+
+  virtual bool connect();
+  virtual bool disconnect();
+  virtual bool is_connected() const { return m_connected; }
+  virtual int send(const void *packet);
+  virtual int recv(void *packet);
+
+  /*
+   *	Commands received so far.
+   */
+  size_t get_command_count() const { return m_command_count; }
+
+  /*
+   *	Time the device works on each command, on the device's clock (see
+   *	Device::set_clock). Until it passes, recv() gets busy status.
+   *	Zero by default.
+   */
+  void set_processing_time(std::chrono::milliseconds processing_time) {
+    m_processing_time = processing_time;
+  }
+
+ private:
+  struct OTPSlot {
+    bool programmed;
+    uint8_t name[15];
+    uint8_t config;
+    uint8_t token_id[13];
+    uint64_t counter;
+  };
+
+  struct PasswordSafeSlot {
+    bool programmed;
+    uint8_t name[11];
+    uint8_t password[20];
+    uint8_t login[32];
+  };
+
+  uint8_t execute(uint8_t command_id, uint32_t crc, const uint8_t *request,
+                  uint8_t *response);
+  OTPSlot *find_otp_slot(uint8_t slot_number);
+  bool check_pin(const uint8_t *pin, size_t size, const uint8_t *expected,
+                 uint8_t &retry_count);
+  bool take_authorization(uint32_t &authorized_crc, uint32_t crc);
+  void factory_reset();
+
+  bool m_connected;
+  bool m_has_response;
+  uint8_t m_response[HID_REPORT_SIZE];
+  size_t m_command_count;
+  std::chrono::milliseconds m_processing_time;
+  Clock::time_point m_ready_at;
+
+  uint8_t m_user_pin[PIN_SIZE];
+  uint8_t m_admin_pin[PIN_SIZE];
+  uint8_t m_user_retry_count;
+  uint8_t m_admin_retry_count;
+  uint8_t m_user_temporary_password[PIN_SIZE];
+  uint8_t m_admin_temporary_password[PIN_SIZE];
+  // CRC of the one packet allowed by the last (User)Authorize, 0 if none
+  uint32_t m_authorized_crc;
+  uint32_t m_user_authorized_crc;
+
+  uint8_t m_general_config[5];
+  uint64_t m_time;
+  OTPSlot m_hotp_slots[3];
+  OTPSlot m_totp_slots[15];
+
+  bool m_password_safe_enabled;
+  PasswordSafeSlot m_password_safe_slots[16];
+};
+}
+}
+#endif
@@ -0,0 +1,83 @@
+#ifndef DEVICE_LEASE_H
+#define DEVICE_LEASE_H
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include "clock.h"
+
+namespace nitrokey {
+namespace device {
+
+/*
+ *	Exclusive use of a device across processes, so that two of them do
+ *	not mix up each other's packets and responses. Held by
+ *	NitrokeyManager for each of its operations (an authorization and the
+ *	command it authorizes are one).
+ *	Advisory flock() locks on files named after the key, in
+ *	$LIBNITROKEY_LOCK_DIR, $XDG_RUNTIME_DIR or /tmp. A process waiting for
+ *	the lease holds a second, turnstile lock, which the holder has to pass
+ *	to take the lease again, so the waiter is served first.
+ *	One lease object is used by one thread at a time; the exchanges of a
+ *	Device (see Device::begin_exchange) make sure of that.
+ */
+class DeviceLease {
+ public:
+  struct Stats {
+    uint64_t acquired;
+    uint64_t contended;  // acquired or timed out after waiting
+    uint64_t timeouts;
+    std::chrono::microseconds total_wait;
+    std::chrono::microseconds max_wait;
+  };
+
+  static constexpr std::chrono::milliseconds MAX_POLL_INTERVAL =
+      std::chrono::milliseconds(16);
+
+  DeviceLease();
+  ~DeviceLease();
+
+  /*
+   *	Waits up to timeout for the lease, polling with growing intervals.
+   *	Throws DeviceLeaseTimeoutException when it passes, and
+   *	DeadlineExceededException or OperationCancelledException on the
+   *	limits of the operation. An empty key needs no lease, as does one
+   *	whose lock files can't be opened.
+   */
+  void acquire(const std::string &key, Clock &clock,
+               std::chrono::milliseconds timeout, Clock::time_point deadline,
+               const std::atomic<bool> *cancelled);
+
+  /*
+   *	Takes the lease if free and nobody waits for it. True also when no
+   *	lease is needed, as for acquire().
+   */
+  bool try_acquire(const std::string &key);
+  void release();
+
+  bool is_held() const { return m_held; }
+  Stats get_stats();
+
+  /*
+   *	Lock file of the key; the turnstile is the one with ".queue" instead
+   *	of ".lock".
+   */
+  static std::string lock_path(const std::string &key);
+
+ private:
+  // false if leasing is not possible for the key
+  bool open(const std::string &key);
+  void close();
+
+  std::string m_key;
+  int m_lock_fd;
+  int m_queue_fd;
+  bool m_held;
+
+  std::mutex m_stats_mutex;
+  Stats m_stats;
+};
+}
+}
+#endif
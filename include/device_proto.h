@@ -1,5 +1,6 @@
 #ifndef DEVICE_PROTO_H
 #define DEVICE_PROTO_H
+#include <algorithm>
 #include <utility>
 #include <thread>
 #include <type_traits>
@@ -13,12 +14,26 @@
 #include "misc.h"
 #include "log.h"
 #include "command_id.h"
+#include "command_metadata.h"
 #include "dissect.h"
+#include "probes.h"
+#include "trace.h"
 #include "CommandFailedException.h"
+#include "LibraryException.h"
+#include "transaction_status.h"
 
 #define STICK20_UPDATE_MODE_VID 0x03EB
 #define STICK20_UPDATE_MODE_PID 0x2FF1
 
+/*
+ *	While the Storage works on a long operation (filling the SD card,
+ *	generating keys, ...) it answers every command with this device_status,
+ *	and the progress in percent at this place of the response payload (see
+ *	stick20::GetDeviceStatus).
+ */
+#define STICK20_DEVICE_STATUS_BUSY_PROGRESSBAR 4
+#define STICK20_PROGRESS_BAR_OFFSET 16
+
 #define PAYLOAD_SIZE 53
 #define PWS_SLOT_COUNT 16
 #define PWS_SLOTNAME_LENGTH 11
@@ -82,6 +97,31 @@ struct HIDReport {
   }
 } __packed;
 
+/*
+ *	Bytes of the HIDReport of a command without payload, CRC included.
+ *	Made at compile time, such commands are sent straight from static
+ *	storage (see Transaction::send).
+ */
+struct ConstantReport {
+  uint8_t bytes[HID_REPORT_SIZE];
+};
+
+constexpr ConstantReport make_constant_report(CommandID cmd_id) {
+  ConstantReport report{};
+  report.bytes[1] = (uint8_t)cmd_id;
+  // as HIDReport::calculate_CRC() on a little endian host
+  uint32_t crc = 0xffffffff;
+  for (size_t i = 1; i < HID_REPORT_SIZE - 4; i += 4) {
+    crc = misc::stm_crc32_word(crc, (uint32_t)report.bytes[i] |
+                                        (uint32_t)report.bytes[i + 1] << 8 |
+                                        (uint32_t)report.bytes[i + 2] << 16 |
+                                        (uint32_t)report.bytes[i + 3] << 24);
+  }
+  for (size_t i = 0; i < 4; i++)
+    report.bytes[HID_REPORT_SIZE - 4 + i] = (uint8_t)(crc >> (8 * i));
+  return report;
+}
+
 /*
  *	Response payload (the parametrized type inside struct HIDReport)
  *
@@ -131,6 +171,7 @@ struct EmptyPayload {
   bool isValid() const { return true; }
 
   std::string dissect() const { return std::string("Empty Payload."); }
+  void dissect(DissectWriter &out) const { out.text("Empty Payload."); }
 } __packed;
 
 template <typename command_packet, typename response_payload>
@@ -138,10 +179,10 @@ class ClearingProxy{
 public:
     ClearingProxy(command_packet &p){
         packet = p;
-        bzero(&p, sizeof(p));
+        misc::secure_zero(&p, sizeof(p));
     }
     ~ClearingProxy(){
-        bzero(&packet, sizeof(packet));
+        misc::secure_zero(&packet, sizeof(packet));
     }
 
     response_payload & data() {
@@ -151,16 +192,84 @@ public:
     command_packet packet;
 };
 
+/*
+ *	CANCELLED or DEADLINE_EXCEEDED if the operation a transaction is a
+ *	part of has been cancelled or has run out of time, OK otherwise.
+ */
+TransactionStatus::Outcome operation_limits_outcome(device::Device &dev);
+
+/*
+ *	Receive side of an exchange with the device, the same for all
+ *	commands: polls for the response to the report sent with sent_crc, as
+ *	the RetryPolicy of the command allows. Used by Transaction, and for
+ *	reports of commands not known at compile time (see
+ *	NitrokeyManager::forward_packet).
+ */
+struct ReceiveState {
+  int status;  // of the last Device::send() or Device::recv()
+  device::Backoff backoff;
+  std::chrono::microseconds wait;  // before the next receive attempt
+  bool exhausted;                  // no response within the RetryPolicy
+  // operation limits exceeded between the receive attempts
+  TransactionStatus::Outcome interrupted;
+  bool long_operation;  // the Storage is busy with a long operation
+
+  // dissection of a response which is not the awaited one
+  typedef void (*ResponseLogger)(const void *response);
+
+  void reset();
+
+  /*
+   *	Once the report was sent: the wait before the first attempt is the
+   *	send receive delay of the device, or none for spinning policies.
+   */
+  void start(device::Device &dev, CommandID id, Latency latency);
+
+  /*
+   *	One receive attempt into response, of HID_REPORT_SIZE. True when
+   *	done: the response came, the Storage is busy with a long operation,
+   *	the RetryPolicy allows no more attempts or the operation limits are
+   *	exceeded (interrupted set). Otherwise sets the wait before the next
+   *	one.
+   */
+  bool attempt(device::Device &dev, CommandID id, bool carries_secrets,
+               uint32_t sent_crc, void *response,
+               ResponseLogger log_invalid = nullptr);
+
+  /*
+   *	Attempts until done, blocking on the waits before them.
+   */
+  void run(device::Device &dev, CommandID id, bool carries_secrets,
+           uint32_t sent_crc, void *response,
+           ResponseLogger log_invalid = nullptr);
+};
+
 template <CommandID cmd_id, typename command_payload, typename response_payload>
 class Transaction : semantics::non_constructible {
  public:
   // Types declared in command class scope can't be reached from there.
   typedef command_payload CommandPayload;
   typedef response_payload ResponsePayload;
+  static constexpr CommandID command_id = cmd_id;
 
   typedef struct HIDReport<cmd_id, CommandPayload> OutgoingPacket;
   typedef struct DeviceResponse<cmd_id, ResponsePayload> ResponsePacket;
 
+  /*
+   *	Facts about the command, see command_metadata(). They choose the
+   *	RetryPolicy, the redaction of recorded packets and the order among
+   *	transactions polled at the same time.
+   */
+  static constexpr CommandMetadata metadata = command_metadata(cmd_id);
+  static constexpr int priority = scheduling_priority(metadata.latency);
+
+  /*
+   *	Packet of commands without payload, sent as it is.
+   */
+  static constexpr bool has_constant_packet =
+      std::is_same<command_payload, EmptyPayload>::value;
+  static constexpr ConstantReport constant_packet = make_constant_report(cmd_id);
+
   static_assert(std::is_pod<OutgoingPacket>::value,
                 "outgoingpacket must be a pod type");
   static_assert(std::is_pod<ResponsePacket>::value,
@@ -181,82 +290,275 @@ class Transaction : semantics::non_constructible {
 
     template <typename T>
     static void clear_packet(T &st){
-        bzero(&st, sizeof(st));
+        misc::secure_zero(&st, sizeof(st));
     }
 
+    /*
+     *	Dump the packets which led to a failure. Dissection is done only if
+     *	the message is going to be printed.
+     */
+    static void log_flight_recorder(device::Device &dev, log::Loglevel lvl) {
+      using namespace ::nitrokey::log;
+      if (!Log::instance().is_enabled(lvl)) return;
+      Log::instance()(std::string("Last packets exchanged with the device:\n") +
+                          dev.get_flight_recorder().dump(),
+                      lvl);
+    }
 
-    static ClearingProxy<ResponsePacket, response_payload> run(device::Device &dev,
-                              const command_payload &payload) {
-    using namespace ::nitrokey::device;
-    using namespace ::nitrokey::log;
-     using namespace std::chrono_literals;
-
-    Log::instance()(__PRETTY_FUNCTION__, Loglevel::DEBUG_L2);
-
-    int status;
-    OutgoingPacket outp;
-    ResponsePacket resp;
-
-    // POD types can't have non-default constructors
-    outp.initialize();
-    resp.initialize();
-
-    outp.payload = payload;
-    outp.update_CRC();
-
-    Log::instance()("Outgoing HID packet:", Loglevel::DEBUG);
-    Log::instance()((std::string)(outp), Loglevel::DEBUG);
 
-    if (!outp.isValid()) throw std::runtime_error("Invalid outgoing packet");
+    /*
+     *	Dissection into a stack buffer, done only if the message is going
+     *	to be printed.
+     */
+    template <typename Dissector, typename Packet>
+    static void log_packet(const char *title, const Packet &packet,
+                           log::Loglevel lvl) {
+      using namespace ::nitrokey::log;
+      if (!Log::instance().is_enabled(lvl)) return;
+      char buf[DISSECT_BUFFER_SIZE];
+      DissectWriter out(buf, sizeof buf);
+      out.text(title).character('\n');
+      Dissector::dissect(packet, out);
+      Log::instance()(out.c_str(), lvl);
+    }
 
-    status = dev.send(&outp);
-    if (status <= 0)
-      throw std::runtime_error(
-          std::string("Device error while sending command ") +
-          std::to_string((int)(status)));
+    static TransactionStatus make_status(TransactionStatus::Outcome outcome,
+                                         int device_result = 0,
+                                         uint8_t last_command_status = 0) {
+      return TransactionStatus{outcome, (uint8_t)cmd_id, last_command_status,
+                               device_result, 0};
+    }
 
-      std::this_thread::sleep_for(dev.get_send_receive_delay());
+    /*
+     *	State of a transaction between its phases. Wiped on destruction, as
+     *	the packets may carry secrets.
+     */
+    struct Exchange : ReceiveState {
+      OutgoingPacket outp;
+      ResponsePacket resp;
+      device::Device *device;          // the exchange is begun on
+
+      Exchange() : device(nullptr) {}
+      ~Exchange() {
+        if (device != nullptr) device->end_exchange();
+        misc::secure_zero(this, sizeof *this);
+      }
+    };
+
+    /*
+     *	run() is made of the phases below: send(), try_receive() until it
+     *	returns true, finish(). Before each try_receive() call there is a
+     *	wait of Exchange::wait (the send receive delay or none before the
+     *	first one, see RetryPolicy).
+     *	Callers which can't block on the waits (see Poller) call the phases
+     *	themselves. The phases throw on failures; their variants returning
+     *	a TransactionStatus (try_send(), receive_attempt(), check()) don't.
+     */
+    static void send(device::Device &dev, const command_payload &payload,
+                     Exchange &x) {
+      try_send(dev, payload, x).raise();
+    }
 
-      // FIXME make checks done in device:recv here
-    int retry = dev.get_retry_count();
-    while (retry-- > 0) {
-      status = dev.recv(&resp);
+    static TransactionStatus try_send(device::Device &dev,
+                                      const command_payload &payload,
+                                      Exchange &x) {
+      using namespace ::nitrokey::device;
+      using namespace ::nitrokey::log;
+
+      x.reset();
+      dev.begin_exchange();
+      x.device = &dev;
+      const auto limits = operation_limits_outcome(dev);
+      if (limits != TransactionStatus::Outcome::OK) return make_status(limits);
+      const OutgoingPacket *packet;
+      if (has_constant_packet) {
+        // only the CRC is needed from x.outp
+        packet = reinterpret_cast<const OutgoingPacket *>(constant_packet.bytes);
+        x.outp.crc = packet->crc;
+        x.resp.initialize();
+      } else {
+        trace::Span span("transaction", "build");
+        // POD types can't have non-default constructors
+        x.outp.initialize();
+        x.resp.initialize();
+
+        x.outp.payload = payload;
+        x.outp.update_CRC();
+        packet = &x.outp;
+      }
+
+      log_packet<QueryDissector<cmd_id, OutgoingPacket>>(
+          "Outgoing HID packet:", *packet, Loglevel::DEBUG);
+
+      if (!packet->isValid()) throw std::runtime_error("Invalid outgoing packet");
+
+      {
+        trace::Span span("transaction", "send");
+        x.status = dev.send(packet);
+      }
+      NK_PROBE2(device__send, (int)cmd_id, x.status);
+      dev.get_flight_recorder().record(FlightRecorder::Direction::OUTGOING,
+                                       packet, x.status,
+                                       metadata.carries_secrets);
+      if (x.status <= 0) {
+        log_flight_recorder(dev, Loglevel::ERROR);
+        return make_status(TransactionStatus::Outcome::SEND_FAILED, x.status);
+      }
+      x.start(dev, cmd_id, metadata.latency);
+      return make_status(TransactionStatus::Outcome::OK);
+    }
 
-      dev.set_last_command_status(resp.last_command_status); // FIXME should be handled on device.recv
+    /*
+     *	One receive attempt. True when done: a response to the sent packet
+     *	came or the RetryPolicy allows no more attempts. Otherwise sets the
+     *	wait before the next one. Throws between the attempts if the
+     *	operation limits are exceeded.
+     */
+    static bool try_receive(device::Device &dev, Exchange &x) {
+      const bool done = receive_attempt(dev, x);
+      make_status(x.interrupted).raise();
+      return done;
+    }
 
-      if (resp.device_status == 0 && resp.last_command_crc == outp.crc) break;
-      Log::instance()("Device is not ready or received packet's last CRC is not equal to sent CRC packet, retrying...",
-                      Loglevel::DEBUG);
-      Log::instance()("Invalid incoming HID packet:", Loglevel::DEBUG_L2);
-      Log::instance()((std::string)(resp), Loglevel::DEBUG_L2);
-      std::this_thread::sleep_for(dev.get_retry_timeout());
-      continue;
+    /*
+     *	As try_receive(), but exceeded operation limits end the exchange
+     *	with Exchange::interrupted set.
+     */
+    static bool receive_attempt(device::Device &dev, Exchange &x) {
+      return x.attempt(dev, cmd_id, metadata.carries_secrets, x.outp.crc,
+                       &x.resp, &log_invalid_response);
     }
-    clear_packet(outp);
 
-    if (status <= 0)
-      throw std::runtime_error(
-          std::string("Device error while executing command ") +
-          std::to_string(status));
+    static void log_invalid_response(const void *response) {
+      log_packet<ResponseDissector<cmd_id, ResponsePacket>>(
+          "Invalid incoming HID packet:",
+          *static_cast<const ResponsePacket *>(response),
+          log::Loglevel::DEBUG_L2);
+    }
 
-    Log::instance()("Incoming HID packet:", Loglevel::DEBUG);
-    Log::instance()((std::string)(resp), Loglevel::DEBUG);
-    Log::instance()(std::string("Retry count: ") + std::to_string(retry), Loglevel::DEBUG);
+    static ClearingProxy<ResponsePacket, response_payload> finish(
+        device::Device &dev, Exchange &x) {
+      check(dev, x, log::Loglevel::WARNING).raise();
+      // See: DeviceResponse
+      return x.resp;
+    }
 
-    if (!resp.isValid()) throw std::runtime_error("Invalid incoming packet");
-    if (retry <= 0) throw std::runtime_error("Maximum retry count reached for receiving response from the device!");
-    if (resp.last_command_status!=0) throw CommandFailedException(resp.command_id, resp.last_command_status);
+    /*
+     *	Outcome of the exchange, once try_receive() or receive_attempt()
+     *	returned true. The packets are logged at failed_command_loglevel
+     *	when the device refuses the command.
+     */
+    static TransactionStatus check(device::Device &dev, Exchange &x,
+                                   log::Loglevel failed_command_loglevel) {
+      using namespace ::nitrokey::log;
+      typedef TransactionStatus::Outcome Outcome;
+
+      if (!has_constant_packet) clear_packet(x.outp);
+
+      if (x.interrupted != Outcome::OK) return make_status(x.interrupted);
+      if (x.status <= 0) {
+        log_flight_recorder(dev, Loglevel::ERROR);
+        return make_status(Outcome::RECEIVE_FAILED, x.status);
+      }
+
+      log_packet<ResponseDissector<cmd_id, ResponsePacket>>(
+          "Incoming HID packet:", x.resp, Loglevel::DEBUG);
+      if (Log::instance().is_enabled(Loglevel::DEBUG))
+        Log::instance()(std::string("Receive attempts: ") +
+                            std::to_string(x.backoff.get_attempts() + 1),
+                        Loglevel::DEBUG);
+
+      if (!x.resp.isValid()) throw std::runtime_error("Invalid incoming packet");
+      if (x.long_operation) {
+        TransactionStatus status =
+            make_status(Outcome::LONG_OPERATION_IN_PROGRESS, x.status);
+        status.progress = x.resp._padding[STICK20_PROGRESS_BAR_OFFSET];
+        return status;
+      }
+      if (x.exhausted) {
+        log_flight_recorder(dev, Loglevel::ERROR);
+        return make_status(x.backoff.deadline_passed()
+                               ? Outcome::RETRY_DEADLINE_PASSED
+                               : Outcome::NO_RESPONSE);
+      }
+      if (x.resp.last_command_status!=0) {
+        log_flight_recorder(dev, failed_command_loglevel);
+        return TransactionStatus{Outcome::COMMAND_FAILED, x.resp.command_id,
+                                 x.resp.last_command_status, x.status, 0};
+      }
+      return make_status(Outcome::OK, x.status);
+    }
 
+    /*
+     *	All phases, blocking on the waits.
+     */
+    static TransactionStatus exchange(device::Device &dev,
+                                      const command_payload &payload,
+                                      Exchange &x,
+                                      log::Loglevel failed_command_loglevel) {
+      using namespace ::nitrokey::log;
+
+      Log::instance()(__PRETTY_FUNCTION__, Loglevel::DEBUG_L2);
+      trace::Span transaction_span("transaction", commandid_to_string(cmd_id),
+                                   (int)cmd_id);
+
+      NK_PROBE1(transaction__start, (int)cmd_id);
+      auto status = try_send(dev, payload, x);
+      int attempts = 0;
+      if (status) {
+        x.run(dev, cmd_id, metadata.carries_secrets, x.outp.crc, &x.resp,
+              &log_invalid_response);
+        attempts = x.backoff.get_attempts() + 1;
+        status = check(dev, x, failed_command_loglevel);
+      }
+      NK_PROBE4(transaction__done, (int)cmd_id, attempts, (int)status.outcome,
+                (int)status.last_command_status);
+      (void)attempts;  // read by the probe only, which may be compiled out
+      return status;
+    }
 
+    static ClearingProxy<ResponsePacket, response_payload> run(device::Device &dev,
+                              const command_payload &payload) {
+      Exchange x;
+      exchange(dev, payload, x, log::Loglevel::WARNING).raise();
       // See: DeviceResponse
-    return resp;
-  }
+      return x.resp;
+    }
+
+    /*
+     *	As run(), without exceptions for the outcomes of the exchange; the
+     *	response payload is copied to response on success only. Refused
+     *	commands are logged at DEBUG level, as the callers expect them.
+     */
+    static TransactionStatus try_run(device::Device &dev,
+                                     const command_payload &payload,
+                                     response_payload &response) {
+      Exchange x;
+      const auto status = exchange(dev, payload, x, log::Loglevel::DEBUG);
+      if (status) response = x.resp.payload;
+      return status;
+    }
 
   static ClearingProxy<ResponsePacket, response_payload> run(device::Device &dev) {
     command_payload empty_payload;
     return run(dev, empty_payload);
   }
 };
+
+template <CommandID cmd_id, typename command_payload, typename response_payload>
+constexpr CommandID
+    Transaction<cmd_id, command_payload, response_payload>::command_id;
+template <CommandID cmd_id, typename command_payload, typename response_payload>
+constexpr CommandMetadata
+    Transaction<cmd_id, command_payload, response_payload>::metadata;
+template <CommandID cmd_id, typename command_payload, typename response_payload>
+constexpr int Transaction<cmd_id, command_payload, response_payload>::priority;
+template <CommandID cmd_id, typename command_payload, typename response_payload>
+constexpr bool
+    Transaction<cmd_id, command_payload, response_payload>::has_constant_packet;
+template <CommandID cmd_id, typename command_payload, typename response_payload>
+constexpr ConstantReport
+    Transaction<cmd_id, command_payload, response_payload>::constant_packet;
 }
 }
 #endif
@@ -3,84 +3,219 @@
  */
 #ifndef DISSECT_H
 #define DISSECT_H
+#include <cstddef>
+#include <cstring>
 #include <string>
-#include <sstream>
-#include <iomanip>
+#include "inttypes.h"
 #include "misc.h"
 #include "cxx_semantics.h"
 #include "command_id.h"
-#include "device_proto.h"
 
 namespace nitrokey {
 namespace proto {
 
+/*
+ *	Big enough for the text dissection of any packet
+ */
+static const size_t DISSECT_BUFFER_SIZE = 2048;
+
+/*
+ *	Appends text to a caller supplied buffer and never allocates.
+ *	Output not fitting in the buffer is cut, the buffer is always
+ *	NUL terminated.
+ */
+class DissectWriter {
+ public:
+  DissectWriter(char *buf, size_t size);
+
+  // inline, so the length of literals is known at compile time
+  DissectWriter &text(const char *s) { return text(s, strlen(s)); }
+  // length bytes, NULs included, see c_string for fields
+  DissectWriter &text(const char *s, size_t length) {
+    if (length > m_capacity - m_length || m_capacity == 0)
+      return text_truncated(s, length);
+    memcpy(m_buf + m_length, s, length);
+    m_length += length;
+    m_buf[m_length] = 0;
+    return *this;
+  }
+  DissectWriter &character(char c) { return text(&c, 1); }
+  DissectWriter &dec(uint64_t value);
+  DissectWriter &dec_signed(int64_t value);
+  // lowercase, no leading zeros
+  DissectWriter &hex(uint64_t value);
+  // fixed 8 digits, as used for CRCs
+  DissectWriter &hex32(uint32_t value);
+  DissectWriter &binary8(uint8_t value);
+  // "0a1b2c", the form used in JSON output
+  DissectWriter &hex_compact(const void *data, size_t size);
+  // "0a 1b 2c \n", 16 bytes per line
+  DissectWriter &hexdump(const void *data, size_t size,
+                         bool print_header = true);
+  // C string of at most max_length characters, stops at NUL
+  DissectWriter &c_string(const uint8_t *s, size_t max_length);
+
+  const char *c_str() const { return m_buf; }
+  size_t size() const { return m_length; }
+  bool truncated() const { return m_truncated; }
+
+ private:
+  DissectWriter &text_truncated(const char *s, size_t length);
+
+  char *m_buf;
+  size_t m_capacity;  // without the terminating NUL
+  size_t m_length;
+  bool m_truncated;
+};
+
+/*
+ *	Names of DeviceResponse device_status and last_command_status,
+ *	"UNKNOWN" for values out of range.
+ */
+const char *device_status_to_string(uint8_t status);
+const char *command_status_to_string(uint8_t status);
+
+/*
+ *	Payload dissection preference: the writer based dissect() of the
+ *	payload, the std::string one, a raw dump of the payload bytes.
+ */
+template <typename Payload>
+auto dissect_payload(const Payload &payload, DissectWriter &out, int)
+    -> decltype(payload.dissect(out), void()) {
+  payload.dissect(out);
+}
+
+template <typename Payload>
+auto dissect_payload(const Payload &payload, DissectWriter &out, long)
+    -> decltype(payload.dissect(), void()) {
+  const std::string s = payload.dissect();
+  out.text(s.data(), s.size());
+}
+
+template <typename Payload>
+void dissect_payload(const Payload &payload, DissectWriter &out, ...) {
+  out.hexdump(&payload, sizeof payload);
+}
+
+/*
+ *	std::string form of the writer based dissect() of a payload, for the
+ *	payloads keeping the older interface.
+ */
+template <typename Payload>
+std::string dissect_to_string(const Payload &payload) {
+  char buf[DISSECT_BUFFER_SIZE];
+  DissectWriter out(buf, sizeof buf);
+  payload.dissect(out);
+  return std::string(out.c_str(), out.size());
+}
+
+// payload bytes without the trailing zeros, for the compact JSON form
+size_t payload_used_size(const uint8_t *data, size_t size);
+
 template <CommandID id, class HIDPacket>
 class QueryDissector : semantics::non_constructible {
  public:
-  static std::string dissect(const HIDPacket &pod) {
-    std::stringstream out;
+  static void dissect(const HIDPacket &pod, DissectWriter &out) {
+    out.text("Raw HID packet:\n");
+    out.hexdump(&pod, sizeof pod);
 
-    out << "Raw HID packet:" << std::endl;
-    out << ::nitrokey::misc::hexdump((const char *)(&pod), sizeof pod);
+    out.text("Contents:\nCommand ID:\t")
+        .text(commandid_to_string((CommandID)(pod.command_id)))
+        .text("\nCRC:\t")
+        .hex32(pod.crc)
+        .text("\nPayload:\n");
+    dissect_payload(pod.payload, out, 0);
+  }
 
-    out << "Contents:" << std::endl;
-    out << "Command ID:\t" << commandid_to_string((CommandID)(pod.command_id))
-        << std::endl;
-      out << "CRC:\t"
-        << std::hex << std::setw(2) << std::setfill('0')
-        << pod.crc << std::endl;
+  static size_t dissect(const HIDPacket &pod, char *buf, size_t size) {
+    DissectWriter out(buf, size);
+    dissect(pod, out);
+    return out.size();
+  }
 
-      out << "Payload:" << std::endl;
-    out << pod.payload.dissect();
-    return out.str();
+  static std::string dissect(const HIDPacket &pod) {
+    char buf[DISSECT_BUFFER_SIZE];
+    return std::string(buf, dissect(pod, buf, sizeof buf));
+  }
+
+  /*
+   *	One line JSON object, payload as hex without trailing zeros.
+   */
+  static size_t dissect_json(const HIDPacket &pod, char *buf, size_t size) {
+    DissectWriter out(buf, size);
+    out.text("{\"command\":\"")
+        .text(commandid_to_string((CommandID)(pod.command_id)))
+        .text("\",\"command_id\":")
+        .dec((uint8_t)pod.command_id)
+        .text(",\"crc\":\"")
+        .hex32(pod.crc)
+        .text("\",\"payload\":\"")
+        .hex_compact(pod._padding,
+                     payload_used_size(pod._padding, sizeof pod._padding))
+        .text("\"}");
+    return out.size();
   }
 };
 
 template <CommandID id, class HIDPacket>
 class ResponseDissector : semantics::non_constructible {
  public:
+  static void dissect(const HIDPacket &pod, DissectWriter &out) {
+    out.text("Raw HID packet:\n");
+    out.hexdump(&pod, sizeof pod);
+
+    out.text("Device status:\t")
+        .dec(pod.device_status)
+        .character(' ')
+        .text(device_status_to_string(pod.device_status))
+        .text("\nCommand ID:\t")
+        .text(commandid_to_string((CommandID)(pod.command_id)))
+        .text("\nLast command CRC:\t")
+        .hex32(pod.last_command_crc)
+        .text("\nLast command status:\t")
+        .dec(pod.last_command_status)
+        .character(' ')
+        .text(command_status_to_string(pod.last_command_status))
+        .text("\nCRC:\t")
+        .hex32(pod.crc)
+        .text("\nPayload:\n");
+    dissect_payload(pod.payload, out, 0);
+  }
+
+  static size_t dissect(const HIDPacket &pod, char *buf, size_t size) {
+    DissectWriter out(buf, size);
+    dissect(pod, out);
+    return out.size();
+  }
+
   static std::string dissect(const HIDPacket &pod) {
-    std::stringstream out;
-
-    // FIXME use values from firmware (possibly generate separate
-    // header automatically)
-    std::string status[4];
-    status[0] = " STATUS_READY";
-    status[1] = " STATUS_BUSY";
-    status[2] = " STATUS_ERROR";
-    status[3] = " STATUS_RECEIVED_REPORT";
-    std::string cmd[11];
-    cmd[0] = " CMD_STATUS_OK";
-    cmd[1] = " CMD_STATUS_WRONG_CRC";
-    cmd[2] = " CMD_STATUS_WRONG_SLOT";
-    cmd[3] = " CMD_STATUS_SLOT_NOT_PROGRAMMED";
-    cmd[4] = " CMD_STATUS_WRONG_PASSWORD";
-    cmd[5] = " CMD_STATUS_NOT_AUTHORIZED";
-    cmd[6] = " CMD_STATUS_TIMESTAMP_WARNING";
-    cmd[7] = " CMD_STATUS_NO_NAME_ERROR";
-    cmd[8] = " CMD_STATUS_NOT_SUPPORTED";
-    cmd[9] = " CMD_STATUS_UNKNOWN_COMMAND";
-    cmd[10] = " CMD_STATUS_AES_DEC_FAILED";
-
-    out << "Raw HID packet:" << std::endl;
-    out << ::nitrokey::misc::hexdump((const char *)(&pod), sizeof pod);
-
-    out << "Device status:\t" << pod.device_status + 0 << " "
-        << status[pod.device_status] << std::endl;
-    out << "Command ID:\t" << commandid_to_string((CommandID)(pod.command_id))
-        << std::endl;
-    out << "Last command CRC:\t"
-            << std::hex << std::setw(2) << std::setfill('0')
-            << pod.last_command_crc << std::endl;
-    out << "Last command status:\t" << pod.last_command_status + 0 << " "
-        << cmd[pod.last_command_status] << std::endl;
-    out << "CRC:\t"
-            << std::hex << std::setw(2) << std::setfill('0')
-            << pod.crc << std::endl;
-
-    out << "Payload:" << std::endl;
-    out << pod.payload.dissect();
-    return out.str();
+    char buf[DISSECT_BUFFER_SIZE];
+    return std::string(buf, dissect(pod, buf, sizeof buf));
+  }
+
+  static size_t dissect_json(const HIDPacket &pod, char *buf, size_t size) {
+    DissectWriter out(buf, size);
+    out.text("{\"device_status\":")
+        .dec(pod.device_status)
+        .text(",\"device_status_name\":\"")
+        .text(device_status_to_string(pod.device_status))
+        .text("\",\"command\":\"")
+        .text(commandid_to_string((CommandID)(pod.command_id)))
+        .text("\",\"command_id\":")
+        .dec(pod.command_id)
+        .text(",\"last_command_crc\":\"")
+        .hex32(pod.last_command_crc)
+        .text("\",\"last_command_status\":")
+        .dec(pod.last_command_status)
+        .text(",\"last_command_status_name\":\"")
+        .text(command_status_to_string(pod.last_command_status))
+        .text("\",\"crc\":\"")
+        .hex32(pod.crc)
+        .text("\",\"payload\":\"")
+        .hex_compact(pod._padding,
+                     payload_used_size(pod._padding, sizeof pod._padding))
+        .text("\"}");
+    return out.size();
   }
 };
 }
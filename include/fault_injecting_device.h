@@ -0,0 +1,84 @@
+#ifndef FAULT_INJECTING_DEVICE_H
+#define FAULT_INJECTING_DEVICE_H
+#include <cstddef>
+#include <memory>
+#include <random>
+#include "device.h"
+
+namespace nitrokey {
+namespace device {
+
+/*
+ *	Device passing packets to another one (any transport, e.g.
+ *	DeviceEmulator) and spoiling some of the received ones, to exercise and
+ *	measure the recovery paths of transactions.
+ *	The delays, default RetryPolicy and model are copied from the wrapped
+ *	device on construction. Waits of transactions go through the
+ *	clock of this device, so give the same clock to both devices when
+ *	testing with a VirtualClock.
+ */
+class FaultInjectingDevice : public Device {
+ public:
+  enum class Fault : uint8_t {
+    BUSY,          // device_status set to busy
+    STALE_CRC,     // last_command_crc not of the sent packet
+    RECV_FAILURE,  // recv fails, nothing read
+    SHORT_READ,    // only a part of the report read, the rest zeroed
+  };
+  static const size_t FAULT_COUNT = 4;
+
+  /*
+   *	When a fault happens. A fault lasts for burst receives and starts
+   *	either on every period-th receive (period > 0) or at random, with
+   *	the given rate per receive (period == 0).
+   */
+  struct Profile {
+    double rate;
+    size_t period;
+    size_t burst;
+  };
+
+  explicit FaultInjectingDevice(std::shared_ptr<Device> device,
+                                uint32_t seed = 0);
+
+  void set_fault(Fault fault, Profile profile);
+  void clear_faults();
+
+  /*
+   *	Faults injected so far.
+   */
+  size_t get_injected_count(Fault fault) const {
+    return m_faults[(size_t)fault].injected;
+  }
+  size_t get_recv_count() const { return m_recv_count; }
+
+  virtual bool connect();
+  virtual bool disconnect();
+  virtual int send(const void *packet);
+  virtual int recv(void *packet);
+  virtual std::string get_lease_key() const {
+    return m_device->get_lease_key();
+  }
+  virtual void begin_operation() { m_device->begin_operation(); }
+  virtual void end_operation() { m_device->end_operation(); }
+
+ private:
+  struct FaultState {
+    bool enabled;
+    Profile profile;
+    size_t remaining;  // receives left of the current burst
+    size_t injected;
+  };
+
+  bool should_inject(FaultState &state);
+
+  std::shared_ptr<Device> m_device;
+  std::mt19937 m_random;
+  FaultState m_faults[FAULT_COUNT];
+  size_t m_recv_count;
+  uint32_t m_previous_crc;
+  uint32_t m_last_crc;
+};
+}
+}
+#endif
@@ -0,0 +1,109 @@
+#ifndef HOTPLUG_H
+#define HOTPLUG_H
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "device.h"
+
+namespace nitrokey {
+namespace device {
+
+/*
+ *	Nitrokey devices on the USB bus, kept up to date from the uevents udev
+ *	sends on netlink after applying its rules, so no device is opened to
+ *	find them. A thread sleeps on the socket and calls the callbacks on
+ *	arrival and removal; idle, it uses no CPU.
+ *	Devices present on start() are read from sysfs, without callbacks,
+ *	as they are again when the socket overflows and events are lost.
+ */
+class HotplugMonitor {
+ public:
+  enum class Action : uint8_t { ARRIVAL, REMOVAL };
+
+  struct UsbDevice {
+    std::string devpath;  // sysfs path without /sys, as in uevents
+    uint16_t vid;
+    uint16_t pid;
+    DeviceModel model;
+    bool update_mode;  // Storage bootloader, can't be connected to
+  };
+
+  struct Event {
+    Action action;
+    UsbDevice device;
+  };
+
+  /*
+   *	Called on the monitor thread, so it should return quickly. It must
+   *	not add or remove callbacks.
+   */
+  typedef std::function<void(const Event &)> Callback;
+
+  /*
+   *	Shared monitor, used by NitrokeyManager::connect() when running.
+   */
+  static HotplugMonitor &instance();
+
+  HotplugMonitor();
+  ~HotplugMonitor();
+
+  /*
+   *	False if the netlink socket can't be opened.
+   */
+  bool start();
+  void stop();
+  bool is_running() const { return m_running; }
+
+  int add_callback(Callback callback);
+  void remove_callback(int id);
+
+  std::vector<UsbDevice> get_devices();
+
+  /*
+   *	True if there is a device of a model which can be connected to.
+   */
+  bool has_connectable_device();
+
+  /*
+   *	Changed on every arrival and removal.
+   */
+  uint64_t get_generation() const { return m_generation; }
+
+  /*
+   *	Handles one netlink message, udev or kernel format. Used by the
+   *	monitor thread, public to replay messages.
+   */
+  void process_uevent(const char *message, size_t size);
+
+  static bool parse_uevent(const char *message, size_t size, Event &event);
+  static bool is_nitrokey(uint16_t vid, uint16_t pid);
+
+ private:
+  /*
+   *	Brings the devices in line with sysfs.
+   */
+  void scan_sysfs(bool notify);
+  void update(const Event &event, bool notify);
+  void run();
+
+  std::mutex m_start_mutex;  // start() and stop()
+  std::mutex m_mutex;        // devices and callbacks
+  std::vector<UsbDevice> m_devices;
+  std::vector<std::pair<int, Callback>> m_callbacks;
+  int m_next_callback_id;
+  std::atomic<uint64_t> m_generation;
+  std::atomic<bool> m_running;
+
+  int m_socket;
+  int m_stop_fd;  // eventfd waking the thread up on stop()
+  std::thread m_thread;
+};
+}
+}
+#endif
@@ -0,0 +1,74 @@
+#ifndef KEEP_ALIVE_H
+#define KEEP_ALIVE_H
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include "device.h"
+
+namespace nitrokey {
+namespace device {
+
+/*
+ *	Keeps a device out of USB autosuspend, so the first request after a
+ *	pause is not slowed down by its wake-up. When the device has been idle
+ *	for idle_threshold, the cheapest read-only command (GET_STATUS) is sent;
+ *	while requests keep coming none is. Keep-alives are whole blocking
+ *	transactions, run on the Poller::blocking() thread, so that they do
+ *	not hold up the polls of awaitable transactions.
+ *	The wake-up time is taken as how much longer a keep-alive took than
+ *	the quickest one; when a request follows the keep-alive, that time
+ *	counts as saved.
+ */
+class KeepAlive : public std::enable_shared_from_this<KeepAlive> {
+ public:
+  struct Stats {
+    uint64_t sent;
+    uint64_t failed;
+    std::chrono::microseconds saved;  // wake-up time not paid by requests
+  };
+
+  static std::shared_ptr<KeepAlive> create(
+      std::shared_ptr<Device> device, std::chrono::milliseconds idle_threshold);
+
+  /*
+   *	Keep-alives are scheduled until stop() or destruction.
+   */
+  void start();
+  void stop();
+
+  /*
+   *	Sends a keep-alive if it is due. Gives the time of the next check.
+   *	Called by the scheduled callbacks, public to drive it with a
+   *	VirtualClock.
+   */
+  Clock::time_point tick();
+
+  Stats get_stats();
+  std::chrono::milliseconds get_idle_threshold() const {
+    return m_idle_threshold;
+  }
+
+ private:
+  KeepAlive(std::shared_ptr<Device> device,
+            std::chrono::milliseconds idle_threshold);
+
+  void schedule(Clock::time_point when, uint64_t generation);
+  void send();
+  // a request after the last keep-alive makes its wake-up time saved
+  void credit_saving();
+
+  std::shared_ptr<Device> m_device;
+  const std::chrono::milliseconds m_idle_threshold;
+
+  std::mutex m_mutex;  // below
+  bool m_running;
+  uint64_t m_generation;  // of start() calls, each has its callback chain
+  Stats m_stats;
+  std::chrono::microseconds m_quickest;  // zero - unknown
+  std::chrono::microseconds m_pending_saving;
+  uint64_t m_exchange_count;  // of the device after the last keep-alive
+};
+}
+}
+#endif
@@ -1,6 +1,11 @@
 #ifndef LOG_H
 #define LOG_H
+#include <atomic>
+#include <condition_variable>
+#include <ctime>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <cstddef>
 
 namespace nitrokey {
@@ -14,6 +19,11 @@ class LogHandler {
 
  protected:
   std::string loglevel_to_str(Loglevel);
+  /*
+   *	Formatted local time of the given second, recomputed only when the
+   *	second changes (per calling thread).
+   */
+  const std::string &format_time(std::time_t t);
 };
 
 class StdlogHandler : public LogHandler {
@@ -23,26 +33,89 @@ class StdlogHandler : public LogHandler {
 
 extern StdlogHandler stdlog_handler;
 
+/*
+ *	Moves writing out of the calling thread: print() copies the message
+ *	into a lock-free ring buffer and returns, a background thread drains
+ *	it to std::clog. When the buffer is full the message is dropped and
+ *	counted; the count is reported in the log once there is room again.
+ *	Safe to call from many threads at once.
+ */
+class AsyncLogHandler : public LogHandler {
+ public:
+  static const size_t SLOT_COUNT = 1024;  // power of 2
+  static const size_t SLOT_TEXT_SIZE = 240;
+  static const size_t MAX_SLOTS_PER_MESSAGE = 64;  // longer ones are cut
+
+  AsyncLogHandler();
+  ~AsyncLogHandler();
+
+  virtual void print(const std::string &, Loglevel lvl);
+
+  /*
+   *	Wait until all messages queued so far are written.
+   */
+  void flush();
+
+  size_t get_dropped_count() const { return m_dropped.load(); }
+
+ private:
+  struct Slot {
+    std::atomic<size_t> sequence;
+    Loglevel level;
+    std::time_t time;
+    uint16_t parts;  // slots taken by the message, set in the first one
+    uint16_t length;
+    char text[SLOT_TEXT_SIZE];
+  };
+
+  void start();
+  void run();
+  bool drain_one();
+  void report_drops();
+
+  Slot m_slots[SLOT_COUNT];
+  std::atomic<size_t> m_enqueue_pos;
+  size_t m_dequeue_pos;  // consumer only
+  std::atomic<size_t> m_written_pos;
+  std::atomic<size_t> m_dropped;
+  size_t m_dropped_reported;
+
+  std::atomic<bool> m_running;
+  std::atomic<bool> m_consumer_waiting;
+  std::once_flag m_started;
+  std::thread m_thread;
+  std::mutex m_mutex;  // consumer side only
+  std::condition_variable m_cv;
+};
+
 class Log {
  public:
   Log() : mp_loghandler(&stdlog_handler), m_loglevel(Loglevel::WARNING) {}
 
-  static Log &instance() {
-    if (mp_instance == NULL) mp_instance = new Log;
-    return *mp_instance;
-  }
+  static Log &instance();
 
   void operator()(const std::string &, Loglevel);
+  // builds the string only if the message is going to be printed
+  void operator()(const char *, Loglevel);
 
   void set_loglevel(Loglevel lvl) { m_loglevel = lvl; }
 
+  bool is_enabled(Loglevel lvl) const {
+    return mp_loghandler.load(std::memory_order_relaxed) != NULL &&
+           (int)(lvl) >= (int)(m_loglevel.load(std::memory_order_relaxed));
+  }
+
   void set_handler(LogHandler *handler) { mp_loghandler = handler; }
 
- private:
-  Loglevel m_loglevel;
-  LogHandler *mp_loghandler;
+  /*
+   *	Switch between the synchronous stdlog_handler and a shared
+   *	AsyncLogHandler. Queued messages are flushed when switching back.
+   */
+  void set_async(bool state);
 
-  static Log *mp_instance;
+ private:
+  std::atomic<LogHandler *> mp_loghandler;
+  std::atomic<Loglevel> m_loglevel;
 };
 }
 }
@@ -0,0 +1,103 @@
+#ifndef LONG_OPERATION_H
+#define LONG_OPERATION_H
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include "NitrokeyManager.h"
+
+namespace nitrokey {
+
+/*
+ *	Long operation of the Storage (filling the SD card, generating keys,
+ *	...) followed without a thread of its own: it is begun by a call of
+ *	NitrokeyManager, then get_progress_bar_value() is polled from the
+ *	Poller::blocking() thread until the device is done, so the polls of
+ *	awaitable transactions are not held up. Progress is passed to a
+ *	callback and can be waited for.
+ *	The device can't be stopped: cancel() stops following the operation,
+ *	which goes on on the device.
+ */
+class LongOperation : public std::enable_shared_from_this<LongOperation> {
+ public:
+  enum class State : uint8_t { RUNNING, DONE, FAILED, CANCELLED };
+
+  struct Progress {
+    State state;
+    int percent;  // 0 - 100, -1 before the first poll
+    // FAILED: as NK_get_last_command_status, 255 if the device could not
+    // be reached; CANCELLED: that of OperationCancelledException; else 0
+    uint8_t status;
+  };
+
+  /*
+   *	Called on each change of the progress and once with the final state,
+   *	one call at a time, in order. Calls are made on the
+   *	Poller::blocking() thread (see Poller about their length), or on the
+   *	thread of start() or cancel() for a state set there.
+   */
+  typedef std::function<void(const Progress &)> Callback;
+
+  typedef std::function<bool(NitrokeyManager &)> Begin;
+
+  static constexpr std::chrono::milliseconds DEFAULT_POLL_INTERVAL =
+      std::chrono::milliseconds(500);
+
+  /*
+   *	Calls begin, e.g. NitrokeyManager::fill_SD_card_with_random_data(),
+   *	then polls the progress every poll_interval while it returns true.
+   *	Failures of begin end the operation as FAILED, nothing is thrown.
+   *	Calls on the manager are serialized with manager_mutex, if given, so
+   *	it can be used meanwhile (and gets LongOperationInProgressException).
+   *	One long operation at a time per device.
+   */
+  static std::shared_ptr<LongOperation> start(
+      std::shared_ptr<NitrokeyManager> manager, Begin begin, Callback callback,
+      std::chrono::milliseconds poll_interval = DEFAULT_POLL_INTERVAL,
+      std::mutex *manager_mutex = nullptr);
+
+  ~LongOperation();
+
+  Progress get_progress();
+  bool is_finished();
+
+  /*
+   *	Stops following the operation, if it runs: it ends as CANCELLED. Once
+   *	this returns the manager is not used anymore.
+   */
+  void cancel();
+
+  /*
+   *	Blocks until the operation ends; false on timeout.
+   */
+  bool wait_for(std::chrono::milliseconds timeout);
+  void wait();
+
+ private:
+  LongOperation(std::shared_ptr<NitrokeyManager> manager, Callback callback,
+                std::chrono::milliseconds poll_interval,
+                std::mutex *manager_mutex);
+
+  void run_begin(Begin &begin);
+  void schedule_poll();
+  void poll();
+  template <typename T>
+  uint8_t call_manager(T function, int &result);
+  // while RUNNING, and reports the change; percent -1 - unchanged
+  void set(State state, int percent, uint8_t status);
+
+  std::shared_ptr<NitrokeyManager> m_manager;
+  std::mutex *m_manager_mutex;
+  Callback m_callback;
+  const std::chrono::milliseconds m_poll_interval;
+
+  std::mutex m_poll_mutex;  // held while the manager is used
+  std::recursive_mutex m_callback_mutex;  // callbacks may call cancel()
+  std::mutex m_mutex;  // below
+  std::condition_variable m_finished;
+  Progress m_progress;
+};
+}
+#endif
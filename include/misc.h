@@ -3,6 +3,9 @@
 #include <stdio.h>
 #include <string>
 #include <vector>
+#include <cstring>
+#include <algorithm>
+#include "LibraryException.h"
 
 namespace nitrokey {
 namespace misc {
@@ -16,9 +19,52 @@ typename T::CommandPayload get_payload(){
 }
 
 
+template <typename T>
+void strcpyT(T& dest, const char* src){
+    if (src == nullptr)
+//            throw EmptySourceStringException(slot_number);
+        return;
+    const size_t s_dest = sizeof dest;
+    if (strlen(src) > s_dest){
+        throw TooLongStringException(strlen(src), s_dest, src);
+    }
+    strncpy((char*) &dest, src, s_dest);
+}
+
+template <typename T, typename U>
+void vector_copy(T& dest, std::vector<U> &vec){
+    const size_t d_size = sizeof(dest);
+    if(d_size < vec.size()){
+        throw TargetBufferSmallerThanSource(vec.size(), d_size);
+    }
+    std::fill(dest, dest+d_size, 0);
+    std::copy(vec.begin(), vec.end(), dest);
+}
+
     std::string hexdump(const char *p, size_t size, bool print_header=true);
+
+    /*
+     * One 32-bit word of the CRC computed by the STM32 CRC unit.
+     * constexpr, so the CRCs of constant packets are computed at compile time.
+     */
+    constexpr uint32_t stm_crc32_word(uint32_t crc, uint32_t data) {
+        crc = crc ^ data;
+        for (int i = 0; i < 32; i++) {
+            if (crc & 0x80000000)
+                crc = (crc << 1) ^ 0x04C11DB7;  // polynomial used in STM32
+            else
+                crc = (crc << 1);
+        }
+        return crc;
+    }
+
     uint32_t stm_crc32(const uint8_t *data, size_t size);
     std::vector<uint8_t> hex_string_to_byte(const char* hexString);
+    /*
+     * Zero memory holding secrets. Unlike bzero it is not dropped by the
+     * compiler when the memory is not read afterwards.
+     */
+    void secure_zero(void *p, size_t size);
 }
 }
 
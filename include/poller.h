@@ -0,0 +1,86 @@
+#ifndef POLLER_H
+#define POLLER_H
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+namespace nitrokey {
+namespace device {
+
+/*
+ *	Single timer thread running callbacks at given times. It drives the
+ *	waits of transactions run without blocking the calling thread (see
+ *	NitrokeyManagerAwaitable.h), so one thread serves any number of
+ *	devices. Callbacks run on the timer thread in time order and delay each
+ *	other, so they should only do a device call and return. Callbacks
+ *	which are due at once (the thread fell behind) run in priority order,
+ *	higher first.
+ *	The thread is started on the first schedule() call.
+ */
+class Poller {
+ public:
+  typedef std::chrono::steady_clock Clock;
+
+  /*
+   *	Shared poller, used by the awaitable operations.
+   */
+  static Poller &instance();
+
+  /*
+   *	Shared poller for callbacks which run whole transactions and so
+   *	block for the device's waits (keep-alives), kept apart from
+   *	instance() so that they never delay the polls of its transactions.
+   */
+  static Poller &blocking();
+
+  Poller();
+  ~Poller();
+
+  void schedule(Clock::time_point when, std::function<void()> callback,
+                int priority = 0);
+  void schedule_after(std::chrono::microseconds delay,
+                      std::function<void()> callback, int priority = 0) {
+    schedule(Clock::now() + delay, std::move(callback), priority);
+  }
+
+  size_t get_pending_count();
+
+ private:
+  struct Timer {
+    Clock::time_point when;
+    int priority;
+    uint64_t sequence;  // keeps the order of callbacks due at the same time
+    std::function<void()> callback;
+
+    bool operator>(const Timer &other) const {
+      return when != other.when ? when > other.when
+                                : sequence > other.sequence;
+    }
+  };
+
+  struct LowerPriority {
+    bool operator()(const Timer &a, const Timer &b) const {
+      return a.priority != b.priority ? a.priority < b.priority
+                                      : a.sequence > b.sequence;
+    }
+  };
+
+  void run();
+
+  std::priority_queue<Timer, std::vector<Timer>, std::greater<Timer>>
+      m_timers;
+  std::priority_queue<Timer, std::vector<Timer>, LowerPriority> m_due;
+  uint64_t m_sequence;
+  bool m_stopping;
+  std::mutex m_mutex;
+  std::condition_variable m_cv;
+  std::thread m_thread;
+};
+}
+}
+#endif
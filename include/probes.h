@@ -0,0 +1,88 @@
+/*
+ *	USDT (statically defined tracing) probes of the libnitrokey provider
+ *
+ *	Each probe is a single nop in the code and a note in the binary
+ *	(.note.stapsdt), so it costs nothing until a tracer attaches to it:
+ *
+ *	  bpftrace -e 'usdt:./build/libnitrokey.so:libnitrokey:transaction__done
+ *	               { @attempts[arg0] = hist(arg1); }'
+ *	  perf probe -x build/libnitrokey.so sdt_libnitrokey:device__recv
+ *
+ *	Probes of the inline transaction code are in each binary including
+ *	device_proto.h; tracers attach to all the sites of a name at once.
+ *	They need <sys/sdt.h> (systemtap-sdt-dev, systemtap-sdt-devel) at build
+ *	time, nothing at run time. Without it, or with NK_NO_USDT defined, the
+ *	probes are compiled out.
+ *
+ *	Probes and arguments, integers:
+ *
+ *	  device__send(command_id, result)
+ *	      packet sent to the device, result of Device::send()
+ *	  device__recv(command_id, result, device_status, attempt)
+ *	      each receive poll, result of Device::recv(), device_status of
+ *	      the response (1 - busy) and the attempt number from 0
+ *	  transaction__start(command_id)
+ *	  transaction__done(command_id, attempts, outcome, last_command_status)
+ *	      blocking transactions (Transaction::run(), try_run()): receive
+ *	      attempts made (0 - not sent), outcome of TransactionStatus
+ *	      (0 - OK), status of the command on the device
+ *	  authorize__start(command_id)
+ *	  authorize__done(command_id, outcome)
+ *	      authorization of the packet of command_id with a temporary
+ *	      password, outcome as above, -1 if an exception was thrown
+ *	  cache__hit(cache), cache__miss(cache)
+ *	      decisions of the caches of the library, see ProbeCache
+ */
+#ifndef PROBES_H
+#define PROBES_H
+
+#if !defined(NK_NO_USDT) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define NK_USDT 1
+#endif
+#endif
+
+#ifdef NK_USDT
+#define NK_PROBE1(name, a1) STAP_PROBE1(libnitrokey, name, a1)
+#define NK_PROBE2(name, a1, a2) STAP_PROBE2(libnitrokey, name, a1, a2)
+#define NK_PROBE4(name, a1, a2, a3, a4) \
+  STAP_PROBE4(libnitrokey, name, a1, a2, a3, a4)
+#else
+// the arguments are named, not evaluated, so that values computed only
+// for a probe do not turn into unused variables
+#define NK_PROBE1(name, a1) \
+  do {                      \
+    (void)sizeof(a1);       \
+  } while (0)
+#define NK_PROBE2(name, a1, a2) \
+  do {                          \
+    (void)sizeof(a1);           \
+    (void)sizeof(a2);           \
+  } while (0)
+#define NK_PROBE4(name, a1, a2, a3, a4) \
+  do {                                  \
+    (void)sizeof(a1);                   \
+    (void)sizeof(a2);                   \
+    (void)sizeof(a3);                   \
+    (void)sizeof(a4);                   \
+  } while (0)
+#endif
+
+namespace nitrokey {
+namespace probes {
+
+/*
+ *	Argument of cache__hit and cache__miss.
+ */
+enum class ProbeCache : int {
+  // NitrokeyManager::connect() with hotplug monitoring: devices are not
+  // reopened while the set of them is unchanged
+  HOTPLUG_CONNECT = 1,
+  // NitrokeyManager::get_storage_status(): the snapshot is returned while
+  // younger than its TTL
+  STORAGE_STATUS = 2,
+};
+}
+}
+#endif
@@ -0,0 +1,95 @@
+#ifndef PROXY_PROTOCOL_H
+#define PROXY_PROTOCOL_H
+#include <cstddef>
+#include <cstdint>
+#include "inttypes.h"
+
+namespace nitrokey {
+namespace proxy {
+
+/*
+ *	Protocol between ProxyServer and RemoteConnection, over TCP. Frames are
+ *	a 12 byte header followed by length bytes of payload, integers little
+ *	endian:
+ *
+ *	  uint32_t id       chosen by the client, echoed in the response
+ *	  uint8_t type      RequestType, ResponseStatus in responses
+ *	  uint8_t version   PROTOCOL_VERSION
+ *	  uint16_t length
+ *	  uint32_t session  chosen by the client, echoed in the response
+ *
+ *	Requests are answered in the order the device runs them, which is not
+ *	the order of sending when several clients share the device, so each
+ *	connection may have any number of requests in flight.
+ *	Between BEGIN and END the device runs the requests of that session of
+ *	that connection only, so that the exchanges of an operation (an
+ *	authorization and the command it authorizes) are not split by other
+ *	clients. A session is a client of the device, one per RemoteDevice:
+ *	devices sharing a connection are kept apart as those on different
+ *	connections are. Requests of the others wait meanwhile, as does their
+ *	BEGIN; a closed connection ends the hold of any of its sessions.
+ */
+constexpr uint8_t PROTOCOL_VERSION = 2;
+constexpr uint16_t DEFAULT_PORT = 4108;
+constexpr size_t HEADER_SIZE = 12;
+constexpr size_t MAX_PAYLOAD = 512;
+
+enum class RequestType : uint8_t {
+  INFO = 1,      // no payload; answer: model of the device, 'P' or 'S'
+  EXCHANGE = 2,  // a HID report; answer: the response to it
+  BEGIN = 3,     // no payload; answered once the device is held, may nest
+  END = 4,       // no payload; ends a BEGIN
+};
+
+enum class ResponseStatus : uint8_t {
+  OK = 0,
+  FAILED = 1,     // payload: exception id of the server (0 - none), message
+  NO_DEVICE = 2,  // the server is not connected to a device
+  BAD_REQUEST = 3,
+};
+
+struct FrameHeader {
+  uint32_t id;
+  uint8_t type;
+  uint8_t version;
+  uint16_t length;
+  uint32_t session;
+};
+
+inline void write_header(const FrameHeader &header, uint8_t *buffer) {
+  for (int i = 0; i < 4; i++) buffer[i] = (uint8_t)(header.id >> (8 * i));
+  buffer[4] = header.type;
+  buffer[5] = header.version;
+  buffer[6] = (uint8_t)header.length;
+  buffer[7] = (uint8_t)(header.length >> 8);
+  for (int i = 0; i < 4; i++)
+    buffer[8 + i] = (uint8_t)(header.session >> (8 * i));
+}
+
+inline FrameHeader read_header(const uint8_t *buffer) {
+  FrameHeader header;
+  header.id = 0;
+  for (int i = 0; i < 4; i++) header.id |= (uint32_t)buffer[i] << (8 * i);
+  header.type = buffer[4];
+  header.version = buffer[5];
+  header.length = (uint16_t)(buffer[6] | buffer[7] << 8);
+  header.session = 0;
+  for (int i = 0; i < 4; i++)
+    header.session |= (uint32_t)buffer[8 + i] << (8 * i);
+  return header;
+}
+
+/*
+ *	Whole buffer or nothing, retrying on EINTR and short transfers. False
+ *	when the connection is closed or broken.
+ */
+bool send_all(int fd, const void *buffer, size_t size);
+bool recv_all(int fd, void *buffer, size_t size);
+
+/*
+ *	Header and payload in one send. False as for send_all.
+ */
+bool send_frame(int fd, const FrameHeader &header, const void *payload);
+}
+}
+#endif
@@ -0,0 +1,103 @@
+#ifndef PROXY_SERVER_H
+#define PROXY_SERVER_H
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "NitrokeyManager.h"
+#include "proxy_protocol.h"
+
+namespace nitrokey {
+
+/*
+ *	Makes the device of a manager usable from other hosts, through
+ *	RemoteDevice (see proxy_protocol.h). Requests of all clients go to one
+ *	queue, run by a worker thread with NitrokeyManager::forward_packet(),
+ *	so the device has the next request at hand as soon as it answers one.
+ *	A client (a session of a connection) holding the device (BEGIN) also
+ *	holds a NitrokeyManager operation, so the device lease is kept for the
+ *	whole of its operation.
+ *	Calls of the owner of the manager are not held off by it.
+ *	There is no authentication nor encryption: listen on loopback and
+ *	tunnel (ssh -L), or on a trusted network only, as the packets carry
+ *	PINs.
+ */
+class ProxyServer {
+ public:
+  struct Stats {
+    uint64_t requests;  // INFO and EXCHANGE
+    uint64_t failed;
+    size_t max_queued;  // requests waiting for the device at once
+  };
+
+  /*
+   *	Calls on the manager are serialized with manager_mutex, if given, so
+   *	it can be used by its owner meanwhile.
+   */
+  explicit ProxyServer(std::shared_ptr<NitrokeyManager> manager,
+                       std::mutex *manager_mutex = nullptr);
+  ~ProxyServer();
+
+  /*
+   *	Listens on the given address ("127.0.0.1", "::", ...). Port 0 picks a
+   *	free one, see get_port(). False if the socket can't be set up.
+   */
+  bool start(const std::string &address, uint16_t port = proxy::DEFAULT_PORT);
+  void stop();
+  bool is_running() const { return m_running; }
+  uint16_t get_port() const { return m_port; }
+
+  Stats get_stats();
+
+ private:
+  struct Connection;
+  struct Request {
+    std::shared_ptr<Connection> connection;
+    uint32_t id;
+    uint32_t session;
+    proxy::RequestType type;
+    bool closed;  // END of all holds of the closed connection, not answered
+    uint8_t packet[HID_REPORT_SIZE];
+  };
+
+  void accept_connections();
+  void read_requests(std::shared_ptr<Connection> connection);
+  void run_requests();
+  // the first request which may run, with m_mutex
+  std::deque<Request>::iterator next_request();
+  void execute(Request &request);
+  // with the manager mutex
+  void begin_hold(const std::shared_ptr<Connection> &connection,
+                  uint32_t session);
+  void end_hold(bool all);
+
+  std::shared_ptr<NitrokeyManager> m_manager;
+  std::mutex *m_manager_mutex;
+
+  std::mutex m_start_mutex;  // start() and stop()
+  std::atomic<bool> m_running;
+  int m_listen_fd;
+  int m_stop_fd;  // eventfd waking up the accepting thread
+  uint16_t m_port;
+  std::thread m_acceptor;
+  std::thread m_worker;
+
+  // of the worker
+  int m_hold_depth;
+  std::unique_ptr<NitrokeyManager::Operation> m_hold;
+
+  std::mutex m_mutex;  // below
+  std::condition_variable m_queued;
+  std::deque<Request> m_queue;
+  std::vector<std::shared_ptr<Connection>> m_connections;
+  std::shared_ptr<Connection> m_holder;  // whose requests run only
+  uint32_t m_holder_session;             // of m_holder
+  Stats m_stats;
+};
+}
+#endif
@@ -0,0 +1,111 @@
+#ifndef REMOTE_DEVICE_H
+#define REMOTE_DEVICE_H
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include "device.h"
+#include "proxy_protocol.h"
+
+namespace nitrokey {
+namespace device {
+
+/*
+ *	TCP connection to a ProxyServer. Thread safe: requests of any number
+ *	of threads (and RemoteDevice objects) are in flight at once, and are
+ *	matched with their responses by a reader thread.
+ */
+class RemoteConnection {
+ public:
+  struct Response {
+    proxy::ResponseStatus status;
+    uint16_t length;
+    uint8_t payload[proxy::MAX_PAYLOAD];
+  };
+
+  /*
+   *	nullptr if the server can't be reached.
+   */
+  static std::shared_ptr<RemoteConnection> connect(const std::string &host,
+                                                   uint16_t port);
+  ~RemoteConnection();
+
+  /*
+   *	The future is ready with the response, or with ResponseStatus::FAILED
+   *	if the connection is lost. Holds (BEGIN and END) are of the session.
+   */
+  std::future<Response> submit(proxy::RequestType type, const void *payload,
+                               uint16_t length, uint32_t session = 0);
+
+  /*
+   *	A session not used on this connection yet, for a new client.
+   */
+  uint32_t new_session() { return m_next_session++; }
+
+  bool is_connected() const { return m_connected; }
+
+ private:
+  explicit RemoteConnection(int fd);
+  void run();
+  void fail_pending();
+
+  int m_fd;
+  std::atomic<bool> m_connected;
+  std::atomic<uint32_t> m_next_session;
+  std::mutex m_send_mutex;
+  std::mutex m_pending_mutex;  // below
+  uint32_t m_next_id;
+  std::unordered_map<uint32_t, std::promise<Response>> m_pending;
+  std::thread m_reader;
+};
+
+/*
+ *	Device behind a ProxyServer. The server runs the whole exchange with
+ *	the device, polling included, so send() only submits the packet and
+ *	recv() waits for the response; there is no polling over the network.
+ *	Several RemoteDevice objects can share a connection, to keep the
+ *	device busy while responses travel back.
+ *	Each NitrokeyManager operation holds the device on the server (BEGIN
+ *	and END requests), so other clients do not get between its exchanges;
+ *	each RemoteDevice is a client of its own for that, with a session of
+ *	the connection.
+ *	The lease of the device (see DeviceLease) is taken by the server.
+ */
+class RemoteDevice : public Device {
+ public:
+  static constexpr std::chrono::seconds RESPONSE_TIMEOUT =
+      std::chrono::seconds(120);
+
+  explicit RemoteDevice(std::shared_ptr<RemoteConnection> connection);
+  ~RemoteDevice();
+
+  /*
+   *	Asks the server for the model of its device.
+   */
+  virtual bool connect();
+  virtual bool disconnect();
+  virtual bool is_connected() const { return m_connection->is_connected(); }
+  virtual int send(const void *packet);
+  virtual int recv(void *packet);
+  virtual void begin_operation();
+  virtual void end_operation();
+
+ private:
+  // false on the operation limits or RESPONSE_TIMEOUT
+  bool wait_for(std::future<RemoteConnection::Response> &response);
+
+  std::shared_ptr<RemoteConnection> m_connection;
+  const uint32_t m_session;
+  std::future<RemoteConnection::Response> m_pending;
+  uint8_t m_response[HID_REPORT_SIZE];
+  bool m_has_response;
+  bool m_held;  // BEGIN sent, END due
+};
+}
+}
+#endif
@@ -0,0 +1,118 @@
+#ifndef RETRY_POLICY_H
+#define RETRY_POLICY_H
+#include <chrono>
+#include "clock.h"
+
+namespace nitrokey {
+namespace device {
+
+/*
+ *	How a transaction polls for the response of the device, after the send
+ *	receive delay. Waits between polls start at initial_delay and grow by
+ *	multiplier up to max_delay, each varied at random by up to +-jitter of
+ *	itself. A response to another packet (stale last_command_crc) means the
+ *	device is about to answer, so it is polled again after stale_crc_delay
+ *	without growing the wait.
+ *	Polling stops after max_attempts polls or when deadline has passed since
+ *	the packet was sent; 0 disables either limit.
+ *	For commands the device answers quickly, a spin window can be set: the
+ *	polls start right after the packet is sent, instead of after the send
+ *	receive delay, and are spin_interval apart (at least
+ *	MIN_SPIN_INTERVAL, which caps the CPU use) until spin_window passes.
+ *	Then the waits above follow, held at initial_delay until the send
+ *	receive delay has passed, so that a response coming after the window
+ *	is not found later than without it.
+ */
+struct RetryPolicy {
+  std::chrono::milliseconds initial_delay;
+  double multiplier;
+  std::chrono::milliseconds max_delay;
+  double jitter;
+  std::chrono::milliseconds stale_crc_delay;
+  int max_attempts;
+  std::chrono::milliseconds deadline;
+  std::chrono::microseconds spin_window;
+  std::chrono::microseconds spin_interval;
+
+  static constexpr std::chrono::microseconds MIN_SPIN_INTERVAL =
+      std::chrono::microseconds(50);
+
+  /*
+   *	Constant delay between a limited number of polls, no deadline.
+   */
+  static RetryPolicy fixed(int max_attempts, std::chrono::milliseconds delay) {
+    return RetryPolicy{delay,
+                       1.0,
+                       delay,
+                       0.0,
+                       delay,
+                       max_attempts,
+                       std::chrono::milliseconds(0),
+                       std::chrono::microseconds(0),
+                       std::chrono::microseconds(0)};
+  }
+
+  /*
+   *	Growing delays, limited by the deadline only.
+   */
+  static RetryPolicy exponential(std::chrono::milliseconds initial_delay,
+                                 std::chrono::milliseconds max_delay,
+                                 std::chrono::milliseconds deadline) {
+    return RetryPolicy{initial_delay,
+                       2.0,
+                       max_delay,
+                       0.2,
+                       std::chrono::milliseconds(5),
+                       0,
+                       deadline,
+                       std::chrono::microseconds(0),
+                       std::chrono::microseconds(0)};
+  }
+
+  /*
+   *	This policy with the given spin window.
+   */
+  RetryPolicy spinning(std::chrono::microseconds window,
+                       std::chrono::microseconds interval) const {
+    RetryPolicy policy = *this;
+    policy.spin_window = window;
+    policy.spin_interval = interval;
+    return policy;
+  }
+
+  bool spins() const { return spin_window.count() > 0; }
+};
+
+/*
+ *	Polling state of a single transaction.
+ */
+class Backoff {
+ public:
+  /*
+   *	The packet was sent at now, see RetryPolicy for send_receive_delay.
+   */
+  void start(const RetryPolicy &policy, Clock::time_point now,
+             std::chrono::milliseconds send_receive_delay);
+
+  /*
+   *	Called after a poll which gave no response at now. Gives the wait
+   *	before the next poll, or false if the policy allows no more polls.
+   */
+  bool next(Clock::time_point now, bool stale_crc,
+            std::chrono::microseconds &wait);
+
+  int get_attempts() const { return m_attempts; }
+  bool deadline_passed() const { return m_deadline_passed; }
+
+ private:
+  RetryPolicy m_policy;
+  Clock::time_point m_deadline;
+  Clock::time_point m_spin_end;
+  Clock::time_point m_growth_start;  // send receive delay after the send
+  double m_delay_ms;
+  int m_attempts;
+  bool m_deadline_passed;
+};
+}
+}
+#endif
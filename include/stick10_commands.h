@@ -22,22 +22,22 @@ class GetSlotName : public Command<CommandID::READ_SLOT_NAME> {
     uint8_t slot_number;
 
     bool isValid() const { return slot_number<0x10+3; }
-      std::string dissect() const {
-          std::stringstream ss;
-          ss << "slot_number:\t" << (int)(slot_number) << std::endl;
-          return ss.str();
-      }
+    std::string dissect() const { return dissect_to_string(*this); }
+    void dissect(DissectWriter &out) const {
+      out.text("slot_number:\t").dec(slot_number).character('\n');
+    }
   } __packed;
 
   struct ResponsePayload {
     uint8_t slot_name[15];
 
     bool isValid() const { return true; }
-      std::string dissect() const {
-          std::stringstream ss;
-          ss << "slot_name:\t" << slot_name << std::endl;
-          return ss.str();
-      }
+    std::string dissect() const { return dissect_to_string(*this); }
+    void dissect(DissectWriter &out) const {
+      out.text("slot_name:\t")
+          .c_string(slot_name, sizeof slot_name)
+          .character('\n');
+    }
   } __packed;
 
   typedef Transaction<command_id(), struct CommandPayload,
@@ -50,11 +50,10 @@ class EraseSlot : Command<CommandID::ERASE_SLOT> {
     uint8_t slot_number;
 
     bool isValid() const { return !(slot_number & 0xF0); }
-      std::string dissect() const {
-          std::stringstream ss;
-          ss << "slot_number:\t" << (int)(slot_number) << std::endl;
-          return ss.str();
-      }
+    std::string dissect() const { return dissect_to_string(*this); }
+    void dissect(DissectWriter &out) const {
+      out.text("slot_number:\t").dec(slot_number).character('\n');
+    }
   } __packed;
 
   typedef Transaction<command_id(), struct CommandPayload, struct EmptyPayload>
@@ -68,12 +67,11 @@ class SetTime : Command<CommandID::SET_TIME> {
     uint64_t time;  // posix time
 
     bool isValid() const { return reset && reset != 1; }
-      std::string dissect() const {
-          std::stringstream ss;
-          ss << "reset:\t" << (int)(reset) << std::endl;
-          ss << "time:\t" << (time) << std::endl;
-          return ss.str();
-      }
+    std::string dissect() const { return dissect_to_string(*this); }
+    void dissect(DissectWriter &out) const {
+      out.text("reset:\t").dec(reset);
+      out.text("\ntime:\t").dec(time).character('\n');
+    }
   } __packed;
 
   typedef Transaction<command_id(), struct CommandPayload, struct EmptyPayload>
@@ -107,22 +105,18 @@ class WriteToHOTPSlot : Command<CommandID::WRITE_TO_SLOT> {
       uint64_t slot_counter;
 
     bool isValid() const { return !(slot_number & 0xF0); }
-    std::string dissect() const {
-        std::stringstream ss;
-        ss << "slot_number:\t" << (int)(slot_number) << std::endl;
-        ss << "slot_name:\t" << slot_name << std::endl;
-        ss << "slot_secret:\t" << slot_secret << std::endl;
-        ss << "slot_config:\t" << std::bitset<8>((int)_slot_config) << std::endl;
-        ss << "\tuse_8_digits(0):\t" << use_8_digits << std::endl;
-        ss << "\tuse_enter(1):\t" << use_enter << std::endl;
-        ss << "\tuse_tokenID(2):\t" << use_tokenID << std::endl;
-
-        ss << "slot_token_id:\t";
-        for (auto i : slot_token_id)
-            ss << std::hex << std::setw(2) << std::setfill('0')<< (int) i << " " ;
-        ss << std::endl;
-        ss << "slot_counter:\t" << (int)slot_counter << std::endl;
-        return ss.str();
+    std::string dissect() const { return dissect_to_string(*this); }
+    void dissect(DissectWriter &out) const {
+      out.text("slot_number:\t").dec(slot_number);
+      out.text("\nslot_name:\t").c_string(slot_name, sizeof slot_name);
+      out.text("\nslot_secret:\t").c_string(slot_secret, sizeof slot_secret);
+      out.text("\nslot_config:\t").binary8(_slot_config);
+      out.text("\n\tuse_8_digits(0):\t").dec(use_8_digits);
+      out.text("\n\tuse_enter(1):\t").dec(use_enter);
+      out.text("\n\tuse_tokenID(2):\t").dec(use_tokenID);
+      out.text("\nslot_token_id:\t")
+          .hexdump(slot_token_id, sizeof slot_token_id, false);
+      out.text("slot_counter:\t").dec(slot_counter).character('\n');
     }
   } __packed;
 
@@ -156,19 +150,16 @@ class WriteToTOTPSlot : Command<CommandID::WRITE_TO_SLOT> {
     uint16_t slot_interval;
 
     bool isValid() const { return !(slot_number & 0xF0); } //TODO check
-      std::string dissect() const {
-          std::stringstream ss;
-          ss << "slot_number:\t" << (int)(slot_number) << std::endl;
-          ss << "slot_name:\t" << slot_name << std::endl;
-          ss << "slot_secret:\t" << slot_secret << std::endl;
-          ss << "slot_config:\t" << std::bitset<8>((int)_slot_config) << std::endl;
-          ss << "slot_token_id:\t";
-          for (auto i : slot_token_id)
-              ss << std::hex << std::setw(2) << std::setfill('0')<< (int) i << " " ;
-          ss << std::endl;
-          ss << "slot_interval:\t" << (int)slot_interval << std::endl;
-          return ss.str();
-      }
+    std::string dissect() const { return dissect_to_string(*this); }
+    void dissect(DissectWriter &out) const {
+      out.text("slot_number:\t").dec(slot_number);
+      out.text("\nslot_name:\t").c_string(slot_name, sizeof slot_name);
+      out.text("\nslot_secret:\t").c_string(slot_secret, sizeof slot_secret);
+      out.text("\nslot_config:\t").binary8(_slot_config);
+      out.text("\nslot_token_id:\t")
+          .hexdump(slot_token_id, sizeof slot_token_id, false);
+      out.text("slot_interval:\t").dec(slot_interval).character('\n');
+    }
   } __packed;
 
   typedef Transaction<command_id(), struct CommandPayload, struct EmptyPayload>
@@ -184,13 +175,12 @@ class GetTOTP : Command<CommandID::GET_CODE> {
     uint8_t last_interval;
 
     bool isValid() const { return !(slot_number & 0xF0); }
-    std::string dissect() const {
-      std::stringstream ss;
-      ss << "slot_number:\t" << (int)(slot_number) << std::endl;
-      ss << "challenge:\t" << (challenge) << std::endl;
-      ss << "last_totp_time:\t" << (last_totp_time) << std::endl;
-      ss << "last_interval:\t" << (int)(last_interval) << std::endl;
-      return ss.str();
+    std::string dissect() const { return dissect_to_string(*this); }
+    void dissect(DissectWriter &out) const {
+      out.text("slot_number:\t").dec(slot_number);
+      out.text("\nchallenge:\t").dec(challenge);
+      out.text("\nlast_totp_time:\t").dec(last_totp_time);
+      out.text("\nlast_interval:\t").dec(last_interval).character('\n');
     }
   } __packed;
 
@@ -211,14 +201,13 @@ class GetTOTP : Command<CommandID::GET_CODE> {
       } __packed ;
 
     bool isValid() const { return true; }
-    std::string dissect() const {
-      std::stringstream ss;
-      ss << "code:\t" << (code) << std::endl;
-        ss << "slot_config:\t" << std::bitset<8>((int)_slot_config) << std::endl;
-        ss << "\tuse_8_digits(0):\t" << use_8_digits << std::endl;
-        ss << "\tuse_enter(1):\t" << use_enter << std::endl;
-        ss << "\tuse_tokenID(2):\t" << use_tokenID << std::endl;
-      return ss.str();
+    std::string dissect() const { return dissect_to_string(*this); }
+    void dissect(DissectWriter &out) const {
+      out.text("code:\t").dec(code);
+      out.text("\nslot_config:\t").binary8(_slot_config);
+      out.text("\n\tuse_8_digits(0):\t").dec(use_8_digits);
+      out.text("\n\tuse_enter(1):\t").dec(use_enter);
+      out.text("\n\tuse_tokenID(2):\t").dec(use_tokenID).character('\n');
     }
   } __packed;
 
@@ -232,10 +221,9 @@ class GetHOTP : Command<CommandID::GET_CODE> {
     uint8_t slot_number;
 
     bool isValid() const { return (slot_number & 0xF0); }
-    std::string dissect() const {
-      std::stringstream ss;
-      ss << "slot_number:\t" << (int)(slot_number) << std::endl;
-      return ss.str();
+    std::string dissect() const { return dissect_to_string(*this); }
+    void dissect(DissectWriter &out) const {
+      out.text("slot_number:\t").dec(slot_number).character('\n');
     }
   } __packed;
 
@@ -256,14 +244,13 @@ class GetHOTP : Command<CommandID::GET_CODE> {
       } __packed;
 
     bool isValid() const { return true; }
-    std::string dissect() const {
-      std::stringstream ss;
-      ss << "code:\t" << (code) << std::endl;
-        ss << "slot_config:\t" << std::bitset<8>((int)_slot_config) << std::endl;
-        ss << "\tuse_8_digits(0):\t" << use_8_digits << std::endl;
-        ss << "\tuse_enter(1):\t" << use_enter << std::endl;
-        ss << "\tuse_tokenID(2):\t" << use_tokenID << std::endl;
-      return ss.str();
+    std::string dissect() const { return dissect_to_string(*this); }
+    void dissect(DissectWriter &out) const {
+      out.text("code:\t").dec(code);
+      out.text("\nslot_config:\t").binary8(_slot_config);
+      out.text("\n\tuse_8_digits(0):\t").dec(use_8_digits);
+      out.text("\n\tuse_enter(1):\t").dec(use_enter);
+      out.text("\n\tuse_tokenID(2):\t").dec(use_tokenID).character('\n');
     }
   } __packed;
 
@@ -278,10 +265,9 @@ class ReadSlot : Command<CommandID::READ_SLOT> {
 
     bool isValid() const { return !(slot_number & 0xF0); }
 
-    std::string dissect() const {
-      std::stringstream ss;
-      ss << "slot_number:\t" << (int)(slot_number) << std::endl;
-      return ss.str();
+    std::string dissect() const { return dissect_to_string(*this); }
+    void dissect(DissectWriter &out) const {
+      out.text("slot_number:\t").dec(slot_number).character('\n');
     }
   } __packed;
 
@@ -293,13 +279,12 @@ class ReadSlot : Command<CommandID::READ_SLOT> {
 
     bool isValid() const { return true; }
 
-    std::string dissect() const {
-      std::stringstream ss;
-      ss << "slot_name:\t" << slot_name << std::endl;
-      ss << "config:\t" << config << std::endl;
-      ss << "token_id:\t" << token_id << std::endl;
-      ss << "counter:\t" << counter << std::endl;
-      return ss.str();
+    std::string dissect() const { return dissect_to_string(*this); }
+    void dissect(DissectWriter &out) const {
+      out.text("slot_name:\t").c_string(slot_name, sizeof slot_name);
+      out.text("\nconfig:\t").dec(config);
+      out.text("\ntoken_id:\t").hex_compact(token_id, sizeof token_id);
+      out.text("\ncounter:\t").dec(counter).character('\n');
     }
   } __packed;
 
@@ -329,22 +314,20 @@ class GetStatus : Command<CommandID::GET_STATUS> {
                 sizeof card_serial, false);
     }
 
-    std::string dissect() const {
-      std::stringstream ss;
-      ss << "firmware_version:\t" << firmware_version << std::endl;
-      ss << "card_serial:\t"
-         << ::nitrokey::misc::hexdump((const char *)(card_serial),
-                                      sizeof card_serial, false);
-      ss << "general_config:\t"
-         << ::nitrokey::misc::hexdump((const char *)(general_config),
-                                      sizeof general_config, false);
-        ss << "numlock:\t" << (int)numlock << std::endl;
-        ss << "capslock:\t" << (int)capslock << std::endl;
-        ss << "scrolllock:\t" << (int)scrolllock << std::endl;
-        ss << "enable_user_password:\t" << (bool) enable_user_password << std::endl;
-        ss << "delete_user_password:\t" << (bool) delete_user_password << std::endl;
-
-        return ss.str();
+    std::string dissect() const { return dissect_to_string(*this); }
+
+    void dissect(DissectWriter &out) const {
+      out.text("firmware_version:\t").dec(firmware_version);
+      out.text("\ncard_serial:\t")
+          .hexdump(card_serial, sizeof card_serial, false);
+      out.text("general_config:\t")
+          .hexdump(general_config, sizeof general_config, false);
+      out.text("numlock:\t").dec(numlock);
+      out.text("\ncapslock:\t").dec(capslock);
+      out.text("\nscrolllock:\t").dec(scrolllock);
+      out.text("\nenable_user_password:\t").dec(enable_user_password != 0);
+      out.text("\ndelete_user_password:\t").dec(delete_user_password != 0);
+      out.character('\n');
     }
   } __packed;
 
@@ -358,10 +341,10 @@ class GetPasswordRetryCount : Command<CommandID::GET_PASSWORD_RETRY_COUNT> {
     uint8_t password_retry_count;
 
     bool isValid() const { return true; }
-    std::string dissect() const {
-      std::stringstream ss;
-      ss << " password_retry_count\t" << (int)password_retry_count << std::endl;
-      return ss.str();
+    std::string dissect() const { return dissect_to_string(*this); }
+    void dissect(DissectWriter &out) const {
+      out.text(" password_retry_count\t").dec(password_retry_count);
+      out.character('\n');
     }
   } __packed;
 
@@ -376,10 +359,10 @@ class GetUserPasswordRetryCount
     uint8_t password_retry_count;
 
     bool isValid() const { return true; }
-    std::string dissect() const {
-      std::stringstream ss;
-      ss << " password_retry_count\t" << (int)password_retry_count << std::endl;
-      return ss.str();
+    std::string dissect() const { return dissect_to_string(*this); }
+    void dissect(DissectWriter &out) const {
+      out.text(" password_retry_count\t").dec(password_retry_count);
+      out.character('\n');
     }
   } __packed;
 
@@ -402,11 +385,11 @@ class GetPasswordSafeSlotStatus : Command<CommandID::GET_PW_SAFE_SLOT_STATUS> {
     uint8_t password_safe_status[PWS_SLOT_COUNT];
 
     bool isValid() const { return true; }
-      std::string dissect() const {
-          std::stringstream ss;
-          ss << "password_safe_status\t";
-          write_array(ss, password_safe_status);
-          return ss.str();
+      std::string dissect() const { return dissect_to_string(*this); }
+      void dissect(DissectWriter &out) const {
+          out.text("password_safe_status\t")
+              .hexdump(password_safe_status, sizeof password_safe_status,
+                       false);
       }
   } __packed;
 
@@ -420,10 +403,9 @@ class GetPasswordSafeSlotName : Command<CommandID::GET_PW_SAFE_SLOT_NAME> {
     uint8_t slot_number;
 
     bool isValid() const { return !(slot_number & 0xF0); }
-    std::string dissect() const {
-      std::stringstream ss;
-      ss << "slot_number\t" << (int)slot_number << std::endl;
-      return ss.str();
+    std::string dissect() const { return dissect_to_string(*this); }
+    void dissect(DissectWriter &out) const {
+      out.text("slot_number\t").dec(slot_number).character('\n');
     }
   } __packed;
 
@@ -431,10 +413,11 @@ class GetPasswordSafeSlotName : Command<CommandID::GET_PW_SAFE_SLOT_NAME> {
     uint8_t slot_name[PWS_SLOTNAME_LENGTH];
 
     bool isValid() const { return true; }
-    std::string dissect() const {
-      std::stringstream ss;
-      ss << " slot_name\t" << (char*)slot_name << std::endl;
-      return ss.str();
+    std::string dissect() const { return dissect_to_string(*this); }
+    void dissect(DissectWriter &out) const {
+      out.text(" slot_name\t")
+          .c_string(slot_name, sizeof slot_name)
+          .character('\n');
     }
   } __packed;
 
@@ -449,10 +432,9 @@ class GetPasswordSafeSlotPassword
     uint8_t slot_number;
 
     bool isValid() const { return !(slot_number & 0xF0); }
-    std::string dissect() const {
-      std::stringstream ss;
-      ss << "   slot_number\t" << (int)slot_number << std::endl;
-      return ss.str();
+    std::string dissect() const { return dissect_to_string(*this); }
+    void dissect(DissectWriter &out) const {
+      out.text("   slot_number\t").dec(slot_number).character('\n');
     }
   } __packed;
 
@@ -460,10 +442,11 @@ class GetPasswordSafeSlotPassword
     uint8_t slot_password[PWS_PASSWORD_LENGTH];
 
     bool isValid() const { return true; }
-    std::string dissect() const {
-      std::stringstream ss;
-      ss << " slot_password\t" << (char*)slot_password << std::endl;
-      return ss.str();
+    std::string dissect() const { return dissect_to_string(*this); }
+    void dissect(DissectWriter &out) const {
+      out.text(" slot_password\t")
+          .c_string(slot_password, sizeof slot_password)
+          .character('\n');
     }
   } __packed;
 
@@ -478,10 +461,9 @@ class GetPasswordSafeSlotLogin
     uint8_t slot_number;
 
     bool isValid() const { return !(slot_number & 0xF0); }
-    std::string dissect() const {
-      std::stringstream ss;
-      ss << "   slot_number\t" << (int)slot_number << std::endl;
-      return ss.str();
+    std::string dissect() const { return dissect_to_string(*this); }
+    void dissect(DissectWriter &out) const {
+      out.text("   slot_number\t").dec(slot_number).character('\n');
     }
   } __packed;
 
@@ -489,10 +471,11 @@ class GetPasswordSafeSlotLogin
     uint8_t slot_login[PWS_LOGINNAME_LENGTH];
 
     bool isValid() const { return true; }
-    std::string dissect() const {
-      std::stringstream ss;
-      ss << " slot_login\t" << (char*)slot_login << std::endl;
-      return ss.str();
+    std::string dissect() const { return dissect_to_string(*this); }
+    void dissect(DissectWriter &out) const {
+      out.text(" slot_login\t")
+          .c_string(slot_login, sizeof slot_login)
+          .character('\n');
     }
   } __packed;
 
@@ -508,13 +491,14 @@ class SetPasswordSafeSlotData : Command<CommandID::SET_PW_SAFE_SLOT_DATA_1> {
     uint8_t slot_password[PWS_PASSWORD_LENGTH];
 
     bool isValid() const { return !(slot_number & 0xF0); }
-      std::string dissect() const {
-          std::stringstream ss;
-          ss << " slot_number\t" << (int)slot_number << std::endl;
-          ss << " slot_name\t" << (char*)slot_name << std::endl;
-          ss << " slot_password\t" << (char*)slot_password << std::endl;
-          return ss.str();
-      }
+    std::string dissect() const { return dissect_to_string(*this); }
+    void dissect(DissectWriter &out) const {
+      out.text(" slot_number\t").dec(slot_number);
+      out.text("\n slot_name\t").c_string(slot_name, sizeof slot_name);
+      out.text("\n slot_password\t")
+          .c_string(slot_password, sizeof slot_password)
+          .character('\n');
+    }
   } __packed;
 
   typedef Transaction<command_id(), struct CommandPayload, struct EmptyPayload>
@@ -528,12 +512,13 @@ class SetPasswordSafeSlotData2 : Command<CommandID::SET_PW_SAFE_SLOT_DATA_2> {
     uint8_t slot_login_name[PWS_LOGINNAME_LENGTH];
 
     bool isValid() const { return !(slot_number & 0xF0); }
-      std::string dissect() const {
-          std::stringstream ss;
-          ss << " slot_number\t" << (int)slot_number << std::endl;
-          ss << " slot_login_name\t" << (char*)slot_login_name << std::endl;
-          return ss.str();
-      }
+    std::string dissect() const { return dissect_to_string(*this); }
+    void dissect(DissectWriter &out) const {
+      out.text(" slot_number\t").dec(slot_number);
+      out.text("\n slot_login_name\t")
+          .c_string(slot_login_name, sizeof slot_login_name)
+          .character('\n');
+    }
   } __packed;
 
   typedef Transaction<command_id(), struct CommandPayload, struct EmptyPayload>
@@ -546,11 +531,10 @@ class ErasePasswordSafeSlot : Command<CommandID::PW_SAFE_ERASE_SLOT> {
     uint8_t slot_number;
 
     bool isValid() const { return !(slot_number & 0xF0); }
-      std::string dissect() const {
-          std::stringstream ss;
-          ss << " slot_number\t" << (int)slot_number << std::endl;
-          return ss.str();
-      }
+    std::string dissect() const { return dissect_to_string(*this); }
+    void dissect(DissectWriter &out) const {
+      out.text(" slot_number\t").dec(slot_number).character('\n');
+    }
 
   } __packed;
 
@@ -564,10 +548,11 @@ class EnablePasswordSafe : Command<CommandID::PW_SAFE_ENABLE> {
     uint8_t user_password[30];
 
     bool isValid() const { return true; }
-    std::string dissect() const {
-      std::stringstream ss;
-      ss << " user_password\t" << (char*) user_password << std::endl;
-      return ss.str();
+    std::string dissect() const { return dissect_to_string(*this); }
+    void dissect(DissectWriter &out) const {
+      out.text(" user_password\t")
+          .c_string(user_password, sizeof user_password)
+          .character('\n');
     }
   } __packed;
 
@@ -615,15 +600,15 @@ class WriteGeneralConfig : Command<CommandID::WRITE_CONFIG> {
             uint8_t delete_user_password;
         };
     };
-      std::string dissect() const {
-          std::stringstream ss;
-          ss << "numlock:\t" << (int)numlock << std::endl;
-          ss << "capslock:\t" << (int)capslock << std::endl;
-          ss << "scrolllock:\t" << (int)scrolllock << std::endl;
-          ss << "enable_user_password:\t" << (bool) enable_user_password << std::endl;
-          ss << "delete_user_password:\t" << (bool) delete_user_password << std::endl;
-          return ss.str();
-      }
+    std::string dissect() const { return dissect_to_string(*this); }
+    void dissect(DissectWriter &out) const {
+      out.text("numlock:\t").dec(numlock);
+      out.text("\ncapslock:\t").dec(capslock);
+      out.text("\nscrolllock:\t").dec(scrolllock);
+      out.text("\nenable_user_password:\t").dec(enable_user_password != 0);
+      out.text("\ndelete_user_password:\t").dec(delete_user_password != 0);
+      out.character('\n');
+    }
   } __packed;
 
   typedef Transaction<command_id(), struct CommandPayload, struct EmptyPayload>
@@ -638,11 +623,13 @@ class FirstAuthenticate : Command<CommandID::FIRST_AUTHENTICATE> {
 
     bool isValid() const { return true; }
 
-    std::string dissect() const {
-      std::stringstream ss;
-      ss << "card_password:\t" << card_password << std::endl;
-      ss << "temporary_password:\t" << temporary_password << std::endl;
-      return ss.str();
+    std::string dissect() const { return dissect_to_string(*this); }
+    void dissect(DissectWriter &out) const {
+      out.text("card_password:\t")
+          .c_string(card_password, sizeof card_password);
+      out.text("\ntemporary_password:\t")
+          .c_string(temporary_password, sizeof temporary_password)
+          .character('\n');
     }
   } __packed;
 
@@ -657,12 +644,14 @@ class UserAuthenticate : Command<CommandID::USER_AUTHENTICATE> {
     uint8_t temporary_password[25];
 
     bool isValid() const { return true; }
-      std::string dissect() const {
-          std::stringstream ss;
-          ss << "card_password:\t" << card_password << std::endl;
-          ss << "temporary_password:\t" << temporary_password << std::endl;
-          return ss.str();
-      }
+    std::string dissect() const { return dissect_to_string(*this); }
+    void dissect(DissectWriter &out) const {
+      out.text("card_password:\t")
+          .c_string(card_password, sizeof card_password);
+      out.text("\ntemporary_password:\t")
+          .c_string(temporary_password, sizeof temporary_password)
+          .character('\n');
+    }
   } __packed;
 
   typedef Transaction<command_id(), struct CommandPayload, struct EmptyPayload>
@@ -675,11 +664,12 @@ class Authorize : Command<CommandID::AUTHORIZE> {
     uint32_t crc_to_authorize;
     uint8_t temporary_password[25];
 
-      std::string dissect() const {
-      std::stringstream ss;
-      ss << " crc_to_authorize:\t" << std::hex << std::setw(2) << std::setfill('0') << crc_to_authorize<< std::endl;
-      ss << " temporary_password:\t" << temporary_password<< std::endl;
-      return ss.str();
+      std::string dissect() const { return dissect_to_string(*this); }
+    void dissect(DissectWriter &out) const {
+      out.text(" crc_to_authorize:\t").hex32(crc_to_authorize);
+      out.text("\n temporary_password:\t")
+          .c_string(temporary_password, sizeof temporary_password)
+          .character('\n');
     }
   } __packed;
 
@@ -692,11 +682,12 @@ class UserAuthorize : Command<CommandID::USER_AUTHORIZE> {
   struct CommandPayload {
     uint32_t crc_to_authorize;
     uint8_t temporary_password[25];
-    std::string dissect() const {
-      std::stringstream ss;
-      ss << " crc_to_authorize:\t" <<  crc_to_authorize<< std::endl;
-      ss << " temporary_password:\t" << temporary_password<< std::endl;
-      return ss.str();
+    std::string dissect() const { return dissect_to_string(*this); }
+    void dissect(DissectWriter &out) const {
+      out.text(" crc_to_authorize:\t").hex32(crc_to_authorize);
+      out.text("\n temporary_password:\t")
+          .c_string(temporary_password, sizeof temporary_password)
+          .character('\n');
     }
   } __packed;
 
@@ -704,16 +695,42 @@ class UserAuthorize : Command<CommandID::USER_AUTHORIZE> {
       CommandTransaction;
 };
 
+/*
+ *	Packet authorizing the command S, chosen from its
+ *	CommandMetadata::authorization.
+ */
+template <typename S,
+          Authorization = S::CommandTransaction::metadata.authorization>
+struct AuthorizingCommand {
+  static_assert(sizeof(S) == 0, "the command needs no authorization");
+};
+
+template <typename S>
+struct AuthorizingCommand<S, Authorization::ADMIN> {
+  typedef Authorize type;
+};
+
+template <typename S>
+struct AuthorizingCommand<S, Authorization::USER> {
+  typedef UserAuthorize type;
+};
+
+template <typename S>
+struct AuthorizingCommand<S, Authorization::USER_IF_PROTECTED> {
+  typedef UserAuthorize type;
+};
+
 class UnlockUserPassword : Command<CommandID::UNLOCK_USER_PASSWORD> {
  public:
   struct CommandPayload {
     uint8_t admin_password[25];
     uint8_t user_new_password[25];
-      std::string dissect() const {
-          std::stringstream ss;
-          ss << " admin_password:\t" <<  admin_password<< std::endl;
-          return ss.str();
-      }
+    std::string dissect() const { return dissect_to_string(*this); }
+    void dissect(DissectWriter &out) const {
+      out.text(" admin_password:\t")
+          .c_string(admin_password, sizeof admin_password)
+          .character('\n');
+    }
   } __packed;
 
   typedef Transaction<command_id(), struct CommandPayload, struct EmptyPayload>
@@ -725,12 +742,13 @@ class ChangeUserPin : Command<CommandID::CHANGE_USER_PIN> {
   struct CommandPayload {
     uint8_t old_pin[25];
     uint8_t new_pin[25];
-      std::string dissect() const {
-          std::stringstream ss;
-          ss << " old_pin:\t" <<  old_pin<< std::endl;
-          ss << " new_pin:\t" << new_pin<< std::endl;
-          return ss.str();
-      }
+    std::string dissect() const { return dissect_to_string(*this); }
+    void dissect(DissectWriter &out) const {
+      out.text(" old_pin:\t").c_string(old_pin, sizeof old_pin);
+      out.text("\n new_pin:\t")
+          .c_string(new_pin, sizeof new_pin)
+          .character('\n');
+    }
   } __packed;
 
   typedef Transaction<command_id(), struct CommandPayload, struct EmptyPayload>
@@ -741,11 +759,12 @@ class IsAESSupported : Command<CommandID::DETECT_SC_AES> {
  public:
   struct CommandPayload {
     uint8_t user_password[20];
-      std::string dissect() const {
-          std::stringstream ss;
-          ss << " user_password:\t" <<  user_password<< std::endl;
-          return ss.str();
-      }
+    std::string dissect() const { return dissect_to_string(*this); }
+    void dissect(DissectWriter &out) const {
+      out.text(" user_password:\t")
+          .c_string(user_password, sizeof user_password)
+          .character('\n');
+    }
   } __packed;
 
   typedef Transaction<command_id(), struct CommandPayload, struct EmptyPayload>
@@ -757,12 +776,13 @@ class ChangeAdminPin : Command<CommandID::CHANGE_ADMIN_PIN> {
   struct CommandPayload {
     uint8_t old_pin[25];
     uint8_t new_pin[25];
-      std::string dissect() const {
-          std::stringstream ss;
-          ss << " old_pin:\t" <<  old_pin<< std::endl;
-          ss << " new_pin:\t" << new_pin<< std::endl;
-          return ss.str();
-      }
+    std::string dissect() const { return dissect_to_string(*this); }
+    void dissect(DissectWriter &out) const {
+      out.text(" old_pin:\t").c_string(old_pin, sizeof old_pin);
+      out.text("\n new_pin:\t")
+          .c_string(new_pin, sizeof new_pin)
+          .character('\n');
+    }
   } __packed;
 
   typedef Transaction<command_id(), struct CommandPayload, struct EmptyPayload>
@@ -779,11 +799,12 @@ class FactoryReset : Command<CommandID::FACTORY_RESET> {
  public:
   struct CommandPayload {
     uint8_t admin_password[20];
-      std::string dissect() const {
-          std::stringstream ss;
-          ss << " admin_password:\t" <<  admin_password<< std::endl;
-          return ss.str();
-      }
+    std::string dissect() const { return dissect_to_string(*this); }
+    void dissect(DissectWriter &out) const {
+      out.text(" admin_password:\t")
+          .c_string(admin_password, sizeof admin_password)
+          .character('\n');
+    }
   } __packed;
 
   typedef Transaction<command_id(), struct CommandPayload, struct EmptyPayload>
@@ -794,11 +815,12 @@ class BuildAESKey : Command<CommandID::NEW_AES_KEY> {
  public:
   struct CommandPayload {
     uint8_t admin_password[20];
-      std::string dissect() const {
-          std::stringstream ss;
-          ss << " admin_password:\t" <<  admin_password<< std::endl;
-          return ss.str();
-      }
+    std::string dissect() const { return dissect_to_string(*this); }
+    void dissect(DissectWriter &out) const {
+      out.text(" admin_password:\t")
+          .c_string(admin_password, sizeof admin_password)
+          .character('\n');
+    }
   } __packed;
 
   typedef Transaction<command_id(), struct CommandPayload, struct EmptyPayload>
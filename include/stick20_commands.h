@@ -26,10 +26,9 @@ namespace stick20 {
       struct CommandPayload {
           uint8_t kind;
           uint8_t old_pin[20];
-          std::string dissect() const {
-            std::stringstream ss;
-            ss << " old_pin:\t" <<  old_pin<< std::endl;
-            return ss.str();
+          std::string dissect() const { return dissect_to_string(*this); }
+          void dissect(DissectWriter &out) const {
+            out.text(" old_pin:\t").c_string(old_pin, sizeof old_pin).character('\n');
           }
           void set_kind(PasswordKind k){
             kind = (uint8_t)k;
@@ -47,10 +46,9 @@ namespace stick20 {
         struct CommandPayload {
             uint8_t kind;
             uint8_t new_pin[20];
-            std::string dissect() const {
-              std::stringstream ss;
-              ss << " new_pin:\t" << new_pin<< std::endl;
-              return ss.str();
+            std::string dissect() const { return dissect_to_string(*this); }
+            void dissect(DissectWriter &out) const {
+              out.text(" new_pin:\t").c_string(new_pin, sizeof new_pin).character('\n');
             }
             void set_kind(PasswordKind k){
               kind = (uint8_t)k;
@@ -182,8 +180,6 @@ class SendPasswordMatrixSetup : semantics::non_constructible {
                       struct EmptyPayload> CommandTransaction;
 };
 
-#define d(x) ss << #x":\t" << x << std::endl;
-
     class GetDeviceStatus : Command<CommandID::GET_DEVICE_STATUS> {
     public:
         static const int OUTPUT_CMD_RESULT_STICK20_STATUS_START = 20 +1;
@@ -196,18 +192,48 @@ class SendPasswordMatrixSetup : semantics::non_constructible {
             uint8_t last_command;
             uint8_t status;
             uint8_t progress_bar_value;
+            // status of the Storage (StickConfiguration of the firmware), see StorageStatus
+            uint16_t magic_number_stick_config;
+            uint8_t read_write_flag_uncrypted_volume;  // 0 - read-only
+            uint8_t read_write_flag_crypted_volume;
+            uint8_t version_info[4];  // reserved, minor, reserved, major
+            uint8_t read_write_flag_hidden_volume;
+            uint8_t firmware_locked;
+            uint8_t new_sd_card_found;  // bit 0 - found, bits 1-7 - counter
+            uint8_t sd_fill_with_random_chars;  // bit 0 - filled
+            uint32_t active_sd_card_id;
+            uint8_t volume_active_flag;  // bit 0 - unencrypted, 1 - encrypted, 2 - hidden
+            uint8_t new_smart_card_found;
+            uint8_t user_password_retry_count;
+            uint8_t admin_password_retry_count;
+            uint32_t active_smart_card_id;
+            uint8_t stick_keys_not_initiated;
             bool isValid() const { return true; }
 
-            std::string dissect() const {
-              std::stringstream ss;
-                d(command_counter);
-                d(last_command);
-                d(status);
-                d(progress_bar_value);
-              ss << "_padding:\t"
-                 << ::nitrokey::misc::hexdump((const char *)(_padding),
-                                              sizeof _padding);
-              return ss.str();
+            std::string dissect() const { return dissect_to_string(*this); }
+            void dissect(DissectWriter &out) const {
+              out.text("command_counter:\t").dec(command_counter);
+              out.text("\nlast_command:\t").dec(last_command);
+              out.text("\nstatus:\t").dec(status);
+              out.text("\nprogress_bar_value:\t").dec(progress_bar_value);
+              out.text("\nmagic_number_stick_config:\t").hex(magic_number_stick_config);
+              out.text("\nread_write_flags (unencrypted, encrypted, hidden):\t")
+                  .dec(read_write_flag_uncrypted_volume).character(' ')
+                  .dec(read_write_flag_crypted_volume).character(' ')
+                  .dec(read_write_flag_hidden_volume);
+              out.text("\nfirmware_version:\t").dec(version_info[3]).character('.')
+                  .dec(version_info[1]);
+              out.text("\nfirmware_locked:\t").dec(firmware_locked);
+              out.text("\nnew_sd_card_found:\t").dec(new_sd_card_found);
+              out.text("\nsd_fill_with_random_chars:\t").dec(sd_fill_with_random_chars);
+              out.text("\nactive_sd_card_id:\t").dec(active_sd_card_id);
+              out.text("\nvolume_active_flag:\t").dec(volume_active_flag);
+              out.text("\nnew_smart_card_found:\t").dec(new_smart_card_found);
+              out.text("\nretry_counts (user, admin):\t").dec(user_password_retry_count)
+                  .character(' ').dec(admin_password_retry_count);
+              out.text("\nactive_smart_card_id:\t").dec(active_smart_card_id);
+              out.text("\nstick_keys_not_initiated:\t").dec(stick_keys_not_initiated);
+              out.text("\n_padding:\t").hexdump(_padding, sizeof _padding);
             }
         } __packed;
 
@@ -0,0 +1,41 @@
+#ifndef STORAGE_STATUS_H
+#define STORAGE_STATUS_H
+#include <cstdint>
+#include "stick20_commands.h"
+
+namespace nitrokey {
+
+/*
+ *	Status of the Nitrokey Storage, decoded from the response of
+ *	GetDeviceStatus.
+ */
+struct StorageStatus {
+  struct Volume {
+    bool active;
+    bool read_only;
+  };
+
+  Volume unencrypted_volume;
+  Volume encrypted_volume;
+  Volume hidden_volume;
+
+  uint8_t firmware_version_major;
+  uint8_t firmware_version_minor;
+  bool firmware_locked;
+
+  uint32_t sd_card_id;
+  bool new_sd_card_found;  // the SD card was not seen by the device before
+  bool sd_card_filled_with_random_data;
+
+  uint32_t smart_card_id;
+  bool new_smart_card_found;
+  bool keys_initialized;
+
+  uint8_t user_retry_count;
+  uint8_t admin_retry_count;
+
+  static StorageStatus decode(
+      const proto::stick20::GetDeviceStatus::ResponsePayload &response);
+};
+}
+#endif
@@ -0,0 +1,100 @@
+/*
+ *	Optional span tracing of device transactions
+ *
+ *	Spans are kept in a fixed in-memory ring buffer and can be dumped
+ *	in Chrome trace event format (chrome://tracing, ui.perfetto.dev).
+ */
+#ifndef TRACE_H
+#define TRACE_H
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <mutex>
+#include <string>
+#include "inttypes.h"
+
+namespace nitrokey {
+namespace trace {
+
+/*
+ *	Complete ("ph":"X") event. Name and category have to point to
+ *	static storage (string literals, __func__), so recording never
+ *	allocates.
+ */
+struct Event {
+  const char *name;
+  const char *category;
+  uint64_t start_us;
+  uint64_t duration_us;
+  uint64_t thread_id;
+  int64_t arg;  // -1 - no argument
+};
+
+class Tracer {
+ public:
+  static const size_t CAPACITY = 4096;
+
+  static Tracer &instance();
+
+  /*
+   *	The only check made on the hot path while tracing is disabled.
+   */
+  static bool enabled() {
+    return s_enabled.load(std::memory_order_relaxed);
+  }
+  static void set_enabled(bool state);
+
+  uint64_t now_us() const;
+  void record(const char *category, const char *name, uint64_t start_us,
+              uint64_t duration_us, int64_t arg);
+  void clear();
+  std::string dump_chrome_json() const;
+
+ private:
+  Tracer();
+
+  static std::atomic<bool> s_enabled;
+
+  mutable std::mutex m_mutex;
+  Event m_events[CAPACITY];
+  size_t m_next;
+  size_t m_count;
+  std::chrono::steady_clock::time_point m_epoch;
+};
+
+/*
+ *	RAII span. Costs one predictable branch when tracing is disabled.
+ */
+class Span {
+ public:
+  Span(const char *category, const char *name, int64_t arg = -1)
+      : m_name(nullptr) {
+    if (__builtin_expect(Tracer::enabled(), 0)) {
+      m_category = category;
+      m_name = name;
+      m_arg = arg;
+      m_start_us = Tracer::instance().now_us();
+    }
+  }
+
+  ~Span() {
+    if (m_name != nullptr) {
+      auto &tracer = Tracer::instance();
+      tracer.record(m_category, m_name, m_start_us,
+                    tracer.now_us() - m_start_us, m_arg);
+    }
+  }
+
+  Span(const Span &) = delete;
+  Span &operator=(const Span &) = delete;
+
+ private:
+  const char *m_category;
+  const char *m_name;
+  int64_t m_arg;
+  uint64_t m_start_us;
+};
+}
+}
+
+#endif
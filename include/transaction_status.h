@@ -0,0 +1,59 @@
+#ifndef TRANSACTION_STATUS_H
+#define TRANSACTION_STATUS_H
+#include <cstdint>
+
+namespace nitrokey {
+namespace proto {
+
+/*
+ *	Outcome of a transaction, returned by Transaction::try_run() and the
+ *	try_* calls of NitrokeyManager instead of an exception. Meant for loops
+ *	in which failures are expected (probing slots, polling until a slot is
+ *	programmed), where throwing and catching would cost more than the
+ *	exchange with the device.
+ */
+struct TransactionStatus {
+  enum class Outcome : uint8_t {
+    OK = 0,
+    COMMAND_FAILED,         // see last_command_status
+    SEND_FAILED,            // see device_result
+    RECEIVE_FAILED,         // see device_result
+    NO_RESPONSE,            // the RetryPolicy allows no more attempts
+    RETRY_DEADLINE_PASSED,  // the RetryPolicy deadline passed
+    CANCELLED,              // see OperationLimits
+    DEADLINE_EXCEEDED,      // see OperationLimits
+    // the Storage works on a long operation, see progress
+    LONG_OPERATION_IN_PROGRESS,
+  };
+
+  // to_command_status() of the device errors, as NK_OP_STATUS_DEVICE_ERROR
+  static constexpr uint8_t DEVICE_ERROR_STATUS = 255;
+
+  Outcome outcome;
+  uint8_t command_id;
+  uint8_t last_command_status;  // of the device, COMMAND_FAILED only
+  int device_result;            // of Device::send() or Device::recv()
+  uint8_t progress;             // percent, LONG_OPERATION_IN_PROGRESS only
+
+  bool ok() const { return outcome == Outcome::OK; }
+  explicit operator bool() const { return ok(); }
+
+  /*
+   *	Throws what Transaction::run() throws for the outcome, nothing for
+   *	OK.
+   */
+  void raise() const;
+
+  /*
+   *	Status in the numbering of the C API (NK_get_last_command_status):
+   *	0, the device status of a failed command or the exception id of
+   *	LibraryException. The device errors, which have no such number,
+   *	are DEVICE_ERROR_STATUS.
+   */
+  uint8_t to_command_status() const;
+
+  const char *describe() const;
+};
+}
+}
+#endif
@@ -0,0 +1,126 @@
+#include <algorithm>
+#include <exception>
+#include "include/keep_alive.h"
+#include "include/log.h"
+#include "include/poller.h"
+#include "include/stick10_commands.h"
+
+using namespace nitrokey::device;
+using namespace nitrokey::log;
+
+std::shared_ptr<KeepAlive> KeepAlive::create(
+    std::shared_ptr<Device> device, std::chrono::milliseconds idle_threshold) {
+  return std::shared_ptr<KeepAlive>(new KeepAlive(device, idle_threshold));
+}
+
+KeepAlive::KeepAlive(std::shared_ptr<Device> device,
+                     std::chrono::milliseconds idle_threshold)
+    : m_device(device),
+      m_idle_threshold(idle_threshold),
+      m_running(false),
+      m_generation(0),
+      m_stats{0, 0, std::chrono::microseconds(0)},
+      m_quickest(0),
+      m_pending_saving(0),
+      m_exchange_count(device->get_exchange_count()) {}
+
+void KeepAlive::start() {
+  uint64_t generation;
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_running) return;
+    m_running = true;
+    generation = ++m_generation;
+  }
+  schedule(m_device->get_clock().now() + m_idle_threshold, generation);
+}
+
+void KeepAlive::stop() {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_running = false;
+}
+
+void KeepAlive::schedule(Clock::time_point when, uint64_t generation) {
+  const std::weak_ptr<KeepAlive> weak = shared_from_this();
+  const auto delay = std::max(
+      ceil_microseconds(when - m_device->get_clock().now()),
+      std::chrono::microseconds(0));
+  Poller::blocking().schedule_after(
+      delay,
+      [weak, generation] {
+        auto self = weak.lock();
+        if (self == nullptr) return;
+        {
+          // stopped, or started again with a callback of its own
+          std::lock_guard<std::mutex> lock(self->m_mutex);
+          if (!self->m_running || self->m_generation != generation) return;
+        }
+        self->schedule(self->tick(), generation);
+      });
+}
+
+void KeepAlive::credit_saving() {
+  const auto count = m_device->get_exchange_count();
+  std::lock_guard<std::mutex> lock(m_mutex);
+  if (count == m_exchange_count) return;
+  m_stats.saved += m_pending_saving;
+  m_pending_saving = std::chrono::microseconds(0);
+  m_exchange_count = count;
+}
+
+Clock::time_point KeepAlive::tick() {
+  credit_saving();
+  Clock::time_point last_activity;
+  if (!m_device->begin_keep_alive(m_idle_threshold, last_activity))
+    return last_activity + m_idle_threshold;
+
+  // not waiting for other processes using the device, they keep it awake
+  auto &lease = m_device->get_lease();
+  if (lease.try_acquire(m_device->get_lease_key())) {
+    send();
+    lease.release();
+  }
+  m_device->end_keep_alive();
+  return m_device->get_clock().now() + m_idle_threshold;
+}
+
+void KeepAlive::send() {
+  auto &clock = m_device->get_clock();
+  auto get_status = [&] {
+    const auto begin = clock.now();
+    proto::stick10::GetStatus::CommandTransaction::run(*m_device);
+    return ceil_microseconds(clock.now() - begin);
+  };
+
+  try {
+    const auto first = get_status();
+    auto quickest = m_quickest;
+    bool woken = false;
+    // a slow one is compared with one right after it
+    if (quickest.count() == 0 || first > 2 * quickest) {
+      const auto second = get_status();
+      woken = quickest.count() != 0 || first > 2 * second;
+      quickest = quickest.count() == 0 ? second : std::min(quickest, second);
+    }
+    quickest = std::min(quickest, first);
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stats.sent++;
+    m_quickest = quickest;
+    m_pending_saving =
+        woken ? first - quickest : std::chrono::microseconds(0);
+    m_exchange_count = m_device->get_exchange_count();
+  } catch (std::exception &e) {
+    Log::instance()(std::string("Keep-alive failed: ") + e.what(),
+                    Loglevel::WARNING);
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stats.failed++;
+    m_pending_saving = std::chrono::microseconds(0);
+  }
+}
+
+KeepAlive::Stats KeepAlive::get_stats() {
+  credit_saving();
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return m_stats;
+}
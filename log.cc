@@ -1,15 +1,25 @@
 #include <iostream>
 #include <string>
 #include <ctime>
-#include <iomanip>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
 #include "log.h"
 
 namespace nitrokey {
 namespace log {
 
-Log *Log::mp_instance = NULL;
 StdlogHandler stdlog_handler;
 
+const size_t AsyncLogHandler::SLOT_COUNT;
+const size_t AsyncLogHandler::SLOT_TEXT_SIZE;
+const size_t AsyncLogHandler::MAX_SLOTS_PER_MESSAGE;
+
+Log &Log::instance() {
+  static Log log;
+  return log;
+}
+
 std::string LogHandler::loglevel_to_str(Loglevel lvl) {
   switch (lvl) {
     case Loglevel::DEBUG_L2:
@@ -26,17 +36,187 @@ std::string LogHandler::loglevel_to_str(Loglevel lvl) {
   return std::string("");
 }
 
+const std::string &LogHandler::format_time(std::time_t t) {
+  static thread_local std::time_t cached_time = -1;
+  static thread_local std::string cached;
+
+  if (t != cached_time) {
+    std::tm tm;
+    char buf[64];
+    localtime_r(&t, &tm);  // std::localtime is not thread safe
+    strftime(buf, sizeof buf, "%c %Z", &tm);
+    cached = buf;
+    cached_time = t;
+  }
+  return cached;
+}
+
 void Log::operator()(const std::string &logstr, Loglevel lvl) {
-  if (mp_loghandler != NULL)
-    if ((int)(lvl) >= (int)(m_loglevel)) mp_loghandler->print(logstr, lvl);
+  LogHandler *handler = mp_loghandler.load(std::memory_order_relaxed);
+  if (handler != NULL)
+    if ((int)(lvl) >= (int)(m_loglevel.load(std::memory_order_relaxed)))
+      handler->print(logstr, lvl);
 }
 
-void StdlogHandler::print(const std::string &str, Loglevel lvl) {
-  std::time_t t = std::time(nullptr);
-  std::tm tm = *std::localtime(&t);
+void Log::operator()(const char *logstr, Loglevel lvl) {
+  if (is_enabled(lvl)) operator()(std::string(logstr), lvl);
+}
+
+static AsyncLogHandler *shared_async_handler() {
+  // never destroyed, so it outlives any late log call at exit
+  static AsyncLogHandler *handler = [] {
+    auto h = new AsyncLogHandler;
+    std::atexit([] { shared_async_handler()->flush(); });
+    return h;
+  }();
+  return handler;
+}
 
+void Log::set_async(bool state) {
+  if (state) {
+    set_handler(shared_async_handler());
+    return;
+  }
+  LogHandler *previous = mp_loghandler.exchange(&stdlog_handler);
+  if (previous == shared_async_handler()) shared_async_handler()->flush();
+}
+
+void StdlogHandler::print(const std::string &str, Loglevel lvl) {
   std::clog << "[" << loglevel_to_str(lvl) << "] ["
-            << std::put_time(&tm, "%c %Z") << "]\t" << str << std::endl;
+            << format_time(std::time(nullptr)) << "]\t" << str << std::endl;
+}
+
+AsyncLogHandler::AsyncLogHandler()
+    : m_enqueue_pos(0),
+      m_dequeue_pos(0),
+      m_written_pos(0),
+      m_dropped(0),
+      m_dropped_reported(0),
+      m_running(false),
+      m_consumer_waiting(false) {
+  for (size_t i = 0; i < SLOT_COUNT; i++)
+    m_slots[i].sequence.store(i, std::memory_order_relaxed);
+}
+
+AsyncLogHandler::~AsyncLogHandler() {
+  m_running = false;
+  m_cv.notify_one();
+  if (m_thread.joinable()) m_thread.join();
+}
+
+void AsyncLogHandler::start() {
+  m_running = true;
+  m_thread = std::thread(&AsyncLogHandler::run, this);
+}
+
+void AsyncLogHandler::print(const std::string &str, Loglevel lvl) {
+  std::call_once(m_started, [this] { start(); });
+
+  const size_t mask = SLOT_COUNT - 1;
+  size_t parts = (str.size() + SLOT_TEXT_SIZE - 1) / SLOT_TEXT_SIZE;
+  parts = std::min(std::max(parts, (size_t)1), MAX_SLOTS_PER_MESSAGE);
+
+  // Claim `parts` consecutive slots. The consumer frees slots in order,
+  // so the last one being free means all of them are.
+  size_t pos = m_enqueue_pos.load(std::memory_order_relaxed);
+  for (;;) {
+    const size_t last = pos + parts - 1;
+    const size_t seq =
+        m_slots[last & mask].sequence.load(std::memory_order_acquire);
+    const intptr_t dif = (intptr_t)seq - (intptr_t)last;
+    if (dif == 0) {
+      if (m_enqueue_pos.compare_exchange_weak(pos, pos + parts,
+                                              std::memory_order_relaxed))
+        break;
+    } else if (dif < 0) {
+      m_dropped.fetch_add(1, std::memory_order_relaxed);
+      return;
+    } else {
+      pos = m_enqueue_pos.load(std::memory_order_relaxed);
+    }
+  }
+
+  const std::time_t now = std::time(nullptr);
+  size_t offset = 0;
+  for (size_t i = 0; i < parts; i++) {
+    Slot &slot = m_slots[(pos + i) & mask];
+    const size_t n = std::min(SLOT_TEXT_SIZE, str.size() - offset);
+    memcpy(slot.text, str.data() + offset, n);
+    slot.length = (uint16_t)n;
+    slot.level = lvl;
+    slot.time = now;
+    slot.parts = (uint16_t)parts;
+    offset += n;
+  }
+  // the first slot is published last, so all parts are visible with it
+  for (size_t i = parts; i-- > 0;)
+    m_slots[(pos + i) & mask].sequence.store(pos + i + 1,
+                                             std::memory_order_release);
+
+  if (m_consumer_waiting.load(std::memory_order_relaxed)) m_cv.notify_one();
+}
+
+bool AsyncLogHandler::drain_one() {
+  const size_t mask = SLOT_COUNT - 1;
+  Slot &first = m_slots[m_dequeue_pos & mask];
+  if (first.sequence.load(std::memory_order_acquire) != m_dequeue_pos + 1)
+    return false;
+
+  const size_t parts = first.parts;
+  const Loglevel level = first.level;
+  const std::time_t time = first.time;
+  std::string text;
+  for (size_t i = 0; i < parts; i++) {
+    Slot &slot = m_slots[(m_dequeue_pos + i) & mask];
+    text.append(slot.text, slot.length);
+    slot.sequence.store(m_dequeue_pos + i + SLOT_COUNT,
+                        std::memory_order_release);
+  }
+  m_dequeue_pos += parts;
+
+  std::clog << "[" << loglevel_to_str(level) << "] [" << format_time(time)
+            << "]\t" << text << '\n';
+  m_written_pos.store(m_dequeue_pos, std::memory_order_release);
+  return true;
+}
+
+void AsyncLogHandler::report_drops() {
+  const size_t dropped = m_dropped.load(std::memory_order_relaxed);
+  if (dropped == m_dropped_reported) return;
+  std::clog << "[" << loglevel_to_str(Loglevel::WARNING) << "] ["
+            << format_time(std::time(nullptr)) << "]\t"
+            << dropped - m_dropped_reported
+            << " log message(s) dropped, buffer was full" << std::endl;
+  m_dropped_reported = dropped;
+}
+
+void AsyncLogHandler::run() {
+  for (;;) {
+    bool written = false;
+    while (drain_one()) written = true;
+    report_drops();
+    if (written) {
+      std::clog.flush();
+      continue;
+    }
+    if (!m_running) break;
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_consumer_waiting = true;
+    // producers never take the lock, so a wake-up can be missed;
+    // the timeout bounds the latency then
+    m_cv.wait_for(lock, std::chrono::milliseconds(10));
+    m_consumer_waiting = false;
+  }
+}
+
+void AsyncLogHandler::flush() {
+  const size_t target = m_enqueue_pos.load(std::memory_order_relaxed);
+  while (m_running &&
+         m_written_pos.load(std::memory_order_acquire) < target) {
+    m_cv.notify_one();
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
 }
 }
 }
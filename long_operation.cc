@@ -0,0 +1,136 @@
+#include <exception>
+#include "include/long_operation.h"
+#include "include/poller.h"
+
+namespace nitrokey {
+
+constexpr std::chrono::milliseconds LongOperation::DEFAULT_POLL_INTERVAL;
+
+std::shared_ptr<LongOperation> LongOperation::start(
+    std::shared_ptr<NitrokeyManager> manager, Begin begin, Callback callback,
+    std::chrono::milliseconds poll_interval, std::mutex *manager_mutex) {
+  std::shared_ptr<LongOperation> operation(new LongOperation(
+      manager, std::move(callback), poll_interval, manager_mutex));
+  operation->run_begin(begin);
+  return operation;
+}
+
+LongOperation::LongOperation(std::shared_ptr<NitrokeyManager> manager,
+                             Callback callback,
+                             std::chrono::milliseconds poll_interval,
+                             std::mutex *manager_mutex)
+    : m_manager(manager),
+      m_manager_mutex(manager_mutex),
+      m_callback(std::move(callback)),
+      m_poll_interval(poll_interval),
+      m_progress{State::RUNNING, -1, 0} {}
+
+LongOperation::~LongOperation() { cancel(); }
+
+LongOperation::Progress LongOperation::get_progress() {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return m_progress;
+}
+
+bool LongOperation::is_finished() {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return m_progress.state != State::RUNNING;
+}
+
+void LongOperation::cancel() {
+  set(State::CANCELLED, -1, OperationCancelledException().exception_id());
+  // a poll in progress ends
+  std::lock_guard<std::mutex> poll_lock(m_poll_mutex);
+}
+
+bool LongOperation::wait_for(std::chrono::milliseconds timeout) {
+  std::unique_lock<std::mutex> lock(m_mutex);
+  return m_finished.wait_for(
+      lock, timeout, [this] { return m_progress.state != State::RUNNING; });
+}
+
+void LongOperation::wait() {
+  std::unique_lock<std::mutex> lock(m_mutex);
+  m_finished.wait(lock, [this] { return m_progress.state != State::RUNNING; });
+}
+
+template <typename T>
+uint8_t LongOperation::call_manager(T function, int &result) {
+  std::unique_lock<std::mutex> manager_lock;
+  if (m_manager_mutex != nullptr)
+    manager_lock = std::unique_lock<std::mutex>(*m_manager_mutex);
+  try {
+    result = function(*m_manager);
+    return 0;
+  } catch (CommandFailedException &e) {
+    return e.last_command_status;
+  } catch (LibraryException &e) {
+    return e.exception_id();
+  } catch (std::exception &) {
+    return proto::TransactionStatus::DEVICE_ERROR_STATUS;
+  }
+}
+
+void LongOperation::run_begin(Begin &begin) {
+  int started = 0;
+  uint8_t status;
+  {
+    std::lock_guard<std::mutex> poll_lock(m_poll_mutex);
+    status = call_manager(
+        [&](NitrokeyManager &manager) { return begin(manager) ? 1 : 0; },
+        started);
+  }
+  if (status != 0)
+    set(State::FAILED, -1, status);
+  else if (!started)
+    set(State::DONE, 100, 0);
+  else
+    schedule_poll();
+}
+
+void LongOperation::schedule_poll() {
+  std::weak_ptr<LongOperation> weak = shared_from_this();
+  // a poll is a whole transaction, waiting for the device
+  device::Poller::blocking().schedule_after(m_poll_interval, [weak] {
+    if (auto operation = weak.lock()) operation->poll();
+  });
+}
+
+void LongOperation::poll() {
+  int percent = -1;
+  uint8_t status;
+  {
+    std::lock_guard<std::mutex> poll_lock(m_poll_mutex);
+    if (is_finished()) return;
+    status = call_manager(
+        [](NitrokeyManager &manager) {
+          return manager.get_progress_bar_value();
+        },
+        percent);
+  }
+  if (status != 0) {
+    set(State::FAILED, -1, status);
+  } else if (percent < 0) {
+    set(State::DONE, 100, 0);
+  } else {
+    set(State::RUNNING, percent, 0);
+    schedule_poll();
+  }
+}
+
+void LongOperation::set(State state, int percent, uint8_t status) {
+  std::lock_guard<std::recursive_mutex> callback_lock(m_callback_mutex);
+  Progress progress;
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_progress.state != State::RUNNING) return;
+    if (state == State::RUNNING && percent == m_progress.percent) return;
+    m_progress.state = state;
+    if (percent >= 0) m_progress.percent = percent;
+    m_progress.status = status;
+    progress = m_progress;
+  }
+  if (state != State::RUNNING) m_finished.notify_all();
+  if (m_callback) m_callback(progress);
+}
+}
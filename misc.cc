@@ -1,10 +1,10 @@
-#include <sstream>
 #include <string>
 #include "misc.h"
 #include "inttypes.h"
 #include <cstdlib>
 #include <cstring>
 #include "LibraryException.h"
+#include "dissect.h"
 
 namespace nitrokey {
 namespace misc {
@@ -35,44 +35,25 @@ std::vector<uint8_t> hex_string_to_byte(const char* hexString){
 };
 
 std::string hexdump(const char *p, size_t size, bool print_header) {
-  std::stringstream out;
-  char formatbuf[128];
-  const char *pstart = p;
-
-  for (const char *pend = p + size; p < pend;) {
-      if (print_header){
-          snprintf(formatbuf, 128, "%04lx\t", p - pstart);
-          out << formatbuf;
-      }
-
-    for (const char *le = p + 16; p < le && p < pend; p++) {
-      snprintf(formatbuf, 128, "%02x ", uint8_t(*p));
-      out << formatbuf;
-    }
-    out << std::endl;
-  }
-  return out.str();
+  // "0000\t" + 16 * "xx " + "\n" per line
+  const size_t lines = (size + 15) / 16;
+  std::string out(lines * (5 + 16 * 3 + 1) + 1, '\0');
+  proto::DissectWriter writer(&out[0], out.size());
+  writer.hexdump(p, size, print_header);
+  out.resize(writer.size());
+  return out;
 }
 
-static uint32_t _crc32(uint32_t crc, uint32_t data) {
-  int i;
-  crc = crc ^ data;
-
-  for (i = 0; i < 32; i++) {
-    if (crc & 0x80000000)
-      crc = (crc << 1) ^ 0x04C11DB7;  // polynomial used in STM32
-    else
-      crc = (crc << 1);
-  }
-
-  return crc;
+void secure_zero(void *p, size_t size) {
+  volatile uint8_t *v = (volatile uint8_t *)p;
+  while (size--) *v++ = 0;
 }
 
 uint32_t stm_crc32(const uint8_t *data, size_t size) {
   uint32_t crc = 0xffffffff;
   const uint32_t *pend = (const uint32_t *)(data + size);
   for (const uint32_t *p = (const uint32_t *)(data); p < pend; p++)
-    crc = _crc32(crc, *p);
+    crc = stm_crc32_word(crc, *p);
   return crc;
 }
 }
@@ -0,0 +1,73 @@
+#include <exception>
+#include "include/poller.h"
+#include "include/log.h"
+
+using namespace nitrokey::device;
+using namespace nitrokey::log;
+
+Poller &Poller::instance() {
+  static Poller poller;
+  return poller;
+}
+
+Poller &Poller::blocking() {
+  static Poller poller;
+  return poller;
+}
+
+Poller::Poller() : m_sequence(0), m_stopping(false) {}
+
+Poller::~Poller() {
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stopping = true;
+  }
+  m_cv.notify_one();
+  if (m_thread.joinable()) m_thread.join();
+}
+
+void Poller::schedule(Clock::time_point when, std::function<void()> callback,
+                      int priority) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  if (!m_thread.joinable()) m_thread = std::thread(&Poller::run, this);
+  const bool earliest = m_timers.empty() || when < m_timers.top().when;
+  m_timers.push(Timer{when, priority, m_sequence++, std::move(callback)});
+  if (earliest) m_cv.notify_one();
+}
+
+size_t Poller::get_pending_count() {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return m_timers.size() + m_due.size();
+}
+
+void Poller::run() {
+  std::unique_lock<std::mutex> lock(m_mutex);
+  while (!m_stopping) {
+    const auto now = Clock::now();
+    while (!m_timers.empty() && m_timers.top().when <= now) {
+      m_due.push(std::move(const_cast<Timer &>(m_timers.top())));
+      m_timers.pop();
+    }
+    if (m_due.empty()) {
+      if (m_timers.empty()) {
+        m_cv.wait(lock);
+        continue;
+      }
+      // a copy: timers scheduled meanwhile may move the top one
+      const auto when = m_timers.top().when;
+      m_cv.wait_until(lock, when);
+      continue;
+    }
+    auto callback = std::move(const_cast<Timer &>(m_due.top()).callback);
+    m_due.pop();
+    lock.unlock();
+    try {
+      callback();
+    } catch (std::exception &e) {
+      // nobody to pass it to
+      Log::instance()(std::string("Poller callback failed: ") + e.what(),
+                      Loglevel::ERROR);
+    }
+    lock.lock();
+  }
+}
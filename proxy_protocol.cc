@@ -0,0 +1,44 @@
+#include <cerrno>
+#include <cstring>
+#include <sys/socket.h>
+#include "include/misc.h"
+#include "include/proxy_protocol.h"
+
+using namespace nitrokey::proxy;
+
+bool nitrokey::proxy::send_all(int fd, const void *buffer, size_t size) {
+  auto p = static_cast<const uint8_t *>(buffer);
+  while (size > 0) {
+    // a closed peer gives EPIPE, not SIGPIPE
+    const ssize_t sent = ::send(fd, p, size, MSG_NOSIGNAL);
+    if (sent < 0 && errno == EINTR) continue;
+    if (sent <= 0) return false;
+    p += sent;
+    size -= (size_t)sent;
+  }
+  return true;
+}
+
+bool nitrokey::proxy::recv_all(int fd, void *buffer, size_t size) {
+  auto p = static_cast<uint8_t *>(buffer);
+  while (size > 0) {
+    const ssize_t received = ::recv(fd, p, size, 0);
+    if (received < 0 && errno == EINTR) continue;
+    if (received <= 0) return false;
+    p += received;
+    size -= (size_t)received;
+  }
+  return true;
+}
+
+bool nitrokey::proxy::send_frame(int fd, const FrameHeader &header,
+                                 const void *payload) {
+  uint8_t frame[HEADER_SIZE + MAX_PAYLOAD];
+  if (header.length > MAX_PAYLOAD) return false;
+  write_header(header, frame);
+  if (header.length > 0) memcpy(frame + HEADER_SIZE, payload, header.length);
+  const bool sent = send_all(fd, frame, HEADER_SIZE + header.length);
+  // packets may carry PINs
+  nitrokey::misc::secure_zero(frame, HEADER_SIZE + header.length);
+  return sent;
+}
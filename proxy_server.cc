@@ -0,0 +1,328 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "include/LibraryException.h"
+#include "include/log.h"
+#include "include/misc.h"
+#include "include/proxy_server.h"
+
+using namespace nitrokey;
+using namespace nitrokey::log;
+using namespace nitrokey::proxy;
+
+struct ProxyServer::Connection {
+  explicit Connection(int fd) : fd(fd), finished(false) {}
+  // after the reader and the last request of the connection
+  ~Connection() { close(fd); }
+
+  bool send(const FrameHeader &header, const void *payload) {
+    std::lock_guard<std::mutex> lock(send_mutex);
+    return send_frame(fd, header, payload);
+  }
+
+  const int fd;
+  std::mutex send_mutex;
+  std::thread reader;
+  std::atomic<bool> finished;
+};
+
+ProxyServer::ProxyServer(std::shared_ptr<NitrokeyManager> manager,
+                         std::mutex *manager_mutex)
+    : m_manager(manager),
+      m_manager_mutex(manager_mutex),
+      m_running(false),
+      m_listen_fd(-1),
+      m_stop_fd(-1),
+      m_port(0),
+      m_hold_depth(0),
+      m_holder_session(0),
+      m_stats{0, 0, 0} {}
+
+ProxyServer::~ProxyServer() { stop(); }
+
+bool ProxyServer::start(const std::string &address, uint16_t port) {
+  std::lock_guard<std::mutex> lock(m_start_mutex);
+  if (m_running) return true;
+
+  struct addrinfo hints;
+  memset(&hints, 0, sizeof hints);
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_PASSIVE | AI_NUMERICHOST;
+  struct addrinfo *addresses;
+  if (getaddrinfo(address.c_str(), std::to_string(port).c_str(), &hints,
+                  &addresses) != 0 ||
+      addresses == nullptr) {
+    Log::instance()("Proxy: invalid address " + address, Loglevel::ERROR);
+    return false;
+  }
+  const auto a = addresses;
+  m_listen_fd = socket(a->ai_family, a->ai_socktype | SOCK_CLOEXEC, a->ai_protocol);
+  const int on = 1;
+  m_stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  const bool listening =
+      m_listen_fd >= 0 && m_stop_fd >= 0 &&
+      setsockopt(m_listen_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof on) == 0 &&
+      bind(m_listen_fd, a->ai_addr, a->ai_addrlen) == 0 &&
+      listen(m_listen_fd, 16) == 0;
+  freeaddrinfo(addresses);
+  if (!listening) {
+    Log::instance()(std::string("Proxy: cannot listen: ") + strerror(errno),
+                    Loglevel::ERROR);
+    if (m_listen_fd >= 0) close(m_listen_fd);
+    if (m_stop_fd >= 0) close(m_stop_fd);
+    m_listen_fd = m_stop_fd = -1;
+    return false;
+  }
+
+  struct sockaddr_storage bound;
+  socklen_t bound_size = sizeof bound;
+  getsockname(m_listen_fd, (struct sockaddr *)&bound, &bound_size);
+  m_port = ntohs(bound.ss_family == AF_INET6
+                     ? ((struct sockaddr_in6 *)&bound)->sin6_port
+                     : ((struct sockaddr_in *)&bound)->sin_port);
+  Log::instance()("Proxy: listening on " + address + ":" +
+                      std::to_string(m_port),
+                  Loglevel::INFO);
+
+  m_running = true;
+  m_worker = std::thread(&ProxyServer::run_requests, this);
+  m_acceptor = std::thread(&ProxyServer::accept_connections, this);
+  return true;
+}
+
+void ProxyServer::stop() {
+  std::lock_guard<std::mutex> start_lock(m_start_mutex);
+  if (!m_running) return;
+  const uint64_t one = 1;
+  if (write(m_stop_fd, &one, sizeof one) < 0) {
+    // the counter can't overflow with a single write
+  }
+  m_acceptor.join();
+  close(m_listen_fd);
+  close(m_stop_fd);
+  m_listen_fd = m_stop_fd = -1;
+
+  // the connections are not accepted into the list anymore
+  for (auto &connection : m_connections) {
+    shutdown(connection->fd, SHUT_RDWR);
+    connection->reader.join();
+  }
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_running = false;
+  }
+  m_queued.notify_all();
+  m_worker.join();
+  m_queue.clear();
+  m_connections.clear();
+}
+
+ProxyServer::Stats ProxyServer::get_stats() {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return m_stats;
+}
+
+void ProxyServer::accept_connections() {
+  struct pollfd fds[2] = {{m_listen_fd, POLLIN, 0}, {m_stop_fd, POLLIN, 0}};
+  while (true) {
+    if (poll(fds, 2, -1) < 0) {
+      if (errno == EINTR) continue;
+      Log::instance()(std::string("Proxy: poll failed: ") + strerror(errno),
+                      Loglevel::ERROR);
+      return;
+    }
+    if (fds[1].revents != 0) return;
+
+    const int fd = accept4(m_listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+    if (fd < 0) continue;
+    const int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+
+    // readers of closed connections are done with
+    for (auto &connection : m_connections)
+      if (connection->finished) connection->reader.join();
+    m_connections.erase(
+        std::remove_if(m_connections.begin(), m_connections.end(),
+                       [](const std::shared_ptr<Connection> &c) {
+                         return !c->reader.joinable();
+                       }),
+        m_connections.end());
+
+    auto connection = std::make_shared<Connection>(fd);
+    connection->reader =
+        std::thread(&ProxyServer::read_requests, this, connection);
+    m_connections.push_back(connection);
+  }
+}
+
+void ProxyServer::read_requests(std::shared_ptr<Connection> connection) {
+  uint8_t buffer[HEADER_SIZE];
+  while (recv_all(connection->fd, buffer, sizeof buffer)) {
+    const auto header = read_header(buffer);
+    if (header.version != PROTOCOL_VERSION || header.length > MAX_PAYLOAD)
+      break;
+    Request request;
+    request.connection = connection;
+    request.id = header.id;
+    request.session = header.session;
+    request.type = (RequestType)header.type;
+    uint8_t payload[MAX_PAYLOAD];
+    if (!recv_all(connection->fd, payload, header.length)) break;
+
+    request.closed = false;
+    const bool valid =
+        ((request.type == RequestType::INFO ||
+          request.type == RequestType::BEGIN ||
+          request.type == RequestType::END) &&
+         header.length == 0) ||
+        (request.type == RequestType::EXCHANGE &&
+         header.length == HID_REPORT_SIZE);
+    if (!valid) {
+      const FrameHeader response{header.id, (uint8_t)ResponseStatus::BAD_REQUEST,
+                                 PROTOCOL_VERSION, 0, header.session};
+      connection->send(response, nullptr);
+      continue;
+    }
+    memcpy(request.packet, payload, header.length);
+    misc::secure_zero(payload, header.length);
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_queue.push_back(request);
+    m_stats.max_queued = std::max(m_stats.max_queued, m_queue.size());
+    misc::secure_zero(request.packet, sizeof request.packet);
+    m_queued.notify_one();
+  }
+
+  // after the requests read, ends a hold of the connection
+  Request closed;
+  closed.connection = connection;
+  closed.id = 0;
+  closed.session = 0;
+  closed.type = RequestType::END;
+  closed.closed = true;
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_queue.push_back(closed);
+  }
+  m_queued.notify_one();
+  connection->finished = true;
+}
+
+std::deque<ProxyServer::Request>::iterator ProxyServer::next_request() {
+  if (m_holder == nullptr) return m_queue.begin();
+  // the END of a closed connection is of all of its sessions
+  return std::find_if(m_queue.begin(), m_queue.end(), [&](const Request &r) {
+    return r.connection == m_holder &&
+           (r.closed || r.session == m_holder_session);
+  });
+}
+
+void ProxyServer::run_requests() {
+  while (true) {
+    Request request;
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_queued.wait(lock, [&] {
+        return !m_running || next_request() != m_queue.end();
+      });
+      if (!m_running) break;
+      const auto next = next_request();
+      request = *next;
+      misc::secure_zero(next->packet, sizeof request.packet);
+      m_queue.erase(next);
+    }
+    execute(request);
+    misc::secure_zero(request.packet, sizeof request.packet);
+  }
+
+  // the device is not held past the server
+  std::unique_lock<std::mutex> manager_lock;
+  if (m_manager_mutex != nullptr)
+    manager_lock = std::unique_lock<std::mutex>(*m_manager_mutex);
+  end_hold(true);
+}
+
+void ProxyServer::begin_hold(const std::shared_ptr<Connection> &connection,
+                             uint32_t session) {
+  // while held, only the holder's requests run
+  if (m_hold_depth++ > 0) return;
+  try {
+    m_hold.reset(new NitrokeyManager::Operation(*m_manager, "proxy_hold"));
+  } catch (...) {
+    m_hold_depth = 0;
+    throw;
+  }
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_holder = connection;
+  m_holder_session = session;
+}
+
+void ProxyServer::end_hold(bool all) {
+  if (m_hold_depth == 0) return;
+  if (!all && --m_hold_depth > 0) return;
+  m_hold_depth = 0;
+  m_hold.reset();
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_holder = nullptr;
+  }
+  m_queued.notify_one();
+}
+
+void ProxyServer::execute(Request &request) {
+  FrameHeader header{request.id, (uint8_t)ResponseStatus::OK, PROTOCOL_VERSION,
+                     0, request.session};
+  uint8_t payload[MAX_PAYLOAD];
+  auto fail = [&](uint8_t exception_id, const char *message) {
+    header.type = (uint8_t)ResponseStatus::FAILED;
+    payload[0] = exception_id;
+    const size_t length = std::min(strlen(message), MAX_PAYLOAD - 1);
+    memcpy(payload + 1, message, length);
+    header.length = (uint16_t)(1 + length);
+  };
+
+  {
+    std::unique_lock<std::mutex> manager_lock;
+    if (m_manager_mutex != nullptr)
+      manager_lock = std::unique_lock<std::mutex>(*m_manager_mutex);
+    try {
+      if (request.type == RequestType::BEGIN) {
+        begin_hold(request.connection, request.session);
+      } else if (request.type == RequestType::END) {
+        end_hold(request.closed);
+      } else if (!m_manager->is_connected()) {
+        header.type = (uint8_t)ResponseStatus::NO_DEVICE;
+      } else if (request.type == RequestType::INFO) {
+        const bool storage =
+            m_manager->get_connected_device_model() == DeviceModel::STORAGE;
+        payload[0] = storage ? 'S' : 'P';
+        header.length = 1;
+      } else {
+        m_manager->forward_packet(request.packet, payload);
+        header.length = HID_REPORT_SIZE;
+      }
+    } catch (LibraryException &e) {
+      fail(e.exception_id(), "library exception");
+    } catch (std::exception &e) {
+      fail(0, e.what());
+    }
+  }
+
+  if (request.closed) return;
+  if (request.type != RequestType::BEGIN && request.type != RequestType::END) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stats.requests++;
+    if (header.type != (uint8_t)ResponseStatus::OK) m_stats.failed++;
+  }
+  // a closed connection is noticed by its reader
+  request.connection->send(header, payload);
+  misc::secure_zero(payload, header.length);
+}
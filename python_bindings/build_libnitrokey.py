@@ -0,0 +1,116 @@
+#!/usr/bin/env python3
+"""
+Builds _libnitrokey, the compiled (cffi API mode) extension used by libnitrokey.py.
+Run after the library is built (make lib):
+
+    python3 python_bindings/build_libnitrokey.py
+
+The extension is linked against build/libnitrokey.so and put next to this file.
+Unlike the ABI mode loaders of python_bindings_example.py and unittest/test_bindings.py, the header is parsed
+once here and the calls are checked by the compiler; each call is a plain C call, with the GIL released
+while it runs.
+"""
+import os
+import re
+
+import cffi
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+ROOT = os.path.dirname(HERE)
+BUILD = os.path.join(ROOT, 'build')
+
+# Batch calls: several slots read with one crossing from Python. Statuses are the ones of the single calls.
+BATCH_DECLARATIONS = """
+void nkpy_get_hotp_codes(struct NK_device *device, const uint8_t *slots, size_t count,
+                         const char *temporary_password, uint32_t *codes, uint8_t *statuses);
+void nkpy_get_totp_codes(struct NK_device *device, const uint8_t *slots, size_t count, uint64_t challenge,
+                         uint64_t last_totp_time, uint8_t last_interval, const char *temporary_password,
+                         uint32_t *codes, uint8_t *statuses);
+void nkpy_get_slot_names(struct NK_device *device, bool totp, const uint8_t *slots, size_t count,
+                         char *names, uint8_t *statuses);
+void nkpy_get_password_safe_slot_names(struct NK_device *device, const uint8_t *slots, size_t count,
+                                       char *names, uint8_t *statuses);
+"""
+
+SOURCE = """
+#include "NK_C_API.h"
+
+void nkpy_get_hotp_codes(struct NK_device *device, const uint8_t *slots, size_t count,
+                         const char *temporary_password, uint32_t *codes, uint8_t *statuses) {
+    for (size_t i = 0; i < count; i++) {
+        codes[i] = NK_device_get_hotp_code_PIN(device, slots[i], temporary_password);
+        statuses[i] = NK_device_get_last_command_status(device);
+    }
+}
+
+void nkpy_get_totp_codes(struct NK_device *device, const uint8_t *slots, size_t count, uint64_t challenge,
+                         uint64_t last_totp_time, uint8_t last_interval, const char *temporary_password,
+                         uint32_t *codes, uint8_t *statuses) {
+    for (size_t i = 0; i < count; i++) {
+        codes[i] = NK_device_get_totp_code_PIN(device, slots[i], challenge, last_totp_time, last_interval,
+                                               temporary_password);
+        statuses[i] = NK_device_get_last_command_status(device);
+    }
+}
+
+// names: count buffers of NK_SLOT_NAME_BUFFER_SIZE
+void nkpy_get_slot_names(struct NK_device *device, bool totp, const uint8_t *slots, size_t count,
+                         char *names, uint8_t *statuses) {
+    for (size_t i = 0; i < count; i++) {
+        char *name = names + i * NK_SLOT_NAME_BUFFER_SIZE;
+        statuses[i] = totp ? NK_device_get_totp_slot_name_buf(device, slots[i], name, NK_SLOT_NAME_BUFFER_SIZE)
+                           : NK_device_get_hotp_slot_name_buf(device, slots[i], name, NK_SLOT_NAME_BUFFER_SIZE);
+    }
+}
+
+// names: count buffers of NK_PWS_SLOT_NAME_BUFFER_SIZE
+void nkpy_get_password_safe_slot_names(struct NK_device *device, const uint8_t *slots, size_t count,
+                                       char *names, uint8_t *statuses) {
+    for (size_t i = 0; i < count; i++) {
+        statuses[i] = NK_device_get_password_safe_slot_name_buf(device, slots[i],
+                                                                names + i * NK_PWS_SLOT_NAME_BUFFER_SIZE,
+                                                                NK_PWS_SLOT_NAME_BUFFER_SIZE);
+    }
+}
+"""
+
+
+def read_declarations(header):
+    """
+    C declarations of the header for cffi: functions (extern ...), structs, enums, typedefs and
+    integer constants. C++ only declarations, after the extern "C" block, are not taken.
+    """
+    declarations = []
+    lines = iter(open(header).readlines())
+    for line in lines:
+        if line.startswith('extern') and '"C"' not in line:
+            declaration = line.replace('extern', '', 1).strip()
+            while ';' not in declaration:
+                declaration += ' ' + next(lines).strip()
+            declarations.append(declaration)
+        elif line.startswith('enum') or line.startswith('typedef'):
+            declaration = line.strip()
+            while ';' not in declaration:
+                declaration += ' ' + next(lines).strip()
+            declarations.append(declaration)
+        elif re.match(r'^struct \w+ \{$', line.strip()):
+            declaration = line.strip()
+            while not declaration.endswith('};'):
+                declaration += ' ' + next(lines).strip()
+            declarations.append(declaration)
+        elif re.match(r'^struct \w+;$', line.strip()):
+            declarations.append(line.strip())
+        elif re.match(r'^#define NK_\w+ \d+$', line.strip()):
+            declarations.append(line.strip())
+    return '\n'.join(declarations)
+
+
+ffibuilder = cffi.FFI()
+ffibuilder.cdef(read_declarations(os.path.join(ROOT, 'NK_C_API.h')) + BATCH_DECLARATIONS)
+# the header is C++ (extern "C" without #ifdef __cplusplus)
+ffibuilder.set_source('_libnitrokey', SOURCE, source_extension='.cpp',
+                      include_dirs=[ROOT], library_dirs=[BUILD], runtime_library_dirs=[BUILD],
+                      libraries=['nitrokey'], extra_compile_args=['-std=c++14'])
+
+if __name__ == '__main__':
+    ffibuilder.compile(tmpdir=HERE, verbose=True)
@@ -0,0 +1,286 @@
+"""
+Python interface of libnitrokey, on the compiled _libnitrokey extension (see build_libnitrokey.py).
+
+Each Device is a handle of its own (NK_device_open), so several keys are driven at once from different threads;
+the GIL is released while a call waits for the device. Batch methods read several slots in one call and give
+lists. AsyncDevice offers the same as coroutines for asyncio, the device waits being done by the library's
+worker threads.
+
+    with Device.open('P') as device:
+        device.first_authenticate('12345678', '123123123')
+        print(device.get_hotp_codes([0, 1, 2]))
+"""
+import asyncio
+import itertools
+
+from _libnitrokey import ffi, lib
+
+__all__ = ['NitrokeyError', 'Device', 'AsyncDevice']
+
+# statuses meaning a slot is empty, in batch reads
+SLOT_NOT_PROGRAMMED = 3
+
+
+class NitrokeyError(Exception):
+    """
+    Command processing error code of a call: a device status (1-255) or a library error (200 and up,
+    see LibraryException.h).
+    """
+
+    def __init__(self, code, operation=''):
+        super().__init__('{} failed with status {}'.format(operation, code))
+        self.code = code
+
+
+def _bytes(s):
+    return s.encode() if isinstance(s, str) else s
+
+
+def _string(buffer):
+    return ffi.string(buffer).decode(errors='replace')
+
+
+class Device:
+    def __init__(self, handle):
+        self._handle = handle
+
+    @classmethod
+    def open(cls, model='P'):
+        return cls._opened(lib.NK_device_open(_bytes(model)), 'open')
+
+    @classmethod
+    def open_path(cls, model, path):
+        return cls._opened(lib.NK_device_open_path(_bytes(model), _bytes(path)), 'open_path')
+
+    @classmethod
+    def open_remote(cls, host, port=4108):
+        """
+        Device served by NK_device_start_proxy on another host.
+        """
+        return cls._opened(lib.NK_device_open_remote(_bytes(host), port), 'open_remote')
+
+    @classmethod
+    def _opened(cls, handle, operation):
+        if handle == ffi.NULL:
+            raise NitrokeyError(lib.NK_get_last_command_status(), operation)
+        return cls(handle)
+
+    def close(self):
+        if self._handle is not None:
+            lib.NK_device_close(self._handle)
+            self._handle = None
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *exc):
+        self.close()
+
+    @property
+    def handle(self):
+        return self._handle
+
+    def _check(self, status, operation):
+        if status != 0:
+            raise NitrokeyError(status, operation)
+
+    def _last_status(self, operation):
+        self._check(lib.NK_device_get_last_command_status(self._handle), operation)
+
+    def get_serial_number(self):
+        buffer = ffi.new('char[]', lib.NK_SERIAL_NUMBER_BUFFER_SIZE)
+        self._check(lib.NK_device_get_serial_number_buf(self._handle, buffer, len(buffer)), 'get_serial_number')
+        return _string(buffer)
+
+    def get_status(self):
+        buffer = ffi.new('char[]', lib.NK_STATUS_BUFFER_SIZE)
+        self._check(lib.NK_device_status_buf(self._handle, buffer, len(buffer)), 'get_status')
+        return _string(buffer)
+
+    def get_admin_retry_count(self):
+        count = lib.NK_device_get_admin_retry_count(self._handle)
+        self._last_status('get_admin_retry_count')
+        return count
+
+    def get_user_retry_count(self):
+        count = lib.NK_device_get_user_retry_count(self._handle)
+        self._last_status('get_user_retry_count')
+        return count
+
+    def first_authenticate(self, admin_pin, temporary_password):
+        self._check(lib.NK_device_first_authenticate(self._handle, _bytes(admin_pin), _bytes(temporary_password)),
+                    'first_authenticate')
+
+    def user_authenticate(self, user_pin, temporary_password):
+        self._check(lib.NK_device_user_authenticate(self._handle, _bytes(user_pin), _bytes(temporary_password)),
+                    'user_authenticate')
+
+    def write_hotp_slot(self, slot, name, secret, counter, temporary_password, use_8_digits=False,
+                        use_enter=False, token_id=None):
+        self._check(lib.NK_device_write_hotp_slot(self._handle, slot, _bytes(name), _bytes(secret), counter,
+                                                  use_8_digits, use_enter, token_id is not None,
+                                                  _bytes(token_id or ''), _bytes(temporary_password)),
+                    'write_hotp_slot')
+
+    def write_totp_slot(self, slot, name, secret, time_window, temporary_password, use_8_digits=False,
+                        use_enter=False, token_id=None):
+        self._check(lib.NK_device_write_totp_slot(self._handle, slot, _bytes(name), _bytes(secret), time_window,
+                                                  use_8_digits, use_enter, token_id is not None,
+                                                  _bytes(token_id or ''), _bytes(temporary_password)),
+                    'write_totp_slot')
+
+    def get_hotp_code(self, slot, temporary_password=''):
+        code = lib.NK_device_get_hotp_code_PIN(self._handle, slot, _bytes(temporary_password))
+        self._last_status('get_hotp_code')
+        return code
+
+    def get_totp_code(self, slot, challenge=0, last_totp_time=0, last_interval=0, temporary_password=''):
+        code = lib.NK_device_get_totp_code_PIN(self._handle, slot, challenge, last_totp_time, last_interval,
+                                               _bytes(temporary_password))
+        self._last_status('get_totp_code')
+        return code
+
+    def get_hotp_slot_name(self, slot):
+        return self._slot_name(slot, lib.NK_device_get_hotp_slot_name_buf, 'get_hotp_slot_name')
+
+    def get_totp_slot_name(self, slot):
+        return self._slot_name(slot, lib.NK_device_get_totp_slot_name_buf, 'get_totp_slot_name')
+
+    def _slot_name(self, slot, function, operation):
+        buffer = ffi.new('char[]', lib.NK_SLOT_NAME_BUFFER_SIZE)
+        self._check(function(self._handle, slot, buffer, len(buffer)), operation)
+        return _string(buffer)
+
+    # batch calls, a single call into the library each
+
+    def get_hotp_codes(self, slots, temporary_password=''):
+        codes, statuses = ffi.new('uint32_t[]', len(slots)), ffi.new('uint8_t[]', len(slots))
+        lib.nkpy_get_hotp_codes(self._handle, slots, len(slots), _bytes(temporary_password), codes, statuses)
+        return self._batch_result(list(codes), statuses, 'get_hotp_codes')
+
+    def get_totp_codes(self, slots, challenge=0, last_totp_time=0, last_interval=0, temporary_password=''):
+        codes, statuses = ffi.new('uint32_t[]', len(slots)), ffi.new('uint8_t[]', len(slots))
+        lib.nkpy_get_totp_codes(self._handle, slots, len(slots), challenge, last_totp_time, last_interval,
+                                _bytes(temporary_password), codes, statuses)
+        return self._batch_result(list(codes), statuses, 'get_totp_codes')
+
+    def get_hotp_slot_names(self, slots):
+        """
+        Names of the slots, None for the ones not programmed.
+        """
+        return self._slot_names(slots, False)
+
+    def get_totp_slot_names(self, slots):
+        return self._slot_names(slots, True)
+
+    def _slot_names(self, slots, totp):
+        size = lib.NK_SLOT_NAME_BUFFER_SIZE
+        names, statuses = ffi.new('char[]', size * len(slots)), ffi.new('uint8_t[]', len(slots))
+        lib.nkpy_get_slot_names(self._handle, totp, slots, len(slots), names, statuses)
+        return self._names(names, size, statuses, 'get_slot_names')
+
+    def get_password_safe_slot_names(self, slots):
+        size = lib.NK_PWS_SLOT_NAME_BUFFER_SIZE
+        names, statuses = ffi.new('char[]', size * len(slots)), ffi.new('uint8_t[]', len(slots))
+        lib.nkpy_get_password_safe_slot_names(self._handle, slots, len(slots), names, statuses)
+        return self._names(names, size, statuses, 'get_password_safe_slot_names')
+
+    def _names(self, names, size, statuses, operation):
+        values = [_string(names + i * size) for i in range(len(statuses))]
+        return self._batch_result(values, statuses, operation, empty=SLOT_NOT_PROGRAMMED)
+
+    def _batch_result(self, values, statuses, operation, empty=None):
+        for i, status in enumerate(statuses):
+            if status == empty:
+                values[i] = None
+            elif status != 0:
+                raise NitrokeyError(status, '{} (item {})'.format(operation, i))
+        return values
+
+
+class AsyncDevice:
+    """
+    Coroutines on a Device. OTP codes and slots go through the completion queue of the library (NK_submit_*),
+    watched by the event loop; other calls run in the default executor. Calls on one device are run in order.
+    """
+
+    def __init__(self, device, loop=None):
+        self.device = device
+        self._loop = loop or asyncio.get_event_loop()
+        self._queue = lib.NK_queue_create()
+        if self._queue == ffi.NULL:
+            raise NitrokeyError(lib.NK_OP_STATUS_DEVICE_ERROR, 'NK_queue_create')
+        self._futures = {}
+        self._ids = itertools.count(1)
+        self._text = ffi.new('char[]', 64)
+        self._loop.add_reader(lib.NK_queue_fd(self._queue), self._reap)
+
+    def close(self):
+        """
+        Cancels pending coroutines; the device is not closed.
+        """
+        if self._queue is None:
+            return
+        self._loop.remove_reader(lib.NK_queue_fd(self._queue))
+        lib.NK_queue_destroy(self._queue)
+        self._queue = None
+        for future in self._futures.values():
+            future.cancel()
+        self._futures.clear()
+
+    def _submit(self, function, operation, *args):
+        user_data = next(self._ids)
+        future = self._loop.create_future()
+        self._futures[user_data] = (future, operation)
+        if function(self.device.handle, self._queue, user_data, *args) != 0:
+            del self._futures[user_data]
+            future.set_exception(NitrokeyError(lib.NK_OP_STATUS_DEVICE_ERROR, operation))
+        return future
+
+    def _reap(self):
+        user_data, kind, status, code = (ffi.new('uint64_t *'), ffi.new('int *'), ffi.new('uint8_t *'),
+                                         ffi.new('uint32_t *'))
+        while lib.NK_queue_reap(self._queue, user_data, kind, status, code, self._text, len(self._text)):
+            future, operation = self._futures.pop(user_data[0], (None, None))
+            if future is None or future.cancelled():
+                continue
+            if status[0] != 0:
+                future.set_exception(NitrokeyError(status[0], operation))
+            elif kind[0] in (lib.NK_OP_GET_HOTP_CODE, lib.NK_OP_GET_TOTP_CODE):
+                future.set_result(code[0])
+            elif kind[0] in (lib.NK_OP_GET_HOTP_SLOT_NAME, lib.NK_OP_GET_TOTP_SLOT_NAME):
+                future.set_result(_string(self._text))
+            else:
+                future.set_result(None)
+
+    async def get_hotp_code(self, slot, temporary_password=''):
+        return await self._submit(lib.NK_submit_get_hotp_code, 'get_hotp_code', slot, _bytes(temporary_password))
+
+    async def get_totp_code(self, slot, challenge=0, last_totp_time=0, last_interval=0, temporary_password=''):
+        return await self._submit(lib.NK_submit_get_totp_code, 'get_totp_code', slot, challenge, last_totp_time,
+                                  last_interval, _bytes(temporary_password))
+
+    async def get_hotp_slot_name(self, slot):
+        return await self._submit(lib.NK_submit_get_hotp_slot_name, 'get_hotp_slot_name', slot)
+
+    async def get_totp_slot_name(self, slot):
+        return await self._submit(lib.NK_submit_get_totp_slot_name, 'get_totp_slot_name', slot)
+
+    async def write_hotp_slot(self, slot, name, secret, counter, temporary_password, use_8_digits=False,
+                              use_enter=False, token_id=None):
+        return await self._submit(lib.NK_submit_write_hotp_slot, 'write_hotp_slot', slot, _bytes(name),
+                                  _bytes(secret), counter, use_8_digits, use_enter, token_id is not None,
+                                  _bytes(token_id or ''), _bytes(temporary_password))
+
+    async def write_totp_slot(self, slot, name, secret, time_window, temporary_password, use_8_digits=False,
+                              use_enter=False, token_id=None):
+        return await self._submit(lib.NK_submit_write_totp_slot, 'write_totp_slot', slot, _bytes(name),
+                                  _bytes(secret), time_window, use_8_digits, use_enter, token_id is not None,
+                                  _bytes(token_id or ''), _bytes(temporary_password))
+
+    async def call(self, method, *args, **kwargs):
+        """
+        Any Device method, e.g. await device.call('get_hotp_codes', [0, 1, 2]).
+        """
+        function = getattr(self.device, method)
+        return await self._loop.run_in_executor(None, lambda: function(*args, **kwargs))
@@ -0,0 +1,103 @@
+#include <algorithm>
+#include <cstring>
+#include "include/device_proto.h"
+
+namespace nitrokey {
+namespace proto {
+
+using namespace nitrokey::device;
+using namespace nitrokey::log;
+
+// offsets in the incoming report, see DeviceResponse
+static const size_t device_status_offset = 1;
+static const size_t last_command_crc_offset = 3;
+static const size_t last_command_status_offset = 7;
+
+TransactionStatus::Outcome operation_limits_outcome(Device &dev) {
+  const auto &limits = dev.get_operation_limits();
+  if (limits.cancelled != nullptr && limits.cancelled->load())
+    return TransactionStatus::Outcome::CANCELLED;
+  if (limits.deadline != Clock::time_point::max() &&
+      dev.get_clock().now() >= limits.deadline)
+    return TransactionStatus::Outcome::DEADLINE_EXCEEDED;
+  return TransactionStatus::Outcome::OK;
+}
+
+void ReceiveState::reset() {
+  status = 0;
+  wait = std::chrono::milliseconds(0);
+  exhausted = false;
+  interrupted = TransactionStatus::Outcome::OK;
+  long_operation = false;
+}
+
+void ReceiveState::start(Device &dev, CommandID id, Latency latency) {
+  const auto &policy = dev.get_retry_policy(id, latency);
+  backoff.start(policy, dev.get_clock().now(), dev.get_send_receive_delay());
+  if (!policy.spins()) wait = dev.get_send_receive_delay();
+}
+
+bool ReceiveState::attempt(Device &dev, CommandID id, bool carries_secrets,
+                           uint32_t sent_crc, void *response,
+                           ResponseLogger log_invalid) {
+  const uint8_t *bytes = static_cast<const uint8_t *>(response);
+  {
+    trace::Span span("transaction", "recv", backoff.get_attempts());
+    status = dev.recv(response);
+  }
+  NK_PROBE4(device__recv, (int)id, status, (int)bytes[device_status_offset],
+            backoff.get_attempts());
+  dev.get_flight_recorder().record(FlightRecorder::Direction::INCOMING,
+                                   response, status, carries_secrets);
+
+  bool stale_crc = false;
+  // a short read is a failed poll, the rest of the report is not there
+  if (status == HID_REPORT_SIZE) {
+    dev.set_last_command_status(bytes[last_command_status_offset]); // FIXME should be handled on device.recv
+
+    const uint8_t device_status = bytes[device_status_offset];
+    if (device_status == STICK20_DEVICE_STATUS_BUSY_PROGRESSBAR &&
+        dev.get_device_model() == DeviceModel::STORAGE) {
+      // it won't get to the command for a while
+      long_operation = true;
+      return true;
+    }
+
+    uint32_t last_command_crc;
+    memcpy(&last_command_crc, bytes + last_command_crc_offset,
+           sizeof last_command_crc);
+    if (device_status == 0 && last_command_crc == sent_crc) return true;
+    stale_crc = device_status == 0;
+    Log::instance()("Device is not ready or received packet's last CRC is not equal to sent CRC packet, retrying...",
+                    Loglevel::DEBUG);
+    if (log_invalid != nullptr) log_invalid(response);
+  }
+
+  interrupted = operation_limits_outcome(dev);
+  if (interrupted != TransactionStatus::Outcome::OK) return true;
+  const auto now = dev.get_clock().now();
+  if (!backoff.next(now, stale_crc, wait)) {
+    exhausted = true;
+    return true;
+  }
+  // the limits are checked again after the wait
+  const auto deadline = dev.get_operation_limits().deadline;
+  if (deadline != Clock::time_point::max())
+    wait = std::min(wait, ceil_microseconds(deadline - now));
+  return false;
+}
+
+void ReceiveState::run(Device &dev, CommandID id, bool carries_secrets,
+                       uint32_t sent_crc, void *response,
+                       ResponseLogger log_invalid) {
+  {
+    trace::Span span("transaction", "send_receive_delay");
+    dev.get_clock().sleep_for(wait);
+  }
+  while (!attempt(dev, id, carries_secrets, sent_crc, response, log_invalid)) {
+    trace::Span span("transaction", "retry_sleep", backoff.get_attempts());
+    dev.get_clock().sleep_for(wait);
+  }
+}
+}
+}
@@ -0,0 +1,212 @@
+#include <cstring>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "include/misc.h"
+#include "include/log.h"
+#include "include/remote_device.h"
+
+using namespace nitrokey::device;
+using namespace nitrokey::log;
+using namespace nitrokey::proxy;
+
+std::shared_ptr<RemoteConnection> RemoteConnection::connect(
+    const std::string &host, uint16_t port) {
+  struct addrinfo hints;
+  memset(&hints, 0, sizeof hints);
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  struct addrinfo *addresses;
+  const auto service = std::to_string(port);
+  const int error = getaddrinfo(host.c_str(), service.c_str(), &hints, &addresses);
+  if (error != 0) {
+    Log::instance()("Can't resolve " + host + ": " + gai_strerror(error),
+                    Loglevel::ERROR);
+    return nullptr;
+  }
+
+  int fd = -1;
+  for (auto a = addresses; a != nullptr && fd < 0; a = a->ai_next) {
+    fd = socket(a->ai_family, a->ai_socktype | SOCK_CLOEXEC, a->ai_protocol);
+    if (fd >= 0 && ::connect(fd, a->ai_addr, a->ai_addrlen) != 0) {
+      close(fd);
+      fd = -1;
+    }
+  }
+  freeaddrinfo(addresses);
+  if (fd < 0) {
+    Log::instance()("Can't connect to " + host + ":" + service,
+                    Loglevel::ERROR);
+    return nullptr;
+  }
+  // requests are small and waited for
+  const int one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+  return std::shared_ptr<RemoteConnection>(new RemoteConnection(fd));
+}
+
+RemoteConnection::RemoteConnection(int fd)
+    : m_fd(fd), m_connected(true), m_next_session(1), m_next_id(1) {
+  m_reader = std::thread(&RemoteConnection::run, this);
+}
+
+RemoteConnection::~RemoteConnection() {
+  shutdown(m_fd, SHUT_RDWR);
+  m_reader.join();
+  close(m_fd);
+}
+
+std::future<RemoteConnection::Response> RemoteConnection::submit(
+    RequestType type, const void *payload, uint16_t length, uint32_t session) {
+  std::promise<Response> promise;
+  auto future = promise.get_future();
+  uint32_t id;
+  {
+    std::lock_guard<std::mutex> lock(m_pending_mutex);
+    id = m_next_id++;
+    if (!m_connected) {
+      Response response;
+      response.status = ResponseStatus::FAILED;
+      response.length = 0;
+      promise.set_value(response);
+      return future;
+    }
+    m_pending.emplace(id, std::move(promise));
+  }
+
+  const FrameHeader header{id, (uint8_t)type, PROTOCOL_VERSION, length,
+                           session};
+  std::lock_guard<std::mutex> lock(m_send_mutex);
+  // on failure the reader fails the request as it stops
+  if (!send_frame(m_fd, header, payload)) shutdown(m_fd, SHUT_RDWR);
+  return future;
+}
+
+void RemoteConnection::run() {
+  uint8_t buffer[HEADER_SIZE];
+  while (recv_all(m_fd, buffer, sizeof buffer)) {
+    const auto header = read_header(buffer);
+    Response response;
+    if (header.version != PROTOCOL_VERSION || header.length > MAX_PAYLOAD ||
+        !recv_all(m_fd, response.payload, header.length)) {
+      break;
+    }
+    response.status = (ResponseStatus)header.type;
+    response.length = header.length;
+
+    std::lock_guard<std::mutex> lock(m_pending_mutex);
+    auto pending = m_pending.find(header.id);
+    if (pending == m_pending.end()) continue;
+    pending->second.set_value(response);
+    m_pending.erase(pending);
+    misc::secure_zero(response.payload, response.length);
+  }
+  Log::instance()("Connection to the proxy server closed", Loglevel::DEBUG);
+  fail_pending();
+}
+
+void RemoteConnection::fail_pending() {
+  std::lock_guard<std::mutex> lock(m_pending_mutex);
+  m_connected = false;
+  Response response;
+  response.status = ResponseStatus::FAILED;
+  response.length = 0;
+  for (auto &pending : m_pending) pending.second.set_value(response);
+  m_pending.clear();
+}
+
+constexpr std::chrono::seconds RemoteDevice::RESPONSE_TIMEOUT;
+
+RemoteDevice::RemoteDevice(std::shared_ptr<RemoteConnection> connection)
+    : m_connection(connection),
+      m_session(connection->new_session()),
+      m_has_response(false),
+      m_held(false) {
+  m_vid = 0;
+  m_pid = 0;
+  // the server polls the device, a response is final
+  m_retry_policy = RetryPolicy::fixed(1, std::chrono::milliseconds(0));
+  m_send_receive_delay = std::chrono::milliseconds(0);
+}
+
+RemoteDevice::~RemoteDevice() { misc::secure_zero(m_response, sizeof m_response); }
+
+bool RemoteDevice::connect() {
+  auto response =
+      m_connection->submit(RequestType::INFO, nullptr, 0, m_session).get();
+  if (response.status != ResponseStatus::OK || response.length < 1)
+    return false;
+  m_model = response.payload[0] == 'S' ? DeviceModel::STORAGE : DeviceModel::PRO;
+  return true;
+}
+
+bool RemoteDevice::disconnect() {
+  // the connection may be shared
+  return true;
+}
+
+int RemoteDevice::send(const void *packet) {
+  if (!m_connection->is_connected()) return -1;
+  m_has_response = false;
+  m_pending =
+      m_connection->submit(RequestType::EXCHANGE, packet, HID_REPORT_SIZE,
+                           m_session);
+  return HID_REPORT_SIZE;
+}
+
+bool RemoteDevice::wait_for(std::future<RemoteConnection::Response> &response) {
+  // in slices, to notice the operation limits
+  const auto slice = std::chrono::milliseconds(10);
+  const auto give_up = std::chrono::steady_clock::now() + RESPONSE_TIMEOUT;
+  while (response.wait_for(slice) != std::future_status::ready) {
+    const auto &limits = get_operation_limits();
+    if ((limits.cancelled != nullptr && limits.cancelled->load()) ||
+        m_clock->now() >= limits.deadline ||
+        std::chrono::steady_clock::now() >= give_up)
+      return false;
+  }
+  return true;
+}
+
+void RemoteDevice::begin_operation() {
+  if (!m_connection->is_connected()) return;
+  auto held = m_connection->submit(RequestType::BEGIN, nullptr, 0, m_session);
+  // answered once the operations of other clients ended; a BEGIN not
+  // answered yet takes the device later, so it is ended as well
+  m_held = true;
+  if (!wait_for(held)) return;
+  const auto response = held.get();
+  // servers without holds refuse it
+  if (response.status != ResponseStatus::OK) m_held = false;
+}
+
+void RemoteDevice::end_operation() {
+  if (!m_held) return;
+  m_held = false;
+  // not waited for, the server runs it before the next requests
+  m_connection->submit(RequestType::END, nullptr, 0, m_session);
+}
+
+int RemoteDevice::recv(void *packet) {
+  if (m_pending.valid()) {
+    if (!wait_for(m_pending)) return 0;
+    auto response = m_pending.get();
+    if (response.status == ResponseStatus::OK &&
+        response.length == HID_REPORT_SIZE) {
+      memcpy(m_response, response.payload, HID_REPORT_SIZE);
+      m_has_response = true;
+    } else {
+      const size_t text = response.length > 1 ? response.length - 1 : 0;
+      Log::instance()("Proxy server failed the exchange: " +
+                          std::string((const char *)response.payload + 1, text),
+                      Loglevel::ERROR);
+    }
+    misc::secure_zero(response.payload, response.length);
+  }
+  if (!m_has_response) return -1;
+  // again for polls after a response not to the sent packet
+  memcpy(packet, m_response, HID_REPORT_SIZE);
+  return HID_REPORT_SIZE;
+}
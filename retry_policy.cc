@@ -0,0 +1,57 @@
+#include <algorithm>
+#include <random>
+#include "include/retry_policy.h"
+
+using namespace nitrokey::device;
+
+constexpr std::chrono::microseconds RetryPolicy::MIN_SPIN_INTERVAL;
+
+void Backoff::start(const RetryPolicy &policy, Clock::time_point now,
+                    std::chrono::milliseconds send_receive_delay) {
+  m_policy = policy;
+  m_deadline = now + policy.deadline;
+  m_spin_end = now + policy.spin_window;
+  m_growth_start = now + send_receive_delay;
+  m_delay_ms = (double)policy.initial_delay.count();
+  m_attempts = 0;
+  m_deadline_passed = false;
+}
+
+static double random_fraction() {
+  // only spreads the polls of devices, no need for a good source
+  static thread_local std::minstd_rand generator(std::random_device{}());
+  return std::uniform_real_distribution<double>(-1.0, 1.0)(generator);
+}
+
+bool Backoff::next(Clock::time_point now, bool stale_crc,
+                   std::chrono::microseconds &wait) {
+  m_attempts++;
+  if (m_policy.max_attempts > 0 && m_attempts >= m_policy.max_attempts)
+    return false;
+  const bool has_deadline = m_policy.deadline.count() > 0;
+  if (has_deadline && now >= m_deadline) {
+    m_deadline_passed = true;
+    return false;
+  }
+
+  if (stale_crc) {
+    wait = m_policy.stale_crc_delay;
+  } else if (now < m_spin_end) {
+    wait = std::max(m_policy.spin_interval, RetryPolicy::MIN_SPIN_INTERVAL);
+  } else {
+    double delay = m_delay_ms;
+    if (m_policy.jitter > 0) delay += delay * m_policy.jitter * random_fraction();
+    wait = std::chrono::milliseconds((long long)(delay + 0.5));
+    // after a spin window, as often as the first waits until the device
+    // would have been polled without it
+    if (now >= m_growth_start)
+      m_delay_ms = std::min(m_delay_ms * m_policy.multiplier,
+                            (double)m_policy.max_delay.count());
+  }
+
+  // the last poll is made at the deadline
+  if (has_deadline) {
+    wait = std::min(wait, ceil_microseconds(m_deadline - now));
+  }
+  return true;
+}
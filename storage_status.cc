@@ -0,0 +1,32 @@
+#include "include/storage_status.h"
+
+namespace nitrokey {
+
+StorageStatus StorageStatus::decode(
+    const proto::stick20::GetDeviceStatus::ResponsePayload &response) {
+  StorageStatus status;
+  status.unencrypted_volume = {(response.volume_active_flag & 0x01) != 0,
+                               response.read_write_flag_uncrypted_volume == 0};
+  status.encrypted_volume = {(response.volume_active_flag & 0x02) != 0,
+                             response.read_write_flag_crypted_volume == 0};
+  status.hidden_volume = {(response.volume_active_flag & 0x04) != 0,
+                          response.read_write_flag_hidden_volume == 0};
+
+  status.firmware_version_major = response.version_info[3];
+  status.firmware_version_minor = response.version_info[1];
+  status.firmware_locked = response.firmware_locked != 0;
+
+  status.sd_card_id = response.active_sd_card_id;
+  status.new_sd_card_found = (response.new_sd_card_found & 0x01) != 0;
+  status.sd_card_filled_with_random_data =
+      (response.sd_fill_with_random_chars & 0x01) != 0;
+
+  status.smart_card_id = response.active_smart_card_id;
+  status.new_smart_card_found = response.new_smart_card_found != 0;
+  status.keys_initialized = response.stick_keys_not_initiated == 0;
+
+  status.user_retry_count = response.user_password_retry_count;
+  status.admin_retry_count = response.admin_password_retry_count;
+  return status;
+}
+}
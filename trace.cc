@@ -0,0 +1,88 @@
+#include <functional>
+#include <sstream>
+#include <thread>
+#include <unistd.h>
+#include "trace.h"
+
+namespace nitrokey {
+namespace trace {
+
+const size_t Tracer::CAPACITY;
+
+std::atomic<bool> Tracer::s_enabled(false);
+
+Tracer::Tracer()
+    : m_next(0), m_count(0), m_epoch(std::chrono::steady_clock::now()) {}
+
+Tracer &Tracer::instance() {
+  static Tracer tracer;
+  return tracer;
+}
+
+void Tracer::set_enabled(bool state) {
+  if (state) instance();  // set up the epoch before the first span
+  s_enabled.store(state, std::memory_order_relaxed);
+}
+
+uint64_t Tracer::now_us() const {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now() - m_epoch)
+      .count();
+}
+
+void Tracer::record(const char *category, const char *name, uint64_t start_us,
+                    uint64_t duration_us, int64_t arg) {
+  static thread_local const uint64_t thread_id =
+      std::hash<std::thread::id>()(std::this_thread::get_id()) & 0xFFFFFFFF;
+
+  std::lock_guard<std::mutex> lock(m_mutex);
+  Event &e = m_events[m_next];
+  e.name = name;
+  e.category = category;
+  e.start_us = start_us;
+  e.duration_us = duration_us;
+  e.thread_id = thread_id;
+  e.arg = arg;
+  m_next = (m_next + 1) % CAPACITY;
+  if (m_count < CAPACITY) m_count++;
+}
+
+void Tracer::clear() {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_next = 0;
+  m_count = 0;
+}
+
+static void write_json_string(std::stringstream &out, const char *s) {
+  out << '"';
+  for (; *s; s++) {
+    if (*s == '"' || *s == '\\') out << '\\';
+    out << *s;
+  }
+  out << '"';
+}
+
+std::string Tracer::dump_chrome_json() const {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  std::stringstream out;
+  const auto pid = getpid();
+
+  out << "{\"traceEvents\":[";
+  const size_t first = (m_next + CAPACITY - m_count) % CAPACITY;
+  for (size_t i = 0; i < m_count; i++) {
+    const Event &e = m_events[(first + i) % CAPACITY];
+    if (i > 0) out << ",";
+    out << "\n{\"name\":";
+    write_json_string(out, e.name);
+    out << ",\"cat\":";
+    write_json_string(out, e.category);
+    out << ",\"ph\":\"X\",\"ts\":" << e.start_us << ",\"dur\":" << e.duration_us
+        << ",\"pid\":" << pid << ",\"tid\":" << e.thread_id;
+    if (e.arg >= 0) out << ",\"args\":{\"arg\":" << e.arg << "}";
+    out << "}";
+  }
+  out << "\n],\"displayTimeUnit\":\"ms\"}\n";
+  return out.str();
+}
+}
+}
@@ -0,0 +1,87 @@
+#include <stdexcept>
+#include <string>
+#include "include/transaction_status.h"
+#include "include/CommandFailedException.h"
+#include "include/LibraryException.h"
+
+namespace nitrokey {
+namespace proto {
+
+constexpr uint8_t TransactionStatus::DEVICE_ERROR_STATUS;
+
+void TransactionStatus::raise() const {
+  switch (outcome) {
+    case Outcome::OK:
+      return;
+    case Outcome::COMMAND_FAILED:
+      throw CommandFailedException(command_id, last_command_status);
+    case Outcome::SEND_FAILED:
+      throw std::runtime_error(
+          std::string("Device error while sending command ") +
+          std::to_string(device_result));
+    case Outcome::RECEIVE_FAILED:
+      throw std::runtime_error(
+          std::string("Device error while executing command ") +
+          std::to_string(device_result));
+    case Outcome::NO_RESPONSE:
+      throw std::runtime_error(
+          "Maximum retry count reached for receiving response from the "
+          "device!");
+    case Outcome::RETRY_DEADLINE_PASSED:
+      throw std::runtime_error(
+          "Retry deadline passed while receiving response from the device!");
+    case Outcome::CANCELLED:
+      throw OperationCancelledException();
+    case Outcome::DEADLINE_EXCEEDED:
+      throw DeadlineExceededException();
+    case Outcome::LONG_OPERATION_IN_PROGRESS:
+      throw LongOperationInProgressException(progress);
+  }
+}
+
+uint8_t TransactionStatus::to_command_status() const {
+  switch (outcome) {
+    case Outcome::OK:
+      return 0;
+    case Outcome::COMMAND_FAILED:
+      return last_command_status;
+    case Outcome::CANCELLED:
+      return OperationCancelledException().exception_id();
+    case Outcome::DEADLINE_EXCEEDED:
+      return DeadlineExceededException().exception_id();
+    case Outcome::LONG_OPERATION_IN_PROGRESS:
+      return LongOperationInProgressException(progress).exception_id();
+    case Outcome::SEND_FAILED:
+    case Outcome::RECEIVE_FAILED:
+    case Outcome::NO_RESPONSE:
+    case Outcome::RETRY_DEADLINE_PASSED:
+      return DEVICE_ERROR_STATUS;
+  }
+  return DEVICE_ERROR_STATUS;
+}
+
+const char *TransactionStatus::describe() const {
+  switch (outcome) {
+    case Outcome::OK:
+      return "OK";
+    case Outcome::COMMAND_FAILED:
+      return "Command execution has failed on device";
+    case Outcome::SEND_FAILED:
+      return "Device error while sending command";
+    case Outcome::RECEIVE_FAILED:
+      return "Device error while executing command";
+    case Outcome::NO_RESPONSE:
+      return "No response from the device";
+    case Outcome::RETRY_DEADLINE_PASSED:
+      return "Retry deadline passed";
+    case Outcome::CANCELLED:
+      return "Operation cancelled";
+    case Outcome::DEADLINE_EXCEEDED:
+      return "Operation deadline exceeded";
+    case Outcome::LONG_OPERATION_IN_PROGRESS:
+      return "Device is busy with a long operation";
+  }
+  return "Unknown";
+}
+}
+}
@@ -0,0 +1,111 @@
+#define CATCH_CONFIG_MAIN  // This tells Catch to provide a main()
+#include "catch.hpp"
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include "NK_C_API.h"
+#include "device_emulator.h"
+
+using namespace nitrokey::device;
+
+// heap allocations made through operator new, by any thread
+static std::atomic<size_t> allocations(0);
+
+void *operator new(size_t size) {
+  allocations++;
+  void *p = malloc(size ? size : 1);
+  if (p == nullptr) throw std::bad_alloc();
+  return p;
+}
+
+void *operator new[](size_t size) { return operator new(size); }
+
+// every form releasing the counted blocks is paired with the malloc above
+void operator delete(void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+void operator delete[](void *p) noexcept { free(p); }
+void operator delete[](void *p, size_t) noexcept { free(p); }
+
+template <typename T>
+size_t allocations_of(T func) {
+  const size_t before = allocations.load();
+  func();
+  return allocations.load() - before;
+}
+
+static NK_device *open_emulator() {
+  NK_set_debug(false);
+  auto device = NK_device_open_object(std::make_shared<DeviceEmulator>());
+  REQUIRE(device != nullptr);
+  REQUIRE(NK_device_first_authenticate(device, "12345678", "123123123") == 0);
+  REQUIRE(NK_device_write_hotp_slot(device, 1, "hotp name", "00112233", 0,
+                                    false, false, false, "", "123123123") == 0);
+  REQUIRE(NK_device_enable_password_safe(device, "123456") == 0);
+  REQUIRE(NK_device_write_password_safe_slot(device, 2, "pws name", "login",
+                                             "password") == 0);
+  return device;
+}
+
+TEST_CASE("Results into caller buffers make no heap allocations",
+          "[allocations]") {
+  auto device = open_emulator();
+  char text[NK_STATUS_BUFFER_SIZE];
+  uint8_t data[NK_PWS_SLOT_STATUS_SIZE];
+
+  REQUIRE(allocations_of([&] {
+            REQUIRE(NK_device_get_hotp_slot_name_buf(device, 1, text,
+                                                     sizeof text) == 0);
+          }) == 0);
+  REQUIRE(std::string(text) == "hotp name");
+
+  REQUIRE(allocations_of([&] {
+            REQUIRE(NK_device_get_password_safe_slot_login_buf(
+                        device, 2, text, sizeof text) == 0);
+          }) == 0);
+  REQUIRE(std::string(text) == "login");
+
+  REQUIRE(allocations_of([&] {
+            REQUIRE(NK_device_get_password_safe_slot_password_buf(
+                        device, 2, text, sizeof text) == 0);
+            REQUIRE(NK_device_get_password_safe_slot_name_buf(
+                        device, 2, text, sizeof text) == 0);
+            REQUIRE(NK_device_get_password_safe_slot_status_buf(
+                        device, data, sizeof data) == 0);
+            REQUIRE(NK_device_read_config_buf(device, data, NK_CONFIG_SIZE) ==
+                    0);
+            REQUIRE(NK_device_get_serial_number_buf(device, text,
+                                                    sizeof text) == 0);
+            REQUIRE(NK_device_status_buf(device, text, sizeof text) == 0);
+          }) == 0);
+  REQUIRE(strlen(text) < NK_STATUS_BUFFER_SIZE);
+
+  // the allocating variants, for comparison
+  REQUIRE(allocations_of([&] {
+            delete[] NK_device_get_password_safe_slot_status(device);
+          }) > 0);
+
+  NK_device_close(device);
+}
+
+TEST_CASE("Buffer too small is reported and the buffer wiped",
+          "[allocations]") {
+  auto device = open_emulator();
+  char text[4];
+  memset(text, 'x', sizeof text);
+  REQUIRE(NK_device_get_hotp_slot_name_buf(device, 1, text, sizeof text) ==
+          203);
+  for (auto c : text) REQUIRE(c == 0);
+
+  char serial[NK_SERIAL_NUMBER_BUFFER_SIZE];
+  REQUIRE(NK_device_get_serial_number_buf(device, serial, sizeof serial) == 0);
+  REQUIRE(std::string(serial) == "00 00 4e 4b \n");
+
+  // not programmed slot
+  char name[NK_SLOT_NAME_BUFFER_SIZE];
+  memset(name, 'x', sizeof name);
+  REQUIRE(NK_device_get_hotp_slot_name_buf(device, 0, name, sizeof name) == 3);
+  for (auto c : name) REQUIRE(c == 0);
+
+  NK_device_close(device);
+}
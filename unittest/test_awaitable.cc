@@ -0,0 +1,116 @@
+#define CATCH_CONFIG_MAIN  // This tells Catch to provide a main()
+#include "catch.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <vector>
+#include "LibraryException.h"
+#include "NitrokeyManagerAwaitable.h"
+#include "device_emulator.h"
+
+#ifdef NITROKEY_COROUTINES
+
+using namespace nitrokey;
+using namespace nitrokey::device;
+using namespace std::chrono;
+
+static const char *TMP_PASSWORD = "123123123";
+
+class SlowDeviceEmulator : public DeviceEmulator {
+ public:
+  SlowDeviceEmulator() { m_send_receive_delay = milliseconds(100); }
+};
+
+class LeasedDeviceEmulator : public DeviceEmulator {
+ public:
+  virtual std::string get_lease_key() const { return "awaitable"; }
+};
+
+static shared_ptr<NitrokeyManager> connect_emulator(shared_ptr<Device> device) {
+  Log::instance().set_loglevel(Loglevel::ERROR);
+  auto manager = NitrokeyManager::create();
+  manager->connect_device(device);
+  return manager;
+}
+
+static coro::Task<uint32_t> program_and_read(AwaitableNitrokeyManager &awaitable) {
+  co_await awaitable.first_authenticate("12345678", TMP_PASSWORD);
+  co_await awaitable.write_HOTP_slot(1, "name", "00112233", 5, false, false,
+                                     false, "", TMP_PASSWORD);
+  co_await awaitable.write_TOTP_slot(0, "totp", "00112233", 30, false, false,
+                                     false, "", TMP_PASSWORD);
+  co_return co_await awaitable.get_HOTP_code(1, "");
+}
+
+TEST_CASE("Awaitable operations give the blocking results", "[awaitable]") {
+  auto manager = connect_emulator(make_shared<DeviceEmulator>());
+  AwaitableNitrokeyManager awaitable(manager);
+
+  REQUIRE(coro::sync_wait(program_and_read(awaitable)) == 5);
+  REQUIRE(coro::sync_wait(awaitable.get_hotp_slot_name(1)) == "name");
+  REQUIRE(manager->get_HOTP_code(1, "") == 6);
+  REQUIRE(coro::sync_wait(awaitable.get_serial_number()) ==
+          manager->get_serial_number());
+  REQUIRE(coro::sync_wait(awaitable.get_TOTP_code(0, 1234567, 0, 30, "")) ==
+          234567);
+  REQUIRE(coro::sync_wait(awaitable.get_totp_slot_name(0)) == "totp");
+}
+
+TEST_CASE("Awaitable operations throw as the blocking ones", "[awaitable]") {
+  auto manager = connect_emulator(make_shared<DeviceEmulator>());
+  AwaitableNitrokeyManager awaitable(manager);
+
+  REQUIRE_THROWS_AS(coro::sync_wait(awaitable.get_hotp_slot_name(10)),
+                    InvalidSlotException);
+  REQUIRE_THROWS_AS(coro::sync_wait(awaitable.get_totp_slot_name(1)),
+                    CommandFailedException);
+  REQUIRE_THROWS_AS(
+      coro::sync_wait(awaitable.first_authenticate("wrong", TMP_PASSWORD)),
+      CommandFailedException);
+}
+
+TEST_CASE("One thread drives many devices at once", "[awaitable]") {
+  const size_t count = 16;
+  std::vector<shared_ptr<AwaitableNitrokeyManager>> awaitables;
+  for (size_t i = 0; i < count; i++) {
+    awaitables.push_back(make_shared<AwaitableNitrokeyManager>(
+        connect_emulator(make_shared<SlowDeviceEmulator>())));
+  }
+
+  std::atomic<size_t> done(0);
+  auto start = [&](AwaitableNitrokeyManager &awaitable) -> coro::detail::Detached {
+    co_await awaitable.get_status();
+    done++;
+  };
+
+  const auto begin = steady_clock::now();
+  for (auto &awaitable : awaitables) start(*awaitable);
+  while (done < count) std::this_thread::sleep_for(milliseconds(5));
+  const auto elapsed = steady_clock::now() - begin;
+
+  // 100 ms each when run one after another
+  REQUIRE(elapsed < milliseconds(100 * count / 2));
+}
+
+TEST_CASE("Awaitable operations hold the lease and keep the limits",
+          "[awaitable]") {
+  char dir[] = "/tmp/nklease.XXXXXX";
+  REQUIRE(mkdtemp(dir) != nullptr);
+  setenv("LIBNITROKEY_LOCK_DIR", dir, 1);
+  auto device = make_shared<LeasedDeviceEmulator>();
+  auto manager = connect_emulator(device);
+  AwaitableNitrokeyManager awaitable(manager);
+
+  coro::sync_wait(awaitable.first_authenticate("12345678", TMP_PASSWORD));
+  REQUIRE(manager->get_device_lease_stats().acquired == 1);
+  REQUIRE_FALSE(device->get_lease().is_held());
+
+  manager->set_timeout(milliseconds(50));
+  device->set_retry_policy(RetryPolicy::fixed(1000000, milliseconds(10)));
+  device->set_processing_time(milliseconds(1000));
+  REQUIRE_THROWS_AS(coro::sync_wait(awaitable.get_status()),
+                    DeadlineExceededException);
+  REQUIRE_FALSE(device->get_lease().is_held());
+}
+
+#endif
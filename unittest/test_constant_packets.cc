@@ -0,0 +1,44 @@
+#define CATCH_CONFIG_MAIN  // This tells Catch to provide a main()
+#include "catch.hpp"
+#include <cstring>
+#include "NitrokeyManager.h"
+#include "device_emulator.h"
+
+using namespace nitrokey;
+using namespace nitrokey::device;
+using namespace nitrokey::proto;
+
+static_assert(stick10::GetStatus::CommandTransaction::has_constant_packet,
+              "no payload");
+static_assert(!stick10::GetHOTP::CommandTransaction::has_constant_packet,
+              "payload");
+
+/*
+ *	Constant packet matches the one built at run time.
+ */
+template <typename Command>
+static void check_constant_packet() {
+  typedef typename Command::CommandTransaction T;
+  typename T::OutgoingPacket built;
+  built.initialize();
+  built.update_CRC();
+  REQUIRE(memcmp(T::constant_packet.bytes, &built, sizeof built) == 0);
+}
+
+TEST_CASE("Constant packets are the built ones", "[constant_packets]") {
+  check_constant_packet<stick10::GetStatus>();
+  check_constant_packet<stick10::GetPasswordRetryCount>();
+  check_constant_packet<stick10::GetUserPasswordRetryCount>();
+  check_constant_packet<stick10::GetPasswordSafeSlotStatus>();
+  check_constant_packet<stick10::LockDevice>();
+  check_constant_packet<stick20::GetDeviceStatus>();
+}
+
+TEST_CASE("Constant packets are answered", "[constant_packets]") {
+  Log::instance().set_loglevel(Loglevel::ERROR);
+  auto manager = NitrokeyManager::create();
+  manager->connect_device(make_shared<DeviceEmulator>());
+
+  REQUIRE(manager->get_serial_number() == "00 00 4e 4b \n");
+  REQUIRE(manager->get_admin_retry_count() == 3);
+}
@@ -0,0 +1,109 @@
+#define CATCH_CONFIG_MAIN  // This tells Catch to provide a main()
+#include "catch.hpp"
+#include <chrono>
+#include <thread>
+#include "NK_C_API.h"
+#include "NitrokeyManager.h"
+#include "device_emulator.h"
+
+using namespace nitrokey;
+using namespace nitrokey::device;
+using namespace std::chrono;
+
+/*
+ *	Emulator which takes the given time for each command.
+ */
+class SlowDeviceEmulator : public DeviceEmulator {
+ public:
+  SlowDeviceEmulator(milliseconds processing_time) {
+    m_send_receive_delay = 10ms;
+    m_retry_policy = RetryPolicy::fixed(1000000, 10ms);
+    set_processing_time(processing_time);
+  }
+};
+
+static shared_ptr<NitrokeyManager> connect_emulator(shared_ptr<Device> device) {
+  Log::instance().set_loglevel(Loglevel::ERROR);
+  auto manager = NitrokeyManager::create();
+  manager->connect_device(device);
+  return manager;
+}
+
+TEST_CASE("Operations fail when their time runs out", "[deadline]") {
+  auto clock = make_shared<VirtualClock>();
+  auto device = make_shared<SlowDeviceEmulator>(1h);
+  device->set_clock(clock);
+  auto manager = connect_emulator(device);
+
+  manager->set_timeout(500ms);
+  REQUIRE_THROWS_AS(manager->get_serial_number(), DeadlineExceededException);
+  REQUIRE(clock->elapsed() == 500ms);
+
+  device->set_processing_time(0ms);
+  REQUIRE(manager->first_authenticate("12345678", "123123123"));
+
+  // the whole operation is limited, not each of its transactions
+  device->set_processing_time(300ms);
+  auto before = clock->elapsed();
+  REQUIRE_THROWS_AS(manager->write_HOTP_slot(1, "name", "00112233", 0, false,
+                                             false, false, "", "123123123"),
+                    DeadlineExceededException);
+  REQUIRE(clock->elapsed() - before == 500ms);
+
+  device->set_processing_time(200ms);
+  REQUIRE(manager->write_HOTP_slot(1, "name", "00112233", 0, false, false,
+                                   false, "", "123123123"));
+
+  manager->set_timeout(0ms);
+  manager->set_deadline(clock->now() + 100ms);
+  REQUIRE_THROWS_AS(manager->get_serial_number(), DeadlineExceededException);
+  manager->set_deadline(Clock::time_point::max());
+  REQUIRE(manager->get_serial_number() == "00 00 4e 4b \n");
+}
+
+TEST_CASE("Operation in progress can be cancelled", "[deadline]") {
+  auto device = make_shared<SlowDeviceEmulator>(1h);
+  auto manager = connect_emulator(device);
+
+  const auto begin = steady_clock::now();
+  std::thread canceller([&] {
+    std::this_thread::sleep_for(100ms);
+    manager->cancel();
+  });
+  REQUIRE_THROWS_AS(manager->get_serial_number(), OperationCancelledException);
+  canceller.join();
+  REQUIRE(steady_clock::now() - begin < 1s);
+
+  // no effect with no operation in progress, nor on operations started later
+  device->set_processing_time(0ms);
+  manager->cancel();
+  REQUIRE(manager->get_serial_number() == "00 00 4e 4b \n");
+  REQUIRE(manager->get_serial_number() == "00 00 4e 4b \n");
+}
+
+TEST_CASE("C API reports deadline and cancellation", "[deadline]") {
+  NK_set_debug(false);
+  auto clock = make_shared<VirtualClock>();
+  auto emulator = make_shared<SlowDeviceEmulator>(1h);
+  emulator->set_clock(clock);
+  auto device = NK_device_open_object(emulator);
+  REQUIRE(device != nullptr);
+  char serial[NK_SERIAL_NUMBER_BUFFER_SIZE];
+
+  NK_device_set_timeout(device, 1000);
+  REQUIRE(NK_device_get_serial_number_buf(device, serial, sizeof serial) ==
+          204);
+  REQUIRE(clock->elapsed() == 1000ms);
+
+  // waits in real time from now on
+  emulator->set_clock(make_shared<SystemClock>());
+  NK_device_set_timeout(device, 0);
+  std::thread canceller([&] {
+    std::this_thread::sleep_for(100ms);
+    NK_device_cancel(device);
+  });
+  REQUIRE(NK_device_get_serial_number_buf(device, serial, sizeof serial) ==
+          205);
+  canceller.join();
+  NK_device_close(device);
+}
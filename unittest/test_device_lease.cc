@@ -0,0 +1,144 @@
+#define CATCH_CONFIG_MAIN  // This tells Catch to provide a main()
+#include "catch.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <thread>
+#include <unistd.h>
+#include "LibraryException.h"
+#include "NitrokeyManager.h"
+#include "device_emulator.h"
+#include "device_lease.h"
+
+using namespace nitrokey;
+using namespace nitrokey::device;
+using namespace std::chrono;
+
+/*
+ *	Lock files in a directory of their own. Two leases of one process
+ *	exclude each other as leases of two processes do.
+ */
+static std::string test_key(const char *name) {
+  static const bool dir_set = [] {
+    char dir[] = "/tmp/nklease.XXXXXX";
+    REQUIRE(mkdtemp(dir) != nullptr);
+    setenv("LIBNITROKEY_LOCK_DIR", dir, 1);
+    return true;
+  }();
+  (void)dir_set;
+  return name;
+}
+
+class LeasedDeviceEmulator : public DeviceEmulator {
+ public:
+  virtual std::string get_lease_key() const { return test_key("emulator"); }
+};
+
+TEST_CASE("Lease lock files are named after the key", "[lease]") {
+  setenv("LIBNITROKEY_LOCK_DIR", "/run/test", 1);
+  REQUIRE(DeviceLease::lock_path("/dev/hidraw3") ==
+          "/run/test/libnitrokey-_dev_hidraw3.lock");
+  REQUIRE(DeviceLease::lock_path("0001:0004:00") ==
+          "/run/test/libnitrokey-0001_0004_00.lock");
+  unsetenv("LIBNITROKEY_LOCK_DIR");
+}
+
+TEST_CASE("Lease waits up to its timeout", "[lease]") {
+  VirtualClock clock;
+  DeviceLease holder, waiter;
+  const auto key = test_key("timeout");
+  holder.acquire(key, clock, 10ms, Clock::time_point::max(), nullptr);
+  REQUIRE(holder.is_held());
+  REQUIRE_FALSE(waiter.try_acquire(key));
+
+  REQUIRE_THROWS_AS(
+      waiter.acquire(key, clock, 100ms, Clock::time_point::max(), nullptr),
+      DeviceLeaseTimeoutException);
+  REQUIRE(clock.elapsed() == 100ms);
+  auto stats = waiter.get_stats();
+  REQUIRE(stats.acquired == 0);
+  REQUIRE(stats.timeouts == 1);
+  REQUIRE(stats.max_wait == 100ms);
+
+  // the limits of the operation come first
+  REQUIRE_THROWS_AS(
+      waiter.acquire(key, clock, 100ms, clock.now() + 50ms, nullptr),
+      DeadlineExceededException);
+  std::atomic<bool> cancelled(true);
+  REQUIRE_THROWS_AS(
+      waiter.acquire(key, clock, 100ms, Clock::time_point::max(), &cancelled),
+      OperationCancelledException);
+
+  holder.release();
+  waiter.acquire(key, clock, 100ms, Clock::time_point::max(), nullptr);
+  stats = waiter.get_stats();
+  REQUIRE(stats.acquired == 1);
+  REQUIRE(stats.contended == 3);
+  REQUIRE(stats.timeouts == 3);
+  REQUIRE(holder.get_stats().contended == 0);
+}
+
+TEST_CASE("Waiting lease is served before the holder takes it again",
+          "[lease]") {
+  SystemClock clock;
+  DeviceLease holder, waiter;
+  const auto key = test_key("fairness");
+  holder.acquire(key, clock, 1000ms, Clock::time_point::max(), nullptr);
+
+  std::atomic<bool> waiter_served(false);
+  std::thread thread([&] {
+    waiter.acquire(key, clock, 5000ms, Clock::time_point::max(), nullptr);
+    waiter_served = true;
+    std::this_thread::sleep_for(50ms);
+    waiter.release();
+  });
+  std::this_thread::sleep_for(100ms);
+  holder.release();
+  holder.acquire(key, clock, 5000ms, Clock::time_point::max(), nullptr);
+  REQUIRE(waiter_served);
+  thread.join();
+  REQUIRE(waiter.get_stats().contended == 1);
+  REQUIRE(holder.get_stats().contended == 1);
+}
+
+TEST_CASE("Manager operations hold the lease", "[lease]") {
+  Log::instance().set_loglevel(Loglevel::ERROR);
+  auto device = make_shared<LeasedDeviceEmulator>();
+  auto manager = NitrokeyManager::create();
+  manager->connect_device(device);
+  manager->get_serial_number();
+  REQUIRE_FALSE(device->get_lease().is_held());
+  REQUIRE(manager->get_device_lease_stats().acquired == 1);
+
+  SystemClock clock;
+  DeviceLease other;
+  other.acquire(device->get_lease_key(), clock, 10ms, Clock::time_point::max(),
+                nullptr);
+  manager->set_device_lease_timeout(20ms);
+  REQUIRE_THROWS_AS(manager->get_serial_number(), DeviceLeaseTimeoutException);
+  REQUIRE(manager->get_device_lease_stats().timeouts == 1);
+
+  // lease free again
+  other.release();
+  manager->get_serial_number();
+  REQUIRE(manager->get_device_lease_stats().acquired == 2);
+
+  manager->set_device_lease_timeout(0ms);
+  other.acquire(device->get_lease_key(), clock, 10ms, Clock::time_point::max(),
+                nullptr);
+  manager->get_serial_number();
+  REQUIRE(manager->get_device_lease_stats().acquired == 2);
+}
+
+TEST_CASE("Devices connected by model or by path take the same lease",
+          "[lease]") {
+  Stick10 by_model, by_path;
+  const auto paths = by_model.enumerate();
+  if (paths.empty()) return;  // no Nitrokey Pro on the bus
+  by_path.set_path(paths.front());
+  REQUIRE(by_model.get_lease_key() == paths.front());
+  REQUIRE(by_path.get_lease_key() == paths.front());
+  REQUIRE(by_model.connect());
+  REQUIRE(by_model.get_lease_key() == paths.front());
+  by_model.disconnect();
+}
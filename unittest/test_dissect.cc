@@ -0,0 +1,128 @@
+#define CATCH_CONFIG_MAIN  // This tells Catch to provide a main()
+#include "catch.hpp"
+#include <string.h>
+#include "device_proto.h"
+#include "stick10_commands.h"
+#include "stick20_commands.h"
+
+using namespace nitrokey::proto;
+using namespace nitrokey::proto::stick10;
+
+typedef DeviceResponse<CommandID::GET_STATUS, GetStatus::ResponsePayload>
+    StatusResponse;
+typedef ResponseDissector<CommandID::GET_STATUS, StatusResponse>
+    StatusDissector;
+
+TEST_CASE("Hexdump layout", "[dissect]") {
+  uint8_t data[18];
+  for (int i = 0; i < 18; i++) data[i] = i * 15;
+  REQUIRE(nitrokey::misc::hexdump((const char *)data, sizeof data) ==
+          "0000\t00 0f 1e 2d 3c 4b 5a 69 78 87 96 a5 b4 c3 d2 e1 \n"
+          "0010\tf0 ff \n");
+  REQUIRE(nitrokey::misc::hexdump((const char *)data, 2, false) ==
+          "00 0f \n");
+}
+
+TEST_CASE("Writer never overflows the buffer", "[dissect]") {
+  char buf[8];
+  DissectWriter out(buf, sizeof buf);
+  out.text("0123").dec(456).hex32(0xdeadbeef);
+  REQUIRE(out.truncated());
+  REQUIRE(out.size() == 7);
+  REQUIRE(strcmp(buf, "0123456") == 0);
+}
+
+TEST_CASE("Writer copies text of a length as it is", "[dissect]") {
+  // NULs included, whether it fits or is cut
+  char buf[16];
+  DissectWriter out(buf, sizeof buf);
+  out.text("0123").text("ab\0cd", 5);
+  REQUIRE_FALSE(out.truncated());
+  REQUIRE(out.size() == 9);
+  REQUIRE(memcmp(buf, "0123ab\0cd", 10) == 0);
+
+  char small[8];
+  DissectWriter cut(small, sizeof small);
+  cut.text("0123").text("ab\0cd", 5);
+  REQUIRE(cut.truncated());
+  REQUIRE(cut.size() == 7);
+  REQUIRE(memcmp(small, "0123ab\0", 8) == 0);
+
+  // fields stop at their NUL or their size
+  const uint8_t field[4] = {'x', 'y', 0, 'z'};
+  const uint8_t full[4] = {'w', 'x', 'y', 'z'};
+  DissectWriter fields(buf, sizeof buf);
+  fields.c_string(field, sizeof field).c_string(full, sizeof full);
+  REQUIRE(fields.size() == 6);
+  REQUIRE(strcmp(buf, "xywxyz") == 0);
+}
+
+TEST_CASE("String dissection is the one of the writer", "[dissect]") {
+  ReadSlot::ResponsePayload slot;
+  memset(&slot, 0, sizeof slot);
+  memcpy(slot.slot_name, "slot", 4);
+  slot.counter = 42;
+  char buf[DISSECT_BUFFER_SIZE];
+  DissectWriter out(buf, sizeof buf);
+  slot.dissect(out);
+  REQUIRE(slot.dissect() == std::string(buf, out.size()));
+  REQUIRE(slot.dissect().find("counter:\t42\n") != std::string::npos);
+}
+
+TEST_CASE("Payload fields are dissected within their size", "[dissect]") {
+  WriteToHOTPSlot::CommandPayload slot;
+  memset(&slot, 0, sizeof slot);
+  slot.slot_number = 0x10;
+  // no NUL, followed by the secret
+  memcpy(slot.slot_name, "fifteen chars..", sizeof slot.slot_name);
+  memcpy(slot.slot_secret, "secret", 6);
+  slot.use_enter = true;
+  slot.slot_token_id[0] = 0xab;
+  slot.slot_counter = 5000000000;
+  const std::string text = slot.dissect();
+  REQUIRE(text.find("slot_name:\tfifteen chars..\n") != std::string::npos);
+  REQUIRE(text.find("slot_secret:\tsecret\n") != std::string::npos);
+  REQUIRE(text.find("slot_config:\t00000010\n") != std::string::npos);
+  REQUIRE(text.find("slot_token_id:\tab 00 ") != std::string::npos);
+  REQUIRE(text.find("slot_counter:\t5000000000\n") != std::string::npos);
+
+  nitrokey::proto::stick20::GetDeviceStatus::ResponsePayload status;
+  memset(&status, 0, sizeof status);
+  status.command_counter = 7;
+  status.magic_number_stick_config = 0x3f2a;
+  status.version_info[1] = 49;
+  status.version_info[3] = 0;
+  char buf[DISSECT_BUFFER_SIZE];
+  DissectWriter out(buf, sizeof buf);
+  status.dissect(out);
+  REQUIRE(status.dissect() == std::string(buf, out.size()));
+  REQUIRE(strstr(buf, "command_counter:\t7\n") != nullptr);
+  REQUIRE(strstr(buf, "magic_number_stick_config:\t3f2a\n") != nullptr);
+  REQUIRE(strstr(buf, "firmware_version:\t0.49\n") != nullptr);
+}
+
+TEST_CASE("Response dissection", "[dissect]") {
+  StatusResponse resp;
+  resp.initialize();
+  resp.command_id = (uint8_t)CommandID::GET_STATUS;
+  resp.last_command_crc = 0x12ab;
+  resp.last_command_status = 5;
+  resp.payload.firmware_version = 7;
+
+  const std::string text = StatusDissector::dissect(resp);
+  REQUIRE(text.find("Last command CRC:\t000012ab\n") != std::string::npos);
+  REQUIRE(text.find("5 CMD_STATUS_NOT_AUTHORIZED") != std::string::npos);
+  REQUIRE(text.find("firmware_version:\t7\n") != std::string::npos);
+
+  char buf[DISSECT_BUFFER_SIZE];
+  StatusDissector::dissect_json(resp, buf, sizeof buf);
+  REQUIRE(strstr(buf, "\"command\":\"GET_STATUS\"") != nullptr);
+  REQUIRE(strstr(buf, "\"payload\":\"07\"") != nullptr);
+
+  // out of range status values must not be looked up
+  resp.device_status = 200;
+  resp.last_command_status = 200;
+  StatusDissector::dissect_json(resp, buf, sizeof buf);
+  REQUIRE(strstr(buf, "\"device_status_name\":\"UNKNOWN\"") != nullptr);
+  REQUIRE(strstr(buf, "\"last_command_status_name\":\"UNKNOWN\"") != nullptr);
+}
@@ -0,0 +1,72 @@
+#define CATCH_CONFIG_MAIN  // This tells Catch to provide a main()
+#include "catch.hpp"
+#include <chrono>
+#include "NitrokeyManager.h"
+#include "device_emulator.h"
+#include "fault_injecting_device.h"
+
+using namespace nitrokey;
+using namespace nitrokey::device;
+using namespace std::chrono;
+
+typedef FaultInjectingDevice::Fault Fault;
+
+class TimedDeviceEmulator : public DeviceEmulator {
+ public:
+  TimedDeviceEmulator() {
+    m_send_receive_delay = 100ms;
+    m_retry_policy = RetryPolicy::fixed(10, 100ms);
+  }
+};
+
+struct Setup {
+  shared_ptr<VirtualClock> clock = make_shared<VirtualClock>();
+  shared_ptr<FaultInjectingDevice> device;
+  shared_ptr<NitrokeyManager> manager = NitrokeyManager::create();
+
+  Setup() {
+    Log::instance().set_loglevel(Loglevel::ERROR);
+    auto emulator = make_shared<TimedDeviceEmulator>();
+    emulator->set_clock(clock);
+    device = make_shared<FaultInjectingDevice>(emulator);
+    device->set_clock(clock);
+    manager->connect_device(device);
+  }
+};
+
+TEST_CASE("Faults are retried over", "[fault_injection]") {
+  Setup s;
+  s.device->set_fault(Fault::BUSY, {0, 4, 1});
+  s.device->set_fault(Fault::STALE_CRC, {0, 2, 1});
+  s.device->set_fault(Fault::RECV_FAILURE, {0, 3, 1});
+  s.device->set_fault(Fault::SHORT_READ, {0, 5, 1});
+
+  for (int i = 0; i < 10; i++)
+    REQUIRE(s.manager->get_serial_number() == "00 00 4e 4b \n");
+  REQUIRE(s.device->get_injected_count(Fault::BUSY) > 0);
+  REQUIRE(s.device->get_injected_count(Fault::STALE_CRC) > 0);
+  REQUIRE(s.device->get_injected_count(Fault::RECV_FAILURE) > 0);
+  REQUIRE(s.device->get_injected_count(Fault::SHORT_READ) > 0);
+  // each spoiled receive costs a retry timeout
+  REQUIRE(s.clock->elapsed() ==
+          10 * 100ms + (s.device->get_recv_count() - 10) * 100ms);
+}
+
+TEST_CASE("Lasting faults exhaust the retries", "[fault_injection]") {
+  Setup s;
+  s.device->set_fault(Fault::BUSY, {1, 0, 1});
+  REQUIRE_THROWS_AS(s.manager->get_serial_number(), std::runtime_error);
+  REQUIRE(s.device->get_recv_count() == 10);
+
+  s.device->clear_faults();
+  s.device->set_fault(Fault::RECV_FAILURE, {0, 1, 1});
+  REQUIRE_THROWS_AS(s.manager->get_serial_number(), std::runtime_error);
+
+  // not taken for a response, though the serial number is in the part read
+  s.device->clear_faults();
+  s.device->set_fault(Fault::SHORT_READ, {0, 1, 1});
+  REQUIRE_THROWS_AS(s.manager->get_serial_number(), std::runtime_error);
+
+  s.device->clear_faults();
+  REQUIRE(s.manager->get_serial_number() == "00 00 4e 4b \n");
+}
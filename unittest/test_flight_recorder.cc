@@ -0,0 +1,92 @@
+#define CATCH_CONFIG_MAIN  // This tells Catch to provide a main()
+#include "catch.hpp"
+#include <cstring>
+#include <thread>
+#include <vector>
+#include "NitrokeyManager.h"
+#include "device_emulator.h"
+
+using namespace nitrokey;
+using namespace nitrokey::device;
+
+typedef FlightRecorder::Direction Direction;
+
+// bytes of the reports which are not derived from the payload: report id
+// and command id, and in responses the device and command status
+static const size_t OUTGOING_KEPT = 2;
+static const size_t INCOMING_DEVICE_STATUS = 1;
+static const size_t INCOMING_COMMAND_ID = 2;
+static const size_t INCOMING_COMMAND_STATUS = 7;
+
+static bool payload_derived(Direction direction, size_t i) {
+  if (direction == Direction::OUTGOING) return i >= OUTGOING_KEPT;
+  return i != 0 && i != INCOMING_DEVICE_STATUS && i != INCOMING_COMMAND_ID &&
+         i != INCOMING_COMMAND_STATUS;
+}
+
+static void require_redacted(const FlightRecorder::Record &r) {
+  REQUIRE(r.redacted);
+  for (size_t i = 0; i < HID_REPORT_SIZE; i++)
+    if (payload_derived(r.direction, i)) REQUIRE(r.packet[i] == 0);
+}
+
+TEST_CASE("Redacted records keep no byte derived from the payload",
+          "[flight_recorder]") {
+  uint8_t packet[HID_REPORT_SIZE];
+  memset(packet, 0xA5, sizeof packet);
+  FlightRecorder recorder;
+  recorder.record(Direction::OUTGOING, packet, HID_REPORT_SIZE, true);
+  recorder.record(Direction::INCOMING, packet, HID_REPORT_SIZE, true);
+  recorder.record(Direction::INCOMING, packet, HID_REPORT_SIZE, false);
+  REQUIRE(recorder.size() == 3);
+
+  require_redacted(recorder.get(0));
+  require_redacted(recorder.get(1));
+  REQUIRE(recorder.get(0).packet[1] == 0xA5);
+  REQUIRE(recorder.get(1).packet[INCOMING_COMMAND_STATUS] == 0xA5);
+  REQUIRE_FALSE(recorder.get(2).redacted);
+  REQUIRE(memcmp(recorder.get(2).packet, packet, sizeof packet) == 0);
+}
+
+TEST_CASE("Exchanges carrying PINs are recorded redacted",
+          "[flight_recorder]") {
+  Log::instance().set_loglevel(Loglevel::ERROR);
+  auto emulator = make_shared<DeviceEmulator>();
+  auto manager = NitrokeyManager::create();
+  manager->connect_device(emulator);
+  auto &recorder = emulator->get_flight_recorder();
+  recorder.clear();
+
+  manager->first_authenticate("12345678", "123123123");
+  manager->get_status();
+  REQUIRE(recorder.size() >= 4);
+  size_t redacted = 0;
+  for (size_t i = 0; i < recorder.size(); i++) {
+    const auto &r = recorder.get(i);
+    if (!r.redacted) continue;
+    redacted++;
+    require_redacted(r);
+  }
+  // FIRST_AUTHENTICATE and its response
+  REQUIRE(redacted >= 2);
+  // GET_STATUS is kept
+  REQUIRE_FALSE(recorder.get(recorder.size() - 1).redacted);
+  const auto dump = manager->get_flight_recorder_dump();
+  REQUIRE(dump.find("31 32 33 34 35 36 37 38") == std::string::npos);
+}
+
+TEST_CASE("Records are taken and dumped from several threads",
+          "[flight_recorder]") {
+  uint8_t packet[HID_REPORT_SIZE];
+  memset(packet, 0, sizeof packet);
+  FlightRecorder recorder;
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; t++)
+    threads.emplace_back([&] {
+      for (int i = 0; i < 1000; i++)
+        recorder.record(Direction::OUTGOING, packet, HID_REPORT_SIZE, false);
+    });
+  for (int i = 0; i < 20; i++) REQUIRE_FALSE(recorder.dump().empty());
+  for (auto &thread : threads) thread.join();
+  REQUIRE(recorder.size() == FlightRecorder::CAPACITY);
+}
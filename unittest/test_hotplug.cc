@@ -0,0 +1,158 @@
+#define CATCH_CONFIG_MAIN  // This tells Catch to provide a main()
+#include "catch.hpp"
+#include <arpa/inet.h>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "NitrokeyManager.h"
+#include "device_emulator.h"
+#include "hotplug.h"
+
+using namespace nitrokey;
+using namespace nitrokey::device;
+
+static const std::string pro_devpath = "/devices/pci0000:00/0000:00:14.0/usb1/1-2";
+
+static std::string uevent_properties(const std::string &action,
+                                     const std::string &devpath,
+                                     const std::string &devtype,
+                                     const std::string &product) {
+  const std::string properties[] = {
+      "ACTION=" + action,    "DEVPATH=" + devpath, "SUBSYSTEM=usb",
+      "DEVTYPE=" + devtype,  "PRODUCT=" + product, "SEQNUM=4242"};
+  std::string message;
+  for (const auto &p : properties) {
+    message += p;
+    message += '\0';
+  }
+  return message;
+}
+
+/*
+ *	Message as sent by the kernel: "action@devpath" and the properties.
+ */
+static std::string kernel_uevent(const std::string &action,
+                                  const std::string &devpath,
+                                  const std::string &devtype,
+                                  const std::string &product) {
+  return action + "@" + devpath + '\0' +
+         uevent_properties(action, devpath, devtype, product);
+}
+
+/*
+ *	The same properties behind a libudev monitor header.
+ */
+static std::string udev_uevent(const std::string &properties) {
+  uint32_t header[10] = {};
+  memcpy(header, "libudev", 8);
+  header[2] = htonl(0xfeedcafe);
+  header[3] = sizeof header;
+  header[4] = sizeof header;
+  header[5] = (uint32_t)properties.size();
+  return std::string((const char *)header, sizeof header) + properties;
+}
+
+static void process(HotplugMonitor &monitor, const std::string &message) {
+  monitor.process_uevent(message.data(), message.size());
+}
+
+TEST_CASE("Nitrokey uevents are parsed", "[hotplug]") {
+  HotplugMonitor::Event event;
+  auto message = kernel_uevent("add", pro_devpath, "usb_device", "20a0/4108/101");
+  REQUIRE(HotplugMonitor::parse_uevent(message.data(), message.size(), event));
+  REQUIRE(event.action == HotplugMonitor::Action::ARRIVAL);
+  REQUIRE(event.device.devpath == pro_devpath);
+  REQUIRE(event.device.model == DeviceModel::PRO);
+
+  message = udev_uevent(uevent_properties("remove", "/devices/usb1/1-3",
+                                          "usb_device", "3eb/2ff1/0"));
+  REQUIRE(HotplugMonitor::parse_uevent(message.data(), message.size(), event));
+  REQUIRE(event.action == HotplugMonitor::Action::REMOVAL);
+  REQUIRE(event.device.update_mode);
+
+  // other devices, interfaces, actions and broken messages
+  const std::string ignored[] = {
+      kernel_uevent("add", pro_devpath, "usb_device", "46d/c52b/1201"),
+      kernel_uevent("add", pro_devpath + ":1.0", "usb_interface", "20a0/4108/101"),
+      kernel_uevent("bind", pro_devpath, "usb_device", "20a0/4108/101"),
+      kernel_uevent("add", pro_devpath, "usb_device", "20a0"),
+      kernel_uevent("add", pro_devpath, "usb_device", "20a0/4108/101")
+          .substr(0, 60),
+      udev_uevent("ACTION=add"),
+  };
+  for (const auto &m : ignored)
+    REQUIRE_FALSE(HotplugMonitor::parse_uevent(m.data(), m.size(), event));
+}
+
+TEST_CASE("Device table follows the events", "[hotplug]") {
+  HotplugMonitor monitor;
+  std::vector<HotplugMonitor::Event> events;
+  const int id = monitor.add_callback(
+      [&](const HotplugMonitor::Event &e) { events.push_back(e); });
+
+  const auto generation = monitor.get_generation();
+  process(monitor, kernel_uevent("add", pro_devpath, "usb_device", "20a0/4108/101"));
+  process(monitor, kernel_uevent("add", "/devices/usb1/1-3", "usb_device",
+                                 "3eb/2ff1/0"));
+  REQUIRE(monitor.get_devices().size() == 2);
+  REQUIRE(monitor.has_connectable_device());
+  REQUIRE(monitor.get_generation() == generation + 2);
+
+  // repeated events change nothing
+  process(monitor, kernel_uevent("add", pro_devpath, "usb_device", "20a0/4108/101"));
+  REQUIRE(events.size() == 2);
+  REQUIRE(monitor.get_generation() == generation + 2);
+
+  process(monitor, kernel_uevent("remove", pro_devpath, "usb_device", "20a0/4108/101"));
+  REQUIRE(events.size() == 3);
+  REQUIRE(events.back().action == HotplugMonitor::Action::REMOVAL);
+  // only the Storage in update mode is left
+  REQUIRE_FALSE(monitor.has_connectable_device());
+
+  monitor.remove_callback(id);
+  process(monitor, kernel_uevent("remove", "/devices/usb1/1-3", "usb_device",
+                                 "3eb/2ff1/0"));
+  REQUIRE(events.size() == 3);
+  REQUIRE(monitor.get_devices().empty());
+}
+
+TEST_CASE("Hotplug cache of connect() keeps only open devices", "[hotplug]") {
+  Log::instance().set_loglevel(Loglevel::ERROR);
+  auto &monitor = HotplugMonitor::instance();
+  // no netlink socket, e.g. in a container: nothing to cache
+  if (!monitor.start()) return;
+  const std::string devpath = "/devices/pci0000:00/0000:00:14.0/usb1/1-9";
+  process(monitor, kernel_uevent("add", devpath, "usb_device", "20a0/4108/101"));
+
+  auto manager = NitrokeyManager::create();
+  auto first = std::make_shared<DeviceEmulator>();
+  REQUIRE(manager->connect_any({first}));
+  REQUIRE(first->is_connected());
+  // cached, the candidates are not tried
+  auto unused = std::make_shared<DeviceEmulator>();
+  REQUIRE(manager->connect_any({unused}));
+  REQUIRE_FALSE(unused->is_connected());
+
+  // reconnects after disconnect(), with no hotplug event in between
+  REQUIRE(manager->disconnect());
+  REQUIRE_FALSE(first->is_connected());
+  auto second = std::make_shared<DeviceEmulator>();
+  REQUIRE(manager->connect_any({second}));
+  REQUIRE(second->is_connected());
+  manager->get_status();
+
+  // and after the device was closed behind the manager's back
+  second->disconnect();
+  auto third = std::make_shared<DeviceEmulator>();
+  REQUIRE(manager->connect_any({third}));
+  REQUIRE(third->is_connected());
+
+  // a device given explicitly is not taken for the cached one
+  REQUIRE(manager->connect_device(std::make_shared<DeviceEmulator>()));
+  auto fourth = std::make_shared<DeviceEmulator>();
+  REQUIRE(manager->connect_any({fourth}));
+  REQUIRE(fourth->is_connected());
+
+  process(monitor, kernel_uevent("remove", devpath, "usb_device", "20a0/4108/101"));
+  monitor.stop();
+}
@@ -0,0 +1,130 @@
+#define CATCH_CONFIG_MAIN  // This tells Catch to provide a main()
+#include "catch.hpp"
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include "NitrokeyManager.h"
+#include "device_emulator.h"
+#include "keep_alive.h"
+#include "poller.h"
+
+using namespace nitrokey;
+using namespace nitrokey::device;
+using namespace std::chrono;
+
+/*
+ *	Emulator going to USB autosuspend after 2 s without packets, and
+ *	taking 300 ms to wake up.
+ */
+class SuspendingDeviceEmulator : public DeviceEmulator {
+ public:
+  SuspendingDeviceEmulator(shared_ptr<Clock> clock) {
+    set_clock(clock);
+    m_send_receive_delay = 1ms;
+    m_retry_policy = RetryPolicy::fixed(1000, 1ms);
+    m_last_send = clock->now();
+  }
+
+  virtual int send(const void *packet) {
+    const auto now = m_clock->now();
+    set_processing_time(now - m_last_send >= 2s ? 300ms : 1ms);
+    m_last_send = now;
+    return DeviceEmulator::send(packet);
+  }
+
+ private:
+  Clock::time_point m_last_send;
+};
+
+static shared_ptr<NitrokeyManager> connect_emulator(shared_ptr<Device> device) {
+  Log::instance().set_loglevel(Loglevel::ERROR);
+  auto manager = NitrokeyManager::create();
+  manager->connect_device(device);
+  return manager;
+}
+
+TEST_CASE("Keep-alive takes the wake-up time of requests", "[keep_alive]") {
+  auto clock = make_shared<VirtualClock>();
+  auto device = make_shared<SuspendingDeviceEmulator>(clock);
+  auto manager = connect_emulator(device);
+  auto keep_alive = KeepAlive::create(device, 1000ms);
+
+  // not due while requests keep coming
+  manager->get_serial_number();
+  clock->advance(500ms);
+  auto next = keep_alive->tick();
+  REQUIRE(next - clock->now() == 500ms);
+  REQUIRE(keep_alive->get_stats().sent == 0);
+
+  // awake device, nothing saved
+  clock->advance(1000ms);
+  keep_alive->tick();
+  REQUIRE(keep_alive->get_stats().sent == 1);
+  manager->get_serial_number();
+  REQUIRE(keep_alive->get_stats().saved == 0us);
+
+  // suspended device is woken up by the keep-alive, not the request
+  clock->advance(5s);
+  keep_alive->tick();
+  auto before = clock->elapsed();
+  manager->get_serial_number();
+  REQUIRE(clock->elapsed() - before < 10ms);
+  auto stats = keep_alive->get_stats();
+  REQUIRE(stats.sent == 2);
+  REQUIRE(stats.failed == 0);
+  REQUIRE(stats.saved >= 290ms);
+  REQUIRE(stats.saved <= 300ms);
+
+  // no request after a keep-alive, nothing saved by it
+  clock->advance(5s);
+  keep_alive->tick();
+  REQUIRE(keep_alive->get_stats().saved == stats.saved);
+}
+
+TEST_CASE("Keep-alive waits for exchanges in progress", "[keep_alive]") {
+  auto clock = make_shared<VirtualClock>();
+  auto device = make_shared<SuspendingDeviceEmulator>(clock);
+  auto manager = connect_emulator(device);
+  auto keep_alive = KeepAlive::create(device, 1000ms);
+
+  device->begin_exchange();
+  clock->advance(5s);
+  REQUIRE(keep_alive->tick() == clock->now() + 1000ms);
+  REQUIRE(keep_alive->get_stats().sent == 0);
+  device->end_exchange();
+  keep_alive->tick();
+  REQUIRE(keep_alive->get_stats().sent == 0);
+  clock->advance(1000ms);
+  keep_alive->tick();
+  REQUIRE(keep_alive->get_stats().sent == 1);
+}
+
+TEST_CASE("Keep-alives are scheduled when idle", "[keep_alive]") {
+  auto device = make_shared<DeviceEmulator>();
+  auto manager = connect_emulator(device);
+  manager->set_keep_alive(50ms);
+  std::this_thread::sleep_for(300ms);
+  const auto sent = manager->get_keep_alive_stats().sent;
+  REQUIRE(sent >= 2);
+
+  manager->set_keep_alive(0ms);
+  std::this_thread::sleep_for(200ms);
+  REQUIRE(manager->get_keep_alive_stats().sent == sent);
+}
+
+TEST_CASE("Keep-alives do not hold up the shared poller", "[keep_alive]") {
+  auto device = make_shared<DeviceEmulator>();
+  device->set_retry_policy(RetryPolicy::fixed(1000, 10ms));
+  device->set_processing_time(300ms);
+  auto manager = connect_emulator(device);
+  manager->set_keep_alive(10ms);
+  // a keep-alive is in progress
+  std::this_thread::sleep_for(100ms);
+
+  const auto begin = steady_clock::now();
+  std::atomic<bool> called(false);
+  Poller::instance().schedule_after(1ms, [&] { called = true; });
+  while (!called) std::this_thread::sleep_for(1ms);
+  REQUIRE(steady_clock::now() - begin < 100ms);
+  manager->set_keep_alive(0ms);
+}
@@ -0,0 +1,58 @@
+"""
+Tests of the compiled Python extension, python_bindings/libnitrokey.py. Build it first with
+python3 ../python_bindings/build_libnitrokey.py, then run with pytest from this directory.
+Needs a Nitrokey Pro with the default PINs, as test_bindings.py.
+"""
+import asyncio
+import os
+import sys
+
+import pytest
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', 'python_bindings'))
+from libnitrokey import AsyncDevice, Device, NitrokeyError, lib
+
+ADMIN = '12345678'
+ADMIN_TEMP = '123123123'
+RFC_SECRET = '3132333435363738393031323334353637383930'  # '12345678901234567890'
+WRONG_PASSWORD = 4
+
+
+@pytest.fixture(scope="module")
+def device(request):
+    lib.NK_set_debug(False)
+    device = Device.open('P')
+    request.addfinalizer(device.close)
+    device.first_authenticate(ADMIN, ADMIN_TEMP)
+    for slot in range(3):
+        device.write_hotp_slot(slot, 'python{}'.format(slot), RFC_SECRET, 0, ADMIN_TEMP)
+    return device
+
+
+def test_batch_calls_give_lists(device):
+    assert device.get_hotp_slot_names([0, 1, 2]) == ['python0', 'python1', 'python2']
+    codes = device.get_hotp_codes([0, 1, 2])
+    # RFC 4226 codes of counter 0, then 1
+    assert codes == [755224, 755224, 755224]
+    assert device.get_hotp_codes([0]) == [287082]
+
+
+def test_errors_are_raised(device):
+    with pytest.raises(NitrokeyError) as error:
+        device.first_authenticate('wrong', ADMIN_TEMP)
+    assert error.value.code == WRONG_PASSWORD
+    device.first_authenticate(ADMIN, ADMIN_TEMP)
+
+
+def test_coroutines(device):
+    async def read_slots():
+        async_device = AsyncDevice(device)
+        try:
+            return await asyncio.gather(async_device.get_hotp_slot_name(1),
+                                        async_device.call('get_serial_number'))
+        finally:
+            async_device.close()
+
+    name, serial = asyncio.run(read_slots())
+    assert name == 'python1'
+    assert serial == device.get_serial_number()
@@ -0,0 +1,246 @@
+#define CATCH_CONFIG_MAIN  // This tells Catch to provide a main()
+#include "catch.hpp"
+#include <unistd.h>
+#include <sys/wait.h>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <streambuf>
+#include <string>
+#include <thread>
+#include <vector>
+#include "log.h"
+
+using namespace nitrokey::log;
+
+static const char *EXIT_CHILD_ENV = "NK_TEST_LOG_EXIT_CHILD";
+static const int EXIT_CHILD_MESSAGES = 500;
+
+/*
+ *	Run instead of the tests in the process started by the "flushed at
+ *	exit" case: queues messages and exits at once, the atexit flush of
+ *	the shared handler has to write them all to stderr.
+ */
+static struct ExitChild {
+  ExitChild() {
+    if (getenv(EXIT_CHILD_ENV) == nullptr) return;
+    Log::instance().set_loglevel(Loglevel::DEBUG);
+    Log::instance().set_async(true);
+    for (int i = 0; i < EXIT_CHILD_MESSAGES; i++)
+      Log::instance()("exit " + std::to_string(i), Loglevel::INFO);
+    exit(0);
+  }
+} exit_child;
+
+/*
+ *	Collects what is written to std::clog while it is set. With hold(),
+ *	the writer of the next character waits until release().
+ */
+class CaptureBuffer : public std::streambuf {
+ public:
+  CaptureBuffer() : m_previous(std::clog.rdbuf(this)) {}
+  ~CaptureBuffer() { std::clog.rdbuf(m_previous); }
+
+  std::string text() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_text;
+  }
+
+  std::vector<std::string> lines() {
+    std::vector<std::string> result;
+    std::istringstream in(text());
+    std::string line;
+    while (std::getline(in, line)) result.push_back(line);
+    return result;
+  }
+
+  void hold() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_held = true;
+  }
+
+  void wait_until_writer_held() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_cv.wait(lock, [this] { return m_writer_waiting; });
+  }
+
+  void release() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_held = false;
+    m_cv.notify_all();
+  }
+
+ protected:
+  virtual int_type overflow(int_type c) {
+    if (c == traits_type::eof()) return traits_type::not_eof(c);
+    const char ch = traits_type::to_char_type(c);
+    xsputn(&ch, 1);
+    return c;
+  }
+
+  virtual std::streamsize xsputn(const char *s, std::streamsize n) {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (m_held) {
+      m_writer_waiting = true;
+      m_cv.notify_all();
+      m_cv.wait(lock, [this] { return !m_held; });
+    }
+    m_text.append(s, n);
+    return n;
+  }
+
+ private:
+  std::streambuf *m_previous;
+  std::mutex m_mutex;
+  std::condition_variable m_cv;
+  std::string m_text;
+  bool m_held = false;
+  bool m_writer_waiting = false;
+};
+
+// text of a line written by a log handler, after the level and the time
+static std::string message_of(const std::string &line) {
+  const size_t tab = line.find('\t');
+  return tab == std::string::npos ? std::string() : line.substr(tab + 1);
+}
+
+TEST_CASE("Messages of each producer are written in order",
+          "[log]") {
+  const int producers = 4;
+  // fits the ring, nothing may be dropped
+  const int messages = AsyncLogHandler::SLOT_COUNT / producers;
+  CaptureBuffer capture;
+  {
+    AsyncLogHandler handler;
+    std::vector<std::thread> threads;
+    for (int p = 0; p < producers; p++)
+      threads.emplace_back([&handler, p, messages] {
+        for (int i = 0; i < messages; i++)
+          handler.print(std::to_string(p) + " " + std::to_string(i),
+                        Loglevel::INFO);
+      });
+    for (auto &thread : threads) thread.join();
+    handler.flush();
+    REQUIRE(handler.get_dropped_count() == 0);
+  }
+
+  std::vector<int> next(producers, 0);
+  for (const auto &line : capture.lines()) {
+    REQUIRE(line.compare(0, 7, "[INFO] ") == 0);
+    int p, i;
+    REQUIRE(sscanf(message_of(line).c_str(), "%d %d", &p, &i) == 2);
+    REQUIRE(p >= 0);
+    REQUIRE(p < producers);
+    REQUIRE(i == next[p]);
+    next[p]++;
+  }
+  for (int p = 0; p < producers; p++) REQUIRE(next[p] == messages);
+}
+
+TEST_CASE("Messages not fitting the full ring are dropped and counted",
+          "[log]") {
+  const size_t extra = 10;
+  CaptureBuffer capture;
+  {
+    AsyncLogHandler handler;
+    capture.hold();
+    handler.print("first", Loglevel::INFO);
+    // the consumer took the first message and is stuck writing it
+    capture.wait_until_writer_held();
+
+    for (size_t i = 0; i < AsyncLogHandler::SLOT_COUNT + extra; i++)
+      handler.print("filler " + std::to_string(i), Loglevel::INFO);
+    REQUIRE(handler.get_dropped_count() == extra);
+
+    // a message of several slots does not fit either
+    handler.print(std::string(AsyncLogHandler::SLOT_TEXT_SIZE * 3, 'x'),
+                  Loglevel::INFO);
+    REQUIRE(handler.get_dropped_count() == extra + 1);
+
+    capture.release();
+    handler.flush();
+  }
+
+  const auto lines = capture.lines();
+  size_t fillers = 0;
+  bool reported = false;
+  for (const auto &line : lines) {
+    const auto message = message_of(line);
+    if (message.compare(0, 7, "filler ") == 0) {
+      REQUIRE(message == "filler " + std::to_string(fillers));
+      fillers++;
+    }
+    if (message == std::to_string(extra + 1) +
+                       " log message(s) dropped, buffer was full")
+      reported = true;
+  }
+  REQUIRE(message_of(lines.front()) == "first");
+  REQUIRE(fillers == AsyncLogHandler::SLOT_COUNT);
+  REQUIRE(reported);
+}
+
+TEST_CASE("Queued messages are flushed when switching back to sync",
+          "[log]") {
+  const int messages = 300;
+  // never destroyed: the thread of the shared handler may still flush
+  // std::clog after set_async returned
+  CaptureBuffer &capture = *new CaptureBuffer;
+  auto &log = Log::instance();
+  log.set_loglevel(Loglevel::DEBUG);
+  log.set_async(true);
+  for (int i = 0; i < messages; i++)
+    log("queued " + std::to_string(i), Loglevel::INFO);
+  log.set_async(false);
+
+  // written before set_async returned
+  auto lines = capture.lines();
+  REQUIRE(lines.size() == (size_t)messages);
+  for (int i = 0; i < messages; i++)
+    REQUIRE(message_of(lines[i]) == "queued " + std::to_string(i));
+
+  // synchronous again
+  log("sync", Loglevel::INFO);
+  lines = capture.lines();
+  REQUIRE(lines.size() == (size_t)messages + 1);
+  REQUIRE(message_of(lines.back()) == "sync");
+  log.set_loglevel(Loglevel::WARNING);
+}
+
+TEST_CASE("Queued messages are flushed at exit", "[log]") {
+  int fds[2];
+  REQUIRE(pipe(fds) == 0);
+  const pid_t pid = fork();
+  REQUIRE(pid >= 0);
+  if (pid == 0) {
+    // a new process, with no handler thread inherited from this one
+    dup2(fds[1], STDERR_FILENO);
+    close(fds[0]);
+    close(fds[1]);
+    setenv(EXIT_CHILD_ENV, "1", 1);
+    execl("/proc/self/exe", "test_log", (char *)nullptr);
+    _exit(127);
+  }
+  close(fds[1]);
+
+  std::string output;
+  char buf[4096];
+  ssize_t n;
+  while ((n = read(fds[0], buf, sizeof buf)) > 0) output.append(buf, n);
+  close(fds[0]);
+  int status;
+  REQUIRE(waitpid(pid, &status, 0) == pid);
+  REQUIRE(WIFEXITED(status));
+  REQUIRE(WEXITSTATUS(status) == 0);
+
+  std::istringstream in(output);
+  std::string line;
+  int i = 0;
+  while (std::getline(in, line)) {
+    REQUIRE(message_of(line) == "exit " + std::to_string(i));
+    i++;
+  }
+  REQUIRE(i == EXIT_CHILD_MESSAGES);
+}
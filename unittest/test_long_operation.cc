@@ -0,0 +1,358 @@
+#define CATCH_CONFIG_MAIN  // This tells Catch to provide a main()
+#include "catch.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "NK_C_API.h"
+#include "NitrokeyManager.h"
+#include "device_emulator.h"
+#include "long_operation.h"
+#include "poller.h"
+#include "misc.h"
+
+using namespace nitrokey;
+using namespace nitrokey::device;
+using namespace nitrokey::proto;
+using namespace std::chrono;
+
+static const uint8_t WRONG_PASSWORD = 4;
+static const size_t CRC_BEGIN = HID_REPORT_SIZE - 4;
+
+/*
+ *	Nitrokey Storage working on its long operations for the given time, on
+ *	the device's clock. Meanwhile it answers every command as busy, with
+ *	the progress. Other commands are answered as by the Pro.
+ */
+class StorageEmulator : public DeviceEmulator {
+ public:
+  StorageEmulator(milliseconds job_duration) : m_job_duration(job_duration) {
+    m_model = DeviceModel::STORAGE;
+  }
+
+  virtual int send(const void *packet) {
+    const uint8_t *request = (const uint8_t *)packet;
+    const auto now = m_clock->now();
+    m_own_response = true;
+    m_command_id = request[1];
+    memcpy(&m_crc, request + CRC_BEGIN, sizeof m_crc);
+    m_status = 0;
+    if (now < m_job_end) return HID_REPORT_SIZE;
+
+    const char *pin = nullptr;
+    const uint8_t *password = request + 2;
+    switch ((CommandID)m_command_id) {
+      case CommandID::FILL_SD_CARD_WITH_RANDOM_CHARS:
+        password++;  // after the volume flag
+        pin = "A12345678";
+        break;
+      case CommandID::GENERATE_NEW_KEYS:
+      case CommandID::EXPORT_FIRMWARE_TO_FILE:
+        pin = "A12345678";
+        break;
+      case CommandID::ENABLE_CRYPTED_PARI:
+        pin = "P123456";
+        break;
+      case CommandID::GET_DEVICE_STATUS:
+        return HID_REPORT_SIZE;
+      default:
+        m_own_response = false;
+        return DeviceEmulator::send(packet);
+    }
+    if (strcmp((const char *)password, pin) != 0) {
+      m_status = WRONG_PASSWORD;
+      return HID_REPORT_SIZE;
+    }
+    m_jobs++;
+    m_job_start = now;
+    m_job_end = now + m_job_duration;
+    return HID_REPORT_SIZE;
+  }
+
+  virtual int recv(void *packet) {
+    if (!m_own_response) return DeviceEmulator::recv(packet);
+    uint8_t *response = (uint8_t *)packet;
+    memset(response, 0, HID_REPORT_SIZE);
+    const auto now = m_clock->now();
+    if (now < m_job_end) {
+      response[1] = STICK20_DEVICE_STATUS_BUSY_PROGRESSBAR;
+      response[8 + STICK20_PROGRESS_BAR_OFFSET] =
+          (uint8_t)((now - m_job_start) * 100 / m_job_duration);
+    } else {
+      response[2] = m_command_id;
+      memcpy(response + 3, &m_crc, sizeof m_crc);
+      response[7] = m_status;
+    }
+    const uint32_t crc = misc::stm_crc32(response + 1, HID_REPORT_SIZE - 5);
+    memcpy(response + CRC_BEGIN, &crc, sizeof crc);
+    return HID_REPORT_SIZE;
+  }
+
+  size_t get_job_count() const { return m_jobs; }
+
+ private:
+  const milliseconds m_job_duration;
+  Clock::time_point m_job_start;
+  Clock::time_point m_job_end;
+  size_t m_jobs = 0;
+
+  bool m_own_response = false;
+  uint8_t m_command_id = 0;
+  uint32_t m_crc = 0;
+  uint8_t m_status = 0;
+};
+
+/*
+ *	As StorageEmulator, with the wait of the Storage before reading a
+ *	response.
+ */
+class SlowStorageEmulator : public StorageEmulator {
+ public:
+  SlowStorageEmulator(milliseconds job_duration)
+      : StorageEmulator(job_duration) {
+    m_send_receive_delay = 300ms;
+  }
+};
+
+static shared_ptr<NitrokeyManager> connect_emulator(shared_ptr<Device> device) {
+  Log::instance().set_loglevel(Loglevel::ERROR);
+  auto manager = NitrokeyManager::create();
+  manager->connect_device(device);
+  return manager;
+}
+
+/*
+ *	Progress passed to the callback of a LongOperation
+ */
+struct Reports {
+  std::mutex mutex;
+  std::vector<LongOperation::Progress> progress;
+
+  LongOperation::Callback callback() {
+    return [this](const LongOperation::Progress &p) {
+      std::lock_guard<std::mutex> lock(mutex);
+      progress.push_back(p);
+    };
+  }
+
+  std::vector<LongOperation::Progress> get() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return progress;
+  }
+};
+
+TEST_CASE("Long operation blocks the device and reports progress",
+          "[long_operation]") {
+  auto clock = make_shared<VirtualClock>();
+  auto emulator = make_shared<StorageEmulator>(10s);
+  emulator->set_clock(clock);
+  auto manager = connect_emulator(emulator);
+
+  REQUIRE(manager->get_progress_bar_value() == -1);
+  REQUIRE(manager->fill_SD_card_with_random_data("12345678"));
+  REQUIRE(emulator->get_job_count() == 1);
+
+  clock->advance(4s);
+  REQUIRE(manager->get_progress_bar_value() == 40);
+  REQUIRE_THROWS_AS(manager->get_HOTP_code(0, ""),
+                    LongOperationInProgressException);
+  uint32_t code;
+  auto status = manager->try_get_HOTP_code(0, "", code);
+  REQUIRE(status.outcome ==
+          TransactionStatus::Outcome::LONG_OPERATION_IN_PROGRESS);
+  REQUIRE(status.progress == 40);
+  REQUIRE(status.to_command_status() == 207);
+
+  clock->advance(6s);
+  REQUIRE(manager->get_progress_bar_value() == -1);
+  REQUIRE(manager->get_user_retry_count() == 3);
+}
+
+TEST_CASE("Long operation with a wrong PIN is not begun", "[long_operation]") {
+  auto emulator = make_shared<StorageEmulator>(10s);
+  auto manager = connect_emulator(emulator);
+
+  REQUIRE_THROWS_AS(manager->create_new_keys("123456"),
+                    CommandFailedException);
+  REQUIRE(emulator->get_last_command_status() == WRONG_PASSWORD);
+  REQUIRE(emulator->get_job_count() == 0);
+  REQUIRE(manager->unlock_encrypted_volume("123456"));
+  REQUIRE(emulator->get_job_count() == 1);
+}
+
+TEST_CASE("LongOperation follows the progress to the end",
+          "[long_operation]") {
+  auto emulator = make_shared<StorageEmulator>(300ms);
+  auto manager = connect_emulator(emulator);
+  Reports reports;
+
+  auto operation = LongOperation::start(
+      manager,
+      [](NitrokeyManager &m) { return m.export_firmware("12345678"); },
+      reports.callback(), 20ms);
+  REQUIRE(operation->wait_for(5s));
+
+  const auto progress = reports.get();
+  REQUIRE(progress.size() >= 3);
+  for (size_t i = 0; i + 1 < progress.size(); i++) {
+    REQUIRE(progress[i].state == LongOperation::State::RUNNING);
+    if (i > 0) REQUIRE(progress[i].percent > progress[i - 1].percent);
+  }
+  REQUIRE(progress.back().state == LongOperation::State::DONE);
+  REQUIRE(progress.back().percent == 100);
+  REQUIRE(progress.back().status == 0);
+  REQUIRE(operation->get_progress().state == LongOperation::State::DONE);
+  REQUIRE(manager->get_progress_bar_value() == -1);
+}
+
+TEST_CASE("LongOperation fails when not begun", "[long_operation]") {
+  auto manager = connect_emulator(make_shared<StorageEmulator>(300ms));
+  Reports reports;
+
+  auto operation = LongOperation::start(
+      manager, [](NitrokeyManager &m) { return m.create_new_keys("wrong"); },
+      reports.callback(), 20ms);
+  REQUIRE(operation->is_finished());
+  const auto progress = reports.get();
+  REQUIRE(progress.size() == 1);
+  REQUIRE(progress[0].state == LongOperation::State::FAILED);
+  REQUIRE(progress[0].status == WRONG_PASSWORD);
+}
+
+TEST_CASE("Cancelled LongOperation stops reporting", "[long_operation]") {
+  auto emulator = make_shared<StorageEmulator>(10s);
+  auto manager = connect_emulator(emulator);
+  Reports reports;
+
+  auto operation = LongOperation::start(
+      manager,
+      [](NitrokeyManager &m) {
+        return m.fill_SD_card_with_random_data("12345678");
+      },
+      reports.callback(), 10ms);
+  REQUIRE_FALSE(operation->wait_for(100ms));
+  operation->cancel();
+  REQUIRE(operation->is_finished());
+  const size_t count = reports.get().size();
+  REQUIRE(reports.get().back().state == LongOperation::State::CANCELLED);
+  REQUIRE(reports.get().back().status ==
+          OperationCancelledException().exception_id());
+
+  const size_t commands = emulator->get_command_count();
+  std::this_thread::sleep_for(50ms);
+  REQUIRE(reports.get().size() == count);
+  REQUIRE(emulator->get_command_count() == commands);
+  // the device goes on
+  REQUIRE(manager->get_progress_bar_value() >= 0);
+}
+
+TEST_CASE("LongOperation polls do not hold up the shared poller",
+          "[long_operation]") {
+  auto manager = connect_emulator(make_shared<SlowStorageEmulator>(10s));
+  auto operation = LongOperation::start(
+      manager,
+      [](NitrokeyManager &m) { return m.export_firmware("12345678"); },
+      nullptr, 10ms);
+  // a poll is in progress
+  std::this_thread::sleep_for(100ms);
+
+  const auto begin = steady_clock::now();
+  std::atomic<bool> called(false);
+  device::Poller::instance().schedule_after(1ms, [&] { called = true; });
+  while (!called) std::this_thread::sleep_for(1ms);
+  REQUIRE(steady_clock::now() - begin < 100ms);
+  operation->cancel();
+}
+
+TEST_CASE("C API completes long operations through the queue",
+          "[long_operation]") {
+  Log::instance().set_loglevel(Loglevel::ERROR);
+  auto device = NK_device_open_object(make_shared<StorageEmulator>(500ms));
+  REQUIRE(device != nullptr);
+  auto queue = NK_queue_create();
+
+  REQUIRE(NK_submit_fill_SD_card_with_random_data(device, queue, 7, "12345678",
+                                                  10) == 0);
+  uint64_t user_data;
+  int operation = 0;
+  uint8_t status;
+  uint32_t code;
+  size_t progress_count = 0;
+  const auto deadline = steady_clock::now() + 5s;
+  while (operation != NK_OP_FILL_SD_CARD && steady_clock::now() < deadline) {
+    if (!NK_queue_reap(queue, &user_data, &operation, &status, &code, nullptr,
+                       0)) {
+      std::this_thread::sleep_for(5ms);
+      continue;
+    }
+    REQUIRE(user_data == 7);
+    if (operation == NK_OP_PROGRESS) {
+      progress_count++;
+      REQUIRE(code < 100);
+    }
+  }
+  REQUIRE(operation == NK_OP_FILL_SD_CARD);
+  REQUIRE(status == 0);
+  REQUIRE(code == 100);
+  REQUIRE(progress_count > 0);
+  REQUIRE(NK_device_get_progress_bar_value(device) == -1);
+
+  // cancelled: completed at once, the device stays busy
+  REQUIRE(NK_submit_create_new_keys(device, queue, 8, "12345678", 10) == 0);
+  while (NK_device_get_progress_bar_value(device) == -1)
+    std::this_thread::sleep_for(5ms);
+  NK_device_cancel_long_operation(device);
+  operation = 0;
+  while (NK_queue_reap(queue, &user_data, &operation, &status, &code, nullptr,
+                       0) &&
+         operation == NK_OP_PROGRESS) {
+  }
+  REQUIRE(operation == NK_OP_CREATE_NEW_KEYS);
+  REQUIRE(status == 205);
+  REQUIRE(NK_device_get_progress_bar_value(device) >= 0);
+  NK_device_get_hotp_code_PIN(device, 0, "");
+  REQUIRE(NK_device_get_last_command_status(device) == 207);
+
+  NK_queue_destroy(queue);
+  NK_device_close(device);
+}
+
+TEST_CASE("C API refuses secrets not fitting their submission buffer",
+          "[long_operation]") {
+  Log::instance().set_loglevel(Loglevel::ERROR);
+  auto device = NK_device_open_object(make_shared<DeviceEmulator>());
+  REQUIRE(device != nullptr);
+  auto queue = NK_queue_create();
+  REQUIRE(NK_device_first_authenticate(device, "12345678", "123123123") == 0);
+
+  const std::string long_secret(128, 'a');
+  REQUIRE(NK_submit_write_hotp_slot(device, queue, 1, 1, "name",
+                                    long_secret.c_str(), 0, false, false,
+                                    false, "", "123123123") == -1);
+  REQUIRE(NK_submit_create_new_keys(device, queue, 2, long_secret.c_str(),
+                                    10) == -1);
+  REQUIRE(NK_submit_write_hotp_slot(device, queue, 3, 1, "name",
+                                    long_secret.c_str() + 1, 0, false, false,
+                                    false, "", nullptr) == 0);
+  REQUIRE(NK_submit_write_hotp_slot(device, queue, 4, 1, "name", "00112233",
+                                    0, false, false, false, "",
+                                    "123123123") == 0);
+
+  uint64_t user_data = 0;
+  int operation;
+  uint8_t status;
+  uint32_t code;
+  const auto deadline = steady_clock::now() + 5s;
+  while (user_data != 4 && steady_clock::now() < deadline)
+    if (!NK_queue_reap(queue, &user_data, &operation, &status, &code, nullptr,
+                       0))
+      std::this_thread::sleep_for(5ms);
+  REQUIRE(user_data == 4);
+  REQUIRE(operation == NK_OP_WRITE_HOTP_SLOT);
+  REQUIRE(status == 0);
+
+  NK_queue_destroy(queue);
+  NK_device_close(device);
+}
@@ -0,0 +1,209 @@
+#define CATCH_CONFIG_MAIN  // This tells Catch to provide a main()
+#include "catch.hpp"
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <future>
+#include <string>
+#include <thread>
+#include <vector>
+#include "CommandFailedException.h"
+#include "NK_C_API.h"
+#include "NitrokeyManager.h"
+#include "device_emulator.h"
+#include "proxy_protocol.h"
+#include "proxy_server.h"
+#include "remote_device.h"
+
+using namespace nitrokey;
+using namespace nitrokey::device;
+using namespace std::chrono;
+
+/*
+ *	Emulator answering after the given time, polled every 100 us.
+ */
+class TimedDeviceEmulator : public DeviceEmulator {
+ public:
+  TimedDeviceEmulator(milliseconds processing_time) {
+    m_send_receive_delay = 0ms;
+    m_retry_policy = RetryPolicy::fixed(1000000, 0ms).spinning(10s, 100us);
+    set_processing_time(processing_time);
+  }
+};
+
+static shared_ptr<NitrokeyManager> connect_device(shared_ptr<Device> device) {
+  Log::instance().set_loglevel(Loglevel::ERROR);
+  auto manager = NitrokeyManager::create();
+  REQUIRE(manager->connect_device(device));
+  return manager;
+}
+
+static shared_ptr<NitrokeyManager> connect_remote(ProxyServer &server) {
+  auto connection = RemoteConnection::connect("127.0.0.1", server.get_port());
+  REQUIRE(connection != nullptr);
+  return connect_device(make_shared<RemoteDevice>(connection));
+}
+
+// the name is allocated for the caller
+static std::string hotp_slot_name(NitrokeyManager &manager, uint8_t slot) {
+  const char *name = manager.get_hotp_slot_name(slot);
+  std::string result(name);
+  free((void *)name);
+  return result;
+}
+
+TEST_CASE("Remote device works as the local one", "[proxy]") {
+  auto local = connect_device(make_shared<TimedDeviceEmulator>(0ms));
+  ProxyServer server(local);
+  REQUIRE(server.start("127.0.0.1", 0));
+  auto remote = connect_remote(server);
+
+  REQUIRE(remote->get_serial_number() == local->get_serial_number());
+  REQUIRE(remote->get_admin_retry_count() == 3);
+
+  // authorized commands
+  REQUIRE(remote->first_authenticate("12345678", "123123123"));
+  REQUIRE(remote->write_HOTP_slot(1, "remote", "00112233", 0, false, false,
+                                  false, "", "123123123"));
+  REQUIRE(hotp_slot_name(*local, 1) == "remote");
+
+  // failures of the device are the same
+  REQUIRE_THROWS_AS(remote->first_authenticate("wrong", "123123123"),
+                    CommandFailedException);
+  REQUIRE(local->get_admin_retry_count() == 2);
+
+  server.stop();
+  REQUIRE_THROWS(remote->get_serial_number());
+  auto stats = server.get_stats();
+  REQUIRE(stats.failed == 0);
+}
+
+TEST_CASE("Requests of several clients are in flight at once", "[proxy]") {
+  auto device = make_shared<TimedDeviceEmulator>(2ms);
+  auto local = connect_device(device);
+  ProxyServer server(local);
+  REQUIRE(server.start("127.0.0.1", 0));
+
+  auto connection = RemoteConnection::connect("127.0.0.1", server.get_port());
+  const auto serial = local->get_serial_number();
+  const size_t clients = 4, calls = 20;
+  std::vector<std::thread> threads;
+  std::atomic<size_t> correct(0);
+  for (size_t i = 0; i < clients; i++) {
+    threads.emplace_back([&] {
+      auto remote = connect_device(make_shared<RemoteDevice>(connection));
+      for (size_t c = 0; c < calls; c++)
+        if (remote->get_serial_number() == serial) correct++;
+    });
+  }
+  for (auto &t : threads) t.join();
+  REQUIRE(correct == clients * calls);
+
+  auto stats = server.get_stats();
+  REQUIRE(stats.requests == clients * (calls + 1));  // with INFO
+  REQUIRE(stats.max_queued > 1);
+}
+
+/*
+ *	GET_STATUS report, as sent by RemoteDevice.
+ */
+static std::vector<uint8_t> status_packet() {
+  typedef proto::stick10::GetStatus::CommandTransaction::OutgoingPacket Packet;
+  Packet packet;
+  packet.initialize();
+  packet.update_CRC();
+  const uint8_t *bytes = (const uint8_t *)&packet;
+  return std::vector<uint8_t>(bytes, bytes + sizeof packet);
+}
+
+static bool answered_within(std::future<RemoteConnection::Response> &response,
+                            milliseconds timeout) {
+  return response.wait_for(timeout) == std::future_status::ready;
+}
+
+TEST_CASE("Operations of a client are not split by other clients",
+          "[proxy]") {
+  using proxy::RequestType;
+  using proxy::ResponseStatus;
+  auto local = connect_device(make_shared<TimedDeviceEmulator>(0ms));
+  ProxyServer server(local);
+  REQUIRE(server.start("127.0.0.1", 0));
+  auto holder = RemoteConnection::connect("127.0.0.1", server.get_port());
+  auto other = RemoteConnection::connect("127.0.0.1", server.get_port());
+  const auto packet = status_packet();
+
+  auto held = holder->submit(RequestType::BEGIN, nullptr, 0);
+  REQUIRE(held.get().status == ResponseStatus::OK);
+  auto waiting = other->submit(RequestType::EXCHANGE, packet.data(),
+                               HID_REPORT_SIZE);
+  auto second_begin = other->submit(RequestType::BEGIN, nullptr, 0);
+  auto own = holder->submit(RequestType::EXCHANGE, packet.data(),
+                            HID_REPORT_SIZE);
+  REQUIRE(own.get().status == ResponseStatus::OK);
+  REQUIRE_FALSE(answered_within(waiting, 100ms));
+  holder->submit(RequestType::END, nullptr, 0);
+  REQUIRE(answered_within(waiting, 1000ms));
+  REQUIRE(waiting.get().status == ResponseStatus::OK);
+  REQUIRE(second_begin.get().status == ResponseStatus::OK);
+
+  // a closed connection ends its hold
+  auto third = RemoteConnection::connect("127.0.0.1", server.get_port());
+  auto after_close = third->submit(RequestType::EXCHANGE, packet.data(),
+                                   HID_REPORT_SIZE);
+  REQUIRE_FALSE(answered_within(after_close, 100ms));
+  other.reset();
+  REQUIRE(answered_within(after_close, 1000ms));
+
+  // sessions sharing a connection are held apart
+  const uint32_t first = third->new_session();
+  const uint32_t second = third->new_session();
+  REQUIRE(first != second);
+  held = third->submit(RequestType::BEGIN, nullptr, 0, first);
+  REQUIRE(held.get().status == ResponseStatus::OK);
+  waiting = third->submit(RequestType::EXCHANGE, packet.data(),
+                          HID_REPORT_SIZE, second);
+  own = third->submit(RequestType::EXCHANGE, packet.data(), HID_REPORT_SIZE,
+                      first);
+  REQUIRE(own.get().status == ResponseStatus::OK);
+  REQUIRE_FALSE(answered_within(waiting, 100ms));
+  third->submit(RequestType::END, nullptr, 0, first);
+  REQUIRE(answered_within(waiting, 1000ms));
+  REQUIRE(waiting.get().status == ResponseStatus::OK);
+
+  // managers hold the device for each of their operations
+  auto remote = connect_remote(server);
+  REQUIRE(remote->first_authenticate("12345678", "123123123"));
+  REQUIRE(remote->write_HOTP_slot(1, "held", "00112233", 0, false, false,
+                                  false, "", "123123123"));
+  REQUIRE(hotp_slot_name(*local, 1) == "held");
+  REQUIRE(server.get_stats().failed == 0);
+}
+
+TEST_CASE("Proxy without device is reported", "[proxy]") {
+  auto manager = NitrokeyManager::create();
+  ProxyServer server(manager);
+  REQUIRE(server.start("127.0.0.1", 0));
+  auto connection = RemoteConnection::connect("127.0.0.1", server.get_port());
+  RemoteDevice device(connection);
+  REQUIRE_FALSE(device.connect());
+  REQUIRE(RemoteConnection::connect("127.0.0.1", 1) == nullptr);
+}
+
+TEST_CASE("C API serves devices to other hosts", "[proxy]") {
+  auto local = NK_device_open_object(make_shared<TimedDeviceEmulator>(0ms));
+  REQUIRE(local != nullptr);
+  const int port = NK_device_start_proxy(local, "127.0.0.1", 0);
+  REQUIRE(port > 0);
+
+  auto remote = NK_device_open_remote("localhost", (uint16_t)port);
+  REQUIRE(remote != nullptr);
+  char local_serial[32], remote_serial[32];
+  REQUIRE(NK_device_get_serial_number_buf(local, local_serial,
+                                          sizeof local_serial) == 0);
+  REQUIRE(NK_device_get_serial_number_buf(remote, remote_serial,
+                                          sizeof remote_serial) == 0);
+  REQUIRE(strcmp(local_serial, remote_serial) == 0);
+
+  NK_device_close(remote);
+  NK_device_close(local);
+}
@@ -0,0 +1,177 @@
+#define CATCH_CONFIG_MAIN  // This tells Catch to provide a main()
+#include "catch.hpp"
+#include <chrono>
+#include <cstddef>
+#include <cstring>
+#include "NK_C_API.h"
+#include "NitrokeyManager.h"
+#include "device_emulator.h"
+#include "misc.h"
+
+using namespace nitrokey;
+using namespace nitrokey::device;
+using namespace nitrokey::proto;
+using namespace std::chrono;
+
+typedef stick20::GetDeviceStatus::ResponsePayload StatusPayload;
+
+static const size_t CRC_BEGIN = HID_REPORT_SIZE - 4;
+
+/*
+ *	Status of a Storage 0.49 with the encrypted volume unlocked.
+ */
+static StatusPayload make_status() {
+  StatusPayload status;
+  memset(&status, 0, sizeof status);
+  status.magic_number_stick_config = 0x3334;
+  status.read_write_flag_uncrypted_volume = 0;
+  status.read_write_flag_crypted_volume = 1;
+  status.read_write_flag_hidden_volume = 1;
+  status.version_info[1] = 49;
+  status.version_info[3] = 0;
+  status.new_sd_card_found = 0x01 | (2 << 1);
+  status.sd_fill_with_random_chars = 0x01;
+  status.active_sd_card_id = 0x12345678;
+  status.volume_active_flag = 0x03;
+  status.user_password_retry_count = 3;
+  status.admin_password_retry_count = 2;
+  status.active_smart_card_id = 0xCAFE;
+  return status;
+}
+
+/*
+ *	Nitrokey Storage answering GetDeviceStatus with make_status(); other
+ *	commands are answered as by the Pro.
+ */
+class StorageStatusEmulator : public DeviceEmulator {
+ public:
+  StorageStatusEmulator() { m_model = DeviceModel::STORAGE; }
+
+  virtual int send(const void *packet) {
+    const uint8_t *request = (const uint8_t *)packet;
+    m_status_query = request[1] == (uint8_t)CommandID::GET_DEVICE_STATUS;
+    if (!m_status_query) return DeviceEmulator::send(packet);
+    m_status_queries++;
+    memset(m_response, 0, sizeof m_response);
+    m_response[2] = request[1];
+    memcpy(m_response + 3, request + CRC_BEGIN, 4);
+    const auto status = make_status();
+    memcpy(m_response + 8, &status, sizeof status);
+    const uint32_t crc = misc::stm_crc32(m_response + 1, HID_REPORT_SIZE - 5);
+    memcpy(m_response + CRC_BEGIN, &crc, sizeof crc);
+    return HID_REPORT_SIZE;
+  }
+
+  virtual int recv(void *packet) {
+    if (!m_status_query) return DeviceEmulator::recv(packet);
+    memcpy(packet, m_response, HID_REPORT_SIZE);
+    return HID_REPORT_SIZE;
+  }
+
+  size_t get_status_queries() const { return m_status_queries; }
+
+ private:
+  bool m_status_query = false;
+  size_t m_status_queries = 0;
+  uint8_t m_response[HID_REPORT_SIZE];
+};
+
+TEST_CASE("Storage status fields are at the places of the firmware",
+          "[storage_status]") {
+  // from the 21st byte of the packet, the 13th of the payload
+  REQUIRE(offsetof(StatusPayload, command_counter) == 13);
+  REQUIRE(offsetof(StatusPayload, magic_number_stick_config) == 17);
+  REQUIRE(offsetof(StatusPayload, version_info) == 21);
+  REQUIRE(offsetof(StatusPayload, active_sd_card_id) == 29);
+  REQUIRE(offsetof(StatusPayload, volume_active_flag) == 33);
+  REQUIRE(offsetof(StatusPayload, active_smart_card_id) == 37);
+  REQUIRE(sizeof(StatusPayload) == 42);
+}
+
+TEST_CASE("Storage status is decoded", "[storage_status]") {
+  const auto status = StorageStatus::decode(make_status());
+  REQUIRE(status.unencrypted_volume.active);
+  REQUIRE(status.unencrypted_volume.read_only);
+  REQUIRE(status.encrypted_volume.active);
+  REQUIRE_FALSE(status.encrypted_volume.read_only);
+  REQUIRE_FALSE(status.hidden_volume.active);
+  REQUIRE(status.firmware_version_major == 0);
+  REQUIRE(status.firmware_version_minor == 49);
+  REQUIRE_FALSE(status.firmware_locked);
+  REQUIRE(status.sd_card_id == 0x12345678);
+  REQUIRE(status.new_sd_card_found);
+  REQUIRE(status.sd_card_filled_with_random_data);
+  REQUIRE(status.smart_card_id == 0xCAFE);
+  REQUIRE_FALSE(status.new_smart_card_found);
+  REQUIRE(status.keys_initialized);
+  REQUIRE(status.user_retry_count == 3);
+  REQUIRE(status.admin_retry_count == 2);
+}
+
+TEST_CASE("Storage status snapshot is reused for its TTL",
+          "[storage_status]") {
+  Log::instance().set_loglevel(Loglevel::ERROR);
+  auto clock = make_shared<VirtualClock>();
+  auto emulator = make_shared<StorageStatusEmulator>();
+  emulator->set_clock(clock);
+  auto manager = NitrokeyManager::create();
+  manager->connect_device(emulator);
+
+  REQUIRE(manager->get_storage_status().sd_card_id == 0x12345678);
+  REQUIRE(emulator->get_status_queries() == 1);
+  clock->advance(900ms);
+  REQUIRE(manager->get_storage_status().sd_card_id == 0x12345678);
+  REQUIRE(emulator->get_status_queries() == 1);
+  clock->advance(100ms);
+  manager->get_storage_status();
+  REQUIRE(emulator->get_status_queries() == 2);
+
+  // changed by the manager
+  manager->lock_device();
+  manager->get_storage_status();
+  REQUIRE(emulator->get_status_queries() == 3);
+  // other calls keep it
+  manager->get_admin_retry_count();
+  manager->get_storage_status();
+  REQUIRE(emulator->get_status_queries() == 3);
+
+  manager->set_storage_status_ttl(0ms);
+  manager->get_storage_status();
+  manager->get_storage_status();
+  REQUIRE(emulator->get_status_queries() == 5);
+
+  // snapshots are of the device
+  manager->set_storage_status_ttl(10s);
+  auto other = make_shared<StorageStatusEmulator>();
+  other->set_clock(clock);
+  manager->connect_device(other);
+  manager->get_storage_status();
+  REQUIRE(other->get_status_queries() == 1);
+}
+
+TEST_CASE("C API fills the storage status", "[storage_status]") {
+  Log::instance().set_loglevel(Loglevel::ERROR);
+  auto emulator = make_shared<StorageStatusEmulator>();
+  auto device = NK_device_open_object(emulator);
+  REQUIRE(device != nullptr);
+
+  NK_storage_status status;
+  memset(&status, 0, sizeof status);
+  REQUIRE(NK_device_get_storage_status(device, &status) == 0);
+  REQUIRE(status.encrypted_volume_active);
+  REQUIRE_FALSE(status.encrypted_volume_read_only);
+  REQUIRE(status.unencrypted_volume_read_only);
+  REQUIRE(status.firmware_version_minor == 49);
+  REQUIRE(status.serial_number_sd_card == 0x12345678);
+  REQUIRE(status.serial_number_smart_card == 0xCAFE);
+  REQUIRE(status.admin_retry_count == 2);
+  REQUIRE(status.filled_with_random);
+  REQUIRE(status.stick_initialized);
+
+  REQUIRE(NK_device_get_storage_status(device, &status) == 0);
+  REQUIRE(emulator->get_status_queries() == 1);
+  NK_device_set_storage_status_ttl(device, 0);
+  REQUIRE(NK_device_get_storage_status(device, &status) == 0);
+  REQUIRE(emulator->get_status_queries() == 2);
+  NK_device_close(device);
+}
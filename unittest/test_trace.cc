@@ -0,0 +1,215 @@
+#define CATCH_CONFIG_MAIN  // This tells Catch to provide a main()
+#include "catch.hpp"
+#include <cctype>
+#include <chrono>
+#include <cstdlib>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+#include "NK_C_API.h"
+#include "NitrokeyManager.h"
+#include "device_emulator.h"
+#include "trace.h"
+
+using namespace nitrokey;
+using namespace nitrokey::device;
+using namespace std::chrono;
+
+/*
+ *	Strict reader of the JSON subset written by the tracer: objects,
+ *	arrays, strings and non-negative integers. Any other text fails.
+ */
+struct JsonValue {
+  enum class Type { NUMBER, STRING, ARRAY, OBJECT } type;
+  uint64_t number = 0;
+  std::string string;
+  std::vector<JsonValue> array;
+  std::map<std::string, JsonValue> object;
+
+  const JsonValue &operator[](const char *key) const {
+    static const JsonValue missing{Type::OBJECT};
+    auto it = object.find(key);
+    return it == object.end() ? missing : it->second;
+  }
+  bool has(const char *key) const { return object.count(key) > 0; }
+};
+
+class JsonReader {
+ public:
+  explicit JsonReader(const std::string &text) : m_text(text), m_pos(0) {}
+
+  // whole text as one value, false if not well-formed
+  bool read(JsonValue &value) {
+    if (!value_at(value)) return false;
+    skip_space();
+    return m_pos == m_text.size();
+  }
+
+ private:
+  void skip_space() {
+    while (m_pos < m_text.size() && isspace((unsigned char)m_text[m_pos]))
+      m_pos++;
+  }
+
+  bool take(char c) {
+    skip_space();
+    if (m_pos >= m_text.size() || m_text[m_pos] != c) return false;
+    m_pos++;
+    return true;
+  }
+
+  bool string_at(std::string &s) {
+    if (!take('"')) return false;
+    while (m_pos < m_text.size()) {
+      char c = m_text[m_pos++];
+      if (c == '"') return true;
+      if ((unsigned char)c < 0x20) return false;
+      if (c == '\\') {
+        if (m_pos >= m_text.size()) return false;
+        c = m_text[m_pos++];
+        if (c != '"' && c != '\\') return false;
+      }
+      s += c;
+    }
+    return false;
+  }
+
+  bool value_at(JsonValue &value) {
+    skip_space();
+    if (m_pos >= m_text.size()) return false;
+    const char c = m_text[m_pos];
+    if (c == '"') {
+      value.type = JsonValue::Type::STRING;
+      return string_at(value.string);
+    }
+    if (c == '[') {
+      value.type = JsonValue::Type::ARRAY;
+      m_pos++;
+      if (take(']')) return true;
+      do {
+        value.array.emplace_back();
+        if (!value_at(value.array.back())) return false;
+      } while (take(','));
+      return take(']');
+    }
+    if (c == '{') {
+      value.type = JsonValue::Type::OBJECT;
+      m_pos++;
+      if (take('}')) return true;
+      do {
+        std::string key;
+        if (!string_at(key) || !take(':')) return false;
+        if (value.object.count(key) > 0) return false;
+        if (!value_at(value.object[key])) return false;
+      } while (take(','));
+      return take('}');
+    }
+    if (!isdigit((unsigned char)c)) return false;
+    value.type = JsonValue::Type::NUMBER;
+    while (m_pos < m_text.size() && isdigit((unsigned char)m_text[m_pos]))
+      value.number = value.number * 10 + (m_text[m_pos++] - '0');
+    return true;
+  }
+
+  const std::string &m_text;
+  size_t m_pos;
+};
+
+// events of NK_get_trace_json(), checked to be complete events
+static std::vector<JsonValue> get_trace_events() {
+  const char *json = NK_get_trace_json();
+  REQUIRE(json != nullptr);
+  const std::string text(json);
+  free((void *)json);
+
+  JsonValue root;
+  REQUIRE(JsonReader(text).read(root));
+  REQUIRE(root.type == JsonValue::Type::OBJECT);
+  REQUIRE(root["displayTimeUnit"].string == "ms");
+  const auto &events = root["traceEvents"];
+  REQUIRE(events.type == JsonValue::Type::ARRAY);
+  for (const auto &e : events.array) {
+    REQUIRE(e["ph"].string == "X");
+    REQUIRE(e["name"].type == JsonValue::Type::STRING);
+    REQUIRE(e["cat"].type == JsonValue::Type::STRING);
+    REQUIRE(e["ts"].type == JsonValue::Type::NUMBER);
+    REQUIRE(e["dur"].type == JsonValue::Type::NUMBER);
+    REQUIRE(e["pid"].type == JsonValue::Type::NUMBER);
+    REQUIRE(e["tid"].type == JsonValue::Type::NUMBER);
+  }
+  return events.array;
+}
+
+TEST_CASE("Nested spans are dumped as complete events", "[trace]") {
+  NK_set_tracing(true);
+  NK_clear_trace();
+  {
+    trace::Span outer("test", "outer \"quoted\\\"");
+    std::this_thread::sleep_for(2ms);
+    {
+      trace::Span inner("test", "inner", 7);
+      std::this_thread::sleep_for(5ms);
+    }
+    std::this_thread::sleep_for(2ms);
+  }
+  NK_set_tracing(false);
+  {
+    trace::Span ignored("test", "disabled");
+  }
+
+  const auto events = get_trace_events();
+  REQUIRE(events.size() == 2);
+  // recorded as they end
+  const auto &inner = events[0];
+  const auto &outer = events[1];
+  REQUIRE(inner["name"].string == "inner");
+  REQUIRE(outer["name"].string == "outer \"quoted\\\"");
+  REQUIRE(inner["cat"].string == "test");
+  REQUIRE(inner["args"]["arg"].number == 7);
+  REQUIRE_FALSE(outer.has("args"));
+  REQUIRE(inner["tid"].number == outer["tid"].number);
+
+  REQUIRE(inner["dur"].number >= 5000);
+  REQUIRE(outer["dur"].number >= 9000);
+  REQUIRE(outer["ts"].number + 2000 <= inner["ts"].number);
+  REQUIRE(inner["ts"].number + inner["dur"].number + 2000 <=
+          outer["ts"].number + outer["dur"].number);
+}
+
+TEST_CASE("Trace keeps the last spans once the ring wraps", "[trace]") {
+  const size_t extra = 10;
+  auto &tracer = trace::Tracer::instance();
+  NK_clear_trace();
+  for (size_t i = 0; i < trace::Tracer::CAPACITY + extra; i++)
+    tracer.record("test", "ring", i, 1, i);
+
+  const auto events = get_trace_events();
+  REQUIRE(events.size() == trace::Tracer::CAPACITY);
+  for (size_t i = 0; i < events.size(); i++) {
+    REQUIRE(events[i]["ts"].number == i + extra);
+    REQUIRE(events[i]["args"]["arg"].number == i + extra);
+  }
+
+  NK_clear_trace();
+  REQUIRE(get_trace_events().empty());
+}
+
+TEST_CASE("Device exchanges are traced", "[trace]") {
+  Log::instance().set_loglevel(Loglevel::ERROR);
+  auto manager = NitrokeyManager::create();
+  manager->connect_device(make_shared<DeviceEmulator>());
+  NK_set_tracing(true);
+  NK_clear_trace();
+  manager->get_status();
+  NK_set_tracing(false);
+
+  const auto events = get_trace_events();
+  REQUIRE_FALSE(events.empty());
+  bool recv = false;
+  for (const auto &e : events) {
+    if (e["cat"].string == "transaction" && e["name"].string == "recv")
+      recv = true;
+  }
+  REQUIRE(recv);
+}
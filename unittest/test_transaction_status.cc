@@ -0,0 +1,167 @@
+#define CATCH_CONFIG_MAIN  // This tells Catch to provide a main()
+#include "catch.hpp"
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+#include "NK_C_API.h"
+#include "NitrokeyManager.h"
+#include "device_emulator.h"
+
+using namespace nitrokey;
+using namespace nitrokey::device;
+using namespace std::chrono;
+
+typedef TransactionStatus::Outcome Outcome;
+
+static const uint8_t SLOT_NOT_PROGRAMMED = 3;
+
+/*
+ *	Emulator which takes the given time for each command.
+ */
+class SlowDeviceEmulator : public DeviceEmulator {
+ public:
+  SlowDeviceEmulator(milliseconds processing_time) {
+    m_send_receive_delay = 10ms;
+    m_retry_policy = RetryPolicy::fixed(5, 10ms);
+    set_processing_time(processing_time);
+  }
+};
+
+/*
+ *	Emulator of which receiving fails.
+ */
+class BrokenDeviceEmulator : public DeviceEmulator {
+ public:
+  virtual int recv(void *packet) {
+    DeviceEmulator::recv(packet);
+    return -1;
+  }
+};
+
+static shared_ptr<NitrokeyManager> connect_emulator(shared_ptr<Device> device) {
+  Log::instance().set_loglevel(Loglevel::ERROR);
+  auto manager = NitrokeyManager::create();
+  manager->connect_device(device);
+  return manager;
+}
+
+TEST_CASE("Refused commands are returned, not thrown", "[transaction_status]") {
+  auto manager = connect_emulator(make_shared<DeviceEmulator>());
+
+  char name[16] = "untouched";
+  auto status = manager->try_get_hotp_slot_name(1, name, sizeof name);
+  REQUIRE_FALSE(status);
+  REQUIRE(status.outcome == Outcome::COMMAND_FAILED);
+  REQUIRE(status.last_command_status == SLOT_NOT_PROGRAMMED);
+  REQUIRE(status.to_command_status() == SLOT_NOT_PROGRAMMED);
+  REQUIRE(std::string(name) == "untouched");
+  REQUIRE_THROWS_AS(status.raise(), CommandFailedException);
+
+  uint32_t code = 42;
+  status = manager->try_get_HOTP_code(1, "", code);
+  REQUIRE(status.outcome == Outcome::COMMAND_FAILED);
+  REQUIRE(code == 42);
+
+  // wrong temporary password: the authorization is refused
+  status = manager->try_get_HOTP_code(1, "123123123", code);
+  REQUIRE(status.outcome == Outcome::COMMAND_FAILED);
+  REQUIRE(code == 42);
+
+  REQUIRE(manager->first_authenticate("12345678", "123123123"));
+  REQUIRE(manager->write_HOTP_slot(1, "name", "00112233", 7, false, false,
+                                   false, "", "123123123"));
+  status = manager->try_get_hotp_slot_name(1, name, sizeof name);
+  REQUIRE(status);
+  REQUIRE(status.outcome == Outcome::OK);
+  REQUIRE(std::string(name) == "name");
+  REQUIRE(manager->try_get_HOTP_code(1, "", code));
+  REQUIRE(code == 7);
+
+  REQUIRE(manager->try_get_totp_slot_name(0, name, sizeof name).last_command_status ==
+          SLOT_NOT_PROGRAMMED);
+  REQUIRE(manager->try_get_TOTP_code(0, 0, 0, 30, "", code).outcome ==
+          Outcome::COMMAND_FAILED);
+
+  // misuse still throws
+  REQUIRE_THROWS_AS(manager->try_get_hotp_slot_name(3, name, sizeof name),
+                    InvalidSlotException);
+  REQUIRE_THROWS_AS(manager->try_get_hotp_slot_name(1, name, 2),
+                    TargetBufferSmallerThanSource);
+}
+
+TEST_CASE("Transaction::try_run reports failures of the exchange",
+          "[transaction_status]") {
+  Log::instance().set_loglevel(Loglevel::ERROR);
+  SECTION("no response within the RetryPolicy") {
+    auto clock = make_shared<VirtualClock>();
+    SlowDeviceEmulator device(1h);
+    device.set_clock(clock);
+    REQUIRE(device.connect());
+
+    GetStatus::CommandTransaction::ResponsePayload response;
+    auto status = GetStatus::CommandTransaction::try_run(
+        device, GetStatus::CommandTransaction::CommandPayload(), response);
+    REQUIRE(status.outcome == Outcome::NO_RESPONSE);
+    REQUIRE(status.command_id == (uint8_t)CommandID::GET_STATUS);
+    REQUIRE_THROWS_AS(status.raise(), std::runtime_error);
+    // the exchange is ended
+    REQUIRE(device.get_exchange_count() == 1);
+  }
+
+  SECTION("device error") {
+    BrokenDeviceEmulator device;
+    REQUIRE(device.connect());
+
+    GetStatus::CommandTransaction::ResponsePayload response;
+    auto status = GetStatus::CommandTransaction::try_run(
+        device, GetStatus::CommandTransaction::CommandPayload(), response);
+    REQUIRE(status.outcome == Outcome::RECEIVE_FAILED);
+    REQUIRE(status.device_result == -1);
+    REQUIRE_THROWS_AS(status.raise(), std::runtime_error);
+    REQUIRE(status.to_command_status() == NK_OP_STATUS_DEVICE_ERROR);
+  }
+
+  SECTION("operation limits") {
+    auto clock = make_shared<VirtualClock>();
+    auto device = make_shared<SlowDeviceEmulator>(1h);
+    device->set_clock(clock);
+    device->set_retry_policy(RetryPolicy::fixed(1000000, 10ms));
+    auto manager = connect_emulator(device);
+
+    manager->set_timeout(500ms);
+    char name[16];
+    auto status = manager->try_get_hotp_slot_name(0, name, sizeof name);
+    REQUIRE(status.outcome == Outcome::DEADLINE_EXCEEDED);
+    REQUIRE(status.to_command_status() ==
+            DeadlineExceededException().exception_id());
+    REQUIRE(clock->elapsed() == 500ms);
+  }
+}
+
+TEST_CASE("C API reads slots through the status path", "[transaction_status]") {
+  Log::instance().set_loglevel(Loglevel::ERROR);
+  auto device = NK_device_open_object(make_shared<DeviceEmulator>());
+  REQUIRE(device != nullptr);
+
+  char name[NK_SLOT_NAME_BUFFER_SIZE];
+  memset(name, 'x', sizeof name);
+  REQUIRE(NK_device_get_hotp_slot_name_buf(device, 0, name, sizeof name) ==
+          SLOT_NOT_PROGRAMMED);
+  REQUIRE(name[0] == 0);
+  REQUIRE(NK_device_get_last_command_status(device) == SLOT_NOT_PROGRAMMED);
+
+  REQUIRE(NK_device_get_hotp_code_PIN(device, 0, "") == 0);
+  REQUIRE(NK_device_get_last_command_status(device) == SLOT_NOT_PROGRAMMED);
+
+  REQUIRE(NK_device_get_hotp_slot_name_buf(device, 9, name, sizeof name) ==
+          InvalidSlotException(9).exception_id());
+
+  REQUIRE(NK_device_first_authenticate(device, "12345678", "123123123") == 0);
+  REQUIRE(NK_device_write_hotp_slot(device, 0, "slot", "00112233", 3, false,
+                                    false, false, "", "123123123") == 0);
+  REQUIRE(NK_device_get_hotp_slot_name_buf(device, 0, name, sizeof name) == 0);
+  REQUIRE(std::string(name) == "slot");
+  REQUIRE(NK_device_get_hotp_code_PIN(device, 0, "") == 3);
+  REQUIRE(NK_device_get_last_command_status(device) == 0);
+  NK_device_close(device);
+}
@@ -0,0 +1,153 @@
+#define CATCH_CONFIG_MAIN  // This tells Catch to provide a main()
+#include "catch.hpp"
+#include <chrono>
+#include "NitrokeyManager.h"
+#include "device_emulator.h"
+
+using namespace nitrokey;
+using namespace nitrokey::device;
+using namespace std::chrono;
+
+/*
+ *	Emulator with the waits of Stick10 and the given processing time.
+ */
+class TimedDeviceEmulator : public DeviceEmulator {
+ public:
+  TimedDeviceEmulator(milliseconds processing_time) {
+    m_send_receive_delay = 100ms;
+    m_retry_policy = RetryPolicy::fixed(100, 100ms);
+    set_processing_time(processing_time);
+  }
+};
+
+static shared_ptr<NitrokeyManager> connect_emulator(
+    shared_ptr<Device> device, shared_ptr<VirtualClock> clock) {
+  Log::instance().set_loglevel(Loglevel::ERROR);
+  device->set_clock(clock);
+  auto manager = NitrokeyManager::create();
+  manager->connect_device(device);
+  return manager;
+}
+
+TEST_CASE("Virtual time makes transaction waits instant", "[virtual_time]") {
+  auto clock = make_shared<VirtualClock>();
+  auto device = make_shared<TimedDeviceEmulator>(350ms);
+  auto manager = connect_emulator(device, clock);
+
+  const size_t count = 1000;
+  const auto begin = steady_clock::now();
+  for (size_t i = 0; i < count; i++) manager->get_serial_number();
+  const auto wall_time = steady_clock::now() - begin;
+
+  // per transaction: 100 ms delay, busy at 100, 200 and 300 ms, ready at 400
+  REQUIRE(clock->elapsed() == count * 400ms);
+  REQUIRE(device->get_command_count() == count);
+  REQUIRE(wall_time < 10s);
+}
+
+TEST_CASE("Busy device exhausts the retries in virtual time",
+          "[virtual_time]") {
+  auto clock = make_shared<VirtualClock>();
+  auto device = make_shared<TimedDeviceEmulator>(1h);
+  auto manager = connect_emulator(device, clock);
+
+  REQUIRE_THROWS_AS(manager->get_serial_number(), std::runtime_error);
+  // delay and a retry timeout between each of the 100 receive attempts
+  REQUIRE(clock->elapsed() == 100ms + 99 * 100ms);
+
+  device->set_processing_time(0ms);
+  REQUIRE(manager->get_serial_number() == "00 00 4e 4b \n");
+}
+
+TEST_CASE("Retry policy backs off up to its deadline", "[virtual_time]") {
+  auto clock = make_shared<VirtualClock>();
+  auto device = make_shared<TimedDeviceEmulator>(1h);
+  auto policy = RetryPolicy::exponential(10ms, 80ms, 1000ms);
+  policy.jitter = 0;
+  device->set_retry_policy(policy);
+  auto manager = connect_emulator(device, clock);
+
+  REQUIRE_THROWS_AS(manager->get_serial_number(), std::runtime_error);
+  // the deadline is counted from the send
+  REQUIRE(clock->elapsed() == 1000ms);
+
+  // polls at 100, 110, 130, 170, 250... ms after the send
+  device->set_processing_time(140ms);
+  const auto before = clock->elapsed();
+  manager->get_serial_number();
+  REQUIRE(clock->elapsed() - before == 170ms);
+}
+
+TEST_CASE("Retry policy can be set per command", "[virtual_time]") {
+  auto clock = make_shared<VirtualClock>();
+  auto device = make_shared<TimedDeviceEmulator>(1h);
+  device->set_retry_policy(proto::CommandID::GET_STATUS,
+                           RetryPolicy::fixed(3, 10ms));
+  auto manager = connect_emulator(device, clock);
+
+  REQUIRE_THROWS_AS(manager->get_serial_number(), std::runtime_error);
+  REQUIRE(clock->elapsed() == 100ms + 2 * 10ms);
+  REQUIRE(device->get_retry_policy(proto::CommandID::GET_CODE).max_attempts ==
+          100);
+}
+
+TEST_CASE("Quick commands are polled in a spin window", "[virtual_time]") {
+  auto clock = make_shared<VirtualClock>();
+  auto device = make_shared<TimedDeviceEmulator>(3ms);
+  auto policy = RetryPolicy::exponential(20ms, 200ms, 10s);
+  policy.jitter = 0;
+  device->set_retry_policy(proto::CommandID::GET_STATUS,
+                           policy.spinning(20ms, 500us));
+  auto manager = connect_emulator(device, clock);
+
+  // no send receive delay, polls 0.5 ms apart
+  manager->get_serial_number();
+  REQUIRE(clock->elapsed() == 3ms);
+
+  // then the usual waits, not growing before the send receive delay:
+  // polls at 40, 60, 80, 100, 120, 160... ms after the send
+  device->set_processing_time(30ms);
+  auto before = clock->elapsed();
+  manager->get_serial_number();
+  REQUIRE(clock->elapsed() - before == 40ms);
+  device->set_processing_time(90ms);
+  before = clock->elapsed();
+  manager->get_serial_number();
+  REQUIRE(clock->elapsed() - before == 100ms);
+  // as without the spin window from there on
+  device->set_processing_time(110ms);
+  before = clock->elapsed();
+  manager->get_serial_number();
+  REQUIRE(clock->elapsed() - before == 120ms);
+
+  // other commands wait the send receive delay first
+  REQUIRE(device->get_retry_policy(proto::CommandID::FIRST_AUTHENTICATE)
+              .spins() == false);
+}
+
+TEST_CASE("Retry policy can be set per latency class", "[virtual_time]") {
+  static_assert(proto::command_metadata(proto::CommandID::GET_STATUS).latency ==
+                    proto::Latency::QUICK,
+                "status is read quickly");
+  static_assert(proto::stick10::GetStatus::CommandTransaction::priority >
+                    proto::stick10::FirstAuthenticate::CommandTransaction::priority,
+                "quick commands are polled first");
+
+  auto clock = make_shared<VirtualClock>();
+  auto device = make_shared<TimedDeviceEmulator>(3ms);
+  device->set_retry_policy(proto::Latency::QUICK,
+                           RetryPolicy::fixed(100, 1ms).spinning(20ms, 500us));
+  auto manager = connect_emulator(device, clock);
+
+  manager->get_serial_number();
+  REQUIRE(clock->elapsed() == 3ms);
+  REQUIRE(device->get_retry_policy(proto::CommandID::GET_CODE).spins());
+  REQUIRE(device->get_retry_policy(proto::CommandID::FIRST_AUTHENTICATE)
+              .spins() == false);
+
+  // a policy set for the command comes first
+  device->set_retry_policy(proto::CommandID::GET_STATUS,
+                           RetryPolicy::fixed(3, 10ms));
+  REQUIRE(device->get_retry_policy(proto::CommandID::GET_STATUS).spins() ==
+          false);
+}